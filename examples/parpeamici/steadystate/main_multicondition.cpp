@@ -50,6 +50,10 @@ class SteadystateApplication : public parpe::OptimizationApplication {
 
         dataProvider = std::make_unique<SteadyStateMultiConditionDataProvider>(
                     getModel(), inFileArgument);
+#ifdef PARPE_ENABLE_MPI
+        // collective, all processes construct the data provider
+        dataProvider->shareInputDataOnNodeIfRequested(MPI_COMM_WORLD);
+#endif
 
         // read options from file
         auto optimizationOptions = parpe::OptimizationOptions::fromHDF5(dataProvider->getHdf5FileId());
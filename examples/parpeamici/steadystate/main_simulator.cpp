@@ -59,6 +59,9 @@ int main(int argc, char **argv) {
         remove(resultFileName.c_str());
 
         SteadyStateMultiConditionDataProvider dp(getModel(), dataFileName, dataFilePath + "/inputData");
+#ifdef PARPE_ENABLE_MPI
+        dp.shareInputDataOnNodeIfRequested(MPI_COMM_WORLD);
+#endif
 
         status = parpe::runSimulator(dp, simulationMode,
                                      dataFileName, dataFilePath,
@@ -90,6 +93,9 @@ int main(int argc, char **argv) {
 
         SteadyStateMultiConditionDataProvider dp(
                     getModel(), conditionFileName, dpPath);
+#ifdef PARPE_ENABLE_MPI
+        dp.shareInputDataOnNodeIfRequested(MPI_COMM_WORLD);
+#endif
 
         status = parpe::runSimulator(dp, simulationMode,
                                      conditionFileName, conditionFilePath,
@@ -1,13 +1,18 @@
 #include <parpeloadbalancer/loadBalancerMaster.h>
 #include <parpeloadbalancer/loadBalancerWorker.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstdio>
+#include <thread>
 #include <unistd.h>
 
 #include <mpi.h>
 
 #define NUM_JOBS 1000
+#define NUM_CLIENTS 4
+#define NUM_PENDING_JOBS 100
+#define VALUES_PER_JOB 4
 
 /*
  * Testing code for MPI load balancing.
@@ -15,18 +20,15 @@
  */
 
 /**
- * @brief master send a double to any of the workers, wait for completion,
- * verify result
- * @return number of errors
+ * @brief Queue `numJobs` jobs for the given client, with values starting at
+ * `firstValue`, and wait for them to finish.
+ * @return number of jobs whose result does not match their own input
  */
-int master() {
-    parpe::LoadBalancerMaster lbm;
-    lbm.run();
-
-    int numJobs = NUM_JOBS;
+int runClient(parpe::LoadBalancerMaster &lbm, int clientId, int firstValue,
+              int numJobs) {
     int numJobsFinished = 0;
 
-    parpe::JobData jobdata[numJobs];
+    std::vector<parpe::JobData> jobdata(numJobs);
 
     // mutex to wait for simulations to finish
     pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
@@ -37,8 +39,11 @@ int master() {
         job->jobDone = &numJobsFinished;
         job->jobDoneChangedCondition = &cond;
         job->jobDoneChangedMutex = &mutex;
-        job->sendBuffer.resize(sizeof(double));
-        *(double *)job->sendBuffer.data() = i;
+        job->clientId = clientId;
+        job->sendBuffer.resize(VALUES_PER_JOB * sizeof(double));
+        auto values = (double *)job->sendBuffer.data();
+        for (int k = 0; k < VALUES_PER_JOB; ++k)
+            values[k] = (firstValue + i) * VALUES_PER_JOB + k;
         lbm.queueJob(job);
     }
 
@@ -55,33 +60,197 @@ int master() {
     for (int i = 0; i < numJobs; ++i) {
         auto buffer = (double *)(jobdata[i].recvBuffer.data());
 
-        if (*buffer != 2 * i)
-            printf("ERROR: %d was %f\n", i, *buffer);
+        if (jobdata[i].recvBuffer.size() != VALUES_PER_JOB * sizeof(double)) {
+            printf("ERROR: client %d job %d: wrong reply size\n", clientId, i);
+            ++errors;
+            continue;
+        }
+        for (int k = 0; k < VALUES_PER_JOB; ++k) {
+            if (buffer[k] != 2 * ((firstValue + i) * VALUES_PER_JOB + k)) {
+                printf("ERROR: client %d job %d was %f\n",
+                       clientId, i, buffer[k]);
+                ++errors;
+            }
+        }
+    }
+
+    return errors;
+}
+
+/**
+ * @brief Cancel jobs while some are queued and some have been sent ahead to
+ * workers. All jobs that were not removed from the queue must finish, either
+ * with the correct result or, if cancelled on the worker, with an empty one.
+ * @return number of errors
+ */
+int cancelPendingJobs(parpe::LoadBalancerMaster &lbm) {
+    int numJobsFinished = 0;
+    std::vector<parpe::JobData> jobdata(NUM_PENDING_JOBS);
+
+    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    for (auto &job: jobdata) {
+        job.jobDone = &numJobsFinished;
+        job.jobDoneChangedCondition = &cond;
+        job.jobDoneChangedMutex = &mutex;
+        job.sendBuffer.resize(sizeof(double));
+        // negative values make the worker sleep
+        *(double *)job.sendBuffer.data() = -1.0;
+        lbm.queueJob(&job);
+    }
+
+    pthread_mutex_lock(&mutex);
+    while (numJobsFinished < 1)
+        pthread_cond_wait(&cond, &mutex);
+    pthread_mutex_unlock(&mutex);
+
+    auto first = jobdata.data();
+    auto last = jobdata.data() + jobdata.size();
+    int numCancelled = lbm.cancelQueuedJobs(
+                [first, last](parpe::JobData const* job) {
+        return job >= first && job < last;
+    });
+
+    pthread_mutex_lock(&mutex);
+    while (numJobsFinished + numCancelled < NUM_PENDING_JOBS)
+        pthread_cond_wait(&cond, &mutex);
+    pthread_mutex_unlock(&mutex);
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&cond);
+
+    int errors = 0;
+    int numCancelledOnWorker = 0;
+    for (auto const& job: jobdata) {
+        if (job.recvBuffer.empty()) {
+            ++numCancelledOnWorker;
+        } else if (job.recvBuffer.size() != sizeof(double)
+                   || *(double *)job.recvBuffer.data() != -2.0) {
+            printf("ERROR: job %d has wrong result\n", job.jobId);
+            ++errors;
+        }
+    }
+    // includes the ones that were never sent
+    numCancelledOnWorker -= numCancelled;
+
+    printf("Cancelled %d queued jobs and %d jobs on workers.\n",
+           numCancelled, numCancelledOnWorker);
+
+    return errors;
+}
+
+/**
+ * @brief Terminate the load balancer while jobs are still queued and in
+ * flight. None of them must be finished afterwards.
+ * @return number of errors
+ */
+int terminateWithPendingJobs(parpe::LoadBalancerMaster &lbm) {
+    int numJobsFinished = 0;
+    std::vector<parpe::JobData> jobdata(NUM_PENDING_JOBS);
+
+    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    for (auto &job: jobdata) {
+        job.jobDone = &numJobsFinished;
+        job.jobDoneChangedCondition = &cond;
+        job.jobDoneChangedMutex = &mutex;
+        job.sendBuffer.resize(sizeof(double));
+        // negative values make the worker sleep
+        *(double *)job.sendBuffer.data() = -1.0;
+        lbm.queueJob(&job);
     }
 
+    // wait for some, but not all jobs to finish
+    pthread_mutex_lock(&mutex);
+    while (numJobsFinished < 1)
+        pthread_cond_wait(&cond, &mutex);
+    pthread_mutex_unlock(&mutex);
+
     lbm.terminate();
+
+    pthread_mutex_lock(&mutex);
+    int numFinishedAtTermination = numJobsFinished;
+    pthread_mutex_unlock(&mutex);
+
+    // replies which arrive now must not be handled anymore
+    usleep(100000);
+
+    int errors = 0;
+    pthread_mutex_lock(&mutex);
+    if (numJobsFinished != numFinishedAtTermination) {
+        printf("ERROR: %d jobs finished after termination\n",
+               numJobsFinished - numFinishedAtTermination);
+        ++errors;
+    }
+    if (numJobsFinished >= NUM_PENDING_JOBS) {
+        printf("ERROR: No jobs were pending at termination\n");
+        ++errors;
+    }
+    pthread_mutex_unlock(&mutex);
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&cond);
+
+    return errors;
+}
+
+/**
+ * @brief master send a double to any of the workers, wait for completion,
+ * verify result
+ * @return number of errors
+ */
+int master() {
+    parpe::LoadBalancerMaster lbm;
+    lbm.run();
+
+    // single client
+    int errors = runClient(lbm, 0, 0, NUM_JOBS);
+
+    // concurrent clients
+    std::vector<std::thread> clients;
+    std::vector<int> clientErrors(NUM_CLIENTS, 0);
+    for (int i = 0; i < NUM_CLIENTS; ++i) {
+        clients.emplace_back([&lbm, &clientErrors, i]() {
+            clientErrors[i] = runClient(lbm, i, i * NUM_JOBS, NUM_JOBS);
+        });
+    }
+    for (int i = 0; i < NUM_CLIENTS; ++i) {
+        clients[i].join();
+        errors += clientErrors[i];
+    }
+
+    errors += cancelPendingJobs(lbm);
+
+    errors += terminateWithPendingJobs(lbm);
+
     lbm.sendTerminationSignalToAllWorkers();
 
     return errors;
 }
 
 /**
- * @brief On the worker side, take the received value, multiply by 2, return
+ * @brief On the worker side, take the received values, multiply by 2, return.
+ * Values are processed in parallel, using PARPE_NUM_THREADS_PER_WORKER
+ * threads, as done for simulations (see parpe::messageHandler).
  * @param buffer
  * @param jobId
  */
 void duplicatingMessageHandler(std::vector<char> &buffer, int  /*jobId*/) {
-    // read message
-    double value = *reinterpret_cast<double *>(buffer.data());
-    //    printf("Received %f\n", value);
+    int numThreads = 1;
+    if (auto env = std::getenv("PARPE_NUM_THREADS_PER_WORKER"))
+        numThreads = std::max(1, std::atoi(env));
 
-    // sleep(1);
+    // read message, result is written in place
+    auto values = reinterpret_cast<double *>(buffer.data());
+    int numValues = buffer.size() / sizeof(double);
 
-    // prepare result
-    buffer.resize(sizeof(double));
-    auto result = reinterpret_cast<double *>(buffer.data());
-    *result = value * 2;
-    //    printf("Sending %f\n", *result);
+    #pragma omp parallel for num_threads(numThreads)
+    for (int i = 0; i < numValues; ++i) {
+        // negative values simulate long-running jobs
+        if (values[i] < 0)
+            usleep(10000);
+        values[i] *= 2;
+    }
 }
 
 void worker() {
@@ -92,7 +261,8 @@ void worker() {
 int main(int argc, char **argv) {
     int status = 0;
 
-    MPI_Init(&argc, &argv);
+    int threadSupport = MPI_THREAD_SINGLE;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &threadSupport);
 
     int mpiRank;
     MPI_Comm_rank(MPI_COMM_WORLD, &mpiRank);
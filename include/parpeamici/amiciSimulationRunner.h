@@ -13,7 +13,13 @@
 #include <amici/rdata.h>
 #include <amici/serialization.h>
 
+#include <atomic>
+#include <deque>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
 #include <vector>
 
 #include <boost/serialization/array.hpp>
@@ -32,6 +38,55 @@ class LoadBalancerMaster;
 using LoadBalancerMaster = int;
 #endif
 
+/**
+ * @brief The SimulationRuntimeHistory class keeps track of the simulation
+ * time of individual conditions as reported by the workers.
+ *
+ * Used by AmiciSimulationRunner to schedule expensive simulations first and
+ * to create work packages with similar expected runtimes. Simulation times
+ * are kept separately for each sensitivity order and smoothed exponentially
+ * to follow changing parameters.
+ *
+ * Thread-safe.
+ */
+class SimulationRuntimeHistory
+{
+  public:
+    /**
+     * @brief Record the time of a finished simulation.
+     * @param conditionIdx
+     * @param sensitivityOrder Sensitivity order of the simulation
+     * @param timeSeconds Simulation wall time
+     */
+    void record(int conditionIdx,
+                amici::SensitivityOrder sensitivityOrder,
+                double timeSeconds);
+
+    /**
+     * @brief Get expected simulation times for the given conditions.
+     *
+     * Conditions without history are assigned the mean of all known
+     * conditions.
+     *
+     * @param conditionIndices
+     * @param sensitivityOrder
+     * @return Expected times in seconds, in the order of `conditionIndices`,
+     * or an empty vector if there is no history for this sensitivity order.
+     */
+    std::vector<double> getExpectedTimes(
+        std::vector<int> const& conditionIndices,
+        amici::SensitivityOrder sensitivityOrder) const;
+
+    /** Weight of a new measurement in the moving average */
+    constexpr static double smoothingFactor = 0.5;
+
+  private:
+    mutable std::mutex mutex;
+
+    /** Smoothed simulation time by sensitivity order and condition index */
+    std::map<std::pair<amici::SensitivityOrder, int>, double> expectedTimes;
+};
+
 /**
  * @brief The AmiciSimulationRunner class queues AMICI simulations, waits for
  * the results and calls a user-provided aggregation function
@@ -52,7 +107,23 @@ class AmiciSimulationRunner
         amici::SensitivityOrder sensitivityOrder;
         std::vector<int> conditionIndices;
         std::string logPrefix;
-        // TODO bool sendY, ...
+        /** If non-negative, `optimizationParameters` is empty and has to be
+         * taken from the AmiciParameterEpoch with this ID */
+        int parameterEpoch = -1;
+        /** Simulate with forward sensitivities and return the output
+         * sensitivities (AmiciResultPackageSimple::modelOutputSensitivities) */
+        bool sendOutputSensitivities = false;
+    };
+
+    /**
+     * @brief Optimization parameters shared by all work packages of one
+     * evaluation
+     */
+    struct AmiciParameterEpoch
+    {
+        AmiciParameterEpoch() = default;
+        int id = -1;
+        std::vector<double> optimizationParameters;
     };
 
     /**
@@ -67,6 +138,9 @@ class AmiciSimulationRunner
         std::vector<double> modelOutput;
         std::vector<double> modelStates;
         int status;
+        /** AMICI ReturnData::sy (nt x nplist x ny, row-major), only if
+         * requested by AmiciWorkPackageSimple::sendOutputSensitivities */
+        std::vector<double> modelOutputSensitivities;
     };
 
     /** Type of function be called after a single job finished  */
@@ -95,6 +169,76 @@ class AmiciSimulationRunner
 
     AmiciSimulationRunner(AmiciSimulationRunner const& other) = delete;
 
+    /**
+     * @brief Set the runtime history to be used for scheduling simulations.
+     *
+     * Simulation times are not recorded automatically, this is left to the
+     * callbacks which deserialize the results.
+     *
+     * @param history May be nullptr to schedule in order of condition indices
+     */
+    void setRuntimeHistory(SimulationRuntimeHistory const* history);
+
+    /**
+     * @brief Send the optimization parameters only once per worker as
+     * AmiciParameterEpoch, instead of with every work package.
+     *
+     * Requires the workers to use a ParameterEpochCache.
+     *
+     * @param shareParameters
+     */
+    void setShareParameters(bool shareParameters);
+
+    /**
+     * @brief Request model output sensitivities from the workers (see
+     * AmiciWorkPackageSimple::sendOutputSensitivities).
+     * @param sendOutputSensitivities
+     */
+    void setSendOutputSensitivities(bool sendOutputSensitivities);
+
+    /**
+     * @brief Set client ID and priority of the queued jobs for scheduling by
+     * the load balancer (see JobQueue).
+     * @param clientId
+     * @param priority
+     */
+    void setJobClient(int clientId, double priority);
+
+    /**
+     * @brief Stop early if any simulation fails, for evaluations which are
+     * lost anyway in that case.
+     *
+     * After the first reply with a failed simulation, the remaining jobs
+     * are cancelled (see LoadBalancerMaster::cancelQueuedJobs), and
+     * callbackJobFinished is not called for any later replies. Jobs which a
+     * worker has already started still have to finish. Only applies to
+     * runDistributedMemory.
+     *
+     * @param cancelOnFailure
+     */
+    void setCancelOnFailure(bool cancelOnFailure);
+
+    /**
+     * @brief Group conditions into work packages.
+     *
+     * Without runtime history, consecutive conditions are grouped. Otherwise,
+     * conditions are distributed, longest first, to the package with the
+     * currently lowest expected runtime (that still has room), and the
+     * packages are sorted by decreasing expected runtime.
+     *
+     * @param conditionIndices Conditions to simulate
+     * @param maxSimulationsPerPackage Maximum number of conditions per package
+     * @param sensitivityOrder
+     * @param history Runtime history. May be nullptr.
+     * @return Condition indices for each package, in the order in which they
+     * should be queued
+     */
+    static std::vector<std::vector<int>> createWorkPackages(
+        std::vector<int> const& conditionIndices,
+        int maxSimulationsPerPackage,
+        amici::SensitivityOrder sensitivityOrder,
+        SimulationRuntimeHistory const* history);
+
 #ifdef PARPE_ENABLE_MPI
     /**
      * @brief Dispatch simulation jobs using LoadBalancerMaster
@@ -126,7 +270,10 @@ class AmiciSimulationRunner
                          int jobIdx,
                          const std::vector<double>& optimizationParameters,
                          amici::SensitivityOrder sensitivityOrder,
-                         const std::vector<int>& conditionIndices);
+                         const std::vector<int>& conditionIndices,
+                         std::shared_ptr<std::vector<char> const> const&
+                         parameterEpochBuffer,
+                         int parameterEpoch);
 #endif
 
     std::vector<double> const& optimizationParameters;
@@ -135,10 +282,51 @@ class AmiciSimulationRunner
 
     callbackJobFinishedType callbackJobFinished = nullptr;
     callbackAllFinishedType aggregate = nullptr;
+    SimulationRuntimeHistory const* runtimeHistory = nullptr;
+    bool shareParameters = false;
+    bool sendOutputSensitivities = false;
+    int jobClientId = -1;
+    double jobPriority = 0.0;
+    bool cancelOnFailure = false;
+    /** Set once a reply with a failed simulation has been received, if
+     * cancelOnFailure */
+    std::atomic<bool> failed {false};
     int errors = 0;
     std::string logPrefix;
 };
 
+/**
+ * @brief The ParameterEpochCache class holds, on the worker side, the
+ * optimization parameters of recent AmiciParameterEpoch%s and fills them in
+ * to work packages referring to them.
+ *
+ * Jobs of different epochs (e.g. from concurrent multi-start optimizations)
+ * may be interleaved. The NUM_SHARED_DATA_CACHED most recently used epochs are
+ * kept, as assumed by LoadBalancerMaster. Since LoadBalancerWorker processes
+ * shared data in order with the jobs, both sides agree on which ones these are.
+ */
+class ParameterEpochCache
+{
+  public:
+    /**
+     * @brief Store the received parameter epoch. To be used as
+     * LoadBalancerWorker::sharedDataHandlerFunc.
+     * @param buffer Serialized AmiciParameterEpoch
+     */
+    void handleSharedData(std::vector<char> const& buffer);
+
+    /**
+     * @brief Set the optimization parameters of the given work package if it
+     * refers to a parameter epoch, and mark that epoch as most recently used.
+     * @param workPackage
+     */
+    void resolve(AmiciSimulationRunner::AmiciWorkPackageSimple& workPackage);
+
+  private:
+    /** Cached epochs, most recently used first */
+    std::deque<AmiciSimulationRunner::AmiciParameterEpoch> epochs;
+};
+
 void
 swap(AmiciSimulationRunner::AmiciResultPackageSimple& first,
      AmiciSimulationRunner::AmiciResultPackageSimple& second);
@@ -162,6 +350,18 @@ serialize(Archive& ar,
     ar& u.sensitivityOrder;
     ar& u.conditionIndices;
     ar& u.logPrefix;
+    ar& u.parameterEpoch;
+    ar& u.sendOutputSensitivities;
+}
+
+template<class Archive>
+void
+serialize(Archive& ar,
+          parpe::AmiciSimulationRunner::AmiciParameterEpoch& u,
+          const unsigned int version)
+{
+    ar& u.id;
+    ar& u.optimizationParameters;
 }
 
 template<class Archive>
@@ -176,6 +376,7 @@ serialize(Archive& ar,
     ar& u.modelOutput;
     ar& u.modelStates;
     ar& u.status;
+    ar& u.modelOutputSensitivities;
 }
 
 } // namespace boost
@@ -0,0 +1,227 @@
+#ifndef PARPE_AMICI_FLAT_INPUT_FILE_H
+#define PARPE_AMICI_FLAT_INPUT_FILE_H
+
+#include <gsl/gsl-lite.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace parpe {
+
+/**
+ * @brief The FlatInputFile class provides read-only access to the
+ * per-simulation input data of MultiConditionDataProviderHDF5 stored in a
+ * single memory-mapped file.
+ *
+ * This avoids opening one HDF5 dataset per simulation condition, and all
+ * processes on a node reading the same file share its pages in the page
+ * cache. Such files are created by `parpe.hdf5_pe_input` (see
+ * write_flat_input_file) from the respective HDF5 input file.
+ *
+ * Layout (little-endian): a Header, followed by numSections SectionEntries,
+ * followed by the 8-byte aligned sections. Matrices are stored row-major.
+ * Variable-length data of all simulations is concatenated, the data of
+ * simulation i being [offsets[i], offsets[i + 1]) (CSR-like).
+ *
+ * The same layout is used for input data shared between the processes on a
+ * node (see FlatInputWriter).
+ */
+class FlatInputFile {
+  public:
+    /** Sections in the order of the section table */
+    enum Section {
+        /** int32, numSimulationConditions x 3 (preequilibration condition,
+         * simulation condition, reinitialize states) */
+        simulationConditions,
+        /** double, numConditions x numFixedParameters */
+        fixedParameters,
+        /** uint64, numSimulationConditions + 1 */
+        timepointOffsets,
+        /** double */
+        timepoints,
+        /** uint64, numSimulationConditions + 1, for measurements and sigmas */
+        measurementOffsets,
+        /** double, numTimepoints x numObservables per simulation */
+        measurements,
+        /** double, same shape as measurements */
+        sigmas,
+        /** int32, numSimulationConditions x numModelParameters */
+        parameterMapping,
+        /** int32, numSimulationConditions x numModelParameters */
+        parameterScaleSimulation,
+        /** double, numSimulationConditions x numModelParameters, or empty */
+        parameterOverrides,
+        /** int32, numOptimizationParameters */
+        parameterScaleOptimization,
+        numSections
+    };
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t numSections;
+        std::int32_t numSimulationConditions;
+        /** Number of conditions with fixed parameters. Without fixed
+         * parameters, the largest condition index referenced in
+         * simulationConditions + 1. */
+        std::int32_t numConditions;
+        std::int32_t numFixedParameters;
+        std::int32_t numModelParameters;
+        std::int32_t numOptimizationParameters;
+        std::int32_t reserved;
+    };
+
+    struct SectionEntry {
+        /** Bytes from the beginning of the file */
+        std::uint64_t offset;
+        /** Number of elements */
+        std::uint64_t count;
+    };
+
+    static constexpr char const* magic = "PARPEFLT";
+
+    static constexpr std::uint32_t version = 1;
+
+    /**
+     * @brief Map the given file and check its layout.
+     * Throws ParPEException if the file can't be mapped or is invalid.
+     * @param fileName
+     */
+    explicit FlatInputFile(std::string const& fileName);
+
+    /**
+     * @brief Use a flat input file image in memory and check its layout.
+     * The memory is not copied and must outlive this object.
+     * Throws ParPEException if the image is invalid.
+     * @param data 8-byte aligned image, e.g. created by FlatInputWriter
+     * @param numBytes
+     */
+    FlatInputFile(void const* data, std::size_t numBytes);
+
+    FlatInputFile(FlatInputFile const&) = delete;
+    FlatInputFile& operator=(FlatInputFile const&) = delete;
+
+    ~FlatInputFile();
+
+    int getNumSimulationConditions() const;
+
+    int getNumConditions() const;
+
+    int getNumFixedParameters() const;
+
+    int getNumModelParameters() const;
+
+    int getNumOptimizationParameters() const;
+
+    gsl::span<std::int32_t const> getSimulationConditions() const;
+
+    gsl::span<double const> getFixedParameters() const;
+
+    gsl::span<std::uint64_t const> getTimepointOffsets() const;
+
+    gsl::span<double const> getTimepoints() const;
+
+    gsl::span<std::uint64_t const> getMeasurementOffsets() const;
+
+    gsl::span<double const> getMeasurements() const;
+
+    gsl::span<double const> getSigmas() const;
+
+    gsl::span<std::int32_t const> getParameterMapping() const;
+
+    gsl::span<std::int32_t const> getParameterScaleSimulation() const;
+
+    /**
+     * @brief Parameter overrides for unmapped parameters
+     * @return Overrides or empty span if there are none
+     */
+    gsl::span<double const> getParameterOverrides() const;
+
+    gsl::span<std::int32_t const> getParameterScaleOptimization() const;
+
+    /**
+     * @brief Size of the mapped file or image
+     * @return Size in bytes
+     */
+    std::size_t size() const;
+
+  private:
+    template<typename T>
+    gsl::span<T const> getSection(Section section) const;
+
+    void checkLayout() const;
+
+    std::string fileName;
+
+    void const* data = nullptr;
+
+    std::size_t numBytes = 0;
+
+    /** Whether data was mapped by us and needs to be unmapped */
+    bool mapped = false;
+};
+
+
+/**
+ * @brief The FlatInputWriter class creates a FlatInputFile image from the
+ * given tables.
+ *
+ * The tables are not copied and must be valid until write() is called.
+ */
+class FlatInputWriter {
+  public:
+    /**
+     * @brief FlatInputWriter
+     * @param header Dimensions. Magic, version and number of sections are
+     * set by the writer.
+     */
+    explicit FlatInputWriter(FlatInputFile::Header const& header);
+
+    /**
+     * @brief Set the content of the given section. Sections which are not set
+     * are empty. Throws ParPEException if the element type does not match
+     * the section.
+     * @param section
+     * @param values
+     */
+    void setSection(FlatInputFile::Section section,
+                    gsl::span<std::int32_t const> values);
+
+    void setSection(FlatInputFile::Section section,
+                    gsl::span<double const> values);
+
+    void setSection(FlatInputFile::Section section,
+                    gsl::span<std::uint64_t const> values);
+
+    /**
+     * @brief Size of the image
+     * @return Size in bytes, a multiple of 8
+     */
+    std::size_t size() const;
+
+    /**
+     * @brief Write the image
+     * @param buffer 8-byte aligned buffer of at least size() bytes
+     */
+    void write(void *buffer) const;
+
+  private:
+    void setSection(FlatInputFile::Section section, void const* values,
+                    std::size_t count, std::size_t valueSize);
+
+    /** Section table for the current content */
+    std::array<FlatInputFile::SectionEntry, FlatInputFile::numSections>
+    getSectionTable() const;
+
+    FlatInputFile::Header header;
+
+    std::array<void const*, FlatInputFile::numSections> sections {};
+
+    std::array<std::uint64_t, FlatInputFile::numSections> counts {};
+};
+
+} // namespace parpe
+
+#endif // PARPE_AMICI_FLAT_INPUT_FILE_H
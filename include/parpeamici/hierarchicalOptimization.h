@@ -8,6 +8,8 @@
 
 #include <memory>
 #include <cmath>
+#include <functional>
+#include <mutex>
 #include <numeric>
 
 #include <H5Cpp.h>
@@ -16,13 +18,216 @@ namespace parpe {
 
 // Currently using enum from amici enum class ParameterTransformation { none, log10 };
 
-enum class ErrorModel { normal }; // TODO logNormal, laplace
+/**
+ * @brief Noise model of the measurements.
+ *
+ * For `laplace`, sigma parameters and sigmas provided with the data are
+ * interpreted as the scale parameter b of the Laplace distribution.
+ */
+enum class ErrorModel { normal, laplace }; // TODO logNormal
 
 class AnalyticalParameterProvider;
 class AnalyticalParameterHdf5Reader;
 class HierarchicalOptimizationProblemWrapper;
 class HierarchicalOptimizationWrapper;
 
+/**
+ * @brief The ConditionMatrices class holds one matrix (e.g. measurements or
+ * sigmas, nt x ny, row-major) per condition in a single contiguous buffer
+ * with per-condition offsets (CSR-like).
+ *
+ * Implicitly constructible from the nested vectors returned by
+ * MultiConditionDataProvider::getAllMeasurements and friends (copies).
+ */
+class ConditionMatrices {
+public:
+    ConditionMatrices() = default;
+
+    ConditionMatrices(std::vector<std::vector<double>> const& matrices);
+
+    /**
+     * @brief Number of conditions
+     * @return
+     */
+    std::size_t size() const;
+
+    gsl::span<double const> operator[](int conditionIdx) const;
+
+    gsl::span<double> operator[](int conditionIdx);
+
+    /**
+     * @brief All values of all conditions
+     * @return
+     */
+    std::vector<double> const& getValues() const;
+
+    gsl::span<double> getValues();
+
+    /**
+     * @brief Offset of each condition in getValues(), with total size as last
+     * element
+     * @return
+     */
+    std::vector<std::size_t> const& getOffsets() const;
+
+private:
+    std::vector<double> values;
+    std::vector<std::size_t> offsets = {0};
+};
+
+/**
+ * @brief The AnalyticalParameterOutputMap class holds, for each analytically
+ * computed parameter, the positions of all dependent model outputs within the
+ * flat ConditionMatrices buffer.
+ *
+ * Compiled once from an AnalyticalParameterProvider, so that analytical
+ * parameters can be computed in a single pass over contiguous index lists.
+ */
+class AnalyticalParameterOutputMap {
+public:
+    AnalyticalParameterOutputMap() = default;
+
+    /**
+     * @brief AnalyticalParameterOutputMap
+     * @param provider Parameter-condition-observable mapping
+     * @param numParameters Number of analytical parameters in `provider`
+     * @param layout Matrices (nt x ny) for all conditions; only their sizes
+     * are used
+     * @param numObservables ny
+     */
+    AnalyticalParameterOutputMap(AnalyticalParameterProvider const& provider,
+                                 int numParameters,
+                                 ConditionMatrices const& layout,
+                                 int numObservables);
+
+    int numParameters() const;
+
+    /**
+     * @brief Positions of the model outputs depending on the given parameter
+     * @param parameterIdx Index of the analytical parameter
+     * @return Indices into ConditionMatrices::getValues()
+     */
+    gsl::span<std::size_t const> operator[](int parameterIdx) const;
+
+private:
+    std::vector<std::size_t> indices;
+    std::vector<std::size_t> offsets = {0};
+};
+
+/**
+ * @brief The NegLogLikelihoodKernel class computes the negative
+ * log-likelihood for normally or Laplace distributed measurements for all
+ * conditions.
+ *
+ * Positions of the present (non-NaN) measurements, the residual
+ * weights (1 / (2 sigma^2), or 1 / b for Laplace noise) and the constant
+ * log-term are precomputed once. The measurements themselves are not copied
+ * but shared with the caller.
+ * Evaluation is then a masked sum of weighted squared (absolute) residuals,
+ * vectorized
+ * within and parallelized across conditions. The result does not depend on
+ * the number of threads.
+ */
+class NegLogLikelihoodKernel {
+public:
+    NegLogLikelihoodKernel() = default;
+
+    /**
+     * @brief NegLogLikelihoodKernel
+     * @param measurements Measurements for all conditions (NaN if missing),
+     * kept for evaluation
+     * @param sigmas Sigmas for all conditions. NaN values for present
+     * measurements (analytically computed sigmas) require passing sigmas to
+     * evaluate.
+     * @param errorModel
+     */
+    NegLogLikelihoodKernel(std::shared_ptr<ConditionMatrices const> measurements,
+                           ConditionMatrices const& sigmas,
+                           ErrorModel errorModel = ErrorModel::normal);
+
+    /**
+     * @brief Negative log-likelihood using the sigmas provided to the
+     * constructor
+     * @param modelOutputsScaled Same layout as measurements
+     * @return Negative log-likelihood, NaN if any relevant model output or
+     * sigma is NaN
+     */
+    double evaluate(ConditionMatrices const& modelOutputsScaled) const;
+
+    /**
+     * @brief Negative log-likelihood using the given sigmas
+     * @param modelOutputsScaled Same layout as measurements
+     * @param sigmas Same layout as measurements
+     * @return Negative log-likelihood, NaN if any relevant model output or
+     * sigma is NaN
+     */
+    double evaluate(ConditionMatrices const& modelOutputsScaled,
+                    ConditionMatrices const& sigmas) const;
+
+private:
+    template<typename Term>
+    double sumOverConditions(Term term) const;
+
+    /** Positions of present measurements in the flat buffer */
+    std::vector<std::size_t> indices;
+    /** Measurements for all conditions */
+    std::shared_ptr<ConditionMatrices const> measurements;
+    /** Weight of the (squared) residual at `indices` */
+    std::vector<double> weights;
+    /** Offsets of each condition in `indices`, with total size as last
+     * element */
+    std::vector<std::size_t> conditionOffsets = {0};
+    /** Sum of log(2 pi sigma^2) / 2, or log(2 b), over present measurements */
+    double logTerm = 0.0;
+    ErrorModel errorModel = ErrorModel::normal;
+    /** Size of the flat buffer the kernel was created for */
+    std::size_t numValues = 0;
+};
+
+/**
+ * @brief Data used by HierarchicalOptimizationWrapper which does not change
+ * during optimization: measurements, sigmas, and what is precomputed from them.
+ */
+struct HierarchicalOptimizationData {
+    /** Measurements and sigmas for all conditions */
+    std::shared_ptr<ConditionMatrices const> measurements;
+    std::shared_ptr<ConditionMatrices const> sigmas;
+
+    /** Dependent model outputs for each analytical parameter */
+    AnalyticalParameterOutputMap scalingOutputs;
+    AnalyticalParameterOutputMap offsetOutputs;
+    AnalyticalParameterOutputMap sigmaOutputs;
+
+    /** For the negative log-likelihood with the cached data */
+    NegLogLikelihoodKernel negLogLikelihoodKernel;
+};
+
+/**
+ * @brief The HierarchicalOptimizationDataCache class creates
+ * HierarchicalOptimizationData on first use and keeps it for all
+ * HierarchicalOptimizationWrapper%s sharing this cache.
+ *
+ * Only to be shared among wrappers for the same data, analytical parameters
+ * and error model, e.g. the different starts of a multi-start optimization.
+ */
+class HierarchicalOptimizationDataCache {
+public:
+    using DataPtr = std::shared_ptr<HierarchicalOptimizationData const>;
+
+    /**
+     * @brief Get the cached data, calling `create` if there is none yet.
+     *
+     * Thread-safe. If `create` throws, the next call will try again.
+     * @param create
+     * @return
+     */
+    DataPtr get(std::function<DataPtr()> const& create);
+
+private:
+    std::once_flag created;
+    DataPtr data;
+};
+
 /**
  * @brief The HierarchicalOptimizationWrapper class is a wrapper for hierarchical optimization of
  * scaling parameters.
@@ -30,6 +235,11 @@ class HierarchicalOptimizationWrapper;
  * Parameters with the given indices are hidden by the wrapper and computed analytically internally.
  *
  * Computes the negative log likelihood for normally distributed measurement (others to be added).
+ *
+ * For Laplace noise (ErrorModel::laplace), offsets and scalings are
+ * computed as weighted medians and the scale parameters in closed form as mean
+ * absolute residual. Note that for gradient evaluations not using
+ * setSinglePassGradient, the wrapped model has to use Laplace noise as well.
  */
 class HierarchicalOptimizationWrapper : public GradientFunction
 {
@@ -53,13 +263,16 @@ public:
      * @param numConditions
      * @param numObservables
      * @param errorModel
+     * @param dataCache Cache for measurements and sigmas, to share them with
+     * other wrappers for the same problem. nullptr to use a separate one.
      */
     HierarchicalOptimizationWrapper(std::unique_ptr<AmiciSummedGradientFunction> fun,
                                    const H5::H5File &file,
                                    const std::string &hdf5RootPath,
                                    int numConditions,
                                    int numObservables,
-                                   ErrorModel errorModel);
+                                   ErrorModel errorModel,
+                                   std::shared_ptr<HierarchicalOptimizationDataCache> dataCache = nullptr);
 
     /**
      * @brief Get information on analytically computed parameters from the provided objects.
@@ -118,9 +331,14 @@ public:
     /**
      * @brief Run simulations with scaling parameters set to 1.0 and collect model outputs
      * @param reducedParameters parameter vector for `fun` without scaling parameters
+     * @param modelOutputSensitivities If not nullptr, simulate with forward
+     * sensitivities and store AMICI ReturnData::sy of the unscaled outputs here
      * @return Vector of double vectors containing AMICI ReturnData::y (nt x ny, column-major)
      */
-    std::vector <std::vector<double>> getUnscaledModelOutputs(const gsl::span<double const> reducedParameters, Logger *logger, double *cpuTime) const;
+    std::vector <std::vector<double>> getUnscaledModelOutputs(
+            const gsl::span<double const> reducedParameters, Logger *logger,
+            double *cpuTime,
+            std::vector<std::vector<double>> *modelOutputSensitivities = nullptr) const;
 
 
     /**
@@ -128,11 +346,11 @@ public:
      * @param modelOutputs Model outputs as provided by getModelOutputs
      * @return the computed scaling factors
      */
-    std::vector<double> computeAnalyticalScalings(std::vector<std::vector<double>> const& measurements,
-                                                  std::vector<std::vector<double>> const& modelOutputsUnscaled) const;
+    std::vector<double> computeAnalyticalScalings(ConditionMatrices const& measurements,
+                                                  ConditionMatrices const& modelOutputsUnscaled) const;
 
     void applyOptimalScalings(std::vector<double> const& proportionalityFactors,
-                              std::vector<std::vector<double> > &modelOutputs) const;
+                              ConditionMatrices &modelOutputs) const;
 
 
     /**
@@ -140,23 +358,37 @@ public:
      * @param modelOutputs Model outputs as provided by getModelOutputs
      * @return the computed offset parameters
      */
-    std::vector<double> computeAnalyticalOffsets(const std::vector<std::vector<double> > &measurements,
-                                                 std::vector <std::vector<double>>& modelOutputsUnscaled) const;
+    std::vector<double> computeAnalyticalOffsets(ConditionMatrices const& measurements,
+                                                 ConditionMatrices const& modelOutputsUnscaled) const;
 
-    std::vector<double> computeAnalyticalSigmas(std::vector<std::vector<double> > const& measurements,
-                                                 const std::vector<std::vector<double> > &modelOutputsScaled) const;
+    std::vector<double> computeAnalyticalSigmas(ConditionMatrices const& measurements,
+                                                ConditionMatrices const& modelOutputsScaled) const;
 
     void applyOptimalOffsets(std::vector<double> const& offsetParameters,
-                             std::vector<std::vector<double> > &modelOutputs) const;
+                             ConditionMatrices &modelOutputs) const;
 
     /**
      * @brief Create vector with sigma matrix for each condition and timepoints from the given analytically computed sigmas
      * @param sigmas
      * @return
      */
-    void fillInAnalyticalSigmas(std::vector<std::vector<double> > &allSigmas,
+    void fillInAnalyticalSigmas(ConditionMatrices &allSigmas,
                                 const std::vector<double> &analyticalSigmas) const;
 
+    /**
+     * @brief Measurements for all conditions. Read from `fun` once on first
+     * use, since they do not change during optimization.
+     * @return
+     */
+    ConditionMatrices const& getMeasurements() const;
+
+    /**
+     * @brief Sigmas for all conditions, NaN for those to be computed
+     * analytically. Read from `fun` once on first use.
+     * @return
+     */
+    ConditionMatrices const& getSigmas() const;
+
     /**
      * @brief Evaluate `fun` using the computed optimal scaling and offset parameters.
      * @param reducedParameters Parameter vector without scaling and offset parameters
@@ -171,12 +403,55 @@ public:
     virtual FunctionEvaluationStatus evaluateWithOptimalParameters(
             std::vector<double> const& fullParameters,
             std::vector<double> const& sigmas,
-            std::vector<std::vector<double>> const& measurements,
-            std::vector<std::vector<double>> const& modelOutputsScaled,
+            ConditionMatrices const& measurements,
+            ConditionMatrices const& modelOutputsScaled,
             double &fval,
             const gsl::span<double> gradient, std::vector<double> &fullGradient,
             Logger *logger, double *cpuTime) const;
 
+    /**
+     * @brief Compute function value and gradient from the output sensitivities
+     * of the first simulation sweep, without simulating again with the
+     * optimal parameters.
+     *
+     * The gradient w.r.t. the analytically computed parameters is 0 by
+     * construction and is set accordingly.
+     *
+     * @param fullParameters Parameter vector including optimal analytical parameters
+     * @param scalings Optimal scaling parameters
+     * @param sigmas Optimal sigma parameters
+     * @param measurements As provided by getMeasurements()
+     * @param modelOutputsScaled Model outputs after applying optimal offset and scaling parameters
+     * @param modelOutputSensitivities Sensitivities of the unscaled model outputs
+     * @param fval out: computed function value
+     * @param gradient out: computed function gradient
+     * @param fullGradient out: gradient w.r.t. fullParameters
+     * @return
+     */
+    FunctionEvaluationStatus evaluateWithOutputSensitivities(
+            std::vector<double> const& fullParameters,
+            std::vector<double> const& scalings,
+            std::vector<double> const& sigmas,
+            ConditionMatrices const& measurements,
+            ConditionMatrices const& modelOutputsScaled,
+            std::vector<std::vector<double>> const& modelOutputSensitivities,
+            double &fval,
+            gsl::span<double> gradient,
+            std::vector<double> &fullGradient) const;
+
+    /**
+     * @brief Compute the gradient in a single simulation sweep from output
+     * sensitivities (see evaluateWithOutputSensitivities), instead of
+     * simulating a second time with the optimal analytical parameters.
+     *
+     * Requires forward sensitivities of all model outputs to be sent to the
+     * master, i.e. nt x np x ny values per condition. Can be enabled by
+     * setting the environment variable PARPE_HIERARCHICAL_SINGLE_PASS=1.
+     *
+     * @param singlePassGradient
+     */
+    void setSinglePassGradient(bool singlePassGradient);
+
     /**
      * @brief Get number of parameters the function expects
      * @return That
@@ -202,6 +477,12 @@ public:
 private:
     void init();
 
+    /** Cached data, created on first use */
+    HierarchicalOptimizationData const& getData() const;
+
+    /** Read measurements and sigmas from `fun` and precompute the rest */
+    HierarchicalOptimizationDataCache::DataPtr createData() const;
+
     /** Reads scaling parameter information from HDF5 file */
     std::unique_ptr<AnalyticalParameterProvider> scalingReader;
     /** Reads offset parameter information from HDF5 file */
@@ -221,6 +502,15 @@ private:
 
     /** Error model to use for computing analytical parameters and negative log-likelihood */
     ErrorModel errorModel = ErrorModel::normal;
+
+    /** Compute gradient from output sensitivities of the first sweep */
+    bool singlePassGradient = false;
+
+    /** Measurements, sigmas etc., possibly shared with other wrappers.
+     * Not read during construction, so that wrappers which are never
+     * evaluated (e.g. on workers) do not hold a copy. */
+    std::shared_ptr<HierarchicalOptimizationDataCache> dataCache =
+            std::make_shared<HierarchicalOptimizationDataCache>();
 };
 
 
@@ -360,8 +650,15 @@ class HierarchicalOptimizationProblemWrapper : public OptimizationProblem {
 public:
     HierarchicalOptimizationProblemWrapper() = default;
 
+    /**
+     * @brief HierarchicalOptimizationProblemWrapper
+     * @param problemToWrap
+     * @param dataProvider
+     * @param dataCache See HierarchicalOptimizationWrapper
+     */
     HierarchicalOptimizationProblemWrapper(std::unique_ptr<OptimizationProblem> problemToWrap,
-                                          const MultiConditionDataProviderHDF5 *dataProvider);
+                                          const MultiConditionDataProviderHDF5 *dataProvider,
+                                          std::shared_ptr<HierarchicalOptimizationDataCache> dataCache = nullptr);
 
     HierarchicalOptimizationProblemWrapper(std::unique_ptr<OptimizationProblem> problemToWrap,
                                           std::unique_ptr<HierarchicalOptimizationWrapper> costFun,
@@ -467,19 +764,19 @@ double getDefaultOffsetParameter(amici::ParameterScaling scaling);
  */
 double computeAnalyticalScalings(int scalingIdx,
                                  const std::vector<std::vector<double> > &modelOutputsUnscaled,
-                                 const std::vector<std::vector<double> > &measurements,
+                                 ConditionMatrices const& measurements,
                                  const AnalyticalParameterProvider &scalingReader,
                                  int numObservables);
 
 double computeAnalyticalOffsets(int offsetIdx,
                                 const std::vector<std::vector<double> > &modelOutputsUnscaled,
-                                const std::vector<std::vector<double> > &measurements,
+                                ConditionMatrices const& measurements,
                                 AnalyticalParameterProvider& offsetReader,
                                 int numObservables);
 
 double computeAnalyticalSigmas(int sigmaIdx,
                                const std::vector<std::vector<double> > &modelOutputsScaled,
-                               const std::vector<std::vector<double> > &measurements,
+                               ConditionMatrices const& measurements,
                                const AnalyticalParameterProvider &sigmaReader,
                                int numObservables,
                                double epsilonAbs = 1e-12, double epsilonRel = 0.01);
@@ -515,9 +812,9 @@ std::vector<double> spliceParameters(const gsl::span<double const> reducedParame
  * @param sigmas
  * @return
  */
-double computeNegLogLikelihood(std::vector <std::vector<double>> const& measurements,
-                               std::vector <std::vector<double>> const& modelOutputsScaled,
-                               const std::vector<std::vector<double> > &sigmas);
+double computeNegLogLikelihood(ConditionMatrices const& measurements,
+                               ConditionMatrices const& modelOutputsScaled,
+                               ConditionMatrices const& sigmas);
 
 /**
  * @brief Compute negative log-likelihood for normal distribution based on the model outputs and measurements for a single condition.
@@ -526,9 +823,54 @@ double computeNegLogLikelihood(std::vector <std::vector<double>> const& measurem
  * @param sigmas
  * @return
  */
-double computeNegLogLikelihood(std::vector<double> const& measurements,
-                               std::vector<double> const& modelOutputsScaled,
-                               const std::vector<double> &sigmas);
+double computeNegLogLikelihood(gsl::span<double const> measurements,
+                               gsl::span<double const> modelOutputsScaled,
+                               gsl::span<double const> sigmas);
+
+/**
+ * @brief Compute the gradient of the negative log-likelihood for normal
+ * or Laplace distribution w.r.t. the simulation parameters for a single condition
+ * from the sensitivities of the unscaled model outputs.
+ * @param measurements (nt x ny)
+ * @param modelOutputsScaled (nt x ny)
+ * @param sigmas (nt x ny)
+ * @param outputScalings Linear scaling factor of each scaled model output
+ * w.r.t. the unscaled one (nt x ny)
+ * @param modelOutputSensitivities Sensitivities of the unscaled model outputs
+ * as AMICI ReturnData::sy (nt x np x ny, row-major)
+ * @param numObservables ny
+ * @param errorModel
+ * @return Gradient w.r.t. the simulation parameters (np), empty if there are
+ * no model outputs
+ */
+std::vector<double> computeNegLogLikelihoodGradient(
+        gsl::span<double const> measurements,
+        gsl::span<double const> modelOutputsScaled,
+        gsl::span<double const> sigmas,
+        gsl::span<double const> outputScalings,
+        std::vector<double> const& modelOutputSensitivities,
+        int numObservables,
+        ErrorModel errorModel = ErrorModel::normal);
+
+/**
+ * @brief Weighted median, i.e. the value t minimizing
+ * sum_i weights_i * |values_i - t|.
+ *
+ * Used as optimal offset and scaling parameters for Laplace noise.
+ * @param values
+ * @param weights Non-negative, same size as values
+ * @return The weighted median, NaN if there are no values or all weights are
+ * 0
+ */
+double weightedMedian(std::vector<double> values,
+                      std::vector<double> const& weights);
+
+/**
+ * @brief Error model for hierarchical optimization as set by the environment
+ * variable PARPE_HIERARCHICAL_ERROR_MODEL (`normal` (default) or `laplace`)
+ * @return The error model
+ */
+ErrorModel getErrorModelFromEnvironment();
 
 void checkGradientForAnalyticalParameters(std::vector<double> const& gradient,
                                           std::vector<int> const& analyticalIndices, double threshold);
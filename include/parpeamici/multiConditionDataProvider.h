@@ -2,6 +2,7 @@
 #define MULTICONDITIONDATAPROVIDER_H
 
 #include <parpecommon/hdf5Misc.h>
+#include <parpecommon/parpeConfig.h>
 #include <parpeoptimization/optimizationOptions.h>
 
 #include <amici/amici.h>
@@ -10,12 +11,20 @@
 
 #include <H5Cpp.h>
 
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <string>
 #include <vector>
 
+#ifdef PARPE_ENABLE_MPI
+#include <mpi.h>
+#endif
+
 namespace parpe {
 
+class FlatInputFile;
+
 /**
  * @brief The MultiConditionDataProvider interface
  */
@@ -181,6 +190,92 @@ private:
 };
 
 
+/**
+ * @brief The ParameterMappingPlan class maps parameters and gradients between
+ * the simulation parameters of a single condition and the optimization
+ * parameters.
+ *
+ * The plan is compiled once from the parameter mapping, parameter scales and
+ * overrides, and then applied repeatedly. Mapped parameters are grouped by
+ * their pair of simulation and optimization parameter scale, so that each
+ * group is processed by a loop without per-element branching.
+ */
+class ParameterMappingPlan {
+  public:
+    ParameterMappingPlan() = default;
+
+    /**
+     * @brief ParameterMappingPlan
+     * @param mapping Optimization parameter index for each simulation
+     * parameter, or -1 if not mapped
+     * @param scaleSim Scale of each simulation parameter
+     * @param scaleOpt Scale of each optimization parameter
+     * @param overrides Values for unmapped simulation parameters, in
+     * simulation scale. May be empty if all parameters are mapped, otherwise
+     * a ParPEException is thrown.
+     */
+    ParameterMappingPlan(gsl::span<int const> mapping,
+                         gsl::span<amici::ParameterScaling const> scaleSim,
+                         gsl::span<amici::ParameterScaling const> scaleOpt,
+                         gsl::span<double const> overrides);
+
+    /**
+     * @brief Set the simulation parameters, in simulation scale, from the
+     * given optimization parameters
+     * @param optimization Optimization parameters, in optimization scale
+     * @param simulation Simulation parameters to be set
+     */
+    void setSimulationParameters(gsl::span<double const> optimization,
+                                 gsl::span<double> simulation) const;
+
+    /**
+     * @brief Add the simulation gradient, transformed to optimization
+     * parameter scale and multiplied by `coefficient`, to the optimization
+     * gradient.
+     * @param simulation Gradient w.r.t. the simulation parameters
+     * @param optimization Gradient w.r.t. the optimization parameters
+     * @param parameters Simulation parameters, in simulation scale
+     * @param coefficient
+     */
+    void addGradient(gsl::span<double const> simulation,
+                     gsl::span<double> optimization,
+                     gsl::span<double const> parameters,
+                     double coefficient) const;
+
+    /**
+     * @brief Get the mapping the plan was compiled from
+     * @return Optimization parameter index for each simulation parameter, or
+     * -1 if not mapped
+     */
+    std::vector<int> getMapping() const;
+
+    std::vector<amici::ParameterScaling> const& getParameterScaleSim() const;
+
+  private:
+    /** Mapped parameters sharing the same scales */
+    struct Group {
+        amici::ParameterScaling scaleSim;
+        amici::ParameterScaling scaleOpt;
+        /** Range in simulationIndices and optimizationIndices */
+        int begin;
+        int end;
+    };
+
+    std::vector<Group> groups;
+
+    std::vector<int> simulationIndices;
+
+    std::vector<int> optimizationIndices;
+
+    std::vector<amici::ParameterScaling> scaleSim;
+
+    /** Unmapped simulation parameters and their values */
+    std::vector<int> unmappedIndices;
+
+    std::vector<double> unmappedValues;
+};
+
+
 /**
  * @brief The MultiConditionDataProvider class reads simulation data for
  * MultiConditionOptimizationProblem from a HDF5 file.
@@ -197,6 +292,20 @@ private:
  * NOTE: The following dimensions are determined by the used AMICI model:
  * * numObservables := Model::ny
  * * numFixedParameters := Model::nk
+ *
+ * Parameter mapping and scales are read once during construction and kept as
+ * a ParameterMappingPlan for each simulation condition.
+ *
+ * Other data is by default read from file whenever it is requested. If the
+ * environment variable PARPE_PRELOAD_DATA is set to 1, all data required for
+ * simulation is read into memory during construction (see preloadData), and
+ * PARPE_PRELOAD_DATA_MAX_MB limits the amount of memory used for that.
+ * If PARPE_FLAT_INPUT_FILE is set, that data and the parameter mapping are
+ * taken from the given memory-mapped file instead (see loadFlatInputFile).
+ * Otherwise, if PARPE_SHARE_INPUT_DATA_ON_NODE is set to 1 and MPI is
+ * active, nothing is loaded during construction. Instead, all processes have
+ * to call shareInputDataOnNodeIfRequested, which loads it once per node into
+ * shared memory (see loadInputDataSharedOnNode).
  */
 
 // TODO split; separate optimization from simulation
@@ -236,6 +345,70 @@ class MultiConditionDataProviderHDF5 : public MultiConditionDataProvider {
 
     void openHdf5File(const std::string &hdf5Filename);
 
+    /**
+     * @brief Read all remaining data required for simulation (simulation
+     * conditions, fixed parameters, timepoints, measurements and sigmas) into
+     * memory. Afterwards, the respective accessors neither perform HDF5 I/O
+     * nor acquire the HDF5 mutex.
+     *
+     * Fixed parameters are loaded before measurements. Any part which
+     * would exceed the memory limit is not loaded and will still be read from
+     * file on demand.
+     *
+     * Not thread-safe; to be called before the data provider is used
+     * concurrently.
+     * @param maxBytes Memory limit for the preloaded data
+     * @return true if all data was loaded, false otherwise
+     */
+    bool preloadData(
+            std::size_t maxBytes = std::numeric_limits<std::size_t>::max());
+
+    /**
+     * @brief Use the simulation conditions, fixed parameters, timepoints,
+     * measurements, sigmas and parameter mapping from the given
+     * memory-mapped FlatInputFile instead of the HDF5 file.
+     *
+     * The data is not copied, so all processes on a node share the pages of
+     * the file. The remaining data (options, bounds, ...) is still read from
+     * the HDF5 file, which must match the flat input file.
+     *
+     * Not thread-safe; to be called before the data provider is used
+     * concurrently.
+     * @param fileName
+     */
+    void loadFlatInputFile(std::string const& fileName);
+
+#ifdef PARPE_ENABLE_MPI
+    /**
+     * @brief Like preloadData, but all processes of `comm` on the same node
+     * share a single read-only copy of the data and of the parameter mapping
+     * tables.
+     *
+     * The first process on each node reads the data from the HDF5 file into
+     * an MPI shared-memory window, the other processes don't read any of it.
+     * The window is released when the data provider is destroyed, which
+     * must happen before MPI_Finalize.
+     *
+     * Collective over `comm`, i.e. all of its processes have to construct a
+     * data provider for the same input and call this. Not thread-safe; to be
+     * called before the data provider is used concurrently.
+     * @param comm Communicator of the processes using this input data
+     */
+    void loadInputDataSharedOnNode(MPI_Comm comm);
+
+    /**
+     * @brief Call loadInputDataSharedOnNode if PARPE_SHARE_INPUT_DATA_ON_NODE
+     * is set to 1 and PARPE_FLAT_INPUT_FILE is not set.
+     *
+     * Collective over `comm`, regardless of the setting. All processes have
+     * to agree on the setting, otherwise a ParPEException is thrown on all of
+     * them.
+     * @param comm Communicator of the processes using this input data
+     * @return Whether the input data is shared
+     */
+    bool shareInputDataOnNodeIfRequested(MPI_Comm comm);
+#endif
+
     /**
      * @brief Get the number of simulations required for objective function
      * evaluation. Currently, this amounts to the number
@@ -390,6 +563,88 @@ protected:
     H5::H5File file;
 
     std::unique_ptr<OptimizationOptions> optimizationOptions;
+
+    /**
+     * @brief In-memory input data, see preloadData and loadFlatInputFile.
+     *
+     * Per-simulation matrices are stored row-major with one row per
+     * simulation. Variable-length data of all simulations is concatenated,
+     * the data of simulation i being [offsets[i], offsets[i + 1]).
+     */
+    struct PreloadedData {
+        /** Set if simulation conditions and fixed parameters are available */
+        bool haveParameters = false;
+        /** Set if timepoints, measurements and sigmas are available */
+        bool haveMeasurements = false;
+
+        int numSimulationConditions = 0;
+        int numOptimizationParameters = 0;
+
+        /** numSimulationConditions x 3 */
+        gsl::span<int const> simulationConditions;
+        /** numConditions x nk */
+        gsl::span<double const> fixedParameters;
+
+        gsl::span<double const> timepoints;
+        gsl::span<std::uint64_t const> timepointOffsets;
+        /** Measurements and sigmas share measurementOffsets */
+        gsl::span<double const> measurements;
+        gsl::span<double const> sigmas;
+        gsl::span<std::uint64_t const> measurementOffsets;
+
+        /** Owner of the memory referenced above */
+        std::shared_ptr<void const> storage;
+    };
+
+    PreloadedData preloaded;
+
+    /**
+     * @brief Compiled parameter mapping for each simulation condition.
+     * If empty, mapping and scales are read from file.
+     */
+    std::vector<ParameterMappingPlan> mappingPlans;
+
+    /** Optimization parameter scales, set together with mappingPlans */
+    std::vector<amici::ParameterScaling> scaleOpt;
+
+  private:
+    /** Storage for preloadData */
+    struct PreloadedStorage;
+
+    void compileParameterMappingPlans();
+
+    /**
+     * @brief Read the parameter mapping tables from file, see
+     * compileParameterMappingPlans(std::size_t, ...).
+     */
+    void readParameterMappingTables(std::vector<int> &mapping,
+                                    std::vector<int> &scaleSim,
+                                    std::vector<double> &overrides);
+
+    /**
+     * @brief Set mappingPlans and preloaded data (except for its storage)
+     * from the given input, which must match the HDF5 file and the model.
+     * @param input
+     */
+    void useFlatInput(FlatInputFile const& input);
+
+    /**
+     * @brief Compile mappingPlans from the given tables. scaleOpt must be set.
+     * @param numSimulations
+     * @param mapping numSimulations x np
+     * @param scaleSim numSimulations x np
+     * @param overrides numSimulations x np, or empty
+     */
+    void compileParameterMappingPlans(std::size_t numSimulations,
+                                      gsl::span<int const> mapping,
+                                      gsl::span<int const> scaleSim,
+                                      gsl::span<double const> overrides);
+
+    bool preloadParameters(PreloadedStorage &storage,
+                           std::size_t maxBytes, std::size_t &usedBytes);
+
+    bool preloadMeasurements(PreloadedStorage &storage,
+                             std::size_t maxBytes, std::size_t &usedBytes);
 };
 
 
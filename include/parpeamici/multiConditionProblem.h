@@ -2,9 +2,11 @@
 #define PARPE_AMICI_MULTI_CONDITION_PROBLEM_H
 
 #include <parpecommon/parpeConfig.h>
+#include <parpecommon/threadPool.h>
 #include <parpeoptimization/multiStartOptimization.h>
 #include <parpeoptimization/optimizationProblem.h>
 #include <parpeamici/amiciSimulationRunner.h>
+#include <parpeamici/simulationLogWriter.h>
 #include <parpeoptimization/minibatchOptimization.h>
 
 #include <amici/amici.h>
@@ -15,7 +17,9 @@
 #include <gsl/gsl-lite.hpp>
 
 #include <memory>
+#include <mutex>
 #include <cstdlib>
+#include <limits>
 
 /** @file multiConditionProblem.h
  *  Interfaces between AMICI model and parPE optimization problem */
@@ -26,6 +30,9 @@ class LoadBalancerMaster;
 class OptimizationResultWriter;
 class MultiConditionDataProviderHDF5;
 class MultiConditionDataProvider;
+class TreeReduction;
+class HierarchicalOptimizationDataCache;
+
 /**
  * @brief Run AMICI simulation for the given condition, save and return results
  * @param solver
@@ -36,6 +43,11 @@ class MultiConditionDataProvider;
  * @param resultWriter
  * @param logLineSearch
  * @param logger
+ * @param sendStates Include model states in result package
+ * @param sendOutputSensitivities Include output sensitivities in result
+ * package (requires forward sensitivities)
+ * @param simulationLog If not nullptr, simulations are logged through this
+ * buffered writer instead of being written to resultWriter's file directly
  * @return Simulation results
  */
 
@@ -47,7 +59,9 @@ AmiciSimulationRunner::AmiciResultPackageSimple runAndLogSimulation(amici::Solve
         OptimizationResultWriter *resultWriter,
         bool logLineSearch,
         Logger *logger,
-        bool sendStates = false);
+        bool sendStates = false,
+        bool sendOutputSensitivities = false,
+        SimulationLogWriter *simulationLog = nullptr);
 
 /**
  * @brief Run simulations (no gradient) with given parameters and collect
@@ -63,6 +77,14 @@ AmiciSimulationRunner::AmiciResultPackageSimple runAndLogSimulation(amici::Solve
  * (nt x ny, column-major)
  * @param logger
  * @param cpuTime
+ * @param sendStates
+ * @param runtimeHistory
+ * @param modelOutputSensitivities If not nullptr, simulate with forward
+ * sensitivities and store AMICI ReturnData::sy for each condition here
+ * @param jobClientId Client ID for load balancer scheduling, see JobQueue
+ * @param jobPriority Priority for load balancer scheduling, see JobQueue
+ * @param getSimulationLog See messageHandler
+ * @param numThreadsPerWorker See messageHandler
  * @return Simulation status
  */
 FunctionEvaluationStatus getModelOutputs(
@@ -73,20 +95,41 @@ FunctionEvaluationStatus getModelOutputs(
         bool logLineSearch,
         gsl::span<const double> parameters,
         std::vector<std::vector<double> > &modelOutput,
-        Logger *logger, double *cpuTime, bool sendStates);
+        Logger *logger, double *cpuTime, bool sendStates,
+        SimulationRuntimeHistory *runtimeHistory = nullptr,
+        std::vector<std::vector<double> > *modelOutputSensitivities = nullptr,
+        int jobClientId = -1, double jobPriority = 0.0,
+        std::function<SimulationLogWriter *()> const& getSimulationLog
+        = nullptr,
+        int numThreadsPerWorker = 1);
 
 /**
  * @brief Callback function for LoadBalancer
+ *
+ * The conditions of the work package are simulated in parallel, each thread
+ * with its own model instance. Exceptions from simulations are rethrown
+ * after all threads have finished.
+ *
  * @param dataProvider
  * @param resultWriter
  * @param logLineSearch
  * @param buffer In/out: message buffer
  * @param jobId: In: Identifier of the job (unique up to INT_MAX)
+ * @param sendStates Include model states in result package
+ * @param parameterCache Provides optimization parameters for work packages
+ * referring to a parameter epoch. May be nullptr if parameters are not shared.
+ * @param getSimulationLog If set, returns the writer to pass to
+ * runAndLogSimulation. Only called if simulations of this package are logged.
+ * @param numThreadsPerWorker Maximum number of threads to use
  */
 void messageHandler(MultiConditionDataProvider *dataProvider,
                     OptimizationResultWriter *resultWriter,
                     bool logLineSearch,
-                    std::vector<char> &buffer, int jobId, bool sendStates);
+                    std::vector<char> &buffer, int jobId, bool sendStates,
+                    ParameterEpochCache* parameterCache = nullptr,
+                    std::function<SimulationLogWriter *()> const&
+                    getSimulationLog = nullptr,
+                    int numThreadsPerWorker = 1);
 
 /**
  * @brief The AmiciSummedGradientFunction class represents a cost function
@@ -150,6 +193,37 @@ public:
             Logger *logger,
             double *cpuTime) const;
 
+    /**
+     * @brief Run simulations with forward sensitivities and collect model
+     * outputs and their sensitivities w.r.t. the simulation parameters
+     * @param parameters Model parameters for simulation
+     * @param modelOutput See getModelOutputs
+     * @param modelOutputSensitivities in: some vector reference, will be
+     * resized. output: AMICI ReturnData::sy for each condition
+     * (nt x nplist x ny, row-major)
+     * @return Simulation status
+     */
+    virtual FunctionEvaluationStatus getModelOutputsAndSensitivities(
+            gsl::span<double const> parameters,
+            std::vector<std::vector<double> > &modelOutput,
+            std::vector<std::vector<double> > &modelOutputSensitivities,
+            Logger *logger,
+            double *cpuTime) const;
+
+    /**
+     * @brief Map the given gradient w.r.t. the simulation parameters of the
+     * given condition to the optimization parameters and add it to gradient
+     * @param conditionIdx
+     * @param simulationGradient Gradient w.r.t. simulation parameters
+     * @param parameters Optimization parameters
+     * @param gradient Gradient w.r.t. optimization parameters
+     */
+    virtual void addSimulationGradient(
+            int conditionIdx,
+            gsl::span<double const> simulationGradient,
+            gsl::span<double const> parameters,
+            gsl::span<double> gradient) const;
+
     virtual std::vector<std::vector<double>> getAllSigmas() const;
 
     virtual std::vector<std::vector<double>> getAllMeasurements() const;
@@ -161,8 +235,24 @@ public:
      */
     virtual void messageHandler(std::vector<char> &buffer, int jobId) const;
 
+    /**
+     * @brief Callback function for LoadBalancer to receive data shared by
+     * multiple jobs, i.e. the optimization parameters
+     * @param buffer Message buffer
+     */
+    virtual void sharedDataHandler(std::vector<char> &buffer) const;
+
     virtual amici::ParameterScaling getParameterScaling(int parameterIndex) const;
 
+    /**
+     * @brief Record the cost on the full data set for a parameter vector, to
+     * prioritize further jobs (PARPE_PRIORITIZE_BY_COST). Called by evaluate,
+     * and by users computing the cost from model outputs themselves, such as
+     * HierarchicalOptimizationWrapper.
+     * @param cost
+     */
+    void reportCost(double cost) const;
+
     /** Include model states in result package */
     bool sendStates = false;
 
@@ -193,13 +283,22 @@ protected:// for testing
      * @param negLogLikelihoodGradient output argument to which *negative*
      * log likelihood gradient is added
      * @param simulationTimeInS unused
+     * @param reduction If not nullptr, the contribution of each condition to
+     * negative log likelihood and gradient is added as a separate term
+     * (value followed by gradient) to this reduction, instead of to
+     * negLogLikelihood and negLogLikelihoodGradient
+     * @param reductionTermIndices Index of the reduction term for each
+     * condition index
      * @return
      */
 
     int aggregateLikelihood(JobData &data, double &negLogLikelihood,
                             gsl::span<double> negLogLikelihoodGradient,
                             double &simulationTimeInS,
-                            gsl::span<const double> optimizationParameters
+                            gsl::span<const double> optimizationParameters,
+                            TreeReduction *reduction = nullptr,
+                            gsl::span<const int> reductionTermIndices
+                            = gsl::span<const int>()
                             ) const;
 
 
@@ -219,6 +318,18 @@ protected:// for testing
 
     void setSensitivityOptions(bool sensiRequired) const;
 
+    /**
+     * @brief Load balancer priority of the jobs of this function
+     * @return -bestCost if prioritizeByCost, 0 otherwise
+     */
+    double getJobPriority() const;
+
+    /**
+     * @brief Create simulationLog on first use. Thread-safe.
+     * @return The simulation log or nullptr if there is no resultWriter
+     */
+    SimulationLogWriter *getSimulationLog() const;
+
 private:
     // TODO: make owning
     MultiConditionDataProvider *dataProvider = nullptr;
@@ -230,9 +341,44 @@ private:
      * gradient is needed */
     std::unique_ptr<amici::Solver> solverOriginal;
     OptimizationResultWriter *resultWriter = nullptr; // TODO: owning?
+    /** Buffers simulation logging to resultWriter's file, to keep HDF5 I/O
+     * out of the simulation loop. Created by getSimulationLog once the first
+     * simulation is logged. */
+    mutable std::unique_ptr<SimulationLogWriter> simulationLog;
+    mutable std::once_flag simulationLogCreated;
+    /** See SimulationLogWriter */
+    int simulationLogSize = 256;
+    double simulationLogFlushInterval = 1.0;
     bool logLineSearch = false;
     int maxSimulationsPerPackage = 8;
     int maxGradientSimulationsPerPackage = 1;
+    /** Number of threads for simulating the conditions of a work package
+     * (environment variable PARPE_NUM_THREADS_PER_WORKER), see
+     * messageHandler */
+    int numThreadsPerWorker = 1;
+    /** Number of threads for aggregating simulation results on the master */
+    int numAggregationThreads = 2;
+    /** Aggregates simulation results in runSimulations. Created on the
+     * first evaluation and kept across evaluations, so that threads are not
+     * restarted for each of them. */
+    mutable std::unique_ptr<ThreadPool> aggregationPool;
+    mutable std::once_flag aggregationPoolCreated;
+    /** Sum contributions of the individual conditions in fixed order, to
+     * obtain bitwise reproducible results. See TreeReduction. */
+    bool deterministicReduction = false;
+    /** Simulation times of previous evaluations, for scheduling */
+    mutable SimulationRuntimeHistory runtimeHistory;
+    /** Identifies the jobs of this function in the load balancer queue, so
+     * that concurrent local optimizations are served round-robin */
+    int jobClientId = -1;
+    /** Prioritize jobs by the best cost of this function so far, so that
+     * simulations of more promising local optimizations are run first
+     * (environment variable PARPE_PRIORITIZE_BY_COST=1) */
+    bool prioritizeByCost = false;
+    /** Lowest cost on the full data set so far */
+    mutable double bestCost = std::numeric_limits<double>::infinity();
+    /** Worker-side: parameters of the current evaluation */
+    mutable ParameterEpochCache parameterCache;
 };
 
 
@@ -317,6 +463,8 @@ class MultiConditionProblemMultiStartOptimizationProblem
 
     bool restartOnFailure() const override;
 
+    int getMaxParallelStarts() const override;
+
     std::unique_ptr<OptimizationProblem> getLocalProblem(
             int multiStartIndex) const override;
 
@@ -326,6 +474,9 @@ private:
     OptimizationResultWriter *resultWriter = nullptr;
     LoadBalancerMaster *loadBalancer = nullptr;
     std::unique_ptr<Logger> logger;
+    /** Measurements and sigmas for hierarchical optimization, shared by all
+     * starts */
+    std::shared_ptr<HierarchicalOptimizationDataCache> hierarchicalDataCache;
 };
 
 
@@ -0,0 +1,110 @@
+#ifndef PARPE_AMICI_SIMULATION_LOG_WRITER_H
+#define PARPE_AMICI_SIMULATION_LOG_WRITER_H
+
+#include <parpecommon/backgroundHdf5Writer.h>
+
+#include <gsl/gsl-lite.hpp>
+
+#include <string>
+#include <vector>
+
+namespace parpe {
+
+/**
+ * @brief Data of a single simulation to be logged, see saveSimulation.
+ */
+struct SimulationLogRecord {
+    /** Path of the group inside the HDF5 file to write to */
+    std::string path;
+    std::vector<double> parameters;
+    double llh = 0.0;
+    /** Log-likelihood gradient. If empty, NaNs are written. */
+    std::vector<double> gradient;
+    double timeElapsedInSeconds = 0.0;
+    int jobId = 0;
+    int status = 0;
+    std::string label;
+};
+
+/**
+ * @brief Write the given simulation log records to the HDF5 file.
+ *
+ * Records are appended to the extendable datasets simulationLogLikelihood,
+ * simulationLogLikelihoodGradient, simulationParameters, ... in the group
+ * specified in the respective record. Consecutive records with the same path
+ * and number of parameters are written with a single extend and write per
+ * dataset. Does not flush the file.
+ *
+ * @param file
+ * @param records
+ */
+void saveSimulations(H5::H5File const& file,
+                     gsl::span<SimulationLogRecord const> records);
+
+/**
+ * @brief The SimulationLogWriter class writes SimulationLogRecords to an
+ * HDF5 file on a background thread.
+ *
+ * Records are collected in a fixed-size ring buffer. A writer thread
+ * takes all buffered records once the buffer is half full or the flush
+ * interval has elapsed, writes them in one batch and flushes the file. If the
+ * buffer is full, log() blocks until there is space again, so no records are
+ * dropped.
+ *
+ * All buffered records are written on destruction.
+ */
+class SimulationLogWriter : public BackgroundHdf5Writer {
+  public:
+    /**
+     * @brief SimulationLogWriter
+     * @param file File to write to
+     * @param capacity Number of records to buffer (>= 1)
+     * @param flushIntervalSeconds Maximum time records are kept in the
+     * buffer
+     */
+    SimulationLogWriter(H5::H5File file,
+                        int capacity = 256,
+                        double flushIntervalSeconds = 1.0);
+
+    ~SimulationLogWriter() override;
+
+    /**
+     * @brief Queue a record for writing. Thread-safe.
+     * @param record
+     */
+    void log(SimulationLogRecord record);
+
+    /**
+     * @brief Number of records written so far
+     * @return
+     */
+    int getNumRecordsWritten() const;
+
+  protected:
+    bool hasBufferedData() const override;
+
+    bool isWriteDue() const override;
+
+    void takeBatch() override;
+
+    void writeBatch() override;
+
+  private:
+    /** Ring buffer of capacity records */
+    std::vector<SimulationLogRecord> records;
+
+    /** Index of the oldest record in the ring buffer */
+    int first = 0;
+
+    /** Number of records in the ring buffer */
+    int numBuffered = 0;
+
+    int numWritten = 0;
+
+    /** Records being written by the I/O thread */
+    std::vector<SimulationLogRecord> batch;
+};
+
+} // namespace parpe
+
+#endif // PARPE_AMICI_SIMULATION_LOG_WRITER_H
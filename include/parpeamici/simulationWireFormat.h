@@ -0,0 +1,116 @@
+#ifndef PARPE_AMICI_SIMULATION_WIRE_FORMAT_H
+#define PARPE_AMICI_SIMULATION_WIRE_FORMAT_H
+
+#include <parpeamici/amiciSimulationRunner.h>
+
+#include <gsl/gsl-lite.hpp>
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+/** @file simulationWireFormat.h
+ * Flat binary message format for AmiciSimulationRunner work and result
+ * packages.
+ *
+ * All messages start with a fixed header (magic number, format version,
+ * message type, number of entries). Result messages are followed by a table
+ * of fixed-size entries holding the scalar results and byte offsets of the
+ * double arrays, which are stored contiguously after the table. This allows
+ * reading results directly from the receive buffer without deserialization.
+ *
+ * Byte order is that of the host; sender and receiver are expected to run on
+ * the same architecture.
+ */
+
+namespace parpe {
+
+/** Current version of the wire format. Increment on any layout change. */
+constexpr std::uint16_t simulationWireFormatVersion = 2;
+
+/**
+ * @brief Serialize a work package into the flat binary format
+ * @param work
+ * @return The message
+ */
+std::vector<char> serializeWorkPackage(
+        AmiciSimulationRunner::AmiciWorkPackageSimple const& work);
+
+/**
+ * @brief Deserialize a work package created by serializeWorkPackage
+ * @param buffer The message
+ * @return The work package
+ */
+AmiciSimulationRunner::AmiciWorkPackageSimple deserializeWorkPackage(
+        gsl::span<char const> buffer);
+
+/**
+ * @brief Serialize simulation results into the flat binary format
+ * @param results Result packages by condition index
+ * @return The message
+ */
+std::vector<char> serializeResultPackages(
+        std::map<int, AmiciSimulationRunner::AmiciResultPackageSimple> const&
+        results);
+
+/**
+ * @brief The ResultPackagesView class provides read access to a message
+ * created by serializeResultPackages without copying.
+ *
+ * The buffer must outlive the view and must be aligned for `double` (which
+ * is the case for `std::vector<char>` storage).
+ */
+class ResultPackagesView
+{
+  public:
+    /**
+     * @brief ResultPackagesView
+     * @param buffer The message. Header and offsets are validated.
+     */
+    explicit ResultPackagesView(gsl::span<char const> buffer);
+
+    /**
+     * @brief Number of result packages
+     * @return
+     */
+    int size() const;
+
+    int conditionIndex(int i) const;
+
+    double llh(int i) const;
+
+    double simulationTimeSeconds(int i) const;
+
+    int status(int i) const;
+
+    gsl::span<double const> gradient(int i) const;
+
+    gsl::span<double const> modelOutput(int i) const;
+
+    gsl::span<double const> modelStates(int i) const;
+
+    gsl::span<double const> modelOutputSensitivities(int i) const;
+
+    /**
+     * @brief Copy the i-th result into a result package
+     * @param i
+     * @return
+     */
+    AmiciSimulationRunner::AmiciResultPackageSimple get(int i) const;
+
+    /**
+     * @brief Copy all results
+     * @return Result packages by condition index
+     */
+    std::map<int, AmiciSimulationRunner::AmiciResultPackageSimple>
+    toMap() const;
+
+  private:
+    gsl::span<char const> buffer;
+
+    int numResults = 0;
+};
+
+} // namespace parpe
+
+#endif // PARPE_AMICI_SIMULATION_WIRE_FORMAT_H
@@ -49,6 +49,13 @@ class StandaloneSimulator
 
     void messageHandler(std::vector<char>& buffer, int jobId);
 
+    /**
+     * @brief Callback function for LoadBalancer to receive data shared by
+     * multiple jobs, i.e. the optimization parameters
+     * @param buffer Message buffer
+     */
+    void sharedDataHandler(std::vector<char>& buffer);
+
   private:
     AmiciSimulationRunner::AmiciResultPackageSimple
     runSimulation(int conditionIdx, amici::Solver& solver, amici::Model& model);
@@ -58,6 +65,9 @@ class StandaloneSimulator
     /** Number of simulations to be sent to workers within one package (when
      * running with MPI). */
     int maxSimulationsPerPackage = 8;
+
+    /** Worker-side: parameters of the current evaluation */
+    ParameterEpochCache parameterCache;
 };
 
 // enum class SimulatorOpType {finalParameters};
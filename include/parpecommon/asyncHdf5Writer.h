@@ -0,0 +1,90 @@
+#ifndef PARPE_COMMON_ASYNC_HDF5_WRITER_H
+#define PARPE_COMMON_ASYNC_HDF5_WRITER_H
+
+#include <parpecommon/backgroundHdf5Writer.h>
+
+#include <gsl/gsl-lite.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace parpe {
+
+/**
+ * @brief The AsyncHdf5Writer class appends rows to extendable 2D datasets
+ * (see hdf5CreateOrExtendAndWriteToDouble2DArray) from a background thread.
+ *
+ * Rows are buffered per dataset. The I/O thread appends all buffered rows of
+ * a dataset with a single extend and write, and flushes the file afterwards.
+ * This happens every flushIntervalSeconds, on flush(), on destruction and at
+ * program exit (see BackgroundHdf5Writer).
+ *
+ * Appending is thread-safe and does not touch the HDF5 library, so callers
+ * don't block on the HDF5 lock.
+ */
+class AsyncHdf5Writer : public BackgroundHdf5Writer {
+  public:
+    /**
+     * @brief AsyncHdf5Writer
+     * @param file File to write to
+     * @param flushIntervalSeconds Maximum time rows are kept in memory
+     */
+    explicit AsyncHdf5Writer(H5::H5File file,
+                             double flushIntervalSeconds = 1.0);
+
+    /**
+     * @brief Writes all buffered rows and stops the I/O thread.
+     */
+    ~AsyncHdf5Writer() override;
+
+    /**
+     * @brief Queue a row for appending to parentPath/datasetName. The dataset
+     * is created if it does not exist.
+     * @param parentPath
+     * @param datasetName
+     * @param row
+     */
+    void appendToDouble2DArray(std::string const& parentPath,
+                               std::string const& datasetName,
+                               gsl::span<const double> row);
+
+    /**
+     * @brief See appendToDouble2DArray
+     */
+    void appendToInt2DArray(std::string const& parentPath,
+                            std::string const& datasetName,
+                            gsl::span<const int> row);
+
+  protected:
+    bool hasBufferedData() const override;
+
+    void takeBatch() override;
+
+    void writeBatch() override;
+
+  private:
+    /** Rows of a single dataset, each of length stride */
+    struct DatasetBuffer {
+        std::string parentPath;
+        hsize_t stride = 0;
+        bool isInt = false;
+        std::vector<double> doubles;
+        std::vector<int> ints;
+        hsize_t numRows = 0;
+    };
+
+    DatasetBuffer &getBuffer(std::string const& parentPath,
+                             std::string const& datasetName,
+                             hsize_t stride, bool isInt);
+
+    /** Buffered rows by full dataset path */
+    std::map<std::string, DatasetBuffer> buffers;
+
+    /** Rows being written by the I/O thread */
+    std::map<std::string, DatasetBuffer> batch;
+};
+
+} // namespace parpe
+
+#endif // PARPE_COMMON_ASYNC_HDF5_WRITER_H
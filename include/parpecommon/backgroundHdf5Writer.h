@@ -0,0 +1,133 @@
+#ifndef PARPE_COMMON_BACKGROUND_HDF5_WRITER_H
+#define PARPE_COMMON_BACKGROUND_HDF5_WRITER_H
+
+#include <H5Cpp.h>
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+namespace parpe {
+
+/**
+ * @brief The BackgroundHdf5Writer class is the base for classes which buffer
+ * data in memory and write it to an HDF5 file from a background thread.
+ *
+ * Derived classes keep the buffered data, protected by `mutex`, and
+ * implement taking and writing batches. The I/O thread writes a batch once
+ * isWriteDue() or after flushIntervalSeconds, and on flush(). Errors while
+ * writing are rethrown from flush() and logged on stop().
+ *
+ * Derived classes have to call start() at the end of their constructor and
+ * stop() at the beginning of their destructor, so the I/O thread only runs
+ * while the derived object is complete.
+ *
+ * All instances are flushed at program exit (see flushAll).
+ */
+class BackgroundHdf5Writer {
+  public:
+    /**
+     * @brief BackgroundHdf5Writer
+     * @param file File to write to
+     * @param flushIntervalSeconds Maximum time data is kept in memory (> 0)
+     */
+    BackgroundHdf5Writer(H5::H5File file, double flushIntervalSeconds);
+
+    BackgroundHdf5Writer(BackgroundHdf5Writer const&) = delete;
+    BackgroundHdf5Writer& operator=(BackgroundHdf5Writer const&) = delete;
+
+    virtual ~BackgroundHdf5Writer();
+
+    /**
+     * @brief Wait until all data buffered so far has been written and the
+     * file has been flushed. If writing failed, the exception is rethrown
+     * here.
+     *
+     * Must not be called while holding the HDF5 lock of this file (see
+     * hdf5MutexGetLock), which the I/O thread requires. This is asserted.
+     */
+    void flush();
+
+    /**
+     * @brief Flush all running instances. Registered with std::atexit.
+     *
+     * Not async-signal-safe.
+     */
+    static void flushAll();
+
+  protected:
+    /**
+     * @brief Start the I/O thread
+     */
+    void start();
+
+    /**
+     * @brief Write all buffered data and stop the I/O thread. Errors are
+     * logged. Does nothing if not running. Same locking requirements as
+     * flush().
+     */
+    void stop();
+
+    /**
+     * @brief Wake the I/O thread to check isWriteDue(). Call after buffering
+     * data.
+     */
+    void notifyWriter();
+
+    /**
+     * @brief Whether any data is buffered. Called with `mutex` locked.
+     */
+    virtual bool hasBufferedData() const = 0;
+
+    /**
+     * @brief Whether buffered data is to be written before the flush interval
+     * has elapsed. Called with `mutex` locked.
+     */
+    virtual bool isWriteDue() const;
+
+    /**
+     * @brief Move all buffered data to the batch to be written next. Called
+     * from the I/O thread with `mutex` locked.
+     */
+    virtual void takeBatch() = 0;
+
+    /**
+     * @brief Write the batch taken last. Called from the I/O thread without
+     * `mutex` locked. The file is flushed afterwards.
+     */
+    virtual void writeBatch() = 0;
+
+    H5::H5File file;
+
+    /** Protects the buffered data of derived classes and the state below */
+    mutable std::mutex mutex;
+
+    /** Signalled whenever the I/O thread has taken or written a batch */
+    std::condition_variable batchProcessed;
+
+  private:
+    void run();
+
+    double flushIntervalSeconds;
+
+    long numBatchesTaken = 0;
+
+    long numBatchesWritten = 0;
+
+    /** Number of flush() calls waiting */
+    int numFlushRequests = 0;
+
+    bool stopping = false;
+
+    std::exception_ptr exception;
+
+    /** Signalled on new data, flush requests or shutdown */
+    std::condition_variable writeRequested;
+
+    std::thread writer;
+};
+
+} // namespace parpe
+
+#endif // PARPE_COMMON_BACKGROUND_HDF5_WRITER_H
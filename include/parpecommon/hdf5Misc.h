@@ -7,8 +7,11 @@
 #include <H5Cpp.h>
 
 #include <pthread.h>
+#include <atomic>
 #include <exception>
 #include <string>
+#include <thread>
+#include <vector>
 #include <mutex>
 #include <cstdarg>
 
@@ -27,12 +30,73 @@ public:
 };
 
 
-typedef std::recursive_mutex mutexHdfType;
+/**
+ * @brief Recursive mutex that knows whether the calling thread holds it
+ */
+class RecursiveOwnedMutex {
+  public:
+    void lock();
+
+    bool try_lock();
+
+    void unlock();
+
+    /**
+     * @brief Whether the calling thread holds this mutex
+     */
+    bool isLockedByThisThread() const;
+
+  private:
+    std::recursive_mutex mutex;
+
+    std::atomic<std::thread::id> owner {std::thread::id()};
+
+    /** Number of times the owner has locked the mutex */
+    int depth = 0;
+};
+
+typedef RecursiveOwnedMutex mutexHdfType;
 
 void initHDF5Mutex();
 
+/**
+ * @brief Lock for HDF5 operations that are not tied to a single open file
+ * (opening or creating files, operations on more than one file).
+ *
+ * Must be acquired before any per-file lock, never while holding one.
+ */
 std::unique_lock<mutexHdfType> hdf5MutexGetLock();
 
+/**
+ * @brief Lock for a sequence of HDF5 operations on the file containing the
+ * given object.
+ *
+ * With a thread-safe HDF5 library (see hdf5HasPerFileLocking), there is one
+ * mutex per file (by file name), so reading from the input file and writing
+ * to result files don't block each other. Otherwise, this is the global lock
+ * from hdf5MutexGetLock().
+ *
+ * Do not hold locks for more than one file at a time, unless holding the
+ * global lock.
+ *
+ * @param objectId Any object in the file. Invalid ids give the global lock.
+ */
+std::unique_lock<mutexHdfType> hdf5MutexGetLock(hid_t objectId);
+
+/**
+ * @brief Whether the calling thread holds the lock returned by
+ * hdf5MutexGetLock(hid_t) for the given object
+ * @param objectId
+ */
+bool hdf5MutexIsLockedByThisThread(hid_t objectId);
+
+/**
+ * @brief Whether hdf5MutexGetLock(hid_t) uses per-file mutexes. True if the
+ * HDF5 library is thread-safe, unless disabled by setting
+ * PARPE_HDF5_PER_FILE_LOCKING=0.
+ */
+bool hdf5HasPerFileLocking();
+
 #define H5_SAVE_ERROR_HANDLER                                                  \
     herr_t (*old_func)(void *);                                                \
     void *old_client_data;                                                     \
@@ -80,6 +144,69 @@ H5::H5File hdf5OpenForAppending(const std::string &hdf5Filename);
 
 void closeHDF5File(hid_t file_id);
 
+/**
+ * @brief Storage options for the extendable datasets created by
+ * hdf5CreateExtendable*Array.
+ *
+ * 2D datasets have shape (stride x n) and grow along n. They are stored in
+ * chunks of (chunkRows x chunkColumns). For 3D datasets, chunks span the
+ * full first two dimensions.
+ *
+ * Defaults are derived from the stride (e.g. the number of parameters),
+ * aiming at chunks of about 256 KiB.
+ *
+ * Large chunks and compression pay off when many entries are appended at
+ * once (AsyncHdf5Writer). When appending one entry at a time, every append
+ * rewrites the partially filled chunk, so compression is then very slow.
+ * See tests/parpecommon/hdf5WriterBenchmark.cpp.
+ */
+struct Hdf5ExtendableDatasetOptions {
+    /** Chunk extent along the fixed dimension. 0: full stride, or less if
+     * a single column exceeds the target chunk size */
+    hsize_t chunkRows = 0;
+
+    /** Chunk extent along the extendable dimension. 0: derived from the
+     * stride */
+    hsize_t chunkColumns = 0;
+
+    /** Deflate compression level (1-9); 0 for no compression */
+    int compressionLevel = 0;
+
+    /** Chunk cache size in bytes for each dataset opened for writing;
+     * 0 for the HDF5 default */
+    std::size_t chunkCacheSize = 0;
+};
+
+/**
+ * @brief Read Hdf5ExtendableDatasetOptions from the environment variables
+ * PARPE_HDF5_CHUNK_ROWS, PARPE_HDF5_CHUNK_COLUMNS,
+ * PARPE_HDF5_COMPRESSION_LEVEL and PARPE_HDF5_CHUNK_CACHE_SIZE.
+ * @return Options, defaults for unset variables
+ */
+Hdf5ExtendableDatasetOptions hdf5ExtendableDatasetOptionsFromEnvironment();
+
+/**
+ * @brief Options used for all extendable datasets created afterwards.
+ * Initialized from the environment on first use.
+ * @return
+ */
+Hdf5ExtendableDatasetOptions hdf5GetExtendableDatasetOptions();
+
+void hdf5SetExtendableDatasetOptions(
+        Hdf5ExtendableDatasetOptions const& options);
+
+/**
+ * @brief Chunk shape for an extendable dataset
+ * @param options
+ * @param stride Number of elements along the fixed dimension(s)
+ * @param elementSize Size of a single element in bytes
+ * @param chunkRows Out: chunk extent along the fixed dimension
+ * @param chunkColumns Out: chunk extent along the extendable dimension
+ */
+void hdf5GetChunkDimensions(Hdf5ExtendableDatasetOptions const& options,
+                            hsize_t stride, std::size_t elementSize,
+                            hsize_t &chunkRows, hsize_t &chunkColumns);
+
 void hdf5CreateExtendableDouble2DArray(hid_t file_id, const char *datasetPath,
                                        hsize_t stride);
 
@@ -91,10 +218,20 @@ void hdf5CreateExtendableDouble3DArray(hid_t file_id, const char *datasetPath,
 
 void hdf5CreateExtendableString1DArray(hid_t file_id, const char *datasetPath);
 
+/**
+ * @brief Append columns to an extendable 2D dataset of shape (stride, n).
+ * @param file_id
+ * @param datasetPath
+ * @param buffer Data for k new columns, row-major (stride x k). k is
+ * determined from the buffer size.
+ */
 void hdf5Extend2ndDimensionAndWriteToDouble2DArray(hid_t file_id,
                                                    const char *datasetPath,
                                                    gsl::span<const double> buffer);
 
+/**
+ * @brief See hdf5Extend2ndDimensionAndWriteToDouble2DArray
+ */
 void hdf5Extend2ndDimensionAndWriteToInt2DArray(hid_t file_id,
                                                 const char *datasetPath,
                                                 gsl::span<const int> buffer);
@@ -103,6 +240,16 @@ void hdf5ExtendAndWriteToString1DArray(hid_t file_id,
                                        const char *datasetPath,
                                        std::string const& buffer);
 
+/**
+ * @brief Append multiple strings to an extendable 1D string dataset
+ * @param file_id
+ * @param datasetPath
+ * @param buffer
+ */
+void hdf5ExtendAndWriteToString1DArray(hid_t file_id,
+                                       const char *datasetPath,
+                                       std::vector<std::string> const& buffer);
+
 void hdf5CreateOrExtendAndWriteToDouble2DArray(hid_t file_id,
                                                const char *parentPath,
                                                const char *datasetName,
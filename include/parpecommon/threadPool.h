@@ -0,0 +1,82 @@
+#ifndef PARPE_COMMON_THREAD_POOL_H
+#define PARPE_COMMON_THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace parpe {
+
+/**
+ * @brief The ThreadPool class runs tasks on a fixed number of threads.
+ *
+ * Tasks receive the index of the executing thread, which allows them to work
+ * on per-thread data without locking.
+ */
+class ThreadPool {
+  public:
+    /** Task to be run. Argument is the index of the executing thread. */
+    using Task = std::function<void(int)>;
+
+    /**
+     * @brief ThreadPool
+     * @param numThreads Number of threads to start (>= 1)
+     */
+    explicit ThreadPool(int numThreads);
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    /**
+     * @brief Waits for all queued tasks to complete and stops the threads.
+     */
+    ~ThreadPool();
+
+    /**
+     * @brief Queue a task. Thread-safe.
+     * @param task
+     */
+    void post(Task task);
+
+    /**
+     * @brief Wait until all queued tasks have completed. If any task threw
+     * an exception, the first one is rethrown here.
+     */
+    void wait();
+
+    /**
+     * @brief Number of threads
+     * @return
+     */
+    int size() const;
+
+  private:
+    void run(int threadIdx);
+
+    std::vector<std::thread> threads;
+
+    std::deque<Task> tasks;
+
+    /** Number of tasks queued or running */
+    int numPending = 0;
+
+    bool stopping = false;
+
+    std::exception_ptr exception;
+
+    std::mutex mutex;
+
+    /** Signalled when a task is queued or the pool is stopping */
+    std::condition_variable taskQueued;
+
+    /** Signalled when numPending reaches 0 */
+    std::condition_variable allDone;
+};
+
+} // namespace parpe
+
+#endif // PARPE_COMMON_THREAD_POOL_H
@@ -0,0 +1,87 @@
+#ifndef PARPE_COMMON_TREE_REDUCTION_H
+#define PARPE_COMMON_TREE_REDUCTION_H
+
+#include <gsl/gsl-lite.hpp>
+
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace parpe {
+
+/**
+ * @brief The TreeReduction class sums a fixed number of equally sized
+ * vectors ("terms") which may be provided in any order, e.g. as simulation
+ * results arrive.
+ *
+ * Terms are combined pairwise along a fixed binary tree over their indices,
+ * as soon as both children of a node are available. The result is therefore
+ * bitwise independent of the order in which terms are added.
+ *
+ * Memory: a partial sum is kept until its sibling is available. If terms are
+ * added in index order, at most one partial sum per tree level is kept, i.e.
+ * at most ceil(log2(numTerms)) + 1 vectors of length termSize. Each term
+ * added ahead of that order may add one more, unless it can be merged with
+ * its sibling, until the missing terms before it have been added. In the
+ * worst case (every other term first), these are about half of the terms.
+ * Callers should therefore add terms roughly in index order.
+ *
+ * add() is thread-safe.
+ */
+class TreeReduction {
+  public:
+    /**
+     * @brief TreeReduction
+     * @param numTerms Number of terms to be added
+     * @param termSize Length of each term
+     */
+    TreeReduction(int numTerms, int termSize);
+
+    /**
+     * @brief Add a term
+     * @param termIdx Index of the term in [0, numTerms). Each index must be
+     * added exactly once.
+     * @param term
+     */
+    void add(int termIdx, std::vector<double> term);
+
+    /**
+     * @brief Check whether all terms have been added
+     * @return
+     */
+    bool isComplete() const;
+
+    /**
+     * @brief Get the sum of all terms. Zero if numTerms is 0.
+     * Must only be called after all terms have been added.
+     * @return
+     */
+    std::vector<double> const& getResult() const;
+
+    /**
+     * @brief Get the number of partial sums currently kept (see memory
+     * bound above)
+     * @return
+     */
+    int getNumPartialSums() const;
+
+  private:
+    /** Number of nodes at the given tree level, 0 being the leaves */
+    int numNodes(int level) const;
+
+    int numTerms;
+
+    /** Partial sums waiting for their sibling, by (level, index) */
+    std::map<std::pair<int, int>, std::vector<double>> pending;
+
+    std::vector<double> result;
+
+    bool complete = false;
+
+    mutable std::mutex mutex;
+};
+
+} // namespace parpe
+
+#endif // PARPE_COMMON_TREE_REDUCTION_H
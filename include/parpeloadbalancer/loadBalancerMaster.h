@@ -4,9 +4,14 @@
 #include <parpecommon/parpeConfig.h>
 
 #include <pthread.h>
-#include <queue>
 #include <semaphore.h>
+#include <deque>
 #include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #ifdef PARPE_ENABLE_MPI
 #include <mpi.h>
@@ -45,6 +50,94 @@ struct JobData {
 
     /** callback when job is finished (if set) */
     std::function<void(JobData*)> callbackJobFinished = nullptr;
+
+    /** data required by this job, which is the same for other jobs (if set).
+     * It is sent to the worker before the job, unless it is among the
+     * NUM_SHARED_DATA_CACHED items that worker has used most recently. Must
+     * not be modified after queueing.
+     */
+    std::shared_ptr<std::vector<char> const> sharedData;
+
+    /** identifies the contents of sharedData (unique, non-negative) */
+    int sharedDataId = -1;
+
+    /** identifies the submitter of this job, e.g. one local optimization of
+     * a multi-start optimization (see JobQueue) */
+    int clientId = -1;
+
+    /** jobs with higher priority are sent first (see JobQueue) */
+    double priority = 0.0;
+};
+
+
+/**
+ * @brief The JobQueue class holds the jobs waiting to be sent to workers.
+ *
+ * Jobs are kept in one FIFO queue per JobData::clientId. Dequeuing serves
+ * the clients round-robin, so that a client queueing many jobs at once does
+ * not delay the jobs of other clients until all of its own jobs have been
+ * sent. Among the clients, the one whose next job has the highest
+ * JobData::priority is served first; round-robin applies to clients of equal
+ * priority.
+ *
+ * To prevent starvation of low-priority clients, priorities age: a client
+ * that has been passed over in favor of higher-priority jobs
+ * `maxTimesSkipped` times is served next, regardless of priority.
+ *
+ * Not thread-safe.
+ */
+class JobQueue {
+  public:
+    /**
+     * @brief JobQueue
+     * @param maxTimesSkipped Number of times a client may be passed over in
+     * favor of higher-priority jobs before it is served (>= 0)
+     */
+    explicit JobQueue(int maxTimesSkipped = 8);
+
+    /**
+     * @brief Append job to the queue of its client
+     * @param job
+     */
+    void push(JobData *job);
+
+    /**
+     * @brief Remove and return the next job to be sent
+     * @return The job or nullptr if empty
+     */
+    JobData *pop();
+
+    /**
+     * @brief Remove all jobs matching the given predicate
+     * @param predicate
+     * @return Number of removed jobs
+     */
+    int removeIf(std::function<bool(JobData const *)> const& predicate);
+
+    bool empty() const;
+
+    std::size_t size() const;
+
+  private:
+    /** Jobs of a single client */
+    struct ClientQueue {
+        std::deque<JobData *> jobs;
+
+        /** Number of jobs of higher priority sent since this client was last
+         * served */
+        int timesSkipped = 0;
+    };
+
+    /** Waiting jobs per client ID */
+    std::map<int, ClientQueue> clientQueues;
+
+    int maxTimesSkipped = 8;
+
+    /** Client most recently served */
+    int lastClientId = -1;
+
+    /** Total number of jobs */
+    std::size_t numJobs = 0;
 };
 
 
@@ -52,6 +145,12 @@ struct JobData {
 /**
  * @brief The LoadBalancerMaster class sends jobs to workers, receives the
  * results and signals the client.
+ *
+ * To hide communication latency, each worker can be sent up to
+ * `jobsPerWorker` jobs at a time, which it processes in order of arrival.
+ * This prefetch depth defaults to 1 and can be set via the environment
+ * variable `PARPE_JOBS_PER_WORKER`. Replies are matched to jobs via the MPI
+ * tag (i.e. the job ID).
  */
 class LoadBalancerMaster {
   public:
@@ -84,7 +183,31 @@ class LoadBalancerMaster {
     void queueJob(JobData *data);
 
     /**
-     * @brief Stop the loadbalancer thread
+     * @brief Cancel the selected jobs which have not been started yet.
+     *
+     * Jobs which have not been sent to any worker yet are removed from the
+     * queue. For these, neither the callback is called, nor `jobDone` is
+     * incremented.
+     *
+     * If MPI_THREAD_MULTIPLE is supported, workers are told to skip the
+     * selected jobs which they have received, but not yet started (see
+     * `PARPE_JOBS_PER_WORKER`). These jobs finish as usual, but with an empty
+     * `recvBuffer`. Jobs which a worker has already started, or which are
+     * just being sent, run to completion.
+     *
+     * @param predicate Selects the jobs to cancel
+     * @return Number of jobs removed from the queue
+     */
+    int cancelQueuedJobs(
+            std::function<bool(JobData const *)> const& predicate);
+
+    /**
+     * @brief Stop the loadbalancer thread.
+     *
+     * Jobs which are still queued or in flight won't be finished, i.e.
+     * neither the callback is called nor `jobDone` is incremented. Once this
+     * returns, their JobData may be destroyed. Workers must still be
+     * receiving (see sendTerminationSignalToAllWorkers).
      */
     void terminate();
 
@@ -121,6 +244,62 @@ class LoadBalancerMaster {
      */
     void loadBalancerThreadRun();
 
+    /**
+     * @brief Block until there is something to do for the dispatcher.
+     *
+     * If no jobs are in flight, this sleeps on `condQueue` until a new job is
+     * queued. Otherwise, it blocks in MPI until a reply arrives or, if there
+     * are idle workers, until queueJob sends a wake-up message. This
+     * requires MPI_THREAD_MULTIPLE. Without it, or with
+     * `PARPE_LOAD_BALANCER_POLL=1`, incoming replies are probed for with an
+     * increasing back-off interval (up to `maxPollIntervalNs`), while, if
+     * there are idle workers, newly queued jobs will end the wait
+     * immediately.
+     *
+     * Note that many MPI implementations (e.g. MPICH and Open MPI with their
+     * default settings) busy-wait inside blocking calls, so blocking does
+     * not necessarily free the master's core. Polling with back-off does, at
+     * the cost of up to `maxPollIntervalNs` additional latency per reply.
+     *
+     * Returns after at least one message has been handled or a job has been
+     * queued. Contains cancellation points.
+     *
+     * @param haveFreeWorker Whether there is any idle worker
+     */
+    void waitForEvent(bool haveFreeWorker);
+
+    /**
+     * @brief Polling version of waitForEvent, for MPI libraries without
+     * MPI_THREAD_MULTIPLE support
+     * @param haveFreeWorker
+     */
+    void pollForEvent(bool haveFreeWorker);
+
+    /**
+     * @brief Receive the given message, which is either a reply or a wake-up
+     * message, and send the next job to the worker which sent the reply.
+     * @param mpiMessage Matched message handle
+     * @param mpiStatus Status of that message
+     * @return true if this was a reply, false for a wake-up message
+     */
+    bool handleMessage(MPI_Message *mpiMessage, MPI_Status *mpiStatus);
+
+    /**
+     * @brief Wake the dispatcher if it is blocked in waitForEvent waiting
+     * for a message. Must be called with `mutexQueue` locked.
+     * @param force Wake up even if not blocked for a new job
+     */
+    void wakeDispatcher(bool force);
+
+    /**
+     * @brief Wait on `condQueue` until the queue is non-empty or the given
+     * timeout has passed.
+     * @param timeoutNs Relative timeout in nanoseconds or a negative value to
+     * wait without timeout.
+     * @return true if the queue is non-empty
+     */
+    bool waitForQueuedJob(long timeoutNs);
+
     /**
      * @brief Frees all send buffers after respective MPI messages have been
      * sent
@@ -130,38 +309,49 @@ class LoadBalancerMaster {
     /**
      * @brief Check for finished jobs, receive their results and send next job
      * if jobs are waiting.
-     * @return Index (not rank) of worker that has finished and not yet received
-     * new work or NO_FREE_WORKER if no such worker.
+     * @return Number of replies that have been handled
      */
     int handleFinishedJobs();
 
     /**
-     * @brief Get index (not rank) of next free worker.
+     * @brief Get index (not rank) of next free worker, i.e. the one with the
+     * fewest jobs in flight, if less than `jobsPerWorker`.
      * @return That index or NO_FREE_WORKER if no such worker
      */
     int getNextFreeWorkerIndex();
 
     /**
-     * @brief Pop oldest element from the queue and return.
-     * @return The first queue element.
+     * @brief Pop next element from the queue (see JobQueue) and return.
+     * @return The next queue element, or nullptr if the queue is empty.
      */
     JobData *getNextJob();
 
     /**
      * @brief Send the given work package to the given worker and track
-     * requests
+     * requests. Send the job's shared data first, if required.
      * @param workerIdx Index (not rank)
      * @param data Job data to send
      */
     void sendToWorker(int workerIdx, JobData *data);
 
+    /**
+     * @brief Send shared data to the given worker, unless it is still cached
+     * there, and mark it as most recently used by this worker.
+     * @param workerIdx Index (not rank)
+     * @param data Job whose shared data to send
+     */
+    void sendSharedDataToWorker(int workerIdx, JobData const *data);
+
     /**
      * @brief Handle the result message from a worker as indicated by mpiStatus.
      *
-     * @param mpiStatus Receive the indicated message, mark job as done,
-     * signal reception.
+     * Receive the indicated message, mark job as done, signal reception.
+     *
+     * @param mpiMessage Matched message handle from MPI_Improbe
+     * @param mpiStatus Status from MPI_Improbe
+     * @return Index (not rank) of the worker which sent the reply
      */
-    int handleReply(MPI_Status *mpiStatus);
+    int handleReply(MPI_Message *mpiMessage, MPI_Status *mpiStatus);
 
     /**
      * @brief Check if jobs are waiting in queue and send to specified worker.
@@ -185,31 +375,76 @@ class LoadBalancerMaster {
     /** Number of workers we can send jobs to */
     int numWorkers = 0;
 
+    /** Own rank in `mpiComm`, used for wake-up messages */
+    int ownRank = 0;
+
+    /** Whether MPI may be called from other threads than the dispatcher,
+     * i.e. MPI_THREAD_MULTIPLE is supported */
+    bool mpiThreadMultiple = false;
+
+    /** Whether the dispatcher blocks in MPI while waiting for replies, which
+     * requires MPI_THREAD_MULTIPLE, or polls (also if
+     * `PARPE_LOAD_BALANCER_POLL=1`). See waitForEvent. */
+    bool blockOnReplies = false;
+
+    /** Set while the dispatcher is blocked in MPI, waiting for a reply or
+     * a new job. Protected by `mutexQueue`. */
+    bool dispatcherWaitingForJob = false;
+
+    /** Whether a wake-up message has been sent, but not received yet.
+     * Protected by `mutexQueue`. */
+    bool wakeupPending = false;
+
+    /** Maximum number of jobs in flight for any single worker */
+    int jobsPerWorker = 1;
+
     /** Queue with jobs to be sent to workers */
-    std::queue<JobData *> queue;
+    JobQueue queue;
 
     /** Last assigned job ID used as MPI message tag */
     int lastJobId = 0;
 
-    /** Keeps track of whether the respective worker is busy (received a job,
-     * but has not sent the result) or is ready to accept a new job.
+    /** Number of jobs which have been sent, but whose results have not yet
+     * been received. Only accessed from the dispatcher thread. */
+    int numJobsInFlight = 0;
+
+    /** Number of jobs per worker which have been sent, but whose results
+     * have not been received yet. A worker can accept new jobs as long as
+     * this is less than `jobsPerWorker`.
      *
      * Length is `numWorkers`. Index is off by one from MPI rank because no job
      * is sent to master (rank 0).
      */
-    std::vector<bool> workerIsBusy;
+    std::vector<int> numJobsOnWorker;
 
     /** MPI requests for jobs sent asynchronously to workers. Used to track when
-     * the respective send buffers can be freed. */
+     * the respective send buffers can be freed.
+     *
+     * Length is `numWorkers * jobsPerWorker`, slots of worker `i` start at
+     * `i * jobsPerWorker`. */
     std::vector<MPI_Request> sendRequests;
 
     /** Jobs that have been sent to workers. Required for handling replies and
-     * signalling the client that processing has completed. */
+     * signalling the client that processing has completed. Same layout as
+     * `sendRequests`, unused slots are `nullptr`. Only modified by the
+     * dispatcher thread, with `mutexQueue` locked. */
     std::vector<JobData *> sentJobsData;
 
+    /** IDs of the shared data cached by the respective worker, most recently
+     * used first, at most NUM_SHARED_DATA_CACHED. Length is `numWorkers`. */
+    std::vector<std::deque<int>> workerSharedDataIds;
+
+    /** MPI requests for shared data that has not yet been sent completely,
+     * along with the respective buffers. */
+    std::list<std::pair<MPI_Request, std::shared_ptr<std::vector<char> const>>>
+    sharedDataSends;
+
     /** Mutex to protect access to `queue`. */
     pthread_mutex_t mutexQueue = PTHREAD_MUTEX_INITIALIZER;
 
+    /** Signaled whenever a job is added to `queue`. Used with `mutexQueue`. */
+    pthread_cond_t condQueue = PTHREAD_COND_INITIALIZER;
+
     /** Semaphore to limit queue length and avoid potentially huge memory
      * allocation for all send and receive buffers. Note that using this might
      * come with a decreasing performance due to frequent rescheduling
@@ -221,6 +456,14 @@ class LoadBalancerMaster {
 
     /** Value to indicate that there is currently no known free worker. */
     constexpr static int NO_FREE_WORKER = -1;
+
+    /** Initial interval for probing for replies of busy workers. */
+    constexpr static long minPollIntervalNs = 10000;
+
+    /** Upper bound for the probing interval after repeated unsuccessful
+     * probes. Bounds the additional latency for receiving a reply when
+     * polling. */
+    constexpr static long maxPollIntervalNs = 1000000;
 };
 
 #endif
@@ -3,13 +3,54 @@
 
 #include <parpecommon/parpeConfig.h>
 
-#include <vector>
+#include <deque>
 #include <functional>
+#include <list>
+#include <vector>
+
+#ifdef PARPE_ENABLE_MPI
+#include <mpi.h>
+#endif
 
 #define MPI_TAG_EXIT_SIGNAL 0
+/** Tag for data shared by multiple jobs, see JobData::sharedData */
+#define MPI_TAG_SHARED_DATA 1
+/** Tag for messages from LoadBalancerMaster::queueJob to the dispatcher
+ * thread (on the master itself) to end a blocking wait for replies */
+#define MPI_TAG_WAKEUP 2
+/** Tag for a list of IDs of jobs which a worker should not process anymore,
+ * see LoadBalancerMaster::cancelQueuedJobs */
+#define MPI_TAG_CANCEL 3
+/** Tags up to this value are reserved for control messages, job IDs are
+ * larger */
+#define MPI_TAG_MAX_CONTROL 3
 
 namespace parpe {
 
+/** Number of most recently used shared data items (see JobData::sharedData)
+ * a worker's shared data handler has to keep. The master resends shared data
+ * only if it is not among these. Usage is counted in the order shared data
+ * and jobs are received. */
+constexpr int NUM_SHARED_DATA_CACHED = 4;
+
+#ifdef PARPE_ENABLE_MPI
+/**
+ * @brief The LoadBalancerWorker class receives jobs from LoadBalancerMaster,
+ * processes them and sends back the results.
+ *
+ * The master may send multiple jobs ahead (see `PARPE_JOBS_PER_WORKER`).
+ * These are received into a local queue as soon as they arrive and are
+ * processed in order. Results are sent asynchronously, tagged with the
+ * respective job ID.
+ *
+ * Data shared by multiple jobs (see JobData::sharedData) is passed to a
+ * separate handler, in order with the jobs, i.e. before the jobs depending on
+ * it are processed. The handler has to keep the NUM_SHARED_DATA_CACHED most
+ * recently used items.
+ *
+ * Jobs which are cancelled by the master (see MPI_TAG_CANCEL) before they
+ * have been processed are answered with an empty reply.
+ */
 class LoadBalancerWorker {
   public:
     LoadBalancerWorker() = default;
@@ -23,15 +64,76 @@ class LoadBalancerWorker {
      */
     using messageHandlerFunc = std::function<void (std::vector<char> &buffer, int jobId)>;
 
-    void run(const messageHandlerFunc &messageHandler);
+    /**
+     * sharedDataHandler is called by run when shared data is received.
+     * @param buffer The message
+     */
+    using sharedDataHandlerFunc = std::function<void (std::vector<char> &buffer)>;
+
+    /**
+     * @brief Receive and handle jobs until the termination signal is received.
+     * @param messageHandler Handler for job messages
+     * @param sharedDataHandler Handler for shared data. Must be set if the
+     * master sends shared data.
+     */
+    void run(const messageHandlerFunc &messageHandler,
+             const sharedDataHandlerFunc &sharedDataHandler = nullptr);
 
   private:
+    /** A received job waiting to be processed */
+    struct ReceivedJob {
+        int jobId;
+        std::vector<char> buffer;
+    };
+
+    /** A result which is being sent */
+    struct PendingReply {
+        MPI_Request request;
+        std::vector<char> buffer;
+    };
+
     /**
-     * @brief waitForAndHandleJobs
+     * @brief Receive all jobs that have arrived and append them to
+     * `receiveQueue`.
+     * @param block Wait for at least one message if true
      * @return true: received termination signal
      */
-    bool waitForAndHandleJobs(const messageHandlerFunc& messageHandler);
+    bool receiveJobs(bool block);
+
+    /**
+     * @brief Remove the given jobs from `receiveQueue`, if still there, and
+     * send empty replies for them.
+     * @param buffer Job IDs (int) to cancel
+     */
+    void cancelJobs(std::vector<char> const& buffer);
+
+    /**
+     * @brief Start sending the given reply to the master.
+     * @param jobId
+     * @param buffer
+     */
+    void sendReply(int jobId, std::vector<char> buffer);
+
+    /**
+     * @brief Process the oldest job in `receiveQueue` and start sending the
+     * results.
+     */
+    void handleNextJob(const messageHandlerFunc& messageHandler,
+                       const sharedDataHandlerFunc &sharedDataHandler);
+
+    /**
+     * @brief Release buffers of replies that have been sent.
+     * @param wait Wait for all pending sends to complete if true
+     */
+    void freeSentReplies(bool wait);
+
+    /** Jobs that have been received, but not yet processed */
+    std::deque<ReceivedJob> receiveQueue;
+
+    /** Replies that have not yet been sent completely */
+    std::list<PendingReply> pendingReplies;
 };
+#endif
 
 } // namespace parpe
 
@@ -17,6 +17,12 @@ public:
 
     virtual bool restartOnFailure() const { return false; }
 
+    /**
+     * @brief Maximum number of local optimizations to run concurrently
+     * @return Number of starts, or 0 for no limit
+     */
+    virtual int getMaxParallelStarts() const { return 0; }
+
     virtual std::unique_ptr<OptimizationProblem>
     getLocalProblem(int multiStartIndex) const = 0;
 
@@ -35,7 +41,7 @@ class MultiStartOptimization {
                            bool runParallel = true,
                            int first_start_idx = 0);
 
-    ~MultiStartOptimization() = default;
+    virtual ~MultiStartOptimization() = default;
 
     /**
      * @brief Start multi-start optimization
@@ -43,7 +49,12 @@ class MultiStartOptimization {
     void run();
 
     /**
-     * @brief Run all optimizations in parallel, each in a dedicated thread
+     * @brief Run optimizations in parallel on a pool of threads, keeping at
+     * most `maxParallelStarts` local optimizations in flight.
+     *
+     * Local problems are created only when their optimization is started.
+     * If restartOnFailure is set, failed starts are retried with new starting
+     * points (start indices after the regular ones).
      */
     void runMultiThreaded();
 
@@ -57,9 +68,22 @@ class MultiStartOptimization {
      */
     void setRunParallel(bool runParallel);
 
-  private:
+    /**
+     * @brief Set maximum number of concurrently running local optimizations
+     * @param maxParallelStarts Number of starts, or 0 for no limit
+     */
+    void setMaxParallelStarts(int maxParallelStarts);
 
-    std::vector<OptimizationProblem *> createLocalOptimizationProblems();
+  protected:
+    /**
+     * @brief Create the local problem for the given start index and run its
+     * optimization. May be called concurrently.
+     * @param startIdx
+     * @return Status, 0 on success
+     */
+    virtual int runLocalOptimization(int startIdx);
+
+  private:
 
     /** Optimization problem to be solved */
     MultiStartOptimizationProblem& msProblem;
@@ -73,6 +97,9 @@ class MultiStartOptimization {
     /** Run multiple optimizations in parallel */
     bool runParallel = true;
 
+    /** Maximum number of concurrently running local optimizations */
+    int maxParallelStarts = 1;
+
     /** Index value of the first start
      * Usable when splitting starts across multiple files */
     int first_start_idx = 0;
@@ -65,6 +65,10 @@ class OptimizationOptions {
 
     int multistartsInParallel = true;
 
+    /** Maximum number of local optimizations to run concurrently (only used
+     * for multi-start optimization). 0: no limit */
+    int maxParallelStarts = 0;
+
     std::string toString();
 
     int getIntOption(const std::string &key);
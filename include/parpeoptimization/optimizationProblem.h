@@ -6,6 +6,8 @@
 #include <parpecommon/functions.h>
 #include <parpecommon/logging.h>
 
+#include <cmath>
+#include <list>
 #include <vector>
 
 #include <hdf5.h>
@@ -15,6 +17,81 @@ namespace parpe {
 
 class OptimizationReporter;
 
+/**
+ * @brief The FunctionEvaluationCache class keeps the results of the most
+ * recent objective function evaluations (least recently used entries are
+ * evicted).
+ *
+ * Optimizers, e.g. during line search, frequently revisit previous points or
+ * request the gradient at a point where only the function value was computed
+ * before. Value-only and value+gradient evaluations are kept in separate lists
+ * of `capacity` entries each, so that a sequence of value-only evaluations
+ * does not evict the gradients. Entries are looked up by a hash of the
+ * parameter vector, and compared exactly on hash match.
+ */
+class FunctionEvaluationCache {
+public:
+    struct Entry {
+        std::vector<double> parameters;
+        std::size_t hash = 0;
+        double fval = NAN;
+        /** Empty for value-only evaluations */
+        std::vector<double> gradient;
+        FunctionEvaluationStatus status = functionEvaluationSuccess;
+        /** Optional additional results, e.g. for hierarchical optimization */
+        std::vector<double> fullParameters;
+        std::vector<double> fullGradient;
+    };
+
+    /**
+     * @brief FunctionEvaluationCache
+     * @param capacity Maximum number of entries for each of value-only and
+     * value+gradient evaluations. 0 disables caching.
+     */
+    explicit FunctionEvaluationCache(int capacity = 1);
+
+    /**
+     * @brief Find the cached evaluation for the given parameters. Counts as
+     * hit or miss.
+     * @param parameters
+     * @param needGradient Only consider evaluations including the gradient
+     * @return The entry, or nullptr if not cached. Valid until the next call
+     * to insert.
+     */
+    Entry const* find(gsl::span<double const> parameters, bool needGradient);
+
+    /**
+     * @brief Add an evaluation result. Its `gradient` decides whether it is
+     * a value-only or value+gradient entry.
+     * @param entry Result, `parameters` must be set, `hash` is set here
+     */
+    void insert(Entry entry);
+
+    void clear();
+
+    int getCapacity() const;
+
+    void setCapacity(int capacity);
+
+    int getNumHits() const;
+
+    int getNumMisses() const;
+
+    static std::size_t hashParameters(gsl::span<double const> parameters);
+
+private:
+    Entry const* findIn(std::list<Entry> &entries,
+                        gsl::span<double const> parameters, std::size_t hash);
+
+    /** Most recently used first */
+    std::list<Entry> valueEntries;
+    std::list<Entry> gradientEntries;
+
+    int capacity = 1;
+    int numHits = 0;
+    int numMisses = 0;
+};
+
 /**
  * @brief The OptimizationReporter class is called from the optimizer and takes
  * care of calling the actual objective function, thereby keeping track of
@@ -91,6 +168,15 @@ public:
 
     void setGradientFunction(GradientFunction *gradFun) const;
 
+    /**
+     * @brief Set the number of cached value-only and value+gradient
+     * evaluations each (default: PARPE_EVALUATION_CACHE_SIZE or 5)
+     * @param numEntries 0 disables caching
+     */
+    void setEvaluationCacheSize(int numEntries) const;
+
+    FunctionEvaluationCache const& getEvaluationCache() const;
+
     std::unique_ptr<OptimizationResultWriter> resultWriter;
 
     mutable double cpuTimeTotalSec = 0.0;
@@ -114,9 +200,10 @@ protected:
     // non-owning
     mutable GradientFunction *gradFun = nullptr;
 
-    // for caching
-    mutable bool haveCachedCost = false;
-    mutable bool haveCachedGradient = false;
+    /** Results of recent evaluations */
+    mutable FunctionEvaluationCache evaluationCache;
+
+    // most recent evaluation
     mutable std::vector<double> cachedGradient;
     mutable double cachedCost = std::numeric_limits<double>::infinity();
     mutable FunctionEvaluationStatus cachedStatus = functionEvaluationSuccess;
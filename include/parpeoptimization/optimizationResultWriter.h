@@ -1,6 +1,9 @@
 #ifndef OPTIMIZATIONRESULTWRITER_H
 #define OPTIMIZATIONRESULTWRITER_H
 
+#include <parpecommon/asyncHdf5Writer.h>
+
+#include <memory>
 #include <string>
 
 #include <H5Cpp.h>
@@ -12,6 +15,11 @@ namespace parpe {
  * @brief The OptimizationResultWriter class receives results during an
  * optimizer run. A new instance is to be created for each run.
  *
+ * Per-iteration and per-function-evaluation data is written asynchronously
+ * by an AsyncHdf5Writer which is shared by all copies of a writer, flushing
+ * every PARPE_RESULT_WRITER_FLUSH_INTERVAL seconds (default: 1). Setting it
+ * to 0 writes synchronously.
+ *
  * TODO: change into interface; add OptimizationResultWriterHDF5
  */
 
@@ -114,6 +122,15 @@ public:
                                       double cpuSec,
                                       int exitStatus) const;
 
+    /**
+     * @brief Save statistics of the objective function evaluation cache
+     * of OptimizationReporter.
+     * @param numHits Number of evaluations served from the cache
+     * @param numMisses Number of evaluations passed to the objective function
+     */
+    virtual void saveEvaluationCacheStatistics(int numHits,
+                                               int numMisses) const;
+
     H5::H5File const& getH5File() const;
 
     virtual std::string const& getRootPath() const;
@@ -128,18 +145,41 @@ public:
 
 protected:
     /**
-     * @brief Write buffered output to file
+     * @brief Write buffered output to file. Must not be called while holding
+     * the HDF5 lock of the file (see BackgroundHdf5Writer::flush).
      */
     virtual void flushResultWriter() const;
 
 private:
     virtual std::string getIterationPath(int iterationIdx) const;
 
+    /**
+     * @brief Append buffer as new column to the given extendable dataset,
+     * asynchronously if enabled
+     * @param parentPath
+     * @param datasetName
+     * @param buffer
+     */
+    void appendToDouble2DArray(std::string const& parentPath,
+                               const char *datasetName,
+                               gsl::span<const double> buffer);
+
+    /**
+     * @brief See appendToDouble2DArray
+     */
+    void appendToInt2DArray(std::string const& parentPath,
+                            const char *datasetName,
+                            gsl::span<const int> buffer);
+
     H5::H5File file = 0;
 
     /** Root path within HDF5 file */
     std::string rootPath = "/";
 
+    /** Writes rows of extendable datasets, nullptr for synchronous
+     * writing */
+    std::shared_ptr<AsyncHdf5Writer> asyncWriter;
+
 };
 
 } // namespace parpe
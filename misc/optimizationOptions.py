@@ -97,6 +97,7 @@ def printUsage():
     
     Options currently supported are 
               numStarts
+      maxParallelStarts
                 maxIter
               optimizer
        retryOptimization""")
@@ -1,5 +1,6 @@
 """Functions for generating parPE parameter estimation HDF5 input files"""
 import argparse
+import struct
 import sys
 from typing import Any, Collection, Optional, Dict, Tuple
 
@@ -35,6 +36,10 @@ NO_PREEQ_CONDITION_IDX: int = -1
 # parameter in opt<->sim mapping
 UNMAPPED_PARAMETER: int = -1
 
+# Flat input file format, see parpe::FlatInputFile
+FLAT_INPUT_MAGIC: bytes = b'PARPEFLT'
+FLAT_INPUT_VERSION: int = 1
+
 
 def requires_preequilibration(measurement_df: DataFrame) -> bool:
     return ptc.PREEQUILIBRATION_CONDITION_ID in measurement_df \
@@ -1049,6 +1054,102 @@ def write_optimization_options(f: h5py.File) -> None:
     # TODO mini-batch options
 
 
+def write_flat_input_file(hdf5_file_name: str, flat_file_name: str,
+                          root_path: str = '') -> None:
+    """
+    Write the per-simulation data and parameter mapping of a parPE HDF5 input
+    file to a flat binary file to be memory-mapped by parPE
+    (see PARPE_FLAT_INPUT_FILE).
+
+    Arguments:
+        hdf5_file_name: parPE HDF5 input file, as created by
+            HDF5DataGenerator
+        flat_file_name: file to create
+        root_path: group in the HDF5 file containing the input data
+    """
+    with h5py.File(hdf5_file_name, 'r') as f:
+        g = f[root_path or '/']
+        num_model_parameters = len(g['model/parameterIds'])
+        nk = len(g['model/fixedParameterIds'])
+        num_optimization_parameters = len(g['parameters/parameterNames'])
+        simulation_conditions = g['fixedParameters/simulationConditions'][:]
+        num_simulations = simulation_conditions.shape[0]
+
+        if nk:
+            # stored as nk x num_conditions
+            fixed_parameters = g['fixedParameters/k'][:].T
+        else:
+            # condition indices are still checked against num_conditions
+            fixed_parameters = np.zeros(
+                (max(simulation_conditions[:, :2].max(initial=-1) + 1, 0),
+                 0))
+        num_conditions = fixed_parameters.shape[0]
+
+        timepoints = []
+        measurements = []
+        sigmas = []
+        for sim_idx in range(num_simulations):
+            timepoints.append(g[f'measurements/t/{sim_idx}'][:].ravel())
+            measurements.append(g[f'measurements/y/{sim_idx}'][:].ravel())
+            sigmas.append(g[f'measurements/ysigma/{sim_idx}'][:].ravel())
+
+        # mapping and overrides are stored as num_model_parameters x
+        # num_simulations
+        if 'parameters/optimizationSimulationMapping' in g:
+            mapping = g['parameters/optimizationSimulationMapping'][:].T
+        else:
+            mapping = np.tile(np.arange(num_model_parameters),
+                              (num_simulations, 1))
+        if 'parameters/parameterOverrides' in g:
+            overrides = g['parameters/parameterOverrides'][:].T
+        else:
+            overrides = np.zeros(0)
+        pscale_simulation = g['parameters/pscaleSimulation'][:]
+        pscale_optimization = g['parameters/pscaleOptimization'][:]
+
+    def offsets(arrays):
+        return np.cumsum([0] + [len(a) for a in arrays])
+
+    def concatenate(arrays):
+        return np.concatenate(arrays) if arrays else np.zeros(0)
+
+    # in the order of parpe::FlatInputFile::Section
+    sections = [
+        np.ascontiguousarray(simulation_conditions, dtype='<i4'),
+        np.ascontiguousarray(fixed_parameters, dtype='<f8'),
+        np.asarray(offsets(timepoints), dtype='<u8'),
+        np.asarray(concatenate(timepoints), dtype='<f8'),
+        np.asarray(offsets(measurements), dtype='<u8'),
+        np.asarray(concatenate(measurements), dtype='<f8'),
+        np.asarray(concatenate(sigmas), dtype='<f8'),
+        np.ascontiguousarray(mapping, dtype='<i4'),
+        np.ascontiguousarray(pscale_simulation, dtype='<i4'),
+        np.ascontiguousarray(overrides, dtype='<f8'),
+        np.ascontiguousarray(pscale_optimization, dtype='<i4'),
+    ]
+
+    header = struct.pack('<8sII6i', FLAT_INPUT_MAGIC, FLAT_INPUT_VERSION,
+                         len(sections), num_simulations, num_conditions, nk,
+                         num_model_parameters, num_optimization_parameters, 0)
+
+    def align(offset):
+        return (offset + 7) // 8 * 8
+
+    section_table = []
+    offset = align(len(header) + 16 * len(sections))
+    for section in sections:
+        section_table.append((offset, section.size))
+        offset = align(offset + section.nbytes)
+
+    with open(flat_file_name, 'wb') as f:
+        f.write(header)
+        for section_offset, count in section_table:
+            f.write(struct.pack('<QQ', section_offset, count))
+        for (section_offset, _), section in zip(section_table, sections):
+            f.write(b'\0' * (section_offset - f.tell()))
+            f.write(section.tobytes())
+
+
 def parse_cli_args():
     """Parse command line arguments"""
 
@@ -1070,6 +1171,10 @@ def parse_cli_args():
     parser.add_argument('-o', dest='hdf5_file_name', default='data.h5',
                         help='Name of HDF5 file to generate')
 
+    parser.add_argument('--flat', dest='flat_file_name',
+                        help='Additionally write the per-simulation data to '
+                             'this flat file to be memory-mapped by parPE')
+
     args = parser.parse_args()
 
     return args
@@ -1088,3 +1193,7 @@ def main():
         petab_problem=petab_problem,
         amici_model=amici_model)
     h5gen.generate_file(args.hdf5_file_name)
+
+    if args.flat_file_name:
+        h5gen.f.close()
+        write_flat_input_file(args.hdf5_file_name, args.flat_file_name)
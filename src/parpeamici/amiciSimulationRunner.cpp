@@ -1,11 +1,17 @@
 #include <parpeamici/amiciSimulationRunner.h>
+#include <parpeamici/simulationWireFormat.h>
 
 #include <parpeloadbalancer/loadBalancerMaster.h>
+#include <parpecommon/logging.h>
+#include <parpecommon/parpeException.h>
 
 #if defined(_OPENMP)
 #include <omp.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <numeric>
 #include <utility>
 
 // #define PARPE_SIMULATION_RUNNER_DEBUG
@@ -27,6 +33,146 @@ AmiciSimulationRunner::AmiciSimulationRunner(std::vector<double> const& optimiza
 
 }
 
+constexpr double SimulationRuntimeHistory::smoothingFactor;
+
+/** Source of unique IDs for AmiciParameterEpoch */
+static std::atomic<int> lastParameterEpoch {-1};
+
+void SimulationRuntimeHistory::record(int conditionIdx,
+                                      amici::SensitivityOrder sensitivityOrder,
+                                      double timeSeconds)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto key = std::make_pair(sensitivityOrder, conditionIdx);
+    auto it = expectedTimes.find(key);
+    if(it == expectedTimes.end()) {
+        expectedTimes[key] = timeSeconds;
+    } else {
+        it->second = smoothingFactor * timeSeconds
+                + (1.0 - smoothingFactor) * it->second;
+    }
+}
+
+std::vector<double> SimulationRuntimeHistory::getExpectedTimes(
+        const std::vector<int> &conditionIndices,
+        amici::SensitivityOrder sensitivityOrder) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::vector<double> result(conditionIndices.size(), -1.0);
+    double sumKnown = 0.0;
+    int numKnown = 0;
+    for(int i = 0; i < static_cast<int>(conditionIndices.size()); ++i) {
+        auto it = expectedTimes.find(
+                    std::make_pair(sensitivityOrder, conditionIndices[i]));
+        if(it != expectedTimes.end()) {
+            result[i] = it->second;
+            sumKnown += it->second;
+            ++numKnown;
+        }
+    }
+
+    if(numKnown == 0)
+        return std::vector<double>();
+
+    double meanKnown = sumKnown / numKnown;
+    for(auto &time: result)
+        if(time < 0.0)
+            time = meanKnown;
+
+    return result;
+}
+
+void AmiciSimulationRunner::setRuntimeHistory(
+        const SimulationRuntimeHistory *history)
+{
+    runtimeHistory = history;
+}
+
+void AmiciSimulationRunner::setShareParameters(bool shareParameters)
+{
+    this->shareParameters = shareParameters;
+}
+
+void AmiciSimulationRunner::setSendOutputSensitivities(
+        bool sendOutputSensitivities)
+{
+    this->sendOutputSensitivities = sendOutputSensitivities;
+}
+
+void AmiciSimulationRunner::setJobClient(int clientId, double priority)
+{
+    jobClientId = clientId;
+    jobPriority = priority;
+}
+
+void AmiciSimulationRunner::setCancelOnFailure(bool cancelOnFailure)
+{
+    this->cancelOnFailure = cancelOnFailure;
+}
+
+std::vector<std::vector<int> > AmiciSimulationRunner::createWorkPackages(
+        const std::vector<int> &conditionIndices,
+        int maxSimulationsPerPackage,
+        amici::SensitivityOrder sensitivityOrder,
+        const SimulationRuntimeHistory *history)
+{
+    auto numConditions = static_cast<int>(conditionIndices.size());
+    auto numPackages = (numConditions + maxSimulationsPerPackage - 1)
+            / maxSimulationsPerPackage;
+    std::vector<std::vector<int>> packages(numPackages);
+
+    auto expectedTimes = history
+            ? history->getExpectedTimes(conditionIndices, sensitivityOrder)
+            : std::vector<double>();
+
+    if(expectedTimes.empty()) {
+        // no information on runtimes, group consecutive conditions
+        for(int i = 0; i < numConditions; ++i)
+            packages[i / maxSimulationsPerPackage].push_back(
+                        conditionIndices[i]);
+        return packages;
+    }
+
+    // longest processing time first
+    std::vector<int> order(numConditions);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return expectedTimes[a] > expectedTimes[b];
+    });
+
+    std::vector<double> packageTimes(numPackages, 0.0);
+    for(auto i: order) {
+        int bestPackageIdx = -1;
+        for(int packageIdx = 0; packageIdx < numPackages; ++packageIdx) {
+            if(static_cast<int>(packages[packageIdx].size())
+                    < maxSimulationsPerPackage
+                    && (bestPackageIdx < 0
+                        || packageTimes[packageIdx]
+                        < packageTimes[bestPackageIdx]))
+                bestPackageIdx = packageIdx;
+        }
+        packages[bestPackageIdx].push_back(conditionIndices[i]);
+        packageTimes[bestPackageIdx] += expectedTimes[i];
+    }
+
+    // queue expensive packages first
+    std::vector<int> packageOrder(numPackages);
+    std::iota(packageOrder.begin(), packageOrder.end(), 0);
+    std::stable_sort(packageOrder.begin(), packageOrder.end(),
+                     [&](int a, int b) {
+        return packageTimes[a] > packageTimes[b];
+    });
+
+    std::vector<std::vector<int>> sortedPackages;
+    sortedPackages.reserve(numPackages);
+    for(auto packageIdx: packageOrder)
+        sortedPackages.push_back(std::move(packages[packageIdx]));
+
+    return sortedPackages;
+}
+
 #ifdef PARPE_ENABLE_MPI
 int AmiciSimulationRunner::runDistributedMemory(LoadBalancerMaster *loadBalancer, const int maxSimulationsPerPackage)
 {
@@ -39,42 +185,72 @@ int AmiciSimulationRunner::runDistributedMemory(LoadBalancerMaster *loadBalancer
     pthread_mutex_t simulationsMutex = PTHREAD_MUTEX_INITIALIZER;
 
     // multiple simulations may be grouped into one work package
-    auto numJobsTotal = static_cast<int>(
-                std::ceil(
-                    static_cast<double>(conditionIndices.size())
-                    / maxSimulationsPerPackage));
+    auto packages = createWorkPackages(conditionIndices,
+                                       maxSimulationsPerPackage,
+                                       sensitivityOrder, runtimeHistory);
+    auto numJobsTotal = static_cast<int>(packages.size());
     std::vector<JobData> jobs {static_cast<decltype (jobs)::size_type>(numJobsTotal)};
     int numJobsFinished = 0;
-    int numConditionsSent = 0;
+
+    // parameters to be sent once per worker
+    std::shared_ptr<std::vector<char> const> parameterEpochBuffer;
+    int parameterEpoch = -1;
+    if(shareParameters) {
+        parameterEpoch = ++lastParameterEpoch;
+        if(parameterEpoch < 0) {
+            // overflow; workers only compare for equality
+            lastParameterEpoch = 0;
+            parameterEpoch = 0;
+        }
+        AmiciParameterEpoch epoch;
+        epoch.id = parameterEpoch;
+        epoch.optimizationParameters = optimizationParameters;
+        parameterEpochBuffer = std::make_shared<std::vector<char>>(
+                    amici::serializeToStdVec<AmiciParameterEpoch>(epoch));
+    }
 
     // prepare and queue work package
     for (int jobIdx = 0; jobIdx < numJobsTotal; ++jobIdx) {
-        int simulationsLeft = static_cast<int>(conditionIndices.size()) - numConditionsSent;
-        int simulationsCurrentPackage = std::min(simulationsLeft, maxSimulationsPerPackage);
-
-        auto currentConditions = std::vector<int>(
-                    &conditionIndices[static_cast<std::vector<int>::size_type>(numConditionsSent)],
-                         &conditionIndices[numConditionsSent + simulationsCurrentPackage]);
         queueSimulation(loadBalancer, &jobs[jobIdx],
                         &numJobsFinished, &simulationsCond, &simulationsMutex,
-                        jobIdx, optimizationParameters, sensitivityOrder, currentConditions);
-
-        numConditionsSent += simulationsCurrentPackage;
+                        jobIdx, optimizationParameters, sensitivityOrder,
+                        packages[jobIdx], parameterEpochBuffer,
+                        parameterEpoch);
         // printf("Queued work: "); printDatapath(path);
     }
 
     // wait for simulations to finish
+    bool cancelled = false;
     pthread_mutex_lock(&simulationsMutex);
-    while (numJobsFinished < numJobsTotal) // TODO don't wait for all to
-                                           // complete; stop early if errors
-                                           // occured
+    while (numJobsFinished < numJobsTotal) {
+        if (failed && !cancelled) {
+            // evaluation is lost, don't wait for jobs not yet started.
+            // Jobs already sent to workers are still replied to, possibly
+            // with an empty result if cancelled there.
+            cancelled = true;
+            auto first = jobs.data();
+            auto last = jobs.data() + jobs.size();
+            int numCancelled = loadBalancer->cancelQueuedJobs(
+                        [first, last](JobData const* job) {
+                return std::greater_equal<JobData const*>()(job, first)
+                        && std::less<JobData const*>()(job, last);
+            });
+            numJobsFinished += numCancelled;
+            logmessage(LOGLVL_DEBUG, "Simulation failed. Cancelled %d of "
+                                     "%d jobs.", numCancelled, numJobsTotal);
+            continue;
+        }
         pthread_cond_wait(&simulationsCond, &simulationsMutex);
+    }
     pthread_mutex_unlock(&simulationsMutex);
     pthread_mutex_destroy(&simulationsMutex);
     pthread_cond_destroy(&simulationsCond);
 
+    if (failed)
+        ++errors;
+
     // unpack
-    if(aggregate)
+    if(aggregate && !failed)
         errors += aggregate(jobs);
 
     return errors;
@@ -99,7 +275,8 @@ int AmiciSimulationRunner::runSharedMemory(const messageHandlerFunc& messageHand
         // to resuse the parallel code and for debugging we still serialze the job data here
         auto curConditionIndices = std::vector<int> {simulationIdx};
         AmiciWorkPackageSimple work {optimizationParameters, sensitivityOrder, curConditionIndices, logPrefix};
-        auto buffer = amici::serializeToStdVec<AmiciWorkPackageSimple>(work);
+        work.sendOutputSensitivities = sendOutputSensitivities;
+        auto buffer = serializeWorkPackage(work);
 
         messageHandler(buffer, simulationIdx);
         jobs[simulationIdx].recvBuffer = buffer;
@@ -122,23 +299,93 @@ void AmiciSimulationRunner::queueSimulation(LoadBalancerMaster *loadBalancer,
                                              pthread_cond_t *jobDoneChangedCondition, pthread_mutex_t *jobDoneChangedMutex, int jobIdx,
                                              std::vector<double> const& optimizationParameters,
                                              amici::SensitivityOrder sensitivityOrder,
-                                             std::vector<int> const& conditionIndices)
+                                             std::vector<int> const& conditionIndices,
+                                             std::shared_ptr<std::vector<char> const> const& parameterEpochBuffer,
+                                             int parameterEpoch)
 {
-    // TODO avoid copy optimizationParameters; reuse;; for const& in work package need to split into(de)serialize
     *d = JobData(jobDone, jobDoneChangedCondition, jobDoneChangedMutex);
-
-    AmiciWorkPackageSimple work {optimizationParameters, sensitivityOrder, conditionIndices, logPrefix};
-    d->sendBuffer = amici::serializeToStdVec<AmiciWorkPackageSimple>(work);
+    d->clientId = jobClientId;
+    d->priority = jobPriority;
+
+    AmiciWorkPackageSimple work;
+    if(parameterEpochBuffer) {
+        // parameters are sent separately
+        work.parameterEpoch = parameterEpoch;
+        d->sharedData = parameterEpochBuffer;
+        d->sharedDataId = parameterEpoch;
+    } else {
+        work.optimizationParameters = optimizationParameters;
+    }
+    work.sensitivityOrder = sensitivityOrder;
+    work.conditionIndices = conditionIndices;
+    work.logPrefix = logPrefix;
+    work.sendOutputSensitivities = sendOutputSensitivities;
+    d->sendBuffer = serializeWorkPackage(work);
 
     // TODO: must ignore 2nd argument for SimulationRunnerSimple
-    if(callbackJobFinished)
+    if(cancelOnFailure) {
+        // called from the load balancer thread
+        d->callbackJobFinished = [this, jobIdx](JobData *job) {
+            if(failed) {
+                // discard late replies
+                job->recvBuffer = std::vector<char>();
+                return;
+            }
+
+            ResultPackagesView results(job->recvBuffer);
+            for(int i = 0; i < results.size(); ++i) {
+                if(results.status(i) != 0) {
+                    failed = true;
+                    break;
+                }
+            }
+
+            if(callbackJobFinished)
+                callbackJobFinished(job, jobIdx);
+        };
+    } else if(callbackJobFinished) {
         d->callbackJobFinished = std::bind2nd(callbackJobFinished, jobIdx);
+    }
 
     loadBalancer->queueJob(d);
 
 }
 #endif
 
+void ParameterEpochCache::handleSharedData(const std::vector<char> &buffer)
+{
+    epochs.push_front(amici::deserializeFromChar<
+                      AmiciSimulationRunner::AmiciParameterEpoch>(
+                          buffer.data(), buffer.size()));
+    if(static_cast<int>(epochs.size()) > NUM_SHARED_DATA_CACHED)
+        epochs.pop_back();
+}
+
+void ParameterEpochCache::resolve(
+        AmiciSimulationRunner::AmiciWorkPackageSimple &workPackage)
+{
+    if(workPackage.parameterEpoch < 0)
+        return;
+
+    auto epoch = std::find_if(
+                epochs.begin(), epochs.end(),
+                [&workPackage](AmiciSimulationRunner::AmiciParameterEpoch const& e) {
+        return e.id == workPackage.parameterEpoch;
+    });
+    if(epoch == epochs.end())
+        throw ParPEException("Work package refers to parameter epoch "
+                             + std::to_string(workPackage.parameterEpoch)
+                             + ", which is not cached.");
+
+    workPackage.optimizationParameters = epoch->optimizationParameters;
+
+    if(epoch != epochs.begin()) {
+        auto mostRecent = std::move(*epoch);
+        epochs.erase(epoch);
+        epochs.push_front(std::move(mostRecent));
+    }
+}
+
 void swap(AmiciSimulationRunner::AmiciResultPackageSimple &first, AmiciSimulationRunner::AmiciResultPackageSimple &second) {
     using std::swap;
     swap(first.llh, second.llh);
@@ -147,6 +394,7 @@ void swap(AmiciSimulationRunner::AmiciResultPackageSimple &first, AmiciSimulatio
     swap(first.modelOutput, second.modelOutput);
     swap(first.modelStates, second.modelStates);
     swap(first.status, second.status);
+    swap(first.modelOutputSensitivities, second.modelOutputSensitivities);
 }
 
 bool operator==(const AmiciSimulationRunner::AmiciResultPackageSimple &lhs, const AmiciSimulationRunner::AmiciResultPackageSimple &rhs) {
@@ -155,6 +403,7 @@ bool operator==(const AmiciSimulationRunner::AmiciResultPackageSimple &lhs, cons
             && lhs.gradient == rhs.gradient
             && lhs.modelOutput == rhs.modelOutput
             && lhs.modelStates == rhs.modelStates
+            && lhs.modelOutputSensitivities == rhs.modelOutputSensitivities
             && lhs.simulationTimeSeconds == rhs.simulationTimeSeconds;
 }
 
@@ -0,0 +1,369 @@
+#include <parpeamici/flatInputFile.h>
+
+#include <parpecommon/parpeException.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace parpe {
+
+constexpr char const* FlatInputFile::magic;
+constexpr std::uint32_t FlatInputFile::version;
+
+namespace {
+
+static_assert(sizeof(FlatInputFile::Header) == 40,
+              "Unexpected padding in FlatInputFile::Header");
+static_assert(sizeof(FlatInputFile::SectionEntry) == 16,
+              "Unexpected padding in FlatInputFile::SectionEntry");
+
+constexpr std::size_t sectionAlignment = 8;
+
+constexpr std::size_t sectionTableEnd =
+        sizeof(FlatInputFile::Header)
+        + FlatInputFile::numSections * sizeof(FlatInputFile::SectionEntry);
+
+std::uint64_t align(std::uint64_t offset) {
+    return (offset + sectionAlignment - 1) / sectionAlignment
+            * sectionAlignment;
+}
+
+/** Element size of each section */
+constexpr std::size_t elementSize[FlatInputFile::numSections] = {
+    sizeof(std::int32_t), // simulationConditions
+    sizeof(double),       // fixedParameters
+    sizeof(std::uint64_t),// timepointOffsets
+    sizeof(double),       // timepoints
+    sizeof(std::uint64_t),// measurementOffsets
+    sizeof(double),       // measurements
+    sizeof(double),       // sigmas
+    sizeof(std::int32_t), // parameterMapping
+    sizeof(std::int32_t), // parameterScaleSimulation
+    sizeof(double),       // parameterOverrides
+    sizeof(std::int32_t), // parameterScaleOptimization
+};
+
+/** Check that offsets are valid CSR offsets into `numValues` values */
+bool isValidOffsets(gsl::span<std::uint64_t const> offsets,
+                    std::uint64_t numValues) {
+    if(offsets.empty() || offsets[0] != 0
+            || offsets[offsets.size() - 1] != numValues)
+        return false;
+    for(std::size_t i = 1; i < static_cast<std::size_t>(offsets.size()); ++i)
+        if(offsets[i] < offsets[i - 1])
+            return false;
+    return true;
+}
+
+} // anonymous namespace
+
+
+FlatInputFile::FlatInputFile(std::string const& fileName)
+    : fileName(fileName)
+{
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw ParPEException("Failed to open flat input file " + fileName
+                             + ": " + std::strerror(errno));
+
+    struct stat fileStatus {};
+    if(fstat(fd, &fileStatus) != 0) {
+        close(fd);
+        throw ParPEException("Failed to stat flat input file " + fileName);
+    }
+    numBytes = static_cast<std::size_t>(fileStatus.st_size);
+
+    if(numBytes < sizeof(Header)) {
+        close(fd);
+        throw ParPEException("Flat input file " + fileName + " is truncated.");
+    }
+
+    auto mapping = mmap(nullptr, numBytes, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping stays valid after closing the file
+    close(fd);
+    if(mapping == MAP_FAILED) {
+        throw ParPEException("Failed to map flat input file " + fileName
+                             + ": " + std::strerror(errno));
+    }
+    data = mapping;
+    mapped = true;
+
+    try {
+        checkLayout();
+    } catch (...) {
+        munmap(mapping, numBytes);
+        throw;
+    }
+}
+
+FlatInputFile::FlatInputFile(void const* data, std::size_t numBytes)
+    : fileName("(in-memory image)"), data(data), numBytes(numBytes)
+{
+    if(numBytes < sizeof(Header))
+        throw ParPEException("Flat input image is truncated.");
+    if(reinterpret_cast<std::uintptr_t>(data) % sectionAlignment)
+        throw ParPEException("Flat input image is misaligned.");
+
+    checkLayout();
+}
+
+FlatInputFile::~FlatInputFile()
+{
+    if(mapped)
+        munmap(const_cast<void *>(data), numBytes);
+}
+
+int FlatInputFile::getNumSimulationConditions() const
+{
+    return static_cast<Header const*>(data)->numSimulationConditions;
+}
+
+int FlatInputFile::getNumConditions() const
+{
+    return static_cast<Header const*>(data)->numConditions;
+}
+
+int FlatInputFile::getNumFixedParameters() const
+{
+    return static_cast<Header const*>(data)->numFixedParameters;
+}
+
+int FlatInputFile::getNumModelParameters() const
+{
+    return static_cast<Header const*>(data)->numModelParameters;
+}
+
+int FlatInputFile::getNumOptimizationParameters() const
+{
+    return static_cast<Header const*>(data)->numOptimizationParameters;
+}
+
+gsl::span<std::int32_t const> FlatInputFile::getSimulationConditions() const
+{
+    return getSection<std::int32_t>(simulationConditions);
+}
+
+gsl::span<double const> FlatInputFile::getFixedParameters() const
+{
+    return getSection<double>(fixedParameters);
+}
+
+gsl::span<std::uint64_t const> FlatInputFile::getTimepointOffsets() const
+{
+    return getSection<std::uint64_t>(timepointOffsets);
+}
+
+gsl::span<double const> FlatInputFile::getTimepoints() const
+{
+    return getSection<double>(timepoints);
+}
+
+gsl::span<std::uint64_t const> FlatInputFile::getMeasurementOffsets() const
+{
+    return getSection<std::uint64_t>(measurementOffsets);
+}
+
+gsl::span<double const> FlatInputFile::getMeasurements() const
+{
+    return getSection<double>(measurements);
+}
+
+gsl::span<double const> FlatInputFile::getSigmas() const
+{
+    return getSection<double>(sigmas);
+}
+
+gsl::span<std::int32_t const> FlatInputFile::getParameterMapping() const
+{
+    return getSection<std::int32_t>(parameterMapping);
+}
+
+gsl::span<std::int32_t const> FlatInputFile::getParameterScaleSimulation() const
+{
+    return getSection<std::int32_t>(parameterScaleSimulation);
+}
+
+gsl::span<double const> FlatInputFile::getParameterOverrides() const
+{
+    return getSection<double>(parameterOverrides);
+}
+
+gsl::span<std::int32_t const> FlatInputFile::getParameterScaleOptimization() const
+{
+    return getSection<std::int32_t>(parameterScaleOptimization);
+}
+
+std::size_t FlatInputFile::size() const
+{
+    return numBytes;
+}
+
+template<typename T>
+gsl::span<T const> FlatInputFile::getSection(Section section) const
+{
+    auto const* sections = reinterpret_cast<SectionEntry const*>(
+                static_cast<char const*>(data) + sizeof(Header));
+    auto const& entry = sections[section];
+    return gsl::make_span(
+                reinterpret_cast<T const*>(
+                    static_cast<char const*>(data) + entry.offset),
+                static_cast<std::size_t>(entry.count));
+}
+
+void FlatInputFile::checkLayout() const
+{
+    auto invalid = [this](std::string const& reason) {
+        return ParPEException("Invalid flat input file " + fileName + ": "
+                              + reason);
+    };
+
+    auto const& header = *static_cast<Header const*>(data);
+    if(std::memcmp(header.magic, magic, sizeof(header.magic)) != 0)
+        throw invalid("Not a parPE flat input file.");
+    if(header.version != version)
+        throw invalid("Unsupported version " + std::to_string(header.version));
+    if(header.numSections != numSections)
+        throw invalid("Unexpected number of sections.");
+    if(numBytes < sectionTableEnd)
+        throw invalid("Truncated section table.");
+    if(header.numSimulationConditions < 0 || header.numConditions < 0
+            || header.numFixedParameters < 0 || header.numModelParameters < 0
+            || header.numOptimizationParameters < 0)
+        throw invalid("Negative dimensions.");
+
+    auto const* sections = reinterpret_cast<SectionEntry const*>(
+                static_cast<char const*>(data) + sizeof(Header));
+    for(int section = 0; section < numSections; ++section) {
+        auto const& entry = sections[section];
+        if(entry.offset % sectionAlignment)
+            throw invalid("Misaligned section " + std::to_string(section));
+        if(entry.offset > numBytes
+                || entry.count > (numBytes - entry.offset)
+                / elementSize[section])
+            throw invalid("Section " + std::to_string(section)
+                          + " exceeds file size.");
+    }
+
+    auto const numSimulations =
+            static_cast<std::uint64_t>(header.numSimulationConditions);
+    auto const numParameters =
+            numSimulations * static_cast<std::uint64_t>(
+                header.numModelParameters);
+    auto count = [sections](Section section) {
+        return sections[section].count;
+    };
+    if(count(simulationConditions) != numSimulations * 3
+            || count(fixedParameters)
+            != static_cast<std::uint64_t>(header.numConditions)
+            * static_cast<std::uint64_t>(header.numFixedParameters)
+            || count(parameterMapping) != numParameters
+            || count(parameterScaleSimulation) != numParameters
+            || (count(parameterOverrides) != 0
+                && count(parameterOverrides) != numParameters)
+            || count(parameterScaleOptimization)
+            != static_cast<std::uint64_t>(header.numOptimizationParameters)
+            || count(timepointOffsets) != numSimulations + 1
+            || count(measurementOffsets) != numSimulations + 1
+            || count(sigmas) != count(measurements))
+        throw invalid("Section sizes do not match the dimensions.");
+
+    if(!isValidOffsets(getTimepointOffsets(), count(timepoints))
+            || !isValidOffsets(getMeasurementOffsets(), count(measurements)))
+        throw invalid("Invalid offsets.");
+
+    // preequilibration and simulation condition, -1 for none
+    auto isValidCondition = [&header](std::int32_t index) {
+        return index >= -1 && index < header.numConditions;
+    };
+    auto conditions = getSimulationConditions();
+    for(std::uint64_t i = 0; i < numSimulations; ++i) {
+        if(!isValidCondition(conditions[i * 3])
+                || !isValidCondition(conditions[i * 3 + 1]))
+            throw invalid("Invalid condition index.");
+    }
+    for(auto index : getParameterMapping())
+        if(index >= header.numOptimizationParameters)
+            throw invalid("Invalid optimization parameter index in mapping.");
+}
+
+
+
+FlatInputWriter::FlatInputWriter(FlatInputFile::Header const& header)
+    : header(header)
+{
+    std::memcpy(this->header.magic, FlatInputFile::magic,
+                sizeof(this->header.magic));
+    this->header.version = FlatInputFile::version;
+    this->header.numSections = FlatInputFile::numSections;
+}
+
+void FlatInputWriter::setSection(FlatInputFile::Section section,
+                                 gsl::span<std::int32_t const> values)
+{
+    setSection(section, values.data(), values.size(), sizeof(std::int32_t));
+}
+
+void FlatInputWriter::setSection(FlatInputFile::Section section,
+                                 gsl::span<double const> values)
+{
+    setSection(section, values.data(), values.size(), sizeof(double));
+}
+
+void FlatInputWriter::setSection(FlatInputFile::Section section,
+                                 gsl::span<std::uint64_t const> values)
+{
+    setSection(section, values.data(), values.size(), sizeof(std::uint64_t));
+}
+
+std::size_t FlatInputWriter::size() const
+{
+    auto table = getSectionTable();
+    auto const& last = table[FlatInputFile::numSections - 1];
+    return align(last.offset
+                 + last.count * elementSize[FlatInputFile::numSections - 1]);
+}
+
+void FlatInputWriter::write(void *buffer) const
+{
+    auto table = getSectionTable();
+    auto bytes = static_cast<char *>(buffer);
+    std::memset(bytes, 0, size());
+    std::memcpy(bytes, &header, sizeof(header));
+    std::memcpy(bytes + sizeof(header), table.data(),
+                table.size() * sizeof(table[0]));
+    for(int section = 0; section < FlatInputFile::numSections; ++section) {
+        if(counts[section])
+            std::memcpy(bytes + table[section].offset, sections[section],
+                        counts[section] * elementSize[section]);
+    }
+}
+
+void FlatInputWriter::setSection(FlatInputFile::Section section,
+                                 void const* values, std::size_t count,
+                                 std::size_t valueSize)
+{
+    if(valueSize != elementSize[section])
+        throw ParPEException("Wrong element type for flat input section "
+                             + std::to_string(section));
+    sections[section] = values;
+    counts[section] = count;
+}
+
+std::array<FlatInputFile::SectionEntry, FlatInputFile::numSections>
+FlatInputWriter::getSectionTable() const
+{
+    std::array<FlatInputFile::SectionEntry, FlatInputFile::numSections> table;
+    std::uint64_t offset = align(sectionTableEnd);
+    for(int section = 0; section < FlatInputFile::numSections; ++section) {
+        table[section] = {offset, counts[section]};
+        offset = align(offset + counts[section] * elementSize[section]);
+    }
+    return table;
+}
+
+} // namespace parpe
@@ -6,6 +6,8 @@
 #include <parpecommon/parpeException.h>
 #include <amici/misc.h>
 
+#include <algorithm>
+#include <cstdlib>
 #include <exception>
 #include <cmath>
 
@@ -16,6 +18,231 @@
 
 namespace parpe {
 
+ConditionMatrices::ConditionMatrices(
+        const std::vector<std::vector<double> > &matrices)
+{
+    offsets.reserve(matrices.size() + 1);
+    std::size_t totalSize = 0;
+    for(auto const& matrix: matrices) {
+        totalSize += matrix.size();
+        offsets.push_back(totalSize);
+    }
+
+    values.reserve(totalSize);
+    for(auto const& matrix: matrices)
+        values.insert(values.end(), matrix.begin(), matrix.end());
+}
+
+std::size_t ConditionMatrices::size() const
+{
+    return offsets.size() - 1;
+}
+
+gsl::span<const double> ConditionMatrices::operator[](int conditionIdx) const
+{
+    return gsl::make_span(values.data() + offsets[conditionIdx],
+                          offsets[conditionIdx + 1] - offsets[conditionIdx]);
+}
+
+gsl::span<double> ConditionMatrices::operator[](int conditionIdx)
+{
+    return gsl::make_span(values.data() + offsets[conditionIdx],
+                          offsets[conditionIdx + 1] - offsets[conditionIdx]);
+}
+
+const std::vector<double> &ConditionMatrices::getValues() const
+{
+    return values;
+}
+
+gsl::span<double> ConditionMatrices::getValues()
+{
+    return values;
+}
+
+const std::vector<std::size_t> &ConditionMatrices::getOffsets() const
+{
+    return offsets;
+}
+
+
+AnalyticalParameterOutputMap::AnalyticalParameterOutputMap(
+        const AnalyticalParameterProvider &provider, int numParameters,
+        const ConditionMatrices &layout, int numObservables)
+{
+    auto const& conditionOffsets = layout.getOffsets();
+
+    offsets.reserve(numParameters + 1);
+    for(int parameterIdx = 0; parameterIdx < numParameters; ++parameterIdx) {
+        for(auto const conditionIdx:
+            provider.getConditionsForParameter(parameterIdx)) {
+            auto conditionOffset = conditionOffsets[conditionIdx];
+            int numTimepoints = layout[conditionIdx].size() / numObservables;
+
+            for(auto const observableIdx:
+                provider.getObservablesForParameter(parameterIdx,
+                                                    conditionIdx)) {
+                if(observableIdx >= numObservables) {
+                    throw ParPEException("Invalid observableIdx >= "
+                                         "numObservables for analytical "
+                                         "parameter "
+                                         + std::to_string(parameterIdx));
+                }
+                // NOTE: this must be in sync with data ordering in AMICI
+                // (assumes row-major)
+                for(int timeIdx = 0; timeIdx < numTimepoints; ++timeIdx)
+                    indices.push_back(conditionOffset + observableIdx
+                                      + timeIdx * numObservables);
+            }
+        }
+        // ascending memory access
+        std::sort(indices.begin() + offsets.back(), indices.end());
+        offsets.push_back(indices.size());
+    }
+}
+
+int AnalyticalParameterOutputMap::numParameters() const
+{
+    return offsets.size() - 1;
+}
+
+gsl::span<const std::size_t> AnalyticalParameterOutputMap::operator[](
+        int parameterIdx) const
+{
+    return gsl::make_span(indices.data() + offsets[parameterIdx],
+                          offsets[parameterIdx + 1] - offsets[parameterIdx]);
+}
+
+
+NegLogLikelihoodKernel::NegLogLikelihoodKernel(
+        std::shared_ptr<const ConditionMatrices> measurements,
+        const ConditionMatrices &sigmas,
+        ErrorModel errorModel)
+    : measurements(std::move(measurements)),
+      errorModel(errorModel)
+{
+    RELEASE_ASSERT(this->measurements, "");
+    RELEASE_ASSERT(this->measurements->getOffsets() == sigmas.getOffsets(),
+                   "measurement/sigma dimension mismatch");
+
+    auto const& mes = this->measurements->getValues();
+    auto const& sigma = sigmas.getValues();
+    auto const& offsets = this->measurements->getOffsets();
+    numValues = mes.size();
+
+    conditionOffsets.reserve(offsets.size());
+    for(int conditionIdx = 0;
+        (unsigned) conditionIdx < this->measurements->size();
+        ++conditionIdx) {
+        for(auto i = offsets[conditionIdx]; i < offsets[conditionIdx + 1];
+            ++i) {
+            if(std::isnan(mes[i]))
+                continue;
+            indices.push_back(i);
+            // NaN if any sigma is not known yet
+            if(errorModel == ErrorModel::laplace) {
+                weights.push_back(1.0 / sigma[i]);
+                logTerm += std::log(2.0 * sigma[i]);
+            } else {
+                double sigmaSquared = sigma[i] * sigma[i];
+                weights.push_back(0.5 / sigmaSquared);
+                logTerm += 0.5 * std::log(2.0 * M_PI * sigmaSquared);
+            }
+        }
+        conditionOffsets.push_back(indices.size());
+    }
+}
+
+template<typename Term>
+double NegLogLikelihoodKernel::sumOverConditions(Term term) const
+{
+    int numConditions = conditionOffsets.size() - 1;
+    // per-condition partial sums, for a result independent of threading
+    std::vector<double> partialSums(numConditions);
+
+#if defined(_OPENMP)
+    #pragma omp parallel for schedule(static) if(indices.size() > 100000)
+#endif
+    for(int conditionIdx = 0; conditionIdx < numConditions; ++conditionIdx) {
+        double sum = 0.0;
+        auto const end = conditionOffsets[conditionIdx + 1];
+#if defined(_OPENMP)
+        #pragma omp simd reduction(+:sum)
+#endif
+        for(auto k = conditionOffsets[conditionIdx]; k < end; ++k)
+            sum += term(k);
+        partialSums[conditionIdx] = sum;
+    }
+
+    return std::accumulate(partialSums.begin(), partialSums.end(), 0.0);
+}
+
+double NegLogLikelihoodKernel::evaluate(
+        const ConditionMatrices &modelOutputsScaled) const
+{
+    RELEASE_ASSERT(modelOutputsScaled.getValues().size() == numValues,
+                   "measurement/simulation output dimension mismatch");
+    auto const sim = modelOutputsScaled.getValues().data();
+    auto const mes = measurements->getValues().data();
+
+    double sumOfResiduals = errorModel == ErrorModel::laplace
+            ? sumOverConditions([&](std::size_t k) {
+        auto i = indices[k];
+        return std::abs(sim[i] - mes[i]) * weights[k];
+    })
+            : sumOverConditions([&](std::size_t k) {
+        auto i = indices[k];
+        double residual = sim[i] - mes[i];
+        return residual * residual * weights[k];
+    });
+
+    double nllh = logTerm + sumOfResiduals;
+    if(std::isnan(nllh))
+        logmessage(LOGLVL_WARNING, "Simulation or sigma is NaN for some "
+                                   "data point");
+    return nllh;
+}
+
+double NegLogLikelihoodKernel::evaluate(
+        const ConditionMatrices &modelOutputsScaled,
+        const ConditionMatrices &sigmas) const
+{
+    RELEASE_ASSERT(modelOutputsScaled.getValues().size() == numValues
+                   && sigmas.getValues().size() == numValues,
+                   "measurement/simulation output dimension mismatch");
+    auto const sim = modelOutputsScaled.getValues().data();
+    auto const sigma = sigmas.getValues().data();
+    auto const mes = measurements->getValues().data();
+
+    double nllh = errorModel == ErrorModel::laplace
+            ? sumOverConditions([&](std::size_t k) {
+        auto i = indices[k];
+        return std::log(2.0 * sigma[i])
+                + std::abs(sim[i] - mes[i]) / sigma[i];
+    })
+            : sumOverConditions([&](std::size_t k) {
+        auto i = indices[k];
+        double residual = sim[i] - mes[i];
+        double sigmaSquared = sigma[i] * sigma[i];
+        return std::log(2.0 * M_PI * sigmaSquared)
+                + residual * residual / sigmaSquared;
+    }) / 2.0;
+
+    if(std::isnan(nllh))
+        logmessage(LOGLVL_WARNING, "Simulation or sigma is NaN for some "
+                                   "data point");
+    return nllh;
+}
+
+
+HierarchicalOptimizationDataCache::DataPtr
+HierarchicalOptimizationDataCache::get(std::function<DataPtr()> const& create)
+{
+    std::call_once(created, [this, &create]() { data = create(); });
+    return data;
+}
+
+
 HierarchicalOptimizationWrapper::HierarchicalOptimizationWrapper(
         std::unique_ptr<AmiciSummedGradientFunction> fun,
         int numConditions,
@@ -38,12 +265,16 @@ HierarchicalOptimizationWrapper::HierarchicalOptimizationWrapper(
         H5::H5File const& file,
         std::string const& hdf5RootPath,
         int numConditions, int numObservables,
-        ErrorModel errorModel)
+        ErrorModel errorModel,
+        std::shared_ptr<HierarchicalOptimizationDataCache> dataCache)
     : fun(std::move(fun)),
       numConditions(numConditions),
       numObservables(numObservables),
       errorModel(errorModel)
 {
+    if(dataCache)
+        this->dataCache = std::move(dataCache);
+
     scalingReader = std::make_unique<AnalyticalParameterHdf5Reader>(
                 file,
                 hdf5RootPath + "/scalingParameterIndices",
@@ -83,8 +314,9 @@ HierarchicalOptimizationWrapper::HierarchicalOptimizationWrapper(
 
 
 void HierarchicalOptimizationWrapper::init() {
-    if(errorModel != ErrorModel::normal) {
-        throw ParPEException("Only gaussian noise is supported so far.");
+
+    if(auto env = std::getenv("PARPE_HIERARCHICAL_SINGLE_PASS")) {
+        singlePassGradient = env[0] == '1';
     }
 
     /* Some functions currently expect these lists to be sorted, therefore
@@ -114,13 +346,51 @@ void HierarchicalOptimizationWrapper::init() {
            <<numParameters()<< " numerical, "
            <<proportionalityFactorIndices.size()<<" proportionality, "
            <<offsetParameterIndices.size()<<" offset, "
-           <<sigmaParameterIndices.size()<<" sigma\n";
+           <<sigmaParameterIndices.size()<<" sigma, "
+           <<(errorModel == ErrorModel::laplace ? "laplace" : "normal")
+           <<" noise\n";
         Logger logger;
         logger.logmessage(LOGLVL_DEBUG, ss.str());
     }
 }
 
 
+const HierarchicalOptimizationData &
+HierarchicalOptimizationWrapper::getData() const
+{
+    return *dataCache->get([this]() { return createData(); });
+}
+
+
+HierarchicalOptimizationDataCache::DataPtr
+HierarchicalOptimizationWrapper::createData() const
+{
+    RELEASE_ASSERT(fun, "");
+
+    // immutable, read once instead of from `fun` on every evaluation
+    auto data = std::make_shared<HierarchicalOptimizationData>();
+    data->measurements = std::make_shared<ConditionMatrices const>(
+                fun->getAllMeasurements());
+    data->sigmas = std::make_shared<ConditionMatrices const>(
+                fun->getAllSigmas());
+
+    data->scalingOutputs = AnalyticalParameterOutputMap(
+                *scalingReader, numProportionalityFactors(),
+                *data->measurements, numObservables);
+    data->offsetOutputs = AnalyticalParameterOutputMap(
+                *offsetReader, numOffsetParameters(),
+                *data->measurements, numObservables);
+    data->sigmaOutputs = AnalyticalParameterOutputMap(
+                *sigmaReader, numSigmaParameters(),
+                *data->measurements, numObservables);
+
+    data->negLogLikelihoodKernel = NegLogLikelihoodKernel(
+                data->measurements, *data->sigmas, errorModel);
+
+    return data;
+}
+
+
 FunctionEvaluationStatus HierarchicalOptimizationWrapper::evaluate(
         gsl::span<const double> parameters,
         double &fval,
@@ -168,15 +438,22 @@ HierarchicalOptimizationWrapper::evaluate(
     }
 
 
+    // compute gradient from output sensitivities of this sweep, instead of
+    // simulating again with the optimal parameters?
+    bool singlePass = singlePassGradient && !gradient.empty();
+
     // evaluate with scaling parameters set to 1 and offsets to 0
-    std::vector<std::vector<double> > modelOutput;
+    ConditionMatrices modelOutput;
+    std::vector<std::vector<double> > modelOutputSensitivities;
     try {
-        modelOutput = getUnscaledModelOutputs(reducedParameters, logger, cpuTime);
+        modelOutput = getUnscaledModelOutputs(
+                    reducedParameters, logger, cpuTime,
+                    singlePass ? &modelOutputSensitivities : nullptr);
     } catch (ParPEException const &e) {
         return FunctionEvaluationStatus::functionEvaluationFailure;
     }
 
-    auto measurements = fun->getAllMeasurements();
+    auto const& measurements = getMeasurements();
 
     // compute correct scaling factors analytically
     auto scalings = computeAnalyticalScalings(measurements, modelOutput);
@@ -210,10 +487,19 @@ HierarchicalOptimizationWrapper::evaluate(
 
     // evaluate with analytical scaling parameters
     double cpuTimeInner = 0.0;
-    status = evaluateWithOptimalParameters(fullParameters, sigmas,
-                                           measurements, modelOutput,
-                                           fval, gradient,
-                                           fullGradient, logger, &cpuTimeInner);
+    if(singlePass) {
+        status = evaluateWithOutputSensitivities(
+                    fullParameters, scalings, sigmas, measurements,
+                    modelOutput, modelOutputSensitivities,
+                    fval, gradient, fullGradient);
+    } else {
+        status = evaluateWithOptimalParameters(
+                    fullParameters, sigmas, measurements, modelOutput,
+                    fval, gradient, fullGradient, logger, &cpuTimeInner);
+    }
+
+    if(status == functionEvaluationSuccess)
+        fun->reportCost(fval);
 
     if(cpuTime)
         *cpuTime += cpuTimeInner + walltimer.getTotal();
@@ -268,7 +554,8 @@ HierarchicalOptimizationWrapper::getDefaultSigmaParameters() const
 std::vector<std::vector<double> >
 HierarchicalOptimizationWrapper::getUnscaledModelOutputs(
         const gsl::span<const double> reducedParameters, Logger *logger,
-        double *cpuTime) const
+        double *cpuTime,
+        std::vector<std::vector<double> > *modelOutputSensitivities) const
 {
     // run simulations, collect outputs
     auto scalingDummy = getDefaultScalingFactors();
@@ -282,8 +569,12 @@ HierarchicalOptimizationWrapper::getUnscaledModelOutputs(
                 scalingDummy, offsetDummy, sigmaDummy);
 
     std::vector<std::vector<double> > modelOutput(numConditions);
-    auto status = fun->getModelOutputs(fullParameters, modelOutput,
-                                       logger, cpuTime);
+    auto status = modelOutputSensitivities
+            ? fun->getModelOutputsAndSensitivities(
+                  fullParameters, modelOutput, *modelOutputSensitivities,
+                  logger, cpuTime)
+            : fun->getModelOutputs(fullParameters, modelOutput,
+                                   logger, cpuTime);
     if(status != FunctionEvaluationStatus::functionEvaluationSuccess)
         throw ParPEException("Function evaluation failed.");
 
@@ -291,22 +582,82 @@ HierarchicalOptimizationWrapper::getUnscaledModelOutputs(
 }
 
 std::vector<double> HierarchicalOptimizationWrapper::computeAnalyticalScalings(
-        std::vector<std::vector<double>> const& measurements,
-        std::vector<std::vector<double>> const& modelOutputsUnscaled) const
+        ConditionMatrices const& measurements,
+        ConditionMatrices const& modelOutputsUnscaled) const
 {
     int numProportionalityFactors = proportionalityFactorIndices.size();
     std::vector<double> proportionalityFactors(numProportionalityFactors);
 
+    auto const& mes = measurements.getValues();
+    auto const& sim = modelOutputsUnscaled.getValues();
+    RELEASE_ASSERT(mes.size() == sim.size(),
+                   "measurement/simulation output dimension mismatch");
+
+    auto const& outputs = getData().scalingOutputs;
+#if defined(_OPENMP)
+    #pragma omp parallel for schedule(dynamic) if(numProportionalityFactors > 1)
+#endif
     for(int scalingIdx = 0; scalingIdx < numProportionalityFactors;
         ++scalingIdx) {
+        double enumerator = 0.0;
+        double denominator = 0.0;
+        int numNaN = 0;
+        int numNegative = 0;
+        // Laplace noise: sum |m - s y| = sum |y| |m / y - s|
+        std::vector<double> ratios;
+        std::vector<double> ratioWeights;
+
+        for(auto const i: outputs[scalingIdx]) {
+            bool measured = !std::isnan(mes[i]);
+            double curSim = sim[i];
+            numNaN += measured && std::isnan(curSim);
+            // negative values due to numerical errors
+            // TODO: some outputs may be validly < 0
+            bool negative = curSim < 0 && curSim > -1e-18;
+            numNegative += measured && negative;
+            curSim = negative ? 0.0 : curSim;
+            enumerator += measured ? curSim * mes[i] : 0.0;
+            denominator += measured ? curSim * curSim : 0.0;
+            if(errorModel == ErrorModel::laplace && measured && curSim != 0.0
+                    && !std::isnan(curSim)) {
+                ratios.push_back(mes[i] / curSim);
+                ratioWeights.push_back(std::abs(curSim));
+            }
+        }
+
+        if(numNaN)
+            logmessage(LOGLVL_WARNING,
+                       "In computeAnalyticalScalings %d: "
+                       "Simulation is NaN for %d data points",
+                       scalingIdx, numNaN);
+        if(numNegative)
+            logmessage(LOGLVL_WARNING,
+                       "In computeAnalyticalScalings %d: "
+                       "Simulation is < 0 for %d data points. "
+                       "Setting to 0.0.", scalingIdx, numNegative);
+
+        double proportionalityFactor = enumerator / denominator;
+        if(errorModel == ErrorModel::laplace && !numNaN && !ratios.empty())
+            proportionalityFactor = weightedMedian(std::move(ratios),
+                                                   ratioWeights);
+        if(denominator == 0.0) {
+            logmessage(LOGLVL_WARNING,
+                       "In computeAnalyticalScalings: denominator is 0.0 for "
+                       "scaling parameter " + std::to_string(scalingIdx)
+                       + ". Probably model output is always 0.0 and scaling, "
+                         "thus, not used. Setting scaling parameter to 1.0.");
+            proportionalityFactor = 1.0;
+        }
+
+        proportionalityFactors[scalingIdx] = proportionalityFactor;
+    }
 
-        auto proportionalityFactor = parpe::computeAnalyticalScalings(
-                    scalingIdx, modelOutputsUnscaled, measurements,
-                    *scalingReader, numObservables);
+    for(int scalingIdx = 0; scalingIdx < numProportionalityFactors;
+        ++scalingIdx) {
         auto scale = fun->getParameterScaling(
                     proportionalityFactorIndices[scalingIdx]);
-        proportionalityFactors[scalingIdx] =
-                getScaledParameter(proportionalityFactor, scale);
+        proportionalityFactors[scalingIdx] = getScaledParameter(
+                    proportionalityFactors[scalingIdx], scale);
     }
 
     return proportionalityFactors;
@@ -314,70 +665,187 @@ std::vector<double> HierarchicalOptimizationWrapper::computeAnalyticalScalings(
 
 void HierarchicalOptimizationWrapper::applyOptimalScalings(
         std::vector<double> const& proportionalityFactors,
-        std::vector<std::vector<double> > &modelOutputs) const {
+        ConditionMatrices &modelOutputs) const {
 
-    for(int i = 0; (unsigned) i < proportionalityFactors.size(); ++i) {
+    auto sim = modelOutputs.getValues();
+    auto const& outputs = getData().scalingOutputs;
+    // sequentially, outputs may depend on multiple parameters
+    for(int scalingIdx = 0;
+        (unsigned) scalingIdx < proportionalityFactors.size(); ++scalingIdx) {
         double scaling = getUnscaledParameter(
-                    proportionalityFactors[i],
-                    fun->getParameterScaling(proportionalityFactorIndices[i]));
+                    proportionalityFactors[scalingIdx],
+                    fun->getParameterScaling(
+                        proportionalityFactorIndices[scalingIdx]));
 
-        applyOptimalScaling(i, scaling, modelOutputs,
-                            *scalingReader, numObservables);
+        for(auto const i: outputs[scalingIdx])
+            sim[i] *= scaling;
     }
 }
 
 
 std::vector<double> HierarchicalOptimizationWrapper::computeAnalyticalOffsets(
-        std::vector<std::vector<double>> const& measurements,
-        std::vector<std::vector<double> > &modelOutputsUnscaled) const
+        ConditionMatrices const& measurements,
+        ConditionMatrices const& modelOutputsUnscaled) const
 {
     int numOffsetParameters = offsetParameterIndices.size();
     std::vector<double> offsetParameters(numOffsetParameters);
 
-    for(int i = 0; i < numOffsetParameters; ++i) {
-        auto offsetParameter = parpe::computeAnalyticalOffsets(
-                    i, modelOutputsUnscaled, measurements,
-                    *offsetReader, numObservables);
-        auto scale = fun->getParameterScaling(offsetParameterIndices[i]);
-        offsetParameters[i] = getScaledParameter(offsetParameter, scale);
+    auto const& mes = measurements.getValues();
+    auto const& sim = modelOutputsUnscaled.getValues();
+    RELEASE_ASSERT(mes.size() == sim.size(),
+                   "measurement/simulation output dimension mismatch");
+
+    auto const& outputs = getData().offsetOutputs;
+#if defined(_OPENMP)
+    #pragma omp parallel for schedule(dynamic) if(numOffsetParameters > 1)
+#endif
+    for(int offsetIdx = 0; offsetIdx < numOffsetParameters; ++offsetIdx) {
+        double enumerator = 0.0;
+        double denominator = 0.0;
+        int numNaN = 0;
+        // Laplace noise: median of residuals
+        std::vector<double> residuals;
+
+        for(auto const i: outputs[offsetIdx]) {
+            bool measured = !std::isnan(mes[i]);
+            numNaN += measured && std::isnan(sim[i]);
+            enumerator += measured ? mes[i] - sim[i] : 0.0;
+            denominator += measured ? 1.0 : 0.0;
+            if(errorModel == ErrorModel::laplace && measured
+                    && !std::isnan(sim[i]))
+                residuals.push_back(mes[i] - sim[i]);
+        }
+
+        if(numNaN)
+            logmessage(LOGLVL_WARNING,
+                       "In computeAnalyticalOffsets %d: "
+                       "Simulation is NaN for %d data points",
+                       offsetIdx, numNaN);
+
+        double offsetParameter = enumerator / denominator;
+        if(errorModel == ErrorModel::laplace && !numNaN && !residuals.empty()) {
+            std::vector<double> unitWeights(residuals.size(), 1.0);
+            offsetParameter = weightedMedian(std::move(residuals),
+                                             unitWeights);
+        }
+        if(denominator == 0.0) {
+            logmessage(LOGLVL_WARNING,
+                       "In computeAnalyticalOffsets: denominator is 0.0 "
+                       "for offset parameter " + std::to_string(offsetIdx)
+                       + ". This probably means that there exists no "
+                         "measurement using this parameter. Setting offset "
+                         "to 0.0.");
+            offsetParameter = 0.0;
+        }
+
+        offsetParameters[offsetIdx] = offsetParameter;
+    }
+
+    for(int offsetIdx = 0; offsetIdx < numOffsetParameters; ++offsetIdx) {
+        auto scale = fun->getParameterScaling(offsetParameterIndices[offsetIdx]);
+        offsetParameters[offsetIdx] = getScaledParameter(
+                    offsetParameters[offsetIdx], scale);
     }
 
     return offsetParameters;
 }
 
 std::vector<double> HierarchicalOptimizationWrapper::computeAnalyticalSigmas(
-        const std::vector<std::vector<double> > &measurements,
-        std::vector<std::vector<double> > const &modelOutputsScaled) const
+        ConditionMatrices const& measurements,
+        ConditionMatrices const& modelOutputsScaled) const
 {
+    // same defaults as parpe::computeAnalyticalSigmas
+    constexpr double epsilonAbsDefault = 1e-12;
+    constexpr double epsilonRel = 0.01;
+
     int numSigmas = sigmaParameterIndices.size();
     std::vector<double> sigmas(numSigmas);
 
-    for(int i = 0; i < numSigmas; ++i) {
-        auto sigma = parpe::computeAnalyticalSigmas(
-                    i,
-                    modelOutputsScaled, measurements,
-                    *sigmaReader, numObservables);
-        auto scale = fun->getParameterScaling(sigmaParameterIndices[i]);
-        sigmas[i] = getScaledParameter(sigma, scale);
+    auto const& mes = measurements.getValues();
+    auto const& sim = modelOutputsScaled.getValues();
+    RELEASE_ASSERT(mes.size() == sim.size(),
+                   "measurement/simulation output dimension mismatch");
+
+    auto const& outputs = getData().sigmaOutputs;
+#if defined(_OPENMP)
+    #pragma omp parallel for schedule(dynamic) if(numSigmas > 1)
+#endif
+    for(int sigmaIdx = 0; sigmaIdx < numSigmas; ++sigmaIdx) {
+        double enumerator = 0.0;
+        double denominator = 0.0;
+        double maxAbsMeasurement = 0.0;
+        int numNaN = 0;
+
+        for(auto const i: outputs[sigmaIdx]) {
+            bool measured = !std::isnan(mes[i]);
+            numNaN += measured && std::isnan(sim[i]);
+            double diff = mes[i] - sim[i];
+            // Laplace noise: mean absolute residual
+            double residualTerm = errorModel == ErrorModel::laplace
+                    ? std::abs(diff) : diff * diff;
+            enumerator += measured ? residualTerm : 0.0;
+            denominator += measured ? 1.0 : 0.0;
+            maxAbsMeasurement = measured
+                    ? std::max(maxAbsMeasurement, std::abs(mes[i]))
+                    : maxAbsMeasurement;
+        }
+
+        if(numNaN)
+            logmessage(LOGLVL_WARNING,
+                       "In computeAnalyticalSigmas %d: "
+                       "Simulation is NaN for %d data points",
+                       sigmaIdx, numNaN);
+        if(denominator == 0.0) {
+            logmessage(LOGLVL_WARNING,
+                       "In computeAnalyticalSigmas: Denominator is 0.0 for "
+                       "sigma parameter " + std::to_string(sigmaIdx)
+                       + ". This probably means that there exists no "
+                         "measurement using this parameter.");
+        }
+
+        double sigma = errorModel == ErrorModel::laplace
+                ? enumerator / denominator
+                : std::sqrt(enumerator / denominator);
+        double epsilonAbs = std::max(epsilonRel * maxAbsMeasurement,
+                                     epsilonAbsDefault);
+        if(sigma < epsilonAbs) {
+            // Must not return sigma = 0.0
+            logmessage(LOGLVL_WARNING, "In computeAnalyticalSigmas "
+                       + std::to_string(sigmaIdx)
+                       + ": Computed sigma < epsilon. Setting to "
+                       + std::to_string(epsilonAbs));
+            sigma = epsilonAbs;
+        }
+
+        sigmas[sigmaIdx] = sigma;
+    }
+
+    for(int sigmaIdx = 0; sigmaIdx < numSigmas; ++sigmaIdx) {
+        auto scale = fun->getParameterScaling(sigmaParameterIndices[sigmaIdx]);
+        sigmas[sigmaIdx] = getScaledParameter(sigmas[sigmaIdx], scale);
     }
     return sigmas;
 }
 
 void HierarchicalOptimizationWrapper::applyOptimalOffsets(
         std::vector<double> const& offsetParameters,
-        std::vector<std::vector<double> > &modelOutputs) const {
+        ConditionMatrices &modelOutputs) const {
 
-    for(int i = 0; (unsigned) i < offsetParameters.size(); ++i) {
+    auto sim = modelOutputs.getValues();
+    auto const& outputs = getData().offsetOutputs;
+    // sequentially, outputs may depend on multiple parameters
+    for(int offsetIdx = 0; (unsigned) offsetIdx < offsetParameters.size();
+        ++offsetIdx) {
         double offset = getUnscaledParameter(
-                    offsetParameters[i],
-                    fun->getParameterScaling(offsetParameterIndices[i]));
-        applyOptimalOffset(i, offset, modelOutputs,
-                           *offsetReader, numObservables);
+                    offsetParameters[offsetIdx],
+                    fun->getParameterScaling(offsetParameterIndices[offsetIdx]));
+        for(auto const i: outputs[offsetIdx])
+            sim[i] += offset;
     }
 }
 
 void HierarchicalOptimizationWrapper::fillInAnalyticalSigmas(
-        std::vector<std::vector<double> > &allSigmas,
+        ConditionMatrices &allSigmas,
         std::vector<double> const& analyticalSigmas) const
 {
     for(int sigmaParameterIdx = 0;
@@ -401,6 +869,7 @@ void HierarchicalOptimizationWrapper::fillInAnalyticalSigmas(
             auto dependentObservables =
                     sigmaReader->getObservablesForParameter(
                         sigmaParameterIdx, conditionIdx);
+            auto conditionSigmas = allSigmas[conditionIdx];
 
             for(auto const observableIdx: dependentObservables) {
 
@@ -411,23 +880,33 @@ void HierarchicalOptimizationWrapper::fillInAnalyticalSigmas(
                     // (assumes row-major)
                     RELEASE_ASSERT(
                                 std::isnan(
-                                    allSigmas[conditionIdx][observableIdx + timeIdx * numObservables]),
+                                    conditionSigmas[observableIdx + timeIdx * numObservables]),
                             "Expected NaN value for sigma parameters being "
                             "estimated, but got non-NAN.");
-                    allSigmas[conditionIdx][observableIdx + timeIdx * numObservables] = sigmaParameterValue;
+                    conditionSigmas[observableIdx + timeIdx * numObservables] = sigmaParameterValue;
                 }
             }
         }
     }
 }
 
+const ConditionMatrices &HierarchicalOptimizationWrapper::getMeasurements() const
+{
+    return *getData().measurements;
+}
+
+const ConditionMatrices &HierarchicalOptimizationWrapper::getSigmas() const
+{
+    return *getData().sigmas;
+}
+
 
 FunctionEvaluationStatus
 HierarchicalOptimizationWrapper::evaluateWithOptimalParameters(
         std::vector<double> const& fullParameters,
         std::vector<double> const& sigmas,
-        std::vector<std::vector<double>> const& measurements,
-        std::vector<std::vector<double>> const& modelOutputsScaled,
+        ConditionMatrices const& measurements,
+        ConditionMatrices const& modelOutputsScaled,
         double &fval,
         const gsl::span<double> gradient,
         std::vector<double>& fullGradient,
@@ -453,18 +932,20 @@ HierarchicalOptimizationWrapper::evaluateWithOptimalParameters(
         fillFilteredParams(fullGradient, analyticalParameterIndices, gradient);
 
         // Check if gradient w.r.t. analytical parameters is 0
-        checkGradientForAnalyticalParameters(
-                    fullGradient, analyticalParameterIndices, 1e-8);
+        // (Laplace: not differentiable at the optimum)
+        if(errorModel == ErrorModel::normal)
+            checkGradientForAnalyticalParameters(
+                        fullGradient, analyticalParameterIndices, 1e-8);
 
+    } else if(sigmaParameterIndices.empty()) {
+        fval = getData().negLogLikelihoodKernel.evaluate(modelOutputsScaled);
     } else {
-        auto fullSigmaMatrices = fun->getAllSigmas();
-        if(!sigmaParameterIndices.empty()) {
-            fillInAnalyticalSigmas(fullSigmaMatrices, sigmas);
-        }
+        auto fullSigmaMatrices = getSigmas();
+        fillInAnalyticalSigmas(fullSigmaMatrices, sigmas);
 
         // ... to compute negative log-likelihood
-        fval = computeNegLogLikelihood(measurements, modelOutputsScaled,
-                                       fullSigmaMatrices);
+        fval = getData().negLogLikelihoodKernel.evaluate(modelOutputsScaled,
+                                               fullSigmaMatrices);
     }
 
     return std::isfinite(fval) ?
@@ -472,6 +953,70 @@ HierarchicalOptimizationWrapper::evaluateWithOptimalParameters(
 }
 
 
+FunctionEvaluationStatus
+HierarchicalOptimizationWrapper::evaluateWithOutputSensitivities(
+        std::vector<double> const& fullParameters,
+        std::vector<double> const& scalings,
+        std::vector<double> const& sigmas,
+        ConditionMatrices const& measurements,
+        ConditionMatrices const& modelOutputsScaled,
+        std::vector<std::vector<double>> const& modelOutputSensitivities,
+        double &fval,
+        gsl::span<double> gradient,
+        std::vector<double>& fullGradient) const
+{
+    auto fullSigmaMatrices = getSigmas();
+    if(!sigmaParameterIndices.empty()) {
+        fillInAnalyticalSigmas(fullSigmaMatrices, sigmas);
+    }
+
+    fval = sigmaParameterIndices.empty()
+            ? getData().negLogLikelihoodKernel.evaluate(modelOutputsScaled)
+            : getData().negLogLikelihoodKernel.evaluate(modelOutputsScaled,
+                                              fullSigmaMatrices);
+    if(!std::isfinite(fval))
+        return functionEvaluationFailure;
+
+    // Scaled outputs are s * y + b, so their sensitivities are s * sy.
+    // Obtain s for every output by scaling a matrix of ones.
+    auto outputScalings = modelOutputsScaled;
+    std::fill(outputScalings.getValues().begin(),
+              outputScalings.getValues().end(), 1.0);
+    applyOptimalScalings(scalings, outputScalings);
+
+    fullGradient.assign(fullParameters.size(), 0.0);
+    for(int conditionIdx = 0; conditionIdx < numConditions; ++conditionIdx) {
+        auto simulationGradient = computeNegLogLikelihoodGradient(
+                    measurements[conditionIdx],
+                    modelOutputsScaled[conditionIdx],
+                    fullSigmaMatrices[conditionIdx],
+                    outputScalings[conditionIdx],
+                    modelOutputSensitivities[conditionIdx],
+                    numObservables, errorModel);
+        if(!simulationGradient.empty())
+            fun->addSimulationGradient(conditionIdx, simulationGradient,
+                                       fullParameters, fullGradient);
+    }
+
+    // Analytical parameters are optimal, and the sensitivities were computed
+    // for their default values anyway
+    auto analyticalParameterIndices = getAnalyticalParameterIndices();
+    for(auto const idx: analyticalParameterIndices)
+        fullGradient[idx] = 0.0;
+
+    // Filter gradient for those parameters expected by the optimizer
+    fillFilteredParams(fullGradient, analyticalParameterIndices, gradient);
+
+    return functionEvaluationSuccess;
+}
+
+void HierarchicalOptimizationWrapper::setSinglePassGradient(
+        bool singlePassGradient)
+{
+    this->singlePassGradient = singlePassGradient;
+}
+
+
 int HierarchicalOptimizationWrapper::numParameters() const {
     return fun->numParameters() - numProportionalityFactors()
             - numOffsetParameters() - numSigmaParameters();
@@ -495,7 +1040,7 @@ AnalyticalParameterHdf5Reader::AnalyticalParameterHdf5Reader(
     : mapPath(std::move(mapPath)),
       analyticalParameterIndicesPath(std::move(analyticalParameterIndicesPath))
 {
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
     this->file = file; // copy while mutex is locked!
     readParameterConditionObservableMappingFromFile();
 }
@@ -559,7 +1104,7 @@ AnalyticalParameterHdf5Reader::getObservablesForParameter(
 
 std::vector<int>
 AnalyticalParameterHdf5Reader::getOptimizationParameterIndices() const {
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
     std::vector<int> analyticalParameterIndices;
     H5_SAVE_ERROR_HANDLER; // don't show error if dataset is missing
     try {
@@ -587,7 +1132,7 @@ AnalyticalParameterHdf5Reader::getOptimizationParameterIndices() const {
 int AnalyticalParameterHdf5Reader::getNumAnalyticalParameters() const
 {
     hsize_t numAnalyticalParameters = 0;
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
 
     H5_SAVE_ERROR_HANDLER; // don't show error if dataset is missing
     try {
@@ -609,7 +1154,7 @@ int AnalyticalParameterHdf5Reader::getNumAnalyticalParameters() const
 void
 AnalyticalParameterHdf5Reader::readParameterConditionObservableMappingFromFile()
 {
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
     H5_SAVE_ERROR_HANDLER;
     try {
         int numScalings = getNumAnalyticalParameters();
@@ -666,7 +1211,8 @@ std::vector<int> AnalyticalParameterHdf5Reader::readRawMap(
 
 HierarchicalOptimizationProblemWrapper::HierarchicalOptimizationProblemWrapper(
         std::unique_ptr<OptimizationProblem> problemToWrap,
-        const MultiConditionDataProviderHDF5 *dataProvider)
+        const MultiConditionDataProviderHDF5 *dataProvider,
+        std::shared_ptr<HierarchicalOptimizationDataCache> dataCache)
     : wrappedProblem(std::move(problemToWrap))
 {
     logger = std::make_unique<Logger>(*wrappedProblem->logger);
@@ -676,7 +1222,7 @@ HierarchicalOptimizationProblemWrapper::HierarchicalOptimizationProblemWrapper(
 
     auto model = dataProvider->getModel();
 
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(dataProvider->getHdf5FileId());
     costFun.reset(
                 new HierarchicalOptimizationWrapper(
                       std::unique_ptr<AmiciSummedGradientFunction>(
@@ -685,7 +1231,8 @@ HierarchicalOptimizationProblemWrapper::HierarchicalOptimizationProblemWrapper(
                       dataProvider->getHdf5FileId(), "/",
                       dataProvider->getNumberOfSimulationConditions(),
                       model->nytrue,
-                      ErrorModel::normal));
+                      getErrorModelFromEnvironment(),
+                      std::move(dataCache)));
 }
 
 HierarchicalOptimizationProblemWrapper::HierarchicalOptimizationProblemWrapper(
@@ -811,7 +1358,7 @@ double getDefaultOffsetParameter(amici::ParameterScaling scaling)
 double computeAnalyticalScalings(
         int scalingIdx,
         const std::vector<std::vector<double> > &modelOutputsUnscaled,
-        const std::vector<std::vector<double> > &measurements,
+        ConditionMatrices const& measurements,
         AnalyticalParameterProvider const& scalingReader,
         int numObservables) {
 
@@ -891,7 +1438,7 @@ double computeAnalyticalScalings(
 double computeAnalyticalOffsets(
         int offsetIdx,
         std::vector<std::vector<double>> const& modelOutputsUnscaled,
-        std::vector<std::vector<double>> const& measurements,
+        ConditionMatrices const& measurements,
         AnalyticalParameterProvider& offsetReader,
         int numObservables)
 {
@@ -942,7 +1489,7 @@ double computeAnalyticalOffsets(
 double computeAnalyticalSigmas(
         int sigmaIdx,
         const std::vector<std::vector<double> > &modelOutputsScaled,
-        const std::vector<std::vector<double> > &measurements,
+        ConditionMatrices const& measurements,
         AnalyticalParameterProvider const& sigmaReader,
         int numObservables,
         double epsilonAbs, double epsilonRel)
@@ -1093,9 +1640,9 @@ std::vector<double> spliceParameters(const gsl::span<double const> reducedParame
 
 
 double computeNegLogLikelihood(
-        std::vector<std::vector<double>> const& measurements,
-        std::vector<std::vector<double>> const& modelOutputsScaled,
-        std::vector<std::vector<double>> const& sigmas) {
+        ConditionMatrices const& measurements,
+        ConditionMatrices const& modelOutputsScaled,
+        ConditionMatrices const& sigmas) {
     RELEASE_ASSERT(measurements.size() == modelOutputsScaled.size(), "");
 
     double nllh = 0.0;
@@ -1112,9 +1659,9 @@ double computeNegLogLikelihood(
     return nllh;
 }
 
-double computeNegLogLikelihood(std::vector<double> const& measurements,
-                               std::vector<double> const& modelOutputsScaled,
-                               std::vector<double> const& sigmas) {
+double computeNegLogLikelihood(gsl::span<double const> measurements,
+                               gsl::span<double const> modelOutputsScaled,
+                               gsl::span<double const> sigmas) {
     double nllh = 0.0;
 
     RELEASE_ASSERT(measurements.size() == modelOutputsScaled.size(),
@@ -1185,34 +1732,43 @@ FunctionEvaluationStatus HierarchicalOptimizationReporter::evaluate(
     if(beforeCostFunctionCall(parameters) != 0)
         return functionEvaluationFailure;
 
-    if(gradient.data()) {
-        if (!haveCachedGradient || !std::equal(parameters.begin(), parameters.end(),
-                                               cachedParameters.begin())) {
-            // Have to compute anew
-            cachedStatus = hierarchicalWrapper->evaluate(
-                        parameters, cachedCost, cachedGradient,
-                        cachedFullParameters, cachedFullGradient,
-                        logger ? logger : this->logger.get(), &myCpuTimeSec);
-            haveCachedCost = true;
-            haveCachedGradient = true;
-        }
+    bool needGradient = gradient.data() != nullptr;
+    if(auto cached = evaluationCache.find(parameters, needGradient)) {
         // recycle old result
-        std::copy(cachedGradient.begin(), cachedGradient.end(), gradient.begin());
-        fval = cachedCost;
+        cachedCost = cached->fval;
+        cachedStatus = cached->status;
+        cachedFullParameters = cached->fullParameters;
+        if(needGradient) {
+            cachedGradient = cached->gradient;
+            cachedFullGradient = cached->fullGradient;
+        }
     } else {
-        if (!haveCachedCost || !std::equal(parameters.begin(), parameters.end(),
-                                           cachedParameters.begin())) {
-            // Have to compute anew
-            cachedStatus = hierarchicalWrapper->evaluate(
-                        parameters, cachedCost, gsl::span<double>(),
-                        cachedFullParameters, cachedFullGradient,
-                        logger ? logger : this->logger.get(), &myCpuTimeSec);
-            haveCachedCost = true;
-            haveCachedGradient = false;
+        // Have to compute anew
+        FunctionEvaluationCache::Entry entry;
+        entry.parameters.assign(parameters.begin(), parameters.end());
+        if(needGradient)
+            entry.gradient.resize(numParameters_);
+        entry.status = hierarchicalWrapper->evaluate(
+                    parameters, entry.fval,
+                    needGradient ? gsl::span<double>(entry.gradient)
+                                 : gsl::span<double>(),
+                    entry.fullParameters, entry.fullGradient,
+                    logger ? logger : this->logger.get(), &myCpuTimeSec);
+
+        cachedCost = entry.fval;
+        cachedStatus = entry.status;
+        cachedFullParameters = entry.fullParameters;
+        if(needGradient) {
+            cachedGradient = entry.gradient;
+            cachedFullGradient = entry.fullGradient;
         }
-        fval = cachedCost;
+        evaluationCache.insert(std::move(entry));
     }
 
+    if(needGradient)
+        std::copy(cachedGradient.begin(), cachedGradient.end(), gradient.begin());
+    fval = cachedCost;
+
     // update cached parameters
     cachedParameters.resize(numParameters_);
     std::copy(parameters.begin(), parameters.end(), cachedParameters.begin());
@@ -1249,9 +1805,13 @@ void HierarchicalOptimizationReporter::finished(
         logger->logmessage(LOGLVL_INFO, "Optimizer status %d, final llh: %e, time: wall: %f cpu: %f.",
                            exitStatus, cachedCost, timeElapsed, cpuTimeTotalSec);
 
-    if(resultWriter)
+    if(resultWriter) {
+        resultWriter->saveEvaluationCacheStatistics(
+                    evaluationCache.getNumHits(),
+                    evaluationCache.getNumMisses());
         resultWriter->saveOptimizerResults(cachedCost, cachedFullParameters,
                                            timeElapsed, cpuTimeTotalSec, exitStatus);
+    }
 }
 
 const std::vector<double> &HierarchicalOptimizationReporter::getFinalParameters() const
@@ -1338,6 +1898,102 @@ bool HierarchicalOptimizationReporter::afterCostFunctionCall(
     return false;
 }
 
+std::vector<double> computeNegLogLikelihoodGradient(
+        gsl::span<double const> measurements,
+        gsl::span<double const> modelOutputsScaled,
+        gsl::span<double const> sigmas,
+        gsl::span<double const> outputScalings,
+        std::vector<double> const& modelOutputSensitivities,
+        int numObservables,
+        ErrorModel errorModel)
+{
+    RELEASE_ASSERT(measurements.size() == modelOutputsScaled.size(),
+                   "measurement/simulation output dimension mismatch");
+    if(measurements.empty())
+        return std::vector<double>();
+
+    int numTimepoints = measurements.size() / numObservables;
+    int numParameters = modelOutputSensitivities.size() / measurements.size();
+    RELEASE_ASSERT(modelOutputSensitivities.size()
+                   == measurements.size() * numParameters,
+                   "Unexpected size of model output sensitivities");
+
+    // d nllh / d p_k = sum_i (y_i - m_i) / sigma_i^2 * s_i * dy_i / dp_k
+    // Laplace: sum_i sign(y_i - m_i) / b_i * s_i * dy_i / dp_k
+    std::vector<double> gradient(numParameters, 0.0);
+    for(int timeIdx = 0; timeIdx < numTimepoints; ++timeIdx) {
+        for(int observableIdx = 0; observableIdx < numObservables;
+            ++observableIdx) {
+            int i = observableIdx + timeIdx * numObservables;
+            if(std::isnan(measurements[i]))
+                continue;
+            double residual = modelOutputsScaled[i] - measurements[i];
+            double weight = errorModel == ErrorModel::laplace
+                    ? ((residual > 0.0) - (residual < 0.0)) / sigmas[i]
+                    : residual / (sigmas[i] * sigmas[i]);
+            weight *= outputScalings[i];
+            auto sy = &modelOutputSensitivities[
+                    timeIdx * numParameters * numObservables + observableIdx];
+            for(int k = 0; k < numParameters; ++k)
+                gradient[k] += weight * sy[k * numObservables];
+        }
+    }
+
+    return gradient;
+}
+
+double weightedMedian(std::vector<double> values,
+                      std::vector<double> const& weights)
+{
+    RELEASE_ASSERT(values.size() == weights.size(), "");
+
+    std::vector<std::size_t> order(values.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&values](std::size_t a, std::size_t b) {
+        return values[a] < values[b];
+    });
+
+    double halfTotalWeight =
+            std::accumulate(weights.begin(), weights.end(), 0.0) / 2.0;
+    if(!(halfTotalWeight > 0.0))
+        return NAN;
+
+    // first value where the cumulative weight reaches half of the total
+    // weight; average with the next one if exactly at the half
+    double cumulativeWeight = 0.0;
+    for(auto it = order.begin(); it != order.end(); ++it) {
+        cumulativeWeight += weights[*it];
+        if(cumulativeWeight < halfTotalWeight)
+            continue;
+
+        if(cumulativeWeight == halfTotalWeight) {
+            auto next = std::find_if(it + 1, order.end(),
+                                     [&weights](std::size_t i) {
+                return weights[i] > 0.0;
+            });
+            if(next != order.end())
+                return (values[*it] + values[*next]) / 2.0;
+        }
+        return values[*it];
+    }
+
+    return values[order.back()];
+}
+
+ErrorModel getErrorModelFromEnvironment()
+{
+    if(auto env = std::getenv("PARPE_HIERARCHICAL_ERROR_MODEL")) {
+        std::string errorModel = env;
+        if(errorModel == "laplace")
+            return ErrorModel::laplace;
+        if(errorModel != "normal")
+            throw ParPEException("Unknown PARPE_HIERARCHICAL_ERROR_MODEL: "
+                                 + errorModel);
+    }
+    return ErrorModel::normal;
+}
+
 void checkGradientForAnalyticalParameters(
         const std::vector<double> &gradient,
         const std::vector<int> &analyticalIndices, double threshold)
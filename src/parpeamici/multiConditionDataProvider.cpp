@@ -1,6 +1,7 @@
 #include <parpeamici/multiConditionDataProvider.h>
 
 #include <parpeamici/amiciMisc.h>
+#include <parpeamici/flatInputFile.h>
 #include <parpecommon/logging.h>
 #include <parpecommon/misc.h>
 #include <parpecommon/parpeException.h>
@@ -8,13 +9,87 @@
 #include <amici/amici.h>
 #include <amici/hdf5.h>
 
+#ifdef PARPE_ENABLE_MPI
+#include <mpi.h>
+#endif
+
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <exception>
 #include <cstring>
 #include <cmath>
 #include <numeric>
 
 namespace parpe {
 
+namespace {
+
+/** Transpose a row-major numRows x numCols matrix */
+template<typename T>
+std::vector<T> transpose(std::vector<T> const& matrix,
+                         std::size_t numRows, std::size_t numCols) {
+    std::vector<T> result(matrix.size());
+    for(std::size_t row = 0; row < numRows; ++row)
+        for(std::size_t col = 0; col < numCols; ++col)
+            result[col * numRows + row] = matrix[row * numCols + col];
+    return result;
+}
+
+/** Copy the i-th range of concatenated variable-length data */
+std::vector<double> getRange(gsl::span<double const> values,
+                             gsl::span<std::uint64_t const> offsets, int i) {
+    return std::vector<double>(values.begin() + offsets[i],
+                               values.begin() + offsets[i + 1]);
+}
+
+std::vector<amici::ParameterScaling> toParameterScaling(
+        gsl::span<int const> scaleInt) {
+    std::vector<amici::ParameterScaling> res(scaleInt.size());
+    for(std::size_t i = 0; i < res.size(); ++i)
+        res[i] = static_cast<amici::ParameterScaling>(scaleInt[i]);
+    return res;
+}
+
+/** Whether input data is to be loaded by loadInputDataSharedOnNode */
+bool isSharingInputDataOnNodeRequested() {
+    if(std::getenv("PARPE_FLAT_INPUT_FILE") || !getMpiActive())
+        return false;
+
+    auto env = std::getenv("PARPE_SHARE_INPUT_DATA_ON_NODE");
+    return env && env[0] == '1';
+}
+
+#ifdef PARPE_ENABLE_MPI
+/**
+ * @brief Input data in an MPI shared-memory window of all processes on a
+ * node. Freeing the window is collective, so all of them have to destroy
+ * their instance.
+ */
+class NodeSharedInput {
+  public:
+    NodeSharedInput(MPI_Comm nodeComm, MPI_Win window,
+                    void const* data, std::size_t numBytes)
+        : nodeComm(nodeComm), window(window), input(data, numBytes) {}
+
+    NodeSharedInput(NodeSharedInput const&) = delete;
+    NodeSharedInput& operator=(NodeSharedInput const&) = delete;
+
+    ~NodeSharedInput() {
+        if(getMpiActive()) {
+            MPI_Win_free(&window);
+            MPI_Comm_free(&nodeComm);
+        }
+    }
+
+    MPI_Comm nodeComm;
+    MPI_Win window;
+    FlatInputFile input;
+};
+#endif
+
+} // namespace
+
 MultiConditionDataProviderHDF5::MultiConditionDataProviderHDF5(
         std::unique_ptr<amici::Model> model,
         std::string const& hdf5Filename)
@@ -26,8 +101,12 @@ MultiConditionDataProviderHDF5::MultiConditionDataProviderHDF5(
         std::string const& rootPath)
     : model(std::move(model)), rootPath(rootPath) {
 
-    auto lock = hdf5MutexGetLock();
-    file = hdf5OpenForReading(hdf5Filename);
+    {
+        auto lock = hdf5MutexGetLock();
+        file = hdf5OpenForReading(hdf5Filename);
+    }
+    // Only locks the input file, result files can be written meanwhile
+    auto lock = hdf5MutexGetLock(file.getId());
 
     optimizationOptions = parpe::OptimizationOptions::fromHDF5(getHdf5FileId());
 
@@ -51,15 +130,453 @@ MultiConditionDataProviderHDF5::MultiConditionDataProviderHDF5(
     checkDataIntegrity();
 
     amici::hdf5::readModelDataFromHDF5(file, *this->model, hdf5AmiciOptionPath);
+
+    if(auto env = std::getenv("PARPE_FLAT_INPUT_FILE")) {
+        loadFlatInputFile(env);
+        return;
+    }
+
+    // loaded later by the collective shareInputDataOnNodeIfRequested
+    if(isSharingInputDataOnNodeRequested())
+        return;
+
+    compileParameterMappingPlans();
+
+    if(auto env = std::getenv("PARPE_PRELOAD_DATA")) {
+        if(env[0] == '1') {
+            auto maxBytes = std::numeric_limits<std::size_t>::max();
+            if(auto envMax = std::getenv("PARPE_PRELOAD_DATA_MAX_MB"))
+                maxBytes = std::stoull(envMax) * 1024 * 1024;
+
+            if(!preloadData(maxBytes))
+                logmessage(LOGLVL_WARNING, "Input data exceeds "
+                           "PARPE_PRELOAD_DATA_MAX_MB, reading remaining "
+                           "data from file on demand.");
+        }
+    }
+}
+
+struct MultiConditionDataProviderHDF5::PreloadedStorage {
+    std::vector<int> simulationConditions;
+    std::vector<double> fixedParameters;
+    std::vector<double> timepoints;
+    std::vector<std::uint64_t> timepointOffsets;
+    std::vector<double> measurements;
+    std::vector<double> sigmas;
+    std::vector<std::uint64_t> measurementOffsets;
+};
+
+bool MultiConditionDataProviderHDF5::preloadData(std::size_t maxBytes)
+{
+    auto lock = hdf5MutexGetLock(file.getId());
+
+    // read everything from file while loading
+    preloaded = PreloadedData();
+    int numSimulationConditions = getNumberOfSimulationConditions();
+    int numOptimizationParameters = getNumOptimizationParameters();
+    preloaded.numSimulationConditions = numSimulationConditions;
+    preloaded.numOptimizationParameters = numOptimizationParameters;
+
+    auto storage = std::make_shared<PreloadedStorage>();
+    std::size_t usedBytes = 0;
+    bool haveParameters = preloadParameters(*storage, maxBytes, usedBytes);
+    bool haveMeasurements = preloadMeasurements(*storage, maxBytes, usedBytes);
+
+    preloaded.simulationConditions = storage->simulationConditions;
+    preloaded.fixedParameters = storage->fixedParameters;
+    preloaded.timepoints = storage->timepoints;
+    preloaded.timepointOffsets = storage->timepointOffsets;
+    preloaded.measurements = storage->measurements;
+    preloaded.sigmas = storage->sigmas;
+    preloaded.measurementOffsets = storage->measurementOffsets;
+    preloaded.storage = std::move(storage);
+    preloaded.haveParameters = haveParameters;
+    preloaded.haveMeasurements = haveMeasurements;
+
+    logmessage(LOGLVL_DEBUG, "Preloaded %zu bytes of input data.", usedBytes);
+
+    return haveParameters && haveMeasurements;
+}
+
+void MultiConditionDataProviderHDF5::loadFlatInputFile(
+        std::string const& fileName)
+{
+    auto input = std::make_shared<FlatInputFile>(fileName);
+    useFlatInput(*input);
+
+    logmessage(LOGLVL_DEBUG, "Mapped %zu bytes of input data from %s.",
+               input->size(), fileName.c_str());
+
+    preloaded.storage = std::move(input);
+}
+
+#ifdef PARPE_ENABLE_MPI
+bool MultiConditionDataProviderHDF5::shareInputDataOnNodeIfRequested(
+        MPI_Comm comm)
+{
+    if(!getMpiActive())
+        return false;
+
+    // check the setting first, so that all or none of the processes
+    // continue with the collective operations of loadInputDataSharedOnNode
+    int requested = isSharingInputDataOnNodeRequested();
+    int minMax[2] = {-requested, requested};
+    MPI_Allreduce(MPI_IN_PLACE, minMax, 2, MPI_INT, MPI_MAX, comm);
+    if(-minMax[0] != minMax[1])
+        throw ParPEException("PARPE_SHARE_INPUT_DATA_ON_NODE and "
+                             "PARPE_FLAT_INPUT_FILE have to be set the same "
+                             "way on all processes.");
+    if(!requested)
+        return false;
+
+    loadInputDataSharedOnNode(comm);
+    return true;
+}
+
+void MultiConditionDataProviderHDF5::loadInputDataSharedOnNode(MPI_Comm comm)
+{
+    MPI_Comm nodeComm;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0,
+                        MPI_INFO_NULL, &nodeComm);
+    int nodeRank = 0;
+    int nodeSize = 0;
+    MPI_Comm_rank(nodeComm, &nodeRank);
+    MPI_Comm_size(nodeComm, &nodeSize);
+
+    // The first process on the node reads everything and creates a flat
+    // input image, which all processes then use in place
+    std::vector<int> mapping;
+    std::vector<int> scaleSim;
+    std::vector<double> overrides;
+    std::vector<int> scaleOptInt;
+    std::unique_ptr<FlatInputWriter> writer;
+    std::exception_ptr error;
+    std::uint64_t numBytes = 0;
+    if(nodeRank == 0) {
+        try {
+            preloadData();
+            readParameterMappingTables(mapping, scaleSim, overrides);
+            for(auto scale: getParameterScaleOpt())
+                scaleOptInt.push_back(static_cast<int>(scale));
+
+            auto const nk = model->nk();
+            FlatInputFile::Header header {};
+            header.numSimulationConditions = preloaded.numSimulationConditions;
+            if(nk) {
+                header.numConditions = preloaded.fixedParameters.size() / nk;
+            } else {
+                // condition indices are still checked against this
+                for(std::size_t i = 0;
+                    i < preloaded.simulationConditions.size(); i += 3) {
+                    header.numConditions = std::max(
+                                {header.numConditions,
+                                 preloaded.simulationConditions[i] + 1,
+                                 preloaded.simulationConditions[i + 1] + 1});
+                }
+            }
+            header.numFixedParameters = nk;
+            header.numModelParameters = model->np();
+            header.numOptimizationParameters =
+                    preloaded.numOptimizationParameters;
+
+            writer = std::make_unique<FlatInputWriter>(header);
+            writer->setSection(FlatInputFile::simulationConditions,
+                               preloaded.simulationConditions);
+            writer->setSection(FlatInputFile::fixedParameters,
+                               preloaded.fixedParameters);
+            writer->setSection(FlatInputFile::timepointOffsets,
+                               preloaded.timepointOffsets);
+            writer->setSection(FlatInputFile::timepoints,
+                               preloaded.timepoints);
+            writer->setSection(FlatInputFile::measurementOffsets,
+                               preloaded.measurementOffsets);
+            writer->setSection(FlatInputFile::measurements,
+                               preloaded.measurements);
+            writer->setSection(FlatInputFile::sigmas, preloaded.sigmas);
+            writer->setSection(FlatInputFile::parameterMapping,
+                               gsl::make_span(mapping));
+            writer->setSection(FlatInputFile::parameterScaleSimulation,
+                               gsl::make_span(scaleSim));
+            writer->setSection(FlatInputFile::parameterOverrides,
+                               gsl::make_span(overrides));
+            writer->setSection(FlatInputFile::parameterScaleOptimization,
+                               gsl::make_span(scaleOptInt));
+            numBytes = writer->size();
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+
+    // 0 bytes signals failure on the first process
+    MPI_Bcast(&numBytes, 1, MPI_UINT64_T, 0, nodeComm);
+    if(!numBytes) {
+        MPI_Comm_free(&nodeComm);
+        if(error)
+            std::rethrow_exception(error);
+        throw ParPEException("Failed to load input data on the first process "
+                             "of this node.");
+    }
+
+    void *data = nullptr;
+    MPI_Win window;
+    MPI_Win_allocate_shared(nodeRank == 0 ? numBytes : 0, 1, MPI_INFO_NULL,
+                            nodeComm, &data, &window);
+    if(nodeRank != 0) {
+        MPI_Aint segmentSize = 0;
+        int displacementUnit = 0;
+        MPI_Win_shared_query(window, 0, &segmentSize, &displacementUnit,
+                             &data);
+    }
+
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, window);
+    if(nodeRank == 0)
+        writer->write(data);
+    MPI_Win_sync(window);
+    MPI_Barrier(nodeComm);
+    MPI_Win_sync(window);
+    MPI_Win_unlock_all(window);
+
+    // drop the private copy
+    preloaded = PreloadedData();
+
+    auto shared = std::make_shared<NodeSharedInput>(
+                nodeComm, window, data, numBytes);
+    useFlatInput(shared->input);
+
+    if(nodeRank == 0)
+        logmessage(LOGLVL_DEBUG, "Sharing %llu bytes of input data between "
+                                 "%d processes on this node.",
+                   static_cast<unsigned long long>(numBytes), nodeSize);
+
+    preloaded.storage = std::move(shared);
+}
+#endif
+
+void MultiConditionDataProviderHDF5::useFlatInput(FlatInputFile const& input)
+{
+    preloaded = PreloadedData();
+    RELEASE_ASSERT(input.getNumSimulationConditions()
+                   == getNumberOfSimulationConditions(),
+                   "Number of simulation conditions in flat input file does "
+                   "not match the HDF5 input file.");
+    RELEASE_ASSERT(input.getNumOptimizationParameters()
+                   == getNumOptimizationParameters(),
+                   "Number of optimization parameters in flat input file does "
+                   "not match the HDF5 input file.");
+    RELEASE_ASSERT(input.getNumFixedParameters() == model->nk()
+                   && input.getNumModelParameters() == model->np(),
+                   "Flat input file does not match the model.");
+
+    scaleOpt = toParameterScaling(input.getParameterScaleOptimization());
+    compileParameterMappingPlans(input.getNumSimulationConditions(),
+                                 input.getParameterMapping(),
+                                 input.getParameterScaleSimulation(),
+                                 input.getParameterOverrides());
+
+    preloaded.numSimulationConditions = input.getNumSimulationConditions();
+    preloaded.numOptimizationParameters =
+            input.getNumOptimizationParameters();
+    preloaded.simulationConditions = input.getSimulationConditions();
+    preloaded.fixedParameters = input.getFixedParameters();
+    preloaded.timepoints = input.getTimepoints();
+    preloaded.timepointOffsets = input.getTimepointOffsets();
+    preloaded.measurements = input.getMeasurements();
+    preloaded.sigmas = input.getSigmas();
+    preloaded.measurementOffsets = input.getMeasurementOffsets();
+    preloaded.haveParameters = true;
+    preloaded.haveMeasurements = true;
+}
+
+void MultiConditionDataProviderHDF5::compileParameterMappingPlans()
+{
+    auto lock = hdf5MutexGetLock(file.getId());
+
+    // read everything from file while compiling
+    mappingPlans.clear();
+    scaleOpt = getParameterScaleOpt();
+
+    auto const numSimulations =
+            static_cast<std::size_t>(getNumberOfSimulationConditions());
+    if(!numSimulations)
+        return;
+
+    std::vector<int> scaleSim;
+    std::vector<int> mapping;
+    std::vector<double> overrides;
+    readParameterMappingTables(mapping, scaleSim, overrides);
+
+    compileParameterMappingPlans(numSimulations, mapping, scaleSim, overrides);
+}
+
+void MultiConditionDataProviderHDF5::readParameterMappingTables(
+        std::vector<int> &mapping, std::vector<int> &scaleSim,
+        std::vector<double> &overrides)
+{
+    auto lock = hdf5MutexGetLock(file.getId());
+
+    auto const np = static_cast<std::size_t>(model->np());
+    auto const numSimulations =
+            static_cast<std::size_t>(getNumberOfSimulationConditions());
+
+    mapping.clear();
+    scaleSim.clear();
+    overrides.clear();
+    if(!np || !numSimulations)
+        return;
+
+    scaleSim = hdf5Read2DIntegerHyperslab(
+                file, hdf5ParameterScaleSimulationPath,
+                numSimulations, np, 0, 0);
+
+    if(hdf5DatasetExists(
+                file, hdf5SimulationToOptimizationParameterMappingPath)) {
+        mapping = transpose(
+                    hdf5Read2DIntegerHyperslab(
+                        file,
+                        hdf5SimulationToOptimizationParameterMappingPath,
+                        np, numSimulations, 0, 0),
+                    np, numSimulations);
+    } else {
+        // trivial default mapping
+        mapping.resize(numSimulations * np);
+        for(std::size_t i = 0; i < numSimulations; ++i)
+            std::iota(&mapping[i * np], &mapping[i * np] + np, 0);
+    }
+
+    if(hdf5DatasetExists(file, hdf5ParameterOverridesPath)) {
+        overrides.resize(np * numSimulations);
+        hdf5Read2DDoubleHyperslab(
+                    file.getId(), hdf5ParameterOverridesPath.c_str(),
+                    np, numSimulations, 0, 0, overrides);
+        overrides = transpose(overrides, np, numSimulations);
+    }
+}
+
+void MultiConditionDataProviderHDF5::compileParameterMappingPlans(
+        std::size_t numSimulations, gsl::span<int const> mapping,
+        gsl::span<int const> scaleSim, gsl::span<double const> overrides)
+{
+    auto const np = static_cast<std::size_t>(model->np());
+
+    std::vector<ParameterMappingPlan> plans;
+    plans.reserve(numSimulations);
+    std::vector<amici::ParameterScaling> rowScaleSim;
+    for(std::size_t i = 0; i < numSimulations; ++i) {
+        auto row = [i, np](auto const& matrix) {
+            return matrix.empty() ? matrix.subspan(0, 0)
+                                  : matrix.subspan(i * np, np);
+        };
+        rowScaleSim = toParameterScaling(row(scaleSim));
+        plans.emplace_back(row(mapping), rowScaleSim, scaleOpt,
+                           row(overrides));
+    }
+    mappingPlans = std::move(plans);
+}
+
+bool MultiConditionDataProviderHDF5::preloadParameters(
+        PreloadedStorage &storage, std::size_t maxBytes, std::size_t &usedBytes)
+{
+    auto const nk = static_cast<std::size_t>(model->nk());
+    auto const numSimulations =
+            static_cast<std::size_t>(preloaded.numSimulationConditions);
+
+    int numConditions = 0;
+    if(nk) {
+        int d1 = 0;
+        hdf5GetDatasetDimensions(file.getId(), hdf5ConditionPath.c_str(),
+                                 2, &d1, &numConditions);
+    }
+
+    auto requiredBytes = numSimulations * 3 * sizeof(int)
+            + numConditions * nk * sizeof(double);
+    if(requiredBytes > maxBytes - usedBytes)
+        return false;
+
+    if(numSimulations) {
+        storage.simulationConditions = hdf5Read2DIntegerHyperslab(
+                    file, hdf5ReferenceConditionPath, numSimulations, 3, 0, 0);
+    }
+
+    if(numConditions) {
+        std::vector<double> fixedParameters(nk * numConditions);
+        hdf5Read2DDoubleHyperslab(file.getId(), hdf5ConditionPath.c_str(),
+                                  nk, numConditions, 0, 0, fixedParameters);
+        storage.fixedParameters = transpose(fixedParameters,
+                                            nk, numConditions);
+    }
+
+    usedBytes += requiredBytes;
+
+    return true;
+}
+
+bool MultiConditionDataProviderHDF5::preloadMeasurements(
+        PreloadedStorage &storage, std::size_t maxBytes, std::size_t &usedBytes)
+{
+    auto const numSimulations = preloaded.numSimulationConditions;
+
+    // determine sizes first, to not read anything if it doesn't fit
+    auto &timepointOffsets = storage.timepointOffsets;
+    auto &measurementOffsets = storage.measurementOffsets;
+    timepointOffsets.assign(numSimulations + 1, 0);
+    measurementOffsets.assign(numSimulations + 1, 0);
+    for(int i = 0; i < numSimulations; ++i) {
+        int numTimepoints = 0;
+        hdf5GetDatasetDimensions(
+                    file.getId(),
+                    (rootPath + "/measurements/t/" + std::to_string(i)).c_str(),
+                    1, &numTimepoints);
+        int d1 = 0, d2 = 0;
+        hdf5GetDatasetDimensions(
+                    file.getId(),
+                    (hdf5MeasurementPath + "/" + std::to_string(i)).c_str(),
+                    2, &d1, &d2);
+        timepointOffsets[i + 1] = timepointOffsets[i] + numTimepoints;
+        measurementOffsets[i + 1] = measurementOffsets[i] + d1 * d2;
+    }
+
+    auto requiredBytes =
+            (timepointOffsets.back() + 2 * measurementOffsets.back())
+            * sizeof(double)
+            + 2 * (numSimulations + 1) * sizeof(std::uint64_t);
+    if(requiredBytes > maxBytes - usedBytes) {
+        timepointOffsets.clear();
+        measurementOffsets.clear();
+        return false;
+    }
+
+    storage.timepoints.reserve(timepointOffsets.back());
+    storage.measurements.reserve(measurementOffsets.back());
+    storage.sigmas.reserve(measurementOffsets.back());
+    for(int i = 0; i < numSimulations; ++i) {
+        auto timepoints = amici::hdf5::getDoubleDataset1D(
+                    file, rootPath + "/measurements/t/" + std::to_string(i));
+        auto measurements = getMeasurementForSimulationIndex(i);
+        auto sigmas = getSigmaForSimulationIndex(i);
+        RELEASE_ASSERT(measurements.size() == sigmas.size(),
+                       "Dimensions of measurements and sigmas do not match.");
+
+        storage.timepoints.insert(storage.timepoints.end(),
+                                  timepoints.begin(), timepoints.end());
+        storage.measurements.insert(storage.measurements.end(),
+                                    measurements.begin(), measurements.end());
+        storage.sigmas.insert(storage.sigmas.end(),
+                              sigmas.begin(), sigmas.end());
+    }
+
+    usedBytes += requiredBytes;
+
+    return true;
 }
 
 int MultiConditionDataProviderHDF5::getNumberOfSimulationConditions() const {
     // TODO: add additional layer for selection of condition indices (for testing
     // and later for minibatch)
     // -> won't need different file for testing/validation splits
-    // TODO: cache
+    if(preloaded.haveParameters || preloaded.haveMeasurements)
+        return preloaded.numSimulationConditions;
 
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
 
     int d1, d2;
     hdf5GetDatasetDimensions(file.getId(), hdf5ReferenceConditionPath.c_str(),
@@ -73,6 +590,9 @@ int MultiConditionDataProviderHDF5::getNumberOfSimulationConditions() const {
 std::vector<int>
 MultiConditionDataProviderHDF5::getSimulationToOptimizationParameterMapping(
         int conditionIdx) const  {
+    if(!mappingPlans.empty())
+        return mappingPlans[conditionIdx].getMapping();
+
     std::string path = hdf5SimulationToOptimizationParameterMappingPath;
 
     if(hdf5DatasetExists(file, path)) {
@@ -91,6 +611,12 @@ void
 MultiConditionDataProviderHDF5::mapSimulationToOptimizationGradientAddMultiply(int conditionIdx, gsl::span<double const> simulation,
         gsl::span<double> optimization,
         gsl::span<double const> parameters, double coefficient) const {
+    if(!mappingPlans.empty()) {
+        mappingPlans[conditionIdx].addGradient(simulation, optimization,
+                                               parameters, coefficient);
+        return;
+    }
+
     auto mapping = getSimulationToOptimizationParameterMapping(conditionIdx);
 
     // Need to consider varying scaling
@@ -113,6 +639,13 @@ void MultiConditionDataProviderHDF5::mapAndSetOptimizationToSimulationVariables(
         gsl::span<amici::ParameterScaling> optimizationScale,
         gsl::span<amici::ParameterScaling> simulationScale) const
 {
+    if(!mappingPlans.empty()) {
+        // scales are the same as in the compiled plan
+        mappingPlans[conditionIdx].setSimulationParameters(optimization,
+                                                           simulation);
+        return;
+    }
+
     auto mapping = getSimulationToOptimizationParameterMapping(conditionIdx);
 
     std::vector<double> overrides;
@@ -131,28 +664,32 @@ void MultiConditionDataProviderHDF5::mapAndSetOptimizationToSimulationVariables(
                             optimization[mapping[i]],
                         optimizationScale[mapping[i]]), simulationScale[i]);
         } else if (!overrides.empty()) {
-            // TODO do we need to rescale here? or done in PEtab?
+            // already in simulation scale, see ParameterMappingPlan
             simulation[i] = overrides[i];
         } else {
-            simulation[i] = NAN;
+            throw ParPEException(
+                        "Simulation parameter " + std::to_string(i)
+                        + " is not mapped, but no override is provided.");
         }
     }
 }
 
 std::vector<amici::ParameterScaling> MultiConditionDataProviderHDF5::getParameterScaleOpt() const
 {
-    auto lock = hdf5MutexGetLock();
-    auto resInt = amici::hdf5::getIntDataset1D(
-                file, hdf5ParameterScaleOptimizationPath);
-    std::vector<amici::ParameterScaling> res(resInt.size());
-    for(unsigned int i = 0; i < resInt.size(); ++i)
-        res[i] = static_cast<amici::ParameterScaling>(resInt[i]);
-    return res;
+    if(!mappingPlans.empty())
+        return scaleOpt;
+
+    auto lock = hdf5MutexGetLock(file.getId());
+    return toParameterScaling(amici::hdf5::getIntDataset1D(
+                                  file, hdf5ParameterScaleOptimizationPath));
 }
 
 amici::ParameterScaling MultiConditionDataProviderHDF5::getParameterScaleOpt(
         int parameterIdx) const
 {
+    if(!mappingPlans.empty())
+        return scaleOpt[parameterIdx];
+
     auto res = hdf5Read1DIntegerHyperslab(
                 file, hdf5ParameterScaleOptimizationPath,
                 1, parameterIdx).at(0);
@@ -162,19 +699,23 @@ amici::ParameterScaling MultiConditionDataProviderHDF5::getParameterScaleOpt(
 std::vector<amici::ParameterScaling>
 MultiConditionDataProviderHDF5::getParameterScaleSim(int simulationIdx) const
 {
-    auto resInt = hdf5Read2DIntegerHyperslab(
-                file, hdf5ParameterScaleSimulationPath,
-                1, model->np(), simulationIdx, 0);
-    std::vector<amici::ParameterScaling> res(resInt.size());
-    for(unsigned int i = 0; i < resInt.size(); ++i)
-        res[i] = static_cast<amici::ParameterScaling>(resInt[i]);
-    return res;
+    if(!mappingPlans.empty())
+        return mappingPlans[simulationIdx].getParameterScaleSim();
+
+    return toParameterScaling(
+                hdf5Read2DIntegerHyperslab(
+                    file, hdf5ParameterScaleSimulationPath,
+                    1, model->np(), simulationIdx, 0));
 }
 
 amici::ParameterScaling MultiConditionDataProviderHDF5::getParameterScaleSim(
         int simulationIdx,
         int modelParameterIdx) const
 {
+    if(!mappingPlans.empty())
+        return mappingPlans[simulationIdx]
+                .getParameterScaleSim()[modelParameterIdx];
+
     auto res = hdf5Read2DIntegerHyperslab(
                 file, hdf5ParameterScaleSimulationPath,
                 1, 1, simulationIdx, modelParameterIdx).at(0);
@@ -216,7 +757,14 @@ void MultiConditionDataProviderHDF5::readFixedSimulationParameters(
     if(!model->nk())
         return;
 
-    auto lock = hdf5MutexGetLock();
+    if(preloaded.haveParameters) {
+        std::copy_n(preloaded.fixedParameters.begin()
+                    + static_cast<std::size_t>(conditionIdx) * model->nk(),
+                    model->nk(), buffer.begin());
+        return;
+    }
+
+    auto lock = hdf5MutexGetLock(file.getId());
 
     H5_SAVE_ERROR_HANDLER;
 
@@ -241,12 +789,16 @@ void MultiConditionDataProviderHDF5::readFixedSimulationParameters(
 
 std::unique_ptr<amici::ExpData> MultiConditionDataProviderHDF5::getExperimentalDataForCondition(
         int simulationIdx) const {
-    auto lock = hdf5MutexGetLock();
-
+    // no lock here: preloaded data is read without locking, the getters
+    // below lock the input file only if needed
     auto edata = std::make_unique<amici::ExpData>(*model);
     RELEASE_ASSERT(edata, "Failed getting experimental data. Check data file.");
-    {
-        auto lock = hdf5MutexGetLock();
+    if(preloaded.haveMeasurements) {
+        edata->setTimepoints(getRange(preloaded.timepoints,
+                                      preloaded.timepointOffsets,
+                                      simulationIdx));
+    } else {
+        auto lock = hdf5MutexGetLock(file.getId());
         edata->setTimepoints(
                     amici::hdf5::getDoubleDataset1D(
                         file, rootPath + "/measurements/t/"
@@ -279,8 +831,12 @@ std::vector<std::vector<double> > MultiConditionDataProviderHDF5::getAllSigmas()
 
 std::vector<double> MultiConditionDataProviderHDF5::getSigmaForSimulationIndex(int simulationIdx) const
 {
+    if(preloaded.haveMeasurements)
+        return getRange(preloaded.sigmas, preloaded.measurementOffsets,
+                        simulationIdx);
+
     hsize_t dim1, dim2;
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
     return amici::hdf5::getDoubleDataset2D(
                 file,
                 hdf5MeasurementSigmaPath + "/" + std::to_string(simulationIdx),
@@ -289,8 +845,12 @@ std::vector<double> MultiConditionDataProviderHDF5::getSigmaForSimulationIndex(i
 
 std::vector<double> MultiConditionDataProviderHDF5::getMeasurementForSimulationIndex(int simulationIdx) const
 {
+    if(preloaded.haveMeasurements)
+        return getRange(preloaded.measurements, preloaded.measurementOffsets,
+                        simulationIdx);
+
     hsize_t dim1, dim2;
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
     return amici::hdf5::getDoubleDataset2D(
                 file, hdf5MeasurementPath + "/" + std::to_string(simulationIdx),
                 dim1, dim2);
@@ -298,7 +858,7 @@ std::vector<double> MultiConditionDataProviderHDF5::getMeasurementForSimulationI
 
 void MultiConditionDataProviderHDF5::getOptimizationParametersLowerBounds(
         gsl::span<double> buffer) const {
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
 
     auto dataset = file.openDataSet(hdf5ParameterMinPath);
 
@@ -315,7 +875,7 @@ void MultiConditionDataProviderHDF5::getOptimizationParametersLowerBounds(
 
 void MultiConditionDataProviderHDF5::getOptimizationParametersUpperBounds(
         gsl::span<double> buffer) const {
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
 
     auto dataset = file.openDataSet(hdf5ParameterMaxPath);
 
@@ -331,6 +891,9 @@ void MultiConditionDataProviderHDF5::getOptimizationParametersUpperBounds(
 }
 
 int MultiConditionDataProviderHDF5::getNumOptimizationParameters() const {
+    if(preloaded.haveParameters || preloaded.haveMeasurements)
+        return preloaded.numOptimizationParameters;
+
     std::string path = rootPath + "/parameters/parameterNames";
     int size = 0;
     hdf5GetDatasetDimensions(file.getId(), path.c_str(), 1, &size);
@@ -345,7 +908,7 @@ std::unique_ptr<amici::Model> MultiConditionDataProviderHDF5::getModel() const {
 std::unique_ptr<amici::Solver> MultiConditionDataProviderHDF5::getSolver() const
 {
     auto solver = model->getSolver();
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
 
     amici::hdf5::readSolverSettingsFromHDF5(file, *solver, hdf5AmiciOptionPath);
     return solver;
@@ -381,6 +944,15 @@ void MultiConditionDataProviderHDF5::getSimAndPreeqConditions(
         const int simulationIdx, int &preequilibrationConditionIdx,
         int &simulationConditionIdx, bool &reinitializeFixedParameterInitialStates) const
 {
+    if(preloaded.haveParameters) {
+        auto const* row = &preloaded.simulationConditions[
+                static_cast<std::size_t>(simulationIdx) * 3];
+        preequilibrationConditionIdx = row[0];
+        simulationConditionIdx = row[1];
+        reinitializeFixedParameterInitialStates = row[2];
+        return;
+    }
+
     auto tmp = hdf5Read2DIntegerHyperslab(file, hdf5ReferenceConditionPath,
                                           1, 3, simulationIdx, 0);
     preequilibrationConditionIdx = tmp[0];
@@ -439,7 +1011,7 @@ void MultiConditionDataProviderHDF5::checkDataIntegrity() const {
 
     int d1, d2;//, d3;
 
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
 
     assert(H5Lexists(file.getId(), hdf5MeasurementPath.c_str(), H5P_DEFAULT));
     assert(H5Lexists(file.getId(), hdf5MeasurementSigmaPath.c_str(), H5P_DEFAULT));
@@ -577,6 +1149,196 @@ std::unique_ptr<amici::Solver> MultiConditionDataProviderDefault::getSolver() co
     return std::unique_ptr<amici::Solver>(solver->clone());
 }
 
+ParameterMappingPlan::ParameterMappingPlan(
+        gsl::span<const int> mapping,
+        gsl::span<const amici::ParameterScaling> scaleSim,
+        gsl::span<const amici::ParameterScaling> scaleOpt,
+        gsl::span<const double> overrides)
+    : scaleSim(scaleSim.begin(), scaleSim.end())
+{
+    RELEASE_ASSERT(mapping.size() == scaleSim.size(),
+                   "Parameter mapping and scales do not match.");
+    RELEASE_ASSERT(overrides.empty() || overrides.size() == mapping.size(),
+                   "Parameter mapping and overrides do not match.");
+
+    auto const numParameters = static_cast<int>(mapping.size());
+    for(int i = 0; i < numParameters; ++i) {
+        RELEASE_ASSERT(mapping[i] < static_cast<int>(scaleOpt.size()),
+                       "Invalid optimization parameter index in mapping.");
+        if(mapping[i] < 0) {
+            // overrides are already in simulation scale (the PEtab exporter
+            // writes unscaled values with linear pscaleSimulation)
+            if(overrides.empty())
+                throw ParPEException(
+                        "Simulation parameter " + std::to_string(i)
+                        + " is not mapped, but no override is provided.");
+            unmappedIndices.push_back(i);
+            unmappedValues.push_back(overrides[i]);
+        }
+    }
+
+    // group mapped parameters by (scaleSim, scaleOpt) via counting sort
+    constexpr int numScales = 3;
+    auto groupIndex = [&](int i) {
+        return static_cast<int>(scaleSim[i]) * numScales
+                + static_cast<int>(scaleOpt[mapping[i]]);
+    };
+    std::vector<int> groupOffsets(numScales * numScales + 1, 0);
+    for(int i = 0; i < numParameters; ++i) {
+        if(mapping[i] >= 0)
+            ++groupOffsets[groupIndex(i) + 1];
+    }
+    std::partial_sum(groupOffsets.begin(), groupOffsets.end(),
+                     groupOffsets.begin());
+
+    simulationIndices.resize(groupOffsets.back());
+    optimizationIndices.resize(groupOffsets.back());
+    auto nextPosition = groupOffsets;
+    for(int i = 0; i < numParameters; ++i) {
+        if(mapping[i] < 0)
+            continue;
+        auto position = nextPosition[groupIndex(i)]++;
+        simulationIndices[position] = i;
+        optimizationIndices[position] = mapping[i];
+    }
+
+    for(int group = 0; group < numScales * numScales; ++group) {
+        if(groupOffsets[group] == groupOffsets[group + 1])
+            continue;
+        groups.push_back(
+                    Group {static_cast<amici::ParameterScaling>(
+                           group / numScales),
+                           static_cast<amici::ParameterScaling>(
+                           group % numScales),
+                           groupOffsets[group], groupOffsets[group + 1]});
+    }
+}
+
+namespace {
+
+/** Apply `transform` to all mapped parameters of the given group */
+template<typename Transform>
+void forEachInGroup(int const* simulationIndices,
+                    int const* optimizationIndices,
+                    int begin, int end, Transform transform) {
+    for(int i = begin; i < end; ++i)
+        transform(simulationIndices[i], optimizationIndices[i]);
+}
+
+} // namespace
+
+void ParameterMappingPlan::setSimulationParameters(
+        gsl::span<const double> optimization,
+        gsl::span<double> simulation) const
+{
+    using amici::ParameterScaling;
+    double const ln10 = std::log(10.0);
+    auto const* simIdx = simulationIndices.data();
+    auto const* optIdx = optimizationIndices.data();
+
+    for(auto const& group: groups) {
+        // select the transformation once per group
+        auto set = [&](auto transform) {
+            forEachInGroup(simIdx, optIdx, group.begin, group.end,
+                           [&](int s, int o) {
+                simulation[s] = transform(optimization[o]);
+            });
+        };
+
+        if(group.scaleSim == group.scaleOpt) {
+            set([](double x) { return x; });
+            continue;
+        }
+
+        switch(group.scaleOpt) {
+        case ParameterScaling::none:
+            if(group.scaleSim == ParameterScaling::ln)
+                set([](double x) { return std::log(x); });
+            else
+                set([](double x) { return std::log10(x); });
+            break;
+        case ParameterScaling::ln:
+            if(group.scaleSim == ParameterScaling::none)
+                set([](double x) { return std::exp(x); });
+            else
+                set([ln10](double x) { return x / ln10; });
+            break;
+        case ParameterScaling::log10:
+            if(group.scaleSim == ParameterScaling::none)
+                set([](double x) { return std::pow(10.0, x); });
+            else
+                set([ln10](double x) { return x * ln10; });
+            break;
+        }
+    }
+
+    for(std::size_t i = 0; i < unmappedIndices.size(); ++i)
+        simulation[unmappedIndices[i]] = unmappedValues[i];
+}
+
+void ParameterMappingPlan::addGradient(gsl::span<const double> simulation,
+                                       gsl::span<double> optimization,
+                                       gsl::span<const double> parameters,
+                                       double coefficient) const
+{
+    using amici::ParameterScaling;
+    double const ln10 = std::log(10.0);
+    auto const* simIdx = simulationIndices.data();
+    auto const* optIdx = optimizationIndices.data();
+
+    for(auto const& group: groups) {
+        // Chain rule factor, see applyChainRule. Selected once per group.
+        auto add = [&](auto factor) {
+            forEachInGroup(simIdx, optIdx, group.begin, group.end,
+                           [&](int s, int o) {
+                optimization[o] += coefficient
+                        * (simulation[s] * factor(parameters[s]));
+            });
+        };
+
+        if(group.scaleSim == group.scaleOpt) {
+            add([](double) { return 1.0; });
+            continue;
+        }
+
+        switch(group.scaleSim) {
+        case ParameterScaling::none:
+            if(group.scaleOpt == ParameterScaling::ln)
+                add([](double p) { return p; });
+            else
+                add([ln10](double p) { return p * ln10; });
+            break;
+        case ParameterScaling::ln:
+            if(group.scaleOpt == ParameterScaling::none)
+                add([](double p) { return 1.0 / std::exp(p); });
+            else
+                add([ln10](double) { return ln10; });
+            break;
+        case ParameterScaling::log10:
+            if(group.scaleOpt == ParameterScaling::none)
+                add([ln10](double p) {
+                    return 1.0 / (std::pow(10.0, p) * ln10); });
+            else
+                add([ln10](double) { return 1.0 / ln10; });
+            break;
+        }
+    }
+}
+
+std::vector<int> ParameterMappingPlan::getMapping() const
+{
+    std::vector<int> mapping(scaleSim.size(), -1);
+    for(std::size_t i = 0; i < simulationIndices.size(); ++i)
+        mapping[simulationIndices[i]] = optimizationIndices[i];
+    return mapping;
+}
+
+const std::vector<amici::ParameterScaling> &
+ParameterMappingPlan::getParameterScaleSim() const
+{
+    return scaleSim;
+}
+
 double applyChainRule(double gradient, double parameter,
                       amici::ParameterScaling oldScale,
                       amici::ParameterScaling newScale)
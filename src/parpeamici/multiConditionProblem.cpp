@@ -2,6 +2,7 @@
 
 #include <parpecommon/logging.h>
 #include <parpecommon/misc.h>
+#include <parpecommon/treeReduction.h>
 
 #include <parpeoptimization/optimizationOptions.h>
 #include <parpeoptimization/optimizationResultWriter.h>
@@ -10,12 +11,20 @@
 #include <parpeamici/hierarchicalOptimization.h>
 #include <parpeamici/multiConditionDataProvider.h>
 #include <parpeamici/amiciMisc.h>
+#include <parpeamici/simulationWireFormat.h>
 
 #include <gsl/gsl-lite.hpp>
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstring>
 #include <ctime>
+#include <exception>
 #include <numeric>
 #include <utility>
 
@@ -162,13 +171,17 @@ MultiConditionProblemMultiStartOptimizationProblem
         LoadBalancerMaster *loadBalancer, std::unique_ptr<Logger> logger)
     : dp(dp), options(std::move(options)),
       resultWriter(resultWriter), loadBalancer(loadBalancer),
-      logger(std::move(logger))
+      logger(std::move(logger)),
+      hierarchicalDataCache(
+          std::make_shared<HierarchicalOptimizationDataCache>())
 {}
 
 int MultiConditionProblemMultiStartOptimizationProblem::getNumberOfStarts() const { return options.numStarts; }
 
 bool MultiConditionProblemMultiStartOptimizationProblem::restartOnFailure() const { return options.retryOptimization; }
 
+int MultiConditionProblemMultiStartOptimizationProblem::getMaxParallelStarts() const { return options.maxParallelStarts; }
+
 std::unique_ptr<OptimizationProblem> MultiConditionProblemMultiStartOptimizationProblem::getLocalProblem(
         int multiStartIndex) const {
     // generate new OptimizationProblem with data from dp
@@ -199,7 +212,7 @@ std::unique_ptr<OptimizationProblem> MultiConditionProblemMultiStartOptimization
     if(options.hierarchicalOptimization)
         return std::unique_ptr<OptimizationProblem>(
                     new parpe::HierarchicalOptimizationProblemWrapper(
-                        std::move(problem), dp));
+                        std::move(problem), dp, hierarchicalDataCache));
 
     return std::move(problem);
 }
@@ -245,37 +258,19 @@ void saveSimulation(const H5::H5File &file, std::string const& pathStr,
                     int status, std::string const& label)
 {
     // TODO replace by SimulationResultWriter
-    const char *fullGroupPath = pathStr.c_str();
-
-    auto lock = hdf5MutexGetLock();
-
-    hdf5CreateOrExtendAndWriteToDouble2DArray(
-        file.getId(), fullGroupPath, "simulationLogLikelihood",
-                gsl::make_span<double>(&llh, 1));
-
-    hdf5CreateOrExtendAndWriteToInt2DArray(
-                file.getId(), fullGroupPath, "jobId",
-                gsl::make_span<const int>(&jobId, 1));
-
-    if (!gradient.empty()) {
-        hdf5CreateOrExtendAndWriteToDouble2DArray(
-            file.getId(), fullGroupPath, "simulationLogLikelihoodGradient",
-                    gradient);
-    } else if(!parameters.empty()) {
-        double dummyGradient[parameters.size()];
-        std::fill_n(dummyGradient, parameters.size(), NAN);
-        hdf5CreateOrExtendAndWriteToDouble2DArray(
-            file.getId(), fullGroupPath, "simulationLogLikelihoodGradient",
-            gsl::make_span<const double>(dummyGradient, parameters.size()));
-    }
+    SimulationLogRecord record;
+    record.path = pathStr;
+    record.parameters = parameters;
+    record.llh = llh;
+    record.gradient.assign(gradient.begin(), gradient.end());
+    record.timeElapsedInSeconds = timeElapsedInSeconds;
+    record.jobId = jobId;
+    record.status = status;
+    record.label = label;
 
-    if (!parameters.empty())
-        hdf5CreateOrExtendAndWriteToDouble2DArray(
-            file.getId(), fullGroupPath, "simulationParameters", parameters);
+    auto lock = hdf5MutexGetLock(file.getId());
 
-    hdf5CreateOrExtendAndWriteToDouble2DArray(
-                file.getId(), fullGroupPath, "simulationWallTimeInSec",
-                gsl::make_span<const double>(&timeElapsedInSeconds, 1));
+    saveSimulations(file, gsl::make_span(&record, 1));
 
     // TODO: This was broken by allowing different numbers of timepoints
     // for different simulation conditions. Vector lengths now may differ and
@@ -293,13 +288,6 @@ void saveSimulation(const H5::H5File &file, std::string const& pathStr,
     //            file.getId(), fullGroupPath, "simulationStateSensitivities", stateSensi,
     //            stateSensi.size() / parameters.size(), parameters.size());
 
-    hdf5CreateOrExtendAndWriteToInt2DArray(
-                file.getId(), fullGroupPath, "simulationStatus",
-                gsl::make_span<const int>(&status, 1));
-
-    hdf5CreateOrExtendAndWriteToString1DArray(file.getId(), fullGroupPath,
-                                           "simulationLabel", label);
-
     file.flush(H5F_SCOPE_LOCAL);
 
 }
@@ -313,7 +301,9 @@ AmiciSimulationRunner::AmiciResultPackageSimple runAndLogSimulation(
         OptimizationResultWriter *resultWriter,
         bool logLineSearch,
         Logger* logger,
-        bool sendStates)
+        bool sendStates,
+        bool sendOutputSensitivities,
+        SimulationLogWriter *simulationLog)
 {
     // wall time  on worker for current simulation
     WallTimer simulationTimer;
@@ -452,10 +442,24 @@ AmiciSimulationRunner::AmiciResultPackageSimple runAndLogSimulation(
 
     if (resultWriter && (solverTemplate.getSensitivityOrder()
                          > amici::SensitivityOrder::none || logLineSearch)) {
-        saveSimulation(resultWriter->getH5File(), resultWriter->getRootPath(),
-                       model.getParameters(), rdata->llh, rdata->sllh,
-                       timeSeconds, rdata->x, rdata->sx, rdata->y,
-                       jobId, rdata->status, logger->getPrefix());
+        if(simulationLog) {
+            SimulationLogRecord record;
+            record.path = resultWriter->getRootPath();
+            record.parameters = model.getParameters();
+            record.llh = rdata->llh;
+            record.gradient = rdata->sllh;
+            record.timeElapsedInSeconds = timeSeconds;
+            record.jobId = jobId;
+            record.status = rdata->status;
+            record.label = logger->getPrefix();
+            simulationLog->log(std::move(record));
+        } else {
+            saveSimulation(resultWriter->getH5File(),
+                           resultWriter->getRootPath(),
+                           model.getParameters(), rdata->llh, rdata->sllh,
+                           timeSeconds, rdata->x, rdata->sx, rdata->y,
+                           jobId, rdata->status, logger->getPrefix());
+        }
     }
 
     return AmiciSimulationRunner::AmiciResultPackageSimple {
@@ -466,7 +470,8 @@ AmiciSimulationRunner::AmiciResultPackageSimple runAndLogSimulation(
                 ? rdata->sllh : std::vector<double>(),
                 rdata->y,
                 sendStates ? rdata->x : std::vector<double>(),
-                rdata->status
+                rdata->status,
+                sendOutputSensitivities ? rdata->sy : std::vector<double>()
     };
 }
 
@@ -478,34 +483,57 @@ FunctionEvaluationStatus getModelOutputs(
         bool logLineSearch,
         gsl::span<const double> parameters,
         std::vector<std::vector<double> > &modelOutput,
-        Logger *logger, double * /*cpuTime*/, bool sendStates)
+        Logger *logger, double * /*cpuTime*/, bool sendStates,
+        SimulationRuntimeHistory *runtimeHistory,
+        std::vector<std::vector<double> > *modelOutputSensitivities,
+        int jobClientId, double jobPriority,
+        std::function<SimulationLogWriter *()> const& getSimulationLog,
+        int numThreadsPerWorker)
 {
     int errors = 0;
 
     std::vector<int> dataIndices(dataProvider->getNumberOfSimulationConditions());
     std::iota(dataIndices.begin(), dataIndices.end(), 0);
 
+    auto sensitivityOrder = modelOutputSensitivities
+            ? amici::SensitivityOrder::first : amici::SensitivityOrder::none;
+
     modelOutput.resize(dataIndices.size());
+    if(modelOutputSensitivities)
+        modelOutputSensitivities->resize(dataIndices.size());
     auto parameterVector = std::vector<double>(parameters.begin(),
                                                parameters.end());
     auto jobFinished = [&](JobData *job, int /*dataIdx*/) { // jobFinished
-        // deserialize
-        auto results =
-                amici::deserializeFromChar<AmiciSummedGradientFunction::ResultMap> (
-                    job->recvBuffer.data(), job->recvBuffer.size());
-        job->recvBuffer = std::vector<char>(); // free buffer
-
-        for (auto const& result : results) {
-            errors += result.second.status;
-            modelOutput[result.first] = result.second.modelOutput;
+        ResultPackagesView results(job->recvBuffer);
+
+        for (int i = 0; i < results.size(); ++i) {
+            auto conditionIdx = results.conditionIndex(i);
+            errors += results.status(i);
+            auto output = results.modelOutput(i);
+            modelOutput[conditionIdx].assign(output.begin(), output.end());
+            if(modelOutputSensitivities) {
+                auto sy = results.modelOutputSensitivities(i);
+                (*modelOutputSensitivities)[conditionIdx].assign(
+                            sy.begin(), sy.end());
+            }
+            if(runtimeHistory)
+                runtimeHistory->record(conditionIdx, sensitivityOrder,
+                                       results.simulationTimeSeconds(i));
         }
+        job->recvBuffer = std::vector<char>(); // free buffer
     };
     AmiciSimulationRunner simRunner(parameterVector,
-                                    amici::SensitivityOrder::none,
+                                    sensitivityOrder,
                                     dataIndices,
                                     jobFinished,
                                     nullptr /* aggregate */,
                                     logger?logger->getPrefix():"");
+    simRunner.setRuntimeHistory(runtimeHistory);
+    simRunner.setShareParameters(true);
+    simRunner.setSendOutputSensitivities(modelOutputSensitivities != nullptr);
+    simRunner.setJobClient(jobClientId, jobPriority);
+    // all outputs are required
+    simRunner.setCancelOnFailure(true);
 
 
 #ifdef PARPE_ENABLE_MPI
@@ -517,7 +545,8 @@ FunctionEvaluationStatus getModelOutputs(
         errors += simRunner.runSharedMemory(
                     [&](std::vector<char> &buffer, int jobId) {
                 messageHandler(dataProvider, resultWriter, logLineSearch,
-                               buffer, jobId, sendStates);
+                               buffer, jobId, sendStates, nullptr,
+                               getSimulationLog, numThreadsPerWorker);
     });
 #ifdef PARPE_ENABLE_MPI
     }
@@ -532,7 +561,11 @@ void messageHandler(MultiConditionDataProvider *dataProvider,
                     OptimizationResultWriter *resultWriter,
                     bool logLineSearch,
                     std::vector<char> &buffer, int jobId,
-                    bool sendStates) {
+                    bool sendStates,
+                    ParameterEpochCache* parameterCache,
+                    std::function<SimulationLogWriter *()> const&
+                    getSimulationLog,
+                    int numThreadsPerWorker) {
 
 #if QUEUE_WORKER_H_VERBOSE >= 2
     int mpiRank;
@@ -545,32 +578,107 @@ void messageHandler(MultiConditionDataProvider *dataProvider,
     auto model = dataProvider->getModel();
 
     // unpack simulation job data
-    auto workPackage = amici::deserializeFromChar<AmiciSummedGradientFunction::WorkPackage>(
-                buffer.data(), buffer.size());
+    auto workPackage = deserializeWorkPackage(buffer);
+    if(parameterCache)
+        parameterCache->resolve(workPackage);
+    RELEASE_ASSERT(workPackage.parameterEpoch < 0 || parameterCache,
+                   "Received shared parameters, but no cache was provided.");
 
     solver->setSensitivityOrder(workPackage.sensitivityOrder);
+    if(workPackage.sendOutputSensitivities) {
+        // output sensitivities are only available from forward sensitivity
+        // analysis
+        RELEASE_ASSERT(workPackage.sensitivityOrder
+                       >= amici::SensitivityOrder::first,
+                       "Output sensitivities require sensitivity order >= 1.");
+        solver->setSensitivityMethod(amici::SensitivityMethod::forward);
+    }
+
+    // Number of threads to run the simulations of this package
+    auto numConditions = static_cast<int>(workPackage.conditionIndices.size());
+    auto numThreads = std::max(1, std::min(numThreadsPerWorker,
+                                           numConditions));
+
+    // see runAndLogSimulation
+    SimulationLogWriter *simulationLog = nullptr;
+    if(getSimulationLog && resultWriter
+            && (workPackage.sensitivityOrder > amici::SensitivityOrder::none
+                || logLineSearch))
+        simulationLog = getSimulationLog();
+
+    std::vector<AmiciSummedGradientFunction::ResultPackage> resultPackages(
+                workPackage.conditionIndices.size());
+
+    // Exceptions must not leave the parallel region. The first one is
+    // rethrown afterwards, remaining simulations are skipped.
+    std::exception_ptr exception;
+    std::atomic<bool> failed(false);
+    auto saveException = [&exception, &failed]() {
+#if defined(_OPENMP)
+        #pragma omp critical(parpe_messageHandler_exception)
+#endif
+        if(!exception)
+            exception = std::current_exception();
+        failed = true;
+    };
 
-    AmiciSummedGradientFunction::ResultMap results;
     // run simulations for all condition indices
-    for(auto conditionIdx: workPackage.conditionIndices) {
-        dataProvider->updateSimulationParametersAndScale(
-                    conditionIdx,
-                    workPackage.optimizationParameters,
-                    *model);
-        Logger logger(workPackage.logPrefix
-                      + "c" + std::to_string(conditionIdx));
-        auto result = runAndLogSimulation(
-                    *solver, *model, conditionIdx, jobId, dataProvider,
-                    resultWriter, logLineSearch, &logger, sendStates);
-        results[conditionIdx] = result;
+#if defined(_OPENMP)
+    #pragma omp parallel num_threads(numThreads) if(numThreads > 1)
+#endif
+    {
+        // Model is modified for each condition, so every thread needs its
+        // own. The solver is only used as template and cloned for each
+        // simulation.
+        std::unique_ptr<amici::Model> threadModel;
+        try {
+            threadModel = numThreads > 1
+                    ? std::unique_ptr<amici::Model>(model->clone())
+                    : std::move(model);
+        } catch (...) {
+            saveException();
+        }
+
+#if defined(_OPENMP)
+        #pragma omp for schedule(dynamic)
+#endif
+        for(int i = 0; i < numConditions; ++i) {
+            if(failed)
+                continue;
+
+            try {
+                auto conditionIdx = workPackage.conditionIndices[i];
+                dataProvider->updateSimulationParametersAndScale(
+                            conditionIdx,
+                            workPackage.optimizationParameters,
+                            *threadModel);
+                Logger logger(workPackage.logPrefix
+                              + "c" + std::to_string(conditionIdx));
+                resultPackages[i] = runAndLogSimulation(
+                            *solver, *threadModel, conditionIdx, jobId,
+                            dataProvider, resultWriter, logLineSearch,
+                            &logger, sendStates,
+                            workPackage.sendOutputSensitivities,
+                            simulationLog);
+            } catch (...) {
+                saveException();
+            }
+        }
     }
 
+    if(exception)
+        std::rethrow_exception(exception);
+
+    AmiciSummedGradientFunction::ResultMap results;
+    for(int i = 0; i < numConditions; ++i)
+        results[workPackage.conditionIndices[i]] = std::move(resultPackages[i]);
+
 #if QUEUE_WORKER_H_VERBOSE >= 2
     printf("[%d] Work done. ", mpiRank);
     fflush(stdout);
 #endif
     // serialize to output buffer
-    buffer = amici::serializeToStdVec(results);
+    buffer = serializeResultPackages(results);
 }
 
 AmiciSummedGradientFunction::AmiciSummedGradientFunction(
@@ -596,6 +704,39 @@ AmiciSummedGradientFunction::AmiciSummedGradientFunction(
             std::getenv("PARPE_MAX_GRADIENT_SIMULATIONS_PER_PACKAGE")) {
         maxGradientSimulationsPerPackage = std::stoi(env);
     }
+
+    if(auto env = std::getenv("PARPE_NUM_THREADS_PER_WORKER")) {
+        numThreadsPerWorker = std::stoi(env);
+        RELEASE_ASSERT(numThreadsPerWorker > 0,
+                       "PARPE_NUM_THREADS_PER_WORKER must be positive.");
+    }
+
+    if(auto env = std::getenv("PARPE_NUM_AGGREGATION_THREADS")) {
+        numAggregationThreads = std::stoi(env);
+        RELEASE_ASSERT(numAggregationThreads > 0,
+                       "PARPE_NUM_AGGREGATION_THREADS must be positive.");
+    }
+
+    if(auto env = std::getenv("PARPE_DETERMINISTIC_REDUCTION")) {
+        deterministicReduction = env[0] == '1';
+    }
+
+    if(auto env = std::getenv("PARPE_PRIORITIZE_BY_COST")) {
+        prioritizeByCost = env[0] == '1';
+    }
+
+    static std::atomic<int> lastJobClientId(-1);
+    jobClientId = ++lastJobClientId;
+
+    if(auto env = std::getenv("PARPE_SIMULATION_LOG_BUFFER_SIZE")) {
+        simulationLogSize = std::stoi(env);
+        RELEASE_ASSERT(simulationLogSize > 0,
+                       "PARPE_SIMULATION_LOG_BUFFER_SIZE must be positive.");
+    }
+
+    if(auto env = std::getenv("PARPE_SIMULATION_LOG_FLUSH_INTERVAL")) {
+        simulationLogFlushInterval = std::stod(env);
+    }
 }
 
 FunctionEvaluationStatus AmiciSummedGradientFunction::evaluate(
@@ -635,9 +776,40 @@ FunctionEvaluationStatus AmiciSummedGradientFunction::evaluate(
         return functionEvaluationFailure;
     }
 
+    // only costs on all data are comparable
+    if(static_cast<int>(datasets.size())
+            == dataProvider->getNumberOfSimulationConditions())
+        reportCost(fval);
+
     return functionEvaluationSuccess;
 }
 
+void AmiciSummedGradientFunction::reportCost(double cost) const
+{
+    if(std::isfinite(cost))
+        bestCost = std::min(bestCost, cost);
+}
+
+double AmiciSummedGradientFunction::getJobPriority() const
+{
+    // lower cost -> higher priority
+    return prioritizeByCost && std::isfinite(bestCost) ? -bestCost : 0.0;
+}
+
+SimulationLogWriter *AmiciSummedGradientFunction::getSimulationLog() const
+{
+    if(!resultWriter)
+        return nullptr;
+
+    // don't start the writer thread unless anything is logged
+    std::call_once(simulationLogCreated, [this]() {
+        simulationLog = std::make_unique<SimulationLogWriter>(
+                    resultWriter->getH5File(), simulationLogSize,
+                    simulationLogFlushInterval);
+    });
+    return simulationLog.get();
+}
+
 int AmiciSummedGradientFunction::numParameters() const
 {
     return dataProvider->getNumOptimizationParameters();
@@ -651,7 +823,43 @@ FunctionEvaluationStatus AmiciSummedGradientFunction::getModelOutputs(
     return parpe::getModelOutputs(dataProvider, loadBalancer,
                                   maxSimulationsPerPackage, resultWriter,
                                   logLineSearch, parameters, modelOutput,
-                                  logger, cpuTime, sendStates);
+                                  logger, cpuTime, sendStates,
+                                  &runtimeHistory, nullptr,
+                                  jobClientId, getJobPriority(),
+                                  [this]() { return getSimulationLog(); },
+                                  numThreadsPerWorker);
+}
+
+FunctionEvaluationStatus
+AmiciSummedGradientFunction::getModelOutputsAndSensitivities(
+        gsl::span<const double> parameters,
+        std::vector<std::vector<double> > &modelOutput,
+        std::vector<std::vector<double> > &modelOutputSensitivities,
+        Logger *logger, double *cpuTime) const
+{
+    return parpe::getModelOutputs(dataProvider, loadBalancer,
+                                  maxGradientSimulationsPerPackage,
+                                  resultWriter, logLineSearch, parameters,
+                                  modelOutput, logger, cpuTime, sendStates,
+                                  &runtimeHistory, &modelOutputSensitivities,
+                                  jobClientId, getJobPriority(),
+                                  [this]() { return getSimulationLog(); },
+                                  numThreadsPerWorker);
+}
+
+void AmiciSummedGradientFunction::addSimulationGradient(
+        int conditionIdx, gsl::span<const double> simulationGradient,
+        gsl::span<const double> parameters, gsl::span<double> gradient) const
+{
+    std::vector<double> simulationParameters(model->np());
+    auto scaleSim = dataProvider->getParameterScaleSim(conditionIdx);
+    auto scaleOpt = dataProvider->getParameterScaleOpt();
+    dataProvider->mapAndSetOptimizationToSimulationVariables(
+                conditionIdx, parameters, simulationParameters, scaleOpt,
+                scaleSim);
+    dataProvider->mapSimulationToOptimizationGradientAddMultiply(
+                conditionIdx, simulationGradient, gradient,
+                simulationParameters, 1.0);
 }
 
 std::vector<std::vector<double> > AmiciSummedGradientFunction::getAllSigmas() const {
@@ -665,7 +873,15 @@ std::vector<std::vector<double> > AmiciSummedGradientFunction::getAllMeasurement
 
 void AmiciSummedGradientFunction::messageHandler(std::vector<char> &buffer, int jobId) const {
     parpe::messageHandler(dataProvider, resultWriter, logLineSearch, buffer,
-                          jobId, sendStates);
+                          jobId, sendStates, &parameterCache,
+                          [this]() { return getSimulationLog(); },
+                          numThreadsPerWorker);
+}
+
+void AmiciSummedGradientFunction::sharedDataHandler(
+        std::vector<char> &buffer) const
+{
+    parameterCache.handleSharedData(buffer);
 }
 
 amici::ParameterScaling AmiciSummedGradientFunction::getParameterScaling(
@@ -688,6 +904,41 @@ int AmiciSummedGradientFunction::runSimulations(
                 optimizationParameters.end());
     double simulationTimeSec = 0.0;
 
+    // Results are aggregated asynchronously on a thread pool, so that the
+    // load balancer can continue dispatching jobs. Each aggregation thread
+    // accumulates into its own buffers, which are reduced in fixed order
+    // after all simulations have finished.
+    struct AggregationBuffer {
+        int errors = 0;
+        double nllh = 0.0;
+        double simulationTimeSec = 0.0;
+        std::vector<double> gradient;
+    };
+    std::vector<AggregationBuffer> aggregationBuffers(numAggregationThreads);
+    // only functions evaluated on the master need threads
+    std::call_once(aggregationPoolCreated, [this]() {
+        aggregationPool = std::make_unique<ThreadPool>(numAggregationThreads);
+    });
+    for(auto &buffer: aggregationBuffers)
+        buffer.gradient.resize(objectiveFunctionGradient.size());
+
+    // In deterministic mode, contributions of all conditions are summed in
+    // fixed order instead. Memory usage of the reduction is logarithmic in
+    // the number of conditions if results arrive in order of dataIndices, so
+    // simulations are not reordered by expected runtime then (see below).
+    std::unique_ptr<TreeReduction> reduction;
+    std::vector<int> reductionTermIndices;
+    if(deterministicReduction) {
+        reduction = std::make_unique<TreeReduction>(
+                    dataIndices.size(), 1 + objectiveFunctionGradient.size());
+        if(!dataIndices.empty())
+            reductionTermIndices.resize(
+                        *std::max_element(dataIndices.begin(),
+                                          dataIndices.end()) + 1, -1);
+        for(int i = 0; i < static_cast<int>(dataIndices.size()); ++i)
+            reductionTermIndices[dataIndices[i]] = i;
+    }
+
     AmiciSimulationRunner simRunner(
                 parameterVector,
                 !objectiveFunctionGradient.empty()
@@ -695,32 +946,75 @@ int AmiciSummedGradientFunction::runSimulations(
                 : amici::SensitivityOrder::none,
                 dataIndices,
                 [&](JobData *job, int /*jobIdx*/) {
-        errors += aggregateLikelihood(*job,
-                                      nllh,
-                                      objectiveFunctionGradient,
-                                      simulationTimeSec,
-                                      optimizationParameters);
+        // Take over the results; job may be reused or destroyed afterwards
+        auto result = std::make_shared<JobData>();
+        result->recvBuffer = std::move(job->recvBuffer);
+        aggregationPool->post([&, result](int threadIdx) {
+            auto &buffer = aggregationBuffers[threadIdx];
+            buffer.errors += aggregateLikelihood(*result,
+                                                 buffer.nllh,
+                                                 buffer.gradient,
+                                                 buffer.simulationTimeSec,
+                                                 optimizationParameters,
+                                                 reduction.get(),
+                                                 reductionTermIndices);
+        });
     }, nullptr,  logger?logger->getPrefix():"");
+    if(!deterministicReduction)
+        simRunner.setRuntimeHistory(&runtimeHistory);
+    simRunner.setShareParameters(true);
+    simRunner.setJobClient(jobClientId, getJobPriority());
+    simRunner.setCancelOnFailure(true);
 
+    try {
 #ifdef PARPE_ENABLE_MPI
-    if (loadBalancer && loadBalancer->isRunning()) {
-        // When running simulations (without gradient),
-        // send more simulations to each worker
-        // to reduce communication overhead
-        errors += simRunner.runDistributedMemory(
-                    loadBalancer,
-                    !objectiveFunctionGradient.empty()
-                    ? maxGradientSimulationsPerPackage
-                    : maxSimulationsPerPackage);
-    } else {
+        if (loadBalancer && loadBalancer->isRunning()) {
+            // When running simulations (without gradient),
+            // send more simulations to each worker
+            // to reduce communication overhead
+            errors += simRunner.runDistributedMemory(
+                        loadBalancer,
+                        !objectiveFunctionGradient.empty()
+                        ? maxGradientSimulationsPerPackage
+                        : maxSimulationsPerPackage);
+        } else {
 #endif
-        errors += simRunner.runSharedMemory(
-                    [&](std::vector<char> &buffer, int jobId) {
-                messageHandler(buffer, jobId);
-    });
+            errors += simRunner.runSharedMemory(
+                        [&](std::vector<char> &buffer, int jobId) {
+                    messageHandler(buffer, jobId);
+        });
 #ifdef PARPE_ENABLE_MPI
-    }
+        }
 #endif
+    } catch (...) {
+        // queued tasks refer to local variables
+        try {
+            aggregationPool->wait();
+        } catch (...) {
+        }
+        throw;
+    }
+
+    aggregationPool->wait();
+    for(auto const& buffer: aggregationBuffers) {
+        errors += buffer.errors;
+        nllh += buffer.nllh;
+        simulationTimeSec += buffer.simulationTimeSec;
+        for(int i = 0; i < static_cast<int>(buffer.gradient.size()); ++i)
+            objectiveFunctionGradient[i] += buffer.gradient[i];
+    }
+
+    if(reduction && reduction->isComplete()) {
+        auto const& sum = reduction->getResult();
+        nllh += sum[0];
+        for(int i = 0; i < static_cast<int>(objectiveFunctionGradient.size());
+            ++i)
+            objectiveFunctionGradient[i] += sum[i + 1];
+    } else if(reduction) {
+        // missing results
+        ++errors;
+    }
+
     if(cpuTime)
         *cpuTime = simulationTimeSec;
 
@@ -731,27 +1025,39 @@ int AmiciSummedGradientFunction::aggregateLikelihood(
         JobData &data, double &negLogLikelihood,
         gsl::span<double> negLogLikelihoodGradient,
         double &simulationTimeInS,
-        gsl::span<const double> optimizationParameters) const
+        gsl::span<const double> optimizationParameters,
+        TreeReduction *reduction,
+        gsl::span<const int> reductionTermIndices) const
 {
     int errors = 0;
 
-    // deserialize
-    auto results =
-            amici::deserializeFromChar<ResultMap> (
-                data.recvBuffer.data(), data.recvBuffer.size());
-    data.recvBuffer = std::vector<char>(); // free buffer
+    // read results in place
+    ResultPackagesView results(data.recvBuffer);
 
+    for (int i = 0; i < results.size(); ++i) {
+        int conditionIdx = results.conditionIndex(i);
 
-    for (auto const& result : results) {
-        int conditionIdx;
-        ResultPackage resultPackage;
-        std::tie(conditionIdx, resultPackage) = result;
+        errors += results.status(i) != AMICI_SUCCESS;
 
-        errors += resultPackage.status != AMICI_SUCCESS;
+        // contribution of this condition: added directly, or as separate
+        // term to the reduction
+        std::vector<double> term;
+        double *negLogLikelihoodTarget = &negLogLikelihood;
+        auto negLogLikelihoodGradientTarget = negLogLikelihoodGradient;
+        if(reduction) {
+            term.assign(1 + negLogLikelihoodGradient.size(), 0.0);
+            negLogLikelihoodTarget = &term[0];
+            negLogLikelihoodGradientTarget = gsl::make_span(term).subspan(1);
+        }
 
         // sum up
-        negLogLikelihood -= resultPackage.llh;
-        simulationTimeInS += resultPackage.simulationTimeSeconds;
+        *negLogLikelihoodTarget -= results.llh(i);
+        simulationTimeInS += results.simulationTimeSeconds(i);
+        runtimeHistory.record(conditionIdx,
+                              negLogLikelihoodGradient.empty()
+                              ? amici::SensitivityOrder::none
+                              : amici::SensitivityOrder::first,
+                              results.simulationTimeSeconds(i));
 
         if (!negLogLikelihoodGradient.empty()) {
             std::vector<double> p(model->np());
@@ -762,10 +1068,16 @@ int AmiciSummedGradientFunction::aggregateLikelihood(
                         conditionIdx, optimizationParameters, p, scaleOpt,
                         scaleSim);
             addSimulationGradientToObjectiveFunctionGradient(
-                        conditionIdx, resultPackage.gradient,
-                        negLogLikelihoodGradient, p);
+                        conditionIdx, results.gradient(i),
+                        negLogLikelihoodGradientTarget, p);
         }
+
+        if(reduction)
+            reduction->add(reductionTermIndices[conditionIdx],
+                           std::move(term));
     }
+    data.recvBuffer = std::vector<char>(); // free buffer
+
     return errors;
 }
 
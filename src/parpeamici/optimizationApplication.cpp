@@ -166,7 +166,11 @@ void OptimizationApplication::logParPEVersion(hid_t file_id) const
 void OptimizationApplication::initMPI(int *argc, char ***argv) {
 #ifdef PARPE_ENABLE_MPI
 
-    int mpiErr = MPI_Init(argc, argv);
+    // MPI_THREAD_MULTIPLE allows the load balancer to block while waiting
+    // for replies, see LoadBalancerMaster::waitForEvent
+    int threadSupport = MPI_THREAD_SINGLE;
+    int mpiErr = MPI_Init_thread(argc, argv, MPI_THREAD_MULTIPLE,
+                                 &threadSupport);
     if (mpiErr != MPI_SUCCESS) {
         logmessage(LOGLVL_CRITICAL, "Problem initializing MPI. Exiting.");
         exit(1);
@@ -248,18 +252,24 @@ void OptimizationApplication::runMaster() {
 void OptimizationApplication::runWorker() {
     // TODO: Move out of here
     LoadBalancerWorker lbw;
-    lbw.run([this](std::vector<char> &buffer, int jobId) {
-        // TODO: this is so damn ugly
-        auto sgf = dynamic_cast<SummedGradientFunctionGradientFunctionAdapter<int>*>(problem->costFun.get());
-        if(sgf) {
-            // non-hierarchical
-            dynamic_cast<AmiciSummedGradientFunction*>(sgf->getWrappedFunction())->messageHandler(buffer, jobId);
-        } else {
-            // hierarchical
-            auto hierarch = dynamic_cast<HierarchicalOptimizationWrapper *>(problem->costFun.get());
-            RELEASE_ASSERT(hierarch, "");
-            hierarch->fun->messageHandler(buffer, jobId);
-        }
+    // TODO: this is so damn ugly
+    AmiciSummedGradientFunction *fun = nullptr;
+    auto sgf = dynamic_cast<SummedGradientFunctionGradientFunctionAdapter<int>*>(problem->costFun.get());
+    if(sgf) {
+        // non-hierarchical
+        fun = dynamic_cast<AmiciSummedGradientFunction*>(sgf->getWrappedFunction());
+    } else {
+        // hierarchical
+        auto hierarch = dynamic_cast<HierarchicalOptimizationWrapper *>(problem->costFun.get());
+        RELEASE_ASSERT(hierarch, "");
+        fun = hierarch->fun.get();
+    }
+    RELEASE_ASSERT(fun, "");
+
+    lbw.run([fun](std::vector<char> &buffer, int jobId) {
+        fun->messageHandler(buffer, jobId);
+    }, [fun](std::vector<char> &buffer) {
+        fun->sharedDataHandler(buffer);
     });
 }
 #endif
@@ -363,7 +373,7 @@ void saveTotalCpuTime(hid_t file_id, const double timeInSeconds)
 {
     hsize_t dims[1] = {1};
 
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file_id);
 
     //std::string pathStr = rootPath + "/totalTimeInSec";
     std::string pathStr = "/totalTimeInSec";
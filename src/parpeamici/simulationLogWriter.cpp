@@ -0,0 +1,178 @@
+#include <parpeamici/simulationLogWriter.h>
+
+#include <parpecommon/hdf5Misc.h>
+#include <parpecommon/misc.h>
+
+#include <cmath>
+#include <utility>
+
+namespace parpe {
+
+namespace {
+
+std::size_t gradientSize(SimulationLogRecord const& record) {
+    return record.gradient.empty() ? record.parameters.size()
+                                   : record.gradient.size();
+}
+
+/** Records can be written in the same batch */
+bool isCompatible(SimulationLogRecord const& a, SimulationLogRecord const& b) {
+    return a.path == b.path
+            && a.parameters.size() == b.parameters.size()
+            && gradientSize(a) == gradientSize(b);
+}
+
+void appendDouble2D(H5::H5File const& file, std::string const& path,
+                    hsize_t stride, gsl::span<const double> buffer) {
+    if (!hdf5DatasetExists(file.getId(), path))
+        hdf5CreateExtendableDouble2DArray(file.getId(), path.c_str(), stride);
+    hdf5Extend2ndDimensionAndWriteToDouble2DArray(
+                file.getId(), path.c_str(), buffer);
+}
+
+void appendInt2D(H5::H5File const& file, std::string const& path,
+                 gsl::span<const int> buffer) {
+    if (!hdf5DatasetExists(file.getId(), path))
+        hdf5CreateExtendableInt2DArray(file.getId(), path.c_str(), 1);
+    hdf5Extend2ndDimensionAndWriteToInt2DArray(
+                file.getId(), path.c_str(), buffer);
+}
+
+/** Write records which are compatible with each other */
+void saveSimulationBatch(H5::H5File const& file,
+                         gsl::span<SimulationLogRecord const> records) {
+    auto const& path = records[0].path;
+    auto numRecords = static_cast<std::size_t>(records.size());
+    auto numParameters = records[0].parameters.size();
+    auto numGradient = gradientSize(records[0]);
+
+    hdf5EnsureGroupExists(file.getId(), path);
+
+    // datasets are (stride x numRecords); buffers are row-major
+    std::vector<double> llh(numRecords);
+    std::vector<double> wallTime(numRecords);
+    std::vector<int> jobId(numRecords);
+    std::vector<int> status(numRecords);
+    std::vector<std::string> label(numRecords);
+    std::vector<double> gradient(numGradient * numRecords, NAN);
+    std::vector<double> parameters(numParameters * numRecords);
+
+    for (std::size_t i = 0; i < numRecords; ++i) {
+        auto const& record = records[i];
+        llh[i] = record.llh;
+        wallTime[i] = record.timeElapsedInSeconds;
+        jobId[i] = record.jobId;
+        status[i] = record.status;
+        label[i] = record.label;
+        for (std::size_t j = 0; j < record.gradient.size(); ++j)
+            gradient[j * numRecords + i] = record.gradient[j];
+        for (std::size_t j = 0; j < numParameters; ++j)
+            parameters[j * numRecords + i] = record.parameters[j];
+    }
+
+    appendDouble2D(file, path + "/simulationLogLikelihood", 1, llh);
+    appendInt2D(file, path + "/jobId", jobId);
+    if (numGradient)
+        appendDouble2D(file, path + "/simulationLogLikelihoodGradient",
+                       numGradient, gradient);
+    if (numParameters)
+        appendDouble2D(file, path + "/simulationParameters",
+                       numParameters, parameters);
+    appendDouble2D(file, path + "/simulationWallTimeInSec", 1, wallTime);
+    appendInt2D(file, path + "/simulationStatus", status);
+
+    auto labelPath = path + "/simulationLabel";
+    if (!hdf5DatasetExists(file.getId(), labelPath))
+        hdf5CreateExtendableString1DArray(file.getId(), labelPath.c_str());
+    hdf5ExtendAndWriteToString1DArray(file.getId(), labelPath.c_str(), label);
+}
+
+} // anonymous namespace
+
+
+void saveSimulations(H5::H5File const& file,
+                     gsl::span<SimulationLogRecord const> records)
+{
+    auto lock = hdf5MutexGetLock(file.getId());
+
+    auto batchBegin = records.begin();
+    while (batchBegin != records.end()) {
+        auto batchEnd = batchBegin + 1;
+        while (batchEnd != records.end() && isCompatible(*batchBegin, *batchEnd))
+            ++batchEnd;
+
+        saveSimulationBatch(file, gsl::make_span(&*batchBegin,
+                                                 batchEnd - batchBegin));
+        batchBegin = batchEnd;
+    }
+}
+
+
+SimulationLogWriter::SimulationLogWriter(H5::H5File file,
+                                         int capacity,
+                                         double flushIntervalSeconds)
+    : BackgroundHdf5Writer(std::move(file), flushIntervalSeconds)
+{
+    RELEASE_ASSERT(capacity > 0, "Simulation log capacity must be positive.");
+    records.resize(capacity);
+    start();
+}
+
+SimulationLogWriter::~SimulationLogWriter()
+{
+    stop();
+}
+
+void SimulationLogWriter::log(SimulationLogRecord record)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    int capacity = records.size();
+    if (numBuffered == capacity) {
+        notifyWriter();
+        batchProcessed.wait(lock, [this, capacity] {
+            return numBuffered < capacity;
+        });
+    }
+
+    records[(first + numBuffered) % capacity] = std::move(record);
+    ++numBuffered;
+
+    if (isWriteDue())
+        notifyWriter();
+}
+
+int SimulationLogWriter::getNumRecordsWritten() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return numWritten;
+}
+
+bool SimulationLogWriter::hasBufferedData() const
+{
+    return numBuffered > 0;
+}
+
+bool SimulationLogWriter::isWriteDue() const
+{
+    return numBuffered >= (static_cast<int>(records.size()) + 1) / 2;
+}
+
+void SimulationLogWriter::takeBatch()
+{
+    int capacity = records.size();
+    batch.clear();
+    for (int i = 0; i < numBuffered; ++i)
+        batch.push_back(std::move(records[(first + i) % capacity]));
+    first = (first + numBuffered) % capacity;
+    numBuffered = 0;
+}
+
+void SimulationLogWriter::writeBatch()
+{
+    saveSimulations(file, batch);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    numWritten += batch.size();
+}
+
+} // namespace parpe
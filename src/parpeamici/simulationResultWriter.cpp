@@ -12,7 +12,7 @@ SimulationResultWriter::SimulationResultWriter(H5::H5File const& file,
                                                std::string rootPath)
     : rootPath(std::move(rootPath))
 {
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
     this->file = file;
 
     updatePaths();
@@ -31,7 +31,7 @@ SimulationResultWriter::SimulationResultWriter(const std::string &hdf5FileName,
 void SimulationResultWriter::createDatasets(hsize_t numSimulations)
 {
 
-    auto lock = parpe::hdf5MutexGetLock();
+    auto lock = parpe::hdf5MutexGetLock(file.getId());
 
 
     double fillValueDbl = NAN;   /* Fill value for the dataset */
@@ -85,7 +85,7 @@ void SimulationResultWriter::saveSimulationResults(
     saveStates(rdata->x, rdata->nt, rdata->nx, simulationIdx);
     saveLikelihood(rdata->llh, simulationIdx);
     // TODO: model or edata? saveParameters(edata->parameters)
-    auto lock = parpe::hdf5MutexGetLock();
+    auto lock = parpe::hdf5MutexGetLock(file.getId());
 
     file.flush(H5F_SCOPE_LOCAL);
 }
@@ -96,7 +96,7 @@ void SimulationResultWriter::saveTimepoints(gsl::span<const double> timepoints,
     if(timepoints.empty())
         return;
 
-    auto lock = parpe::hdf5MutexGetLock();
+    auto lock = parpe::hdf5MutexGetLock(file.getId());
 
     // Create dataset
     constexpr int rank = 1;
@@ -122,7 +122,7 @@ void SimulationResultWriter::saveMeasurements(
                    static_cast<decltype(measurements)::index_type>(nt * nytrue),
                    "");
 
-    auto lock = parpe::hdf5MutexGetLock();
+    auto lock = parpe::hdf5MutexGetLock(file.getId());
 
     // Create dataset
     constexpr int rank = 2;
@@ -147,7 +147,7 @@ void SimulationResultWriter::saveModelOutputs(
     RELEASE_ASSERT(outputs.size() ==
                    static_cast<decltype(outputs)::index_type>(nt * nytrue), "");
 
-    auto lock = parpe::hdf5MutexGetLock();
+    auto lock = parpe::hdf5MutexGetLock(file.getId());
 
     // Create dataset
     constexpr int rank = 2;
@@ -172,7 +172,7 @@ void SimulationResultWriter::saveStates(
     RELEASE_ASSERT(states.size() ==
                    static_cast<decltype(states)::index_type>(nt * nx), "");
 
-    auto lock = parpe::hdf5MutexGetLock();
+    auto lock = parpe::hdf5MutexGetLock(file.getId());
 
     // Create dataset
     constexpr int rank = 2;
@@ -191,7 +191,7 @@ void SimulationResultWriter::saveParameters(gsl::span<const double> parameters,
     if(parameters.empty())
         return;
 
-    auto lock = parpe::hdf5MutexGetLock();
+    auto lock = parpe::hdf5MutexGetLock(file.getId());
 
     // Create dataset
     constexpr int rank = 1;
@@ -211,7 +211,7 @@ void SimulationResultWriter::saveLikelihood(double llh, int simulationIdx) const
         return;
     }
 
-    auto lock = parpe::hdf5MutexGetLock();
+    auto lock = parpe::hdf5MutexGetLock(file.getId());
 
     auto dataset = file.openDataSet(llhPath);
 
@@ -230,7 +230,7 @@ void SimulationResultWriter::saveLikelihood(double llh, int simulationIdx) const
 
 H5::H5File SimulationResultWriter::reopenFile()
 {
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
     return H5::H5File(file.getId());
 }
 
@@ -0,0 +1,329 @@
+#include <parpeamici/simulationWireFormat.h>
+
+#include <parpecommon/parpeException.h>
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+namespace parpe {
+
+namespace {
+
+constexpr std::uint32_t wireMagic = 0x45505050; // "PPPE"
+
+enum class WireMessageType : std::uint16_t {
+    workPackage = 1,
+    resultPackages = 2
+};
+
+/** Common message header */
+struct WireHeader {
+    std::uint32_t magic;
+    std::uint16_t version;
+    WireMessageType type;
+    /** Number of result entries, or conditions for work packages */
+    std::uint32_t count;
+    std::uint32_t reserved;
+};
+
+/** Follows WireHeader in work packages, followed by the parameters (double),
+ * condition indices (int32) and log prefix (char) */
+struct WireWorkPackage {
+    std::int32_t sensitivityOrder;
+    std::int32_t parameterEpoch;
+    /** Bit 0: sendOutputSensitivities */
+    std::uint64_t flags;
+    std::uint64_t numParameters;
+    std::uint64_t logPrefixLength;
+};
+
+/** Array reference, offset in bytes from start of message */
+struct WireArray {
+    std::uint64_t offset;
+    std::uint64_t size;
+};
+
+/** Table entry for a single result, following WireHeader */
+struct WireResult {
+    std::int32_t conditionIdx;
+    std::int32_t status;
+    double llh;
+    double simulationTimeSeconds;
+    WireArray gradient;
+    WireArray modelOutput;
+    WireArray modelStates;
+    WireArray modelOutputSensitivities;
+};
+
+static_assert(sizeof(WireHeader) % alignof(double) == 0, "");
+static_assert(sizeof(WireWorkPackage) % alignof(double) == 0, "");
+static_assert(sizeof(WireResult) % alignof(double) == 0, "");
+
+template<typename T>
+void append(std::vector<char> &buffer, std::size_t &offset,
+            T const* data, std::size_t count) {
+    if(count == 0)
+        return;
+    std::memcpy(&buffer[offset], data, count * sizeof(T));
+    offset += count * sizeof(T);
+}
+
+template<typename T>
+T readAt(gsl::span<char const> buffer, std::size_t offset) {
+    if(offset + sizeof(T) > static_cast<std::size_t>(buffer.size()))
+        throw ParPEException("Truncated simulation message.");
+    T result;
+    std::memcpy(&result, buffer.data() + offset, sizeof(T));
+    return result;
+}
+
+WireHeader readHeader(gsl::span<char const> buffer, WireMessageType type) {
+    auto header = readAt<WireHeader>(buffer, 0);
+    if(header.magic != wireMagic || header.type != type)
+        throw ParPEException("Invalid simulation message.");
+    if(header.version != simulationWireFormatVersion)
+        throw ParPEException(
+                "Unsupported simulation message format version "
+                + std::to_string(header.version) + ", expected "
+                + std::to_string(simulationWireFormatVersion) + ".");
+    return header;
+}
+
+} // namespace
+
+
+std::vector<char> serializeWorkPackage(
+        const AmiciSimulationRunner::AmiciWorkPackageSimple &work)
+{
+    WireHeader header {wireMagic, simulationWireFormatVersion,
+                WireMessageType::workPackage,
+                static_cast<std::uint32_t>(work.conditionIndices.size()), 0};
+    WireWorkPackage workHeader {
+        static_cast<std::int32_t>(work.sensitivityOrder),
+                work.parameterEpoch,
+                work.sendOutputSensitivities ? 1u : 0u,
+                work.optimizationParameters.size(),
+                work.logPrefix.size()};
+
+    std::vector<char> buffer(
+                sizeof(WireHeader) + sizeof(WireWorkPackage)
+                + work.optimizationParameters.size() * sizeof(double)
+                + work.conditionIndices.size() * sizeof(std::int32_t)
+                + work.logPrefix.size());
+    std::size_t offset = 0;
+    append(buffer, offset, &header, 1);
+    append(buffer, offset, &workHeader, 1);
+    append(buffer, offset, work.optimizationParameters.data(),
+           work.optimizationParameters.size());
+    static_assert(sizeof(int) == sizeof(std::int32_t), "");
+    append(buffer, offset, work.conditionIndices.data(),
+           work.conditionIndices.size());
+    append(buffer, offset, work.logPrefix.data(), work.logPrefix.size());
+
+    return buffer;
+}
+
+AmiciSimulationRunner::AmiciWorkPackageSimple deserializeWorkPackage(
+        gsl::span<const char> buffer)
+{
+    auto header = readHeader(buffer, WireMessageType::workPackage);
+    std::size_t offset = sizeof(WireHeader);
+    auto workHeader = readAt<WireWorkPackage>(buffer, offset);
+    offset += sizeof(WireWorkPackage);
+
+    std::size_t expectedSize =
+            offset + workHeader.numParameters * sizeof(double)
+            + header.count * sizeof(std::int32_t)
+            + workHeader.logPrefixLength;
+    if(expectedSize != static_cast<std::size_t>(buffer.size()))
+        throw ParPEException("Invalid work package size.");
+
+    AmiciSimulationRunner::AmiciWorkPackageSimple work;
+    work.sensitivityOrder =
+            static_cast<amici::SensitivityOrder>(workHeader.sensitivityOrder);
+    work.parameterEpoch = workHeader.parameterEpoch;
+    work.sendOutputSensitivities = workHeader.flags & 1u;
+
+    work.optimizationParameters.resize(workHeader.numParameters);
+    std::memcpy(work.optimizationParameters.data(), buffer.data() + offset,
+                workHeader.numParameters * sizeof(double));
+    offset += workHeader.numParameters * sizeof(double);
+
+    work.conditionIndices.resize(header.count);
+    std::memcpy(work.conditionIndices.data(), buffer.data() + offset,
+                header.count * sizeof(std::int32_t));
+    offset += header.count * sizeof(std::int32_t);
+
+    work.logPrefix.assign(buffer.data() + offset, workHeader.logPrefixLength);
+
+    return work;
+}
+
+std::vector<char> serializeResultPackages(
+        const std::map<int, AmiciSimulationRunner::AmiciResultPackageSimple>
+        &results)
+{
+    // compute size and offsets
+    std::size_t dataOffset = sizeof(WireHeader)
+            + results.size() * sizeof(WireResult);
+    std::vector<WireResult> entries;
+    entries.reserve(results.size());
+    auto addArray = [&dataOffset](std::vector<double> const& v) {
+        WireArray array {dataOffset, v.size()};
+        dataOffset += v.size() * sizeof(double);
+        return array;
+    };
+    for(auto const& result: results) {
+        auto const& package = result.second;
+        WireResult entry;
+        entry.conditionIdx = result.first;
+        entry.status = package.status;
+        entry.llh = package.llh;
+        entry.simulationTimeSeconds = package.simulationTimeSeconds;
+        entry.gradient = addArray(package.gradient);
+        entry.modelOutput = addArray(package.modelOutput);
+        entry.modelStates = addArray(package.modelStates);
+        entry.modelOutputSensitivities =
+                addArray(package.modelOutputSensitivities);
+        entries.push_back(entry);
+    }
+
+    std::vector<char> buffer(dataOffset);
+    WireHeader header {wireMagic, simulationWireFormatVersion,
+                WireMessageType::resultPackages,
+                static_cast<std::uint32_t>(results.size()), 0};
+    std::size_t offset = 0;
+    append(buffer, offset, &header, 1);
+    append(buffer, offset, entries.data(), entries.size());
+    for(auto const& result: results) {
+        auto const& package = result.second;
+        append(buffer, offset, package.gradient.data(),
+               package.gradient.size());
+        append(buffer, offset, package.modelOutput.data(),
+               package.modelOutput.size());
+        append(buffer, offset, package.modelStates.data(),
+               package.modelStates.size());
+        append(buffer, offset, package.modelOutputSensitivities.data(),
+               package.modelOutputSensitivities.size());
+    }
+
+    return buffer;
+}
+
+ResultPackagesView::ResultPackagesView(gsl::span<const char> buffer)
+    : buffer(buffer)
+{
+    auto header = readHeader(buffer, WireMessageType::resultPackages);
+    numResults = static_cast<int>(header.count);
+
+    if(reinterpret_cast<std::uintptr_t>(buffer.data()) % alignof(double))
+        throw ParPEException("Result message buffer is misaligned.");
+
+    auto bufferSize = static_cast<std::size_t>(buffer.size());
+    if(sizeof(WireHeader) + numResults * sizeof(WireResult) > bufferSize)
+        throw ParPEException("Truncated simulation message.");
+
+    auto checkArray = [bufferSize](WireArray const& array) {
+        if(array.offset % alignof(double)
+                || array.offset + array.size * sizeof(double) > bufferSize)
+            throw ParPEException("Invalid array in simulation message.");
+    };
+    for(int i = 0; i < numResults; ++i) {
+        auto entry = readAt<WireResult>(
+                    buffer, sizeof(WireHeader) + i * sizeof(WireResult));
+        checkArray(entry.gradient);
+        checkArray(entry.modelOutput);
+        checkArray(entry.modelStates);
+        checkArray(entry.modelOutputSensitivities);
+    }
+}
+
+int ResultPackagesView::size() const
+{
+    return numResults;
+}
+
+#define PARPE_WIRE_RESULT_FIELD(i, field) \
+    readAt<decltype(WireResult::field)>( \
+        buffer, sizeof(WireHeader) + (i) * sizeof(WireResult) \
+        + offsetof(WireResult, field))
+
+int ResultPackagesView::conditionIndex(int i) const
+{
+    return PARPE_WIRE_RESULT_FIELD(i, conditionIdx);
+}
+
+double ResultPackagesView::llh(int i) const
+{
+    return PARPE_WIRE_RESULT_FIELD(i, llh);
+}
+
+double ResultPackagesView::simulationTimeSeconds(int i) const
+{
+    return PARPE_WIRE_RESULT_FIELD(i, simulationTimeSeconds);
+}
+
+int ResultPackagesView::status(int i) const
+{
+    return PARPE_WIRE_RESULT_FIELD(i, status);
+}
+
+static gsl::span<double const> getArray(gsl::span<char const> buffer,
+                                        WireArray const& array) {
+    return gsl::make_span(
+                reinterpret_cast<double const*>(buffer.data() + array.offset),
+                array.size);
+}
+
+gsl::span<const double> ResultPackagesView::gradient(int i) const
+{
+    return getArray(buffer, PARPE_WIRE_RESULT_FIELD(i, gradient));
+}
+
+gsl::span<const double> ResultPackagesView::modelOutput(int i) const
+{
+    return getArray(buffer, PARPE_WIRE_RESULT_FIELD(i, modelOutput));
+}
+
+gsl::span<const double> ResultPackagesView::modelStates(int i) const
+{
+    return getArray(buffer, PARPE_WIRE_RESULT_FIELD(i, modelStates));
+}
+
+gsl::span<const double> ResultPackagesView::modelOutputSensitivities(
+        int i) const
+{
+    return getArray(buffer,
+                    PARPE_WIRE_RESULT_FIELD(i, modelOutputSensitivities));
+}
+
+#undef PARPE_WIRE_RESULT_FIELD
+
+AmiciSimulationRunner::AmiciResultPackageSimple ResultPackagesView::get(
+        int i) const
+{
+    auto gradient = this->gradient(i);
+    auto modelOutput = this->modelOutput(i);
+    auto modelStates = this->modelStates(i);
+    auto modelOutputSensitivities = this->modelOutputSensitivities(i);
+    return AmiciSimulationRunner::AmiciResultPackageSimple {
+        llh(i), simulationTimeSeconds(i),
+                std::vector<double>(gradient.begin(), gradient.end()),
+                std::vector<double>(modelOutput.begin(), modelOutput.end()),
+                std::vector<double>(modelStates.begin(), modelStates.end()),
+                status(i),
+                std::vector<double>(modelOutputSensitivities.begin(),
+                                    modelOutputSensitivities.end())};
+}
+
+std::map<int, AmiciSimulationRunner::AmiciResultPackageSimple>
+ResultPackagesView::toMap() const
+{
+    std::map<int, AmiciSimulationRunner::AmiciResultPackageSimple> results;
+    for(int i = 0; i < numResults; ++i)
+        results[conditionIndex(i)] = get(i);
+    return results;
+}
+
+} // namespace parpe
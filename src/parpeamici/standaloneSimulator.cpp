@@ -4,6 +4,7 @@
 #include <parpeamici/hierarchicalOptimization.h>
 #include <parpeamici/multiConditionDataProvider.h>
 #include <parpeamici/simulationResultWriter.h>
+#include <parpeamici/simulationWireFormat.h>
 #include <parpecommon/misc.h>
 #include <parpeloadbalancer/loadBalancerMaster.h>
 #include <parpeoptimization/optimizationOptions.h>
@@ -101,7 +102,7 @@ StandaloneSimulator::run(const std::string& resultFile,
           std::move(hierarchicalSigmaReader),
           dataProvider->getNumberOfSimulationConditions(),
           model->nytrue,
-          ErrorModel::normal);
+          getErrorModelFromEnvironment());
         std::cout << "Need to compute analytical parameters: "
                   << conditionFilePath << "  "
                   << proportionalityFactorIndices.size()
@@ -132,7 +133,7 @@ StandaloneSimulator::run(const std::string& resultFile,
 
         auto resultFileH5 = rw.reopenFile();
         hdf5EnsureGroupExists(resultFileH5.getId(), resultPath.c_str());
-        auto lock = hdf5MutexGetLock();
+        auto lock = hdf5MutexGetLock(resultFileH5.getId());
         amici::hdf5::createAndWriteDouble1DDataset(
           resultFileH5, resultPath + "/problemParameters", parameters);
     }
@@ -159,10 +160,8 @@ StandaloneSimulator::run(const std::string& resultFile,
                            if (needComputeAnalyticalParameters)
                                return;
 
-                           auto results = amici::deserializeFromChar<std::map<
-                             int,
-                             AmiciSimulationRunner::AmiciResultPackageSimple>>(
-                             job->recvBuffer.data(), job->recvBuffer.size());
+                           auto results = ResultPackagesView(job->recvBuffer)
+                                            .toMap();
                            job->recvBuffer = std::vector<char>(); // free buffer
 
                            for (auto const& result : results) {
@@ -208,10 +207,7 @@ StandaloneSimulator::run(const std::string& resultFile,
 
                // collect all model outputs
                for (auto& job : jobs) {
-                   auto results = amici::deserializeFromChar<
-                     std::map<int,
-                              AmiciSimulationRunner::AmiciResultPackageSimple>>(
-                     job.recvBuffer.data(), job.recvBuffer.size());
+                   auto results = ResultPackagesView(job.recvBuffer).toMap();
                    job.recvBuffer = std::vector<char>(); // free buffer
                    for (auto& result : results) {
                        swap(simulationResults[result.first], result.second);
@@ -225,18 +221,19 @@ StandaloneSimulator::run(const std::string& resultFile,
 
                // TODO: redundant with hierarchicalOptimization.cpp
                //  compute scaling factors and offset parameters
-               auto allMeasurements = dataProvider->getAllMeasurements();
+               auto const& allMeasurements = hierarchical.getMeasurements();
                RELEASE_ASSERT(dataIndices.size() == allMeasurements.size(), "");
 
+               ConditionMatrices scaledModelOutputs(modelOutputs);
                auto scalings = hierarchical.computeAnalyticalScalings(
-                 allMeasurements, modelOutputs);
+                 allMeasurements, scaledModelOutputs);
                auto offsets = hierarchical.computeAnalyticalOffsets(
-                 allMeasurements, modelOutputs);
-               hierarchical.applyOptimalScalings(scalings, modelOutputs);
-               hierarchical.applyOptimalOffsets(offsets, modelOutputs);
+                 allMeasurements, scaledModelOutputs);
+               hierarchical.applyOptimalScalings(scalings, scaledModelOutputs);
+               hierarchical.applyOptimalOffsets(offsets, scaledModelOutputs);
                auto sigmas = hierarchical.computeAnalyticalSigmas(
-                 allMeasurements, modelOutputs);
-               auto fullSigmaMatrices = hierarchical.fun->getAllSigmas();
+                 allMeasurements, scaledModelOutputs);
+               auto fullSigmaMatrices = hierarchical.getSigmas();
                if (!hierarchical.getSigmaParameterIndices().empty()) {
                    hierarchical.fillInAnalyticalSigmas(fullSigmaMatrices,
                                                        sigmas);
@@ -254,7 +251,7 @@ StandaloneSimulator::run(const std::string& resultFile,
                auto resultFileH5 = rw.reopenFile();
                hdf5EnsureGroupExists(resultFileH5.getId(), resultPath.c_str());
                {
-                   auto lock = hdf5MutexGetLock();
+                   auto lock = hdf5MutexGetLock(resultFileH5.getId());
                    amici::hdf5::createAndWriteDouble1DDataset(
                      resultFileH5, resultPath + "/problemParameters", parameters);
                    hdf5Write1dStringDataset(resultFileH5,
@@ -277,7 +274,7 @@ StandaloneSimulator::run(const std::string& resultFile,
                     ++conditionIdx) {
                    double llh = -parpe::computeNegLogLikelihood(
                      allMeasurements[conditionIdx],
-                     modelOutputs[conditionIdx],
+                     scaledModelOutputs[conditionIdx],
                      fullSigmaMatrices[conditionIdx]);
 
                    auto edata = dataProvider->getExperimentalDataForCondition(
@@ -291,7 +288,7 @@ StandaloneSimulator::run(const std::string& resultFile,
                                        edata->nt(),
                                        edata->nytrue(),
                                        conditionIdx);
-                   rw.saveModelOutputs(modelOutputs[conditionIdx],
+                   rw.saveModelOutputs(scaledModelOutputs[conditionIdx],
                                        edata->nt(),
                                        model->nytrue,
                                        conditionIdx);
@@ -337,9 +334,8 @@ StandaloneSimulator::messageHandler(std::vector<char>& buffer, int /*jobId*/)
     // unpack simulation job data
     auto model = dataProvider->getModel();
     auto solver = dataProvider->getSolver();
-    auto sim =
-      amici::deserializeFromChar<AmiciSimulationRunner::AmiciWorkPackageSimple>(
-        buffer.data(), buffer.size());
+    auto sim = deserializeWorkPackage(buffer);
+    parameterCache.resolve(sim);
     solver->setSensitivityOrder(sim.sensitivityOrder);
 
 #if QUEUE_WORKER_H_VERBOSE >= 2
@@ -363,7 +359,13 @@ StandaloneSimulator::messageHandler(std::vector<char>& buffer, int /*jobId*/)
     fflush(stdout);
 #endif
 
-    buffer = amici::serializeToStdVec(results);
+    buffer = serializeResultPackages(results);
+}
+
+void
+StandaloneSimulator::sharedDataHandler(std::vector<char>& buffer)
+{
+    parameterCache.handleSharedData(buffer);
 }
 
 AmiciSimulationRunner::AmiciResultPackageSimple
@@ -417,7 +419,7 @@ StandaloneSimulator::runSimulation(int conditionIdx,
 std::vector<double>
 getFinalParameters(std::string const& startIndex, H5::H5File const& file)
 {
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
 
     // find last iteration /multistarts/$/iteration/$/costFunParameters
     std::string iterationPath =
@@ -522,7 +524,7 @@ getFunctionEvaluationWithMinimalCost(std::string const& datasetPath,
 std::vector<std::vector<double>>
 getParameterTrajectory(std::string const& startIndex, H5::H5File const& file)
 {
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
 
     std::string parameterPath =
       std::string("/multistarts/") + startIndex + "/iterCostFunParameters";
@@ -748,9 +750,13 @@ runSimulator(MultiConditionDataProvider& dp,
             loadBalancer.sendTerminationSignalToAllWorkers();
         } else {
             parpe::LoadBalancerWorker lbw;
-            lbw.run([&sim](std::vector<char>& buffer, int jobId) {
-                sim.messageHandler(buffer, jobId);
-            });
+            lbw.run(
+              [&sim](std::vector<char>& buffer, int jobId) {
+                  sim.messageHandler(buffer, jobId);
+              },
+              [&sim](std::vector<char>& buffer) {
+                  sim.sharedDataHandler(buffer);
+              });
         }
     } else {
 #endif
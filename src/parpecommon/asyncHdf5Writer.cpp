@@ -0,0 +1,113 @@
+#include <parpecommon/asyncHdf5Writer.h>
+
+#include <parpecommon/hdf5Misc.h>
+#include <parpecommon/misc.h>
+
+#include <utility>
+
+namespace parpe {
+
+namespace {
+
+/** Convert rows (numRows x stride) to the (stride x numRows) layout of the
+ * dataset */
+template <typename T>
+std::vector<T> transpose(std::vector<T> const& rows, hsize_t stride,
+                         hsize_t numRows) {
+    std::vector<T> result(rows.size());
+    for (hsize_t row = 0; row < numRows; ++row)
+        for (hsize_t col = 0; col < stride; ++col)
+            result[col * numRows + row] = rows[row * stride + col];
+    return result;
+}
+
+} // anonymous namespace
+
+
+AsyncHdf5Writer::AsyncHdf5Writer(H5::H5File file, double flushIntervalSeconds)
+    : BackgroundHdf5Writer(std::move(file), flushIntervalSeconds)
+{
+    start();
+}
+
+AsyncHdf5Writer::~AsyncHdf5Writer()
+{
+    stop();
+}
+
+void AsyncHdf5Writer::appendToDouble2DArray(std::string const& parentPath,
+                                            std::string const& datasetName,
+                                            gsl::span<const double> row)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &buffer = getBuffer(parentPath, datasetName, row.size(), false);
+    buffer.doubles.insert(buffer.doubles.end(), row.begin(), row.end());
+    ++buffer.numRows;
+}
+
+void AsyncHdf5Writer::appendToInt2DArray(std::string const& parentPath,
+                                         std::string const& datasetName,
+                                         gsl::span<const int> row)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &buffer = getBuffer(parentPath, datasetName, row.size(), true);
+    buffer.ints.insert(buffer.ints.end(), row.begin(), row.end());
+    ++buffer.numRows;
+}
+
+bool AsyncHdf5Writer::hasBufferedData() const
+{
+    return !buffers.empty();
+}
+
+void AsyncHdf5Writer::takeBatch()
+{
+    batch.clear();
+    std::swap(batch, buffers);
+}
+
+AsyncHdf5Writer::DatasetBuffer &AsyncHdf5Writer::getBuffer(
+        std::string const& parentPath, std::string const& datasetName,
+        hsize_t stride, bool isInt)
+{
+    auto &buffer = buffers[parentPath + "/" + datasetName];
+    if (buffer.numRows == 0) {
+        buffer.parentPath = parentPath;
+        buffer.stride = stride;
+        buffer.isInt = isInt;
+    }
+    RELEASE_ASSERT(buffer.stride == stride && buffer.isInt == isInt,
+                   "Row does not match previous rows of this dataset.");
+    return buffer;
+}
+
+void AsyncHdf5Writer::writeBatch()
+{
+    auto lock = hdf5MutexGetLock(file.getId());
+
+    for (auto const& item : batch) {
+        auto const& path = item.first;
+        auto const& buffer = item.second;
+
+        hdf5EnsureGroupExists(file.getId(), buffer.parentPath.c_str());
+
+        if (buffer.isInt) {
+            if (!hdf5DatasetExists(file.getId(), path))
+                hdf5CreateExtendableInt2DArray(file.getId(), path.c_str(),
+                                               buffer.stride);
+            hdf5Extend2ndDimensionAndWriteToInt2DArray(
+                        file.getId(), path.c_str(),
+                        transpose(buffer.ints, buffer.stride, buffer.numRows));
+        } else {
+            if (!hdf5DatasetExists(file.getId(), path))
+                hdf5CreateExtendableDouble2DArray(file.getId(), path.c_str(),
+                                                  buffer.stride);
+            hdf5Extend2ndDimensionAndWriteToDouble2DArray(
+                        file.getId(), path.c_str(),
+                        transpose(buffer.doubles, buffer.stride,
+                                  buffer.numRows));
+        }
+    }
+}
+
+} // namespace parpe
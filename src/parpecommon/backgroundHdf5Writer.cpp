@@ -0,0 +1,165 @@
+#include <parpecommon/backgroundHdf5Writer.h>
+
+#include <parpecommon/hdf5Misc.h>
+#include <parpecommon/logging.h>
+#include <parpecommon/misc.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <set>
+#include <utility>
+
+namespace parpe {
+
+namespace {
+
+/** Running instances, for flushAll */
+std::mutex instancesMutex;
+std::set<BackgroundHdf5Writer *> instances;
+std::once_flag atexitRegistered;
+
+} // anonymous namespace
+
+
+BackgroundHdf5Writer::BackgroundHdf5Writer(H5::H5File file,
+                                           double flushIntervalSeconds)
+    : file(std::move(file)),
+      flushIntervalSeconds(flushIntervalSeconds)
+{
+    RELEASE_ASSERT(flushIntervalSeconds > 0,
+                   "Flush interval must be positive.");
+}
+
+BackgroundHdf5Writer::~BackgroundHdf5Writer()
+{
+    // the I/O thread calls virtual functions of the derived class
+    RELEASE_ASSERT(!writer.joinable(),
+                   "Derived class has to call stop() on destruction.");
+}
+
+void BackgroundHdf5Writer::flush()
+{
+    // the I/O thread needs that lock to finish
+    RELEASE_ASSERT(!hdf5MutexIsLockedByThisThread(file.getId()),
+                   "Must not flush while holding the HDF5 lock of the file.");
+
+    std::unique_lock<std::mutex> lock(mutex);
+    // everything buffered now goes into the next batch
+    auto target = numBatchesTaken + (hasBufferedData() ? 1 : 0);
+    ++numFlushRequests;
+    writeRequested.notify_one();
+    batchProcessed.wait(lock, [this, target] {
+        return numBatchesWritten >= target;
+    });
+    --numFlushRequests;
+
+    if (exception)
+        std::rethrow_exception(exception);
+}
+
+void BackgroundHdf5Writer::flushAll()
+{
+    std::lock_guard<std::mutex> lock(instancesMutex);
+    for (auto instance : instances) {
+        try {
+            instance->flush();
+        } catch (...) {
+            // reported on destruction
+        }
+    }
+}
+
+void BackgroundHdf5Writer::start()
+{
+    RELEASE_ASSERT(!writer.joinable(), "Writer is already running.");
+    writer = std::thread(&BackgroundHdf5Writer::run, this);
+
+    std::call_once(atexitRegistered, [] { std::atexit(flushAll); });
+    std::lock_guard<std::mutex> lock(instancesMutex);
+    instances.insert(this);
+}
+
+void BackgroundHdf5Writer::stop()
+{
+    if (!writer.joinable())
+        return;
+
+    RELEASE_ASSERT(!hdf5MutexIsLockedByThisThread(file.getId()),
+                   "Must not stop while holding the HDF5 lock of the file.");
+
+    {
+        std::lock_guard<std::mutex> lock(instancesMutex);
+        instances.erase(this);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    writeRequested.notify_one();
+    writer.join();
+
+    if (exception) {
+        try {
+            std::rethrow_exception(exception);
+        } catch (std::exception const& e) {
+            logmessage(LOGLVL_ERROR, "Failed to write to HDF5 file: %s",
+                       e.what());
+        } catch (H5::Exception const& e) {
+            logmessage(LOGLVL_ERROR, "Failed to write to HDF5 file: %s",
+                       e.getCDetailMsg());
+        }
+    }
+}
+
+void BackgroundHdf5Writer::notifyWriter()
+{
+    writeRequested.notify_one();
+}
+
+bool BackgroundHdf5Writer::isWriteDue() const
+{
+    return false;
+}
+
+void BackgroundHdf5Writer::run()
+{
+    auto flushInterval = std::chrono::duration<double>(flushIntervalSeconds);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        writeRequested.wait_for(lock, flushInterval, [this] {
+            return stopping || (hasBufferedData()
+                                && (numFlushRequests > 0 || isWriteDue()));
+        });
+
+        if (!hasBufferedData()) {
+            if (stopping)
+                break;
+            continue;
+        }
+
+        takeBatch();
+        ++numBatchesTaken;
+        // derived classes may wait for buffer space
+        batchProcessed.notify_all();
+
+        lock.unlock();
+        try {
+            writeBatch();
+            auto hdf5Lock = hdf5MutexGetLock(file.getId());
+            file.flush(H5F_SCOPE_LOCAL);
+        } catch (...) {
+            lock.lock();
+            if (!exception)
+                exception = std::current_exception();
+            lock.unlock();
+        }
+        lock.lock();
+
+        ++numBatchesWritten;
+        batchProcessed.notify_all();
+    }
+}
+
+} // namespace parpe
@@ -2,9 +2,12 @@
 #include <parpecommon/logging.h>
 #include <parpecommon/misc.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <sstream>
 #include <utility>
 #include <unistd.h>
@@ -14,19 +17,169 @@
 
 namespace parpe {
 
-/** mutex for **ALL** HDF5 library calls; read and write; any file(?) */
+/** Global mutex, see hdf5MutexGetLock(). Guards all HDF5 library calls if
+ * the library is not thread-safe. */
 static mutexHdfType mutexHdf;
 
+/** Per-file mutexes by file name, see hdf5MutexGetLock(hid_t). Entries are
+ * never removed. */
+static std::mutex fileMutexesMutex;
+static std::map<std::string, std::unique_ptr<mutexHdfType>> fileMutexes;
+
+/** Mutex for the file containing the given object, or the global mutex */
+static mutexHdfType &getFileMutex(hid_t objectId)
+{
+    if(!hdf5HasPerFileLocking() || objectId <= 0 || H5Iis_valid(objectId) <= 0)
+        return mutexHdf;
+
+    auto nameLength = H5Fget_name(objectId, nullptr, 0);
+    if(nameLength <= 0)
+        return mutexHdf;
+    std::string fileName(nameLength, '\0');
+    H5Fget_name(objectId, &fileName[0], nameLength + 1);
+
+    std::lock_guard<std::mutex> lock(fileMutexesMutex);
+    auto &mutex = fileMutexes[fileName];
+    if(!mutex)
+        mutex = std::make_unique<mutexHdfType>();
+    return *mutex;
+}
+
+/** Approximate size of chunks with default Hdf5ExtendableDatasetOptions */
+constexpr std::size_t targetChunkBytes = 256 * 1024;
+
+/** Upper limit for derived chunk extent along the extendable dimension */
+constexpr hsize_t maxDefaultChunkColumns = 1024;
+
+/** Options for new extendable datasets. Guarded by
+ * extendableDatasetOptionsMutex. */
+static std::unique_ptr<Hdf5ExtendableDatasetOptions> extendableDatasetOptions;
+static std::mutex extendableDatasetOptionsMutex;
+
+static Hdf5ExtendableDatasetOptions getExtendableDatasetOptions()
+{
+    std::lock_guard<std::mutex> lock(extendableDatasetOptionsMutex);
+    if(!extendableDatasetOptions)
+        extendableDatasetOptions = std::make_unique<Hdf5ExtendableDatasetOptions>(
+                    hdf5ExtendableDatasetOptionsFromEnvironment());
+    return *extendableDatasetOptions;
+}
+
+/**
+ * @brief Create dataset creation property list for an extendable dataset
+ * @param rank
+ * @param fixedDimensions Dimensions 0 to rank - 2
+ * @param elementSize
+ * @return Property list, to be closed by the caller
+ */
+static hid_t createExtendableDatasetCreationProperties(
+        int rank, hsize_t const* fixedDimensions, std::size_t elementSize)
+{
+    auto const& options = getExtendableDatasetOptions();
+
+    hsize_t stride = 1;
+    for(int i = 0; i < rank - 1; ++i)
+        stride *= fixedDimensions[i];
+
+    hsize_t chunkRows, chunkColumns;
+    hdf5GetChunkDimensions(options, stride, elementSize,
+                           chunkRows, chunkColumns);
+
+    std::vector<hsize_t> chunkDimensions(fixedDimensions,
+                                         fixedDimensions + rank - 1);
+    chunkDimensions.push_back(chunkColumns);
+    // row splitting only for 2D
+    if(rank == 2)
+        chunkDimensions[0] = chunkRows;
+
+    hid_t datasetCreationProperty = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(datasetCreationProperty, rank, chunkDimensions.data());
+
+    if(options.compressionLevel > 0 && H5Zfilter_avail(H5Z_FILTER_DEFLATE)) {
+        H5Pset_shuffle(datasetCreationProperty);
+        H5Pset_deflate(datasetCreationProperty, options.compressionLevel);
+    }
+
+    return datasetCreationProperty;
+}
+
+/**
+ * @brief Create dataset access property list with the configured chunk
+ * cache size
+ * @return Property list, to be closed by the caller
+ */
+static hid_t createExtendableDatasetAccessProperties()
+{
+    hid_t datasetAccessProperty = H5Pcreate(H5P_DATASET_ACCESS);
+    auto cacheSize = getExtendableDatasetOptions().chunkCacheSize;
+    if(cacheSize > 0)
+        H5Pset_chunk_cache(datasetAccessProperty,
+                           H5D_CHUNK_CACHE_NSLOTS_DEFAULT, cacheSize,
+                           H5D_CHUNK_CACHE_W0_DEFAULT);
+    return datasetAccessProperty;
+}
+
 void initHDF5Mutex() {
     // TODO: check if still required
     H5dont_atexit();
 }
 
+void RecursiveOwnedMutex::lock()
+{
+    mutex.lock();
+    owner = std::this_thread::get_id();
+    ++depth;
+}
+
+bool RecursiveOwnedMutex::try_lock()
+{
+    if(!mutex.try_lock())
+        return false;
+    owner = std::this_thread::get_id();
+    ++depth;
+    return true;
+}
+
+void RecursiveOwnedMutex::unlock()
+{
+    if(--depth == 0)
+        owner = std::thread::id();
+    mutex.unlock();
+}
+
+bool RecursiveOwnedMutex::isLockedByThisThread() const
+{
+    return owner == std::this_thread::get_id();
+}
+
 std::unique_lock<mutexHdfType> hdf5MutexGetLock()
 {
     return std::unique_lock<mutexHdfType>(mutexHdf);
 }
 
+std::unique_lock<mutexHdfType> hdf5MutexGetLock(hid_t objectId)
+{
+    return std::unique_lock<mutexHdfType>(getFileMutex(objectId));
+}
+
+bool hdf5MutexIsLockedByThisThread(hid_t objectId)
+{
+    return getFileMutex(objectId).isLockedByThisThread();
+}
+
+bool hdf5HasPerFileLocking()
+{
+    static bool const perFileLocking = [] {
+        hbool_t threadSafe = false;
+        if(H5is_library_threadsafe(&threadSafe) < 0 || !threadSafe)
+            return false;
+        if(auto env = std::getenv("PARPE_HDF5_PER_FILE_LOCKING"))
+            return std::atoi(env) != 0;
+        return true;
+    }();
+    return perFileLocking;
+}
+
 herr_t hdf5ErrorStackWalker_cb(unsigned int n, const H5E_error_t *err_desc,
                                void* /*client_data*/) {
     assert(err_desc);
@@ -50,7 +203,7 @@ herr_t hdf5ErrorStackWalker_cb(unsigned int n, const H5E_error_t *err_desc,
 
 bool hdf5DatasetExists(hid_t file_id, const char *datasetName)
 {
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
     bool exists = H5Lexists(file_id, datasetName, H5P_DEFAULT) > 0;
 
     return exists;
@@ -58,7 +211,7 @@ bool hdf5DatasetExists(hid_t file_id, const char *datasetName)
 
 bool hdf5GroupExists(hid_t file_id, const char *groupName)
 {
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
 
     // switch off error handler, check existance and reenable
     H5_SAVE_ERROR_HANDLER;
@@ -71,6 +224,7 @@ bool hdf5GroupExists(hid_t file_id, const char *groupName)
 }
 
 void hdf5EnsureGroupExists(hid_t file_id, const char *groupName) {
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
     if (!hdf5GroupExists(file_id, groupName)) {
         hdf5CreateGroup(file_id, groupName, true);
     }
@@ -78,9 +232,9 @@ void hdf5EnsureGroupExists(hid_t file_id, const char *groupName) {
 
 void hdf5CreateGroup(hid_t file_id, const char *groupPath, bool recursively)
 {
-    auto groupCreationPropertyList = H5P_DEFAULT;
+    hid_t groupCreationPropertyList = H5P_DEFAULT;
 
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
 
     if (recursively) {
         groupCreationPropertyList = H5Pcreate(H5P_LINK_CREATE);
@@ -89,6 +243,9 @@ void hdf5CreateGroup(hid_t file_id, const char *groupPath, bool recursively)
 
     auto group = H5Gcreate(file_id, groupPath, groupCreationPropertyList,
                            H5P_DEFAULT, H5P_DEFAULT);
+    if (recursively)
+        H5Pclose(groupCreationPropertyList);
+
     if (group < 0)
         throw(HDF5Exception("Failed to create group in hdf5CreateGroup: %s",
                             groupPath));
@@ -96,6 +253,63 @@ void hdf5CreateGroup(hid_t file_id, const char *groupPath, bool recursively)
     H5Gclose(group);
 }
 
+Hdf5ExtendableDatasetOptions hdf5ExtendableDatasetOptionsFromEnvironment()
+{
+    Hdf5ExtendableDatasetOptions options;
+
+    if(auto env = std::getenv("PARPE_HDF5_CHUNK_ROWS"))
+        options.chunkRows = std::stoul(env);
+
+    if(auto env = std::getenv("PARPE_HDF5_CHUNK_COLUMNS"))
+        options.chunkColumns = std::stoul(env);
+
+    if(auto env = std::getenv("PARPE_HDF5_COMPRESSION_LEVEL")) {
+        options.compressionLevel = std::stoi(env);
+        RELEASE_ASSERT(options.compressionLevel >= 0
+                       && options.compressionLevel <= 9,
+                       "PARPE_HDF5_COMPRESSION_LEVEL must be in [0, 9].");
+    }
+
+    if(auto env = std::getenv("PARPE_HDF5_CHUNK_CACHE_SIZE"))
+        options.chunkCacheSize = std::stoul(env);
+
+    return options;
+}
+
+Hdf5ExtendableDatasetOptions hdf5GetExtendableDatasetOptions()
+{
+    return getExtendableDatasetOptions();
+}
+
+void hdf5SetExtendableDatasetOptions(
+        const Hdf5ExtendableDatasetOptions &options)
+{
+    std::lock_guard<std::mutex> lock(extendableDatasetOptionsMutex);
+    extendableDatasetOptions =
+            std::make_unique<Hdf5ExtendableDatasetOptions>(options);
+}
+
+void hdf5GetChunkDimensions(const Hdf5ExtendableDatasetOptions &options,
+                            hsize_t stride, std::size_t elementSize,
+                            hsize_t &chunkRows, hsize_t &chunkColumns)
+{
+    stride = std::max<hsize_t>(stride, 1);
+
+    if(options.chunkRows > 0)
+        chunkRows = std::min(options.chunkRows, stride);
+    else
+        chunkRows = std::min<hsize_t>(
+                    stride, std::max<hsize_t>(1, targetChunkBytes / elementSize));
+
+    if(options.chunkColumns > 0)
+        chunkColumns = options.chunkColumns;
+    else
+        chunkColumns = std::max<hsize_t>(
+                    1, std::min<hsize_t>(
+                        maxDefaultChunkColumns,
+                        targetChunkBytes / (chunkRows * elementSize)));
+}
+
 void hdf5CreateExtendableDouble2DArray(hid_t file_id,
                                        const char *datasetPath,
                                        hsize_t stride)
@@ -104,19 +318,19 @@ void hdf5CreateExtendableDouble2DArray(hid_t file_id,
     hsize_t initialDimensions[2] = {stride, 0};
     hsize_t maximumDimensions[2] = {stride, H5S_UNLIMITED};
 
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
 
     hid_t dataspace =
             H5Screate_simple(rank, initialDimensions, maximumDimensions);
 
     // need chunking for extendable dataset
-    hsize_t chunkDimensions[2] = {stride, 1};
-    hid_t datasetCreationProperty = H5Pcreate(H5P_DATASET_CREATE);
-    H5Pset_chunk(datasetCreationProperty, rank, chunkDimensions);
+    hid_t datasetCreationProperty = createExtendableDatasetCreationProperties(
+                rank, initialDimensions, sizeof(double));
 
     hid_t dataset =
             H5Dcreate2(file_id, datasetPath, H5T_NATIVE_DOUBLE, dataspace,
                        H5P_DEFAULT, datasetCreationProperty, H5P_DEFAULT);
+    H5Pclose(datasetCreationProperty);
 
     if(dataset < 0)
         throw HDF5Exception("hdf5CreateExtendableDouble2DArray");
@@ -129,9 +343,11 @@ void hdf5CreateExtendableDouble2DArray(hid_t file_id,
 void hdf5Extend2ndDimensionAndWriteToDouble2DArray(
         hid_t file_id, const char *datasetPath, gsl::span<const double> buffer)
 {
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
 
-    hid_t dataset = H5Dopen2(file_id, datasetPath, H5P_DEFAULT);
+    hid_t datasetAccessProperty = createExtendableDatasetAccessProperties();
+    hid_t dataset = H5Dopen2(file_id, datasetPath, datasetAccessProperty);
+    H5Pclose(datasetAccessProperty);
     if (dataset < 0) {
         throw HDF5Exception("Failed to open dataset %s in "
                             "hdf5Extend2ndDimensionAndWriteToDouble2DArray",
@@ -155,14 +371,17 @@ void hdf5Extend2ndDimensionAndWriteToDouble2DArray(
     H5Sget_simple_extent_dims(filespace, currentDimensions, nullptr);
     H5Sclose(filespace);
 
-    RELEASE_ASSERT(buffer.size() == currentDimensions[0], "");
+    RELEASE_ASSERT(currentDimensions[0] > 0
+                   && buffer.size() % currentDimensions[0] == 0, "");
+    hsize_t numColumns = buffer.size() / currentDimensions[0];
 
-    hsize_t newDimensions[2] = {currentDimensions[0], currentDimensions[1] + 1};
+    hsize_t newDimensions[2] = {currentDimensions[0],
+                                currentDimensions[1] + numColumns};
     herr_t status = H5Dset_extent(dataset, newDimensions);
 
     filespace = H5Dget_space(dataset);
     hsize_t offset[2] = {0, currentDimensions[1]};
-    hsize_t slabsize[2] = {currentDimensions[0], 1};
+    hsize_t slabsize[2] = {currentDimensions[0], numColumns};
 
     status = H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, nullptr,
                                  slabsize, nullptr);
@@ -185,7 +404,7 @@ void hdf5Extend3rdDimensionAndWriteToDouble3DArray(hid_t file_id,
                                                    const char *datasetPath,
                                                    const double *buffer)
 {
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
 
     hid_t dataset = H5Dopen2(file_id, datasetPath, H5P_DEFAULT);
 
@@ -227,6 +446,8 @@ void hdf5CreateOrExtendAndWriteToDouble2DArray(hid_t file_id,
                                                const char *datasetName,
                                                gsl::span<const double> buffer)
 {
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
+
     hdf5EnsureGroupExists(file_id, parentPath);
 
     std::string fullDatasetPath = std::string(parentPath) + "/" + datasetName;
@@ -246,6 +467,8 @@ void hdf5CreateOrExtendAndWriteToDouble3DArray(hid_t file_id,
                                                gsl::span<const double> buffer,
                                                hsize_t stride1,
                                                hsize_t stride2) {
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
+
     hdf5EnsureGroupExists(file_id, parentPath);
 
     std::string fullDatasetPath = std::string(parentPath) + "/" + datasetName;
@@ -266,7 +489,7 @@ void hdf5CreateOrExtendAndWriteToInt2DArray(hid_t file_id,
                                             const char *datasetName,
                                             gsl::span<const int> buffer)
 {
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
 
     hdf5EnsureGroupExists(file_id, parentPath);
 
@@ -285,9 +508,11 @@ void hdf5Extend2ndDimensionAndWriteToInt2DArray(hid_t file_id,
                                                 const char *datasetPath,
                                                 gsl::span<const int> buffer)
 {
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
 
-    hid_t dataset = H5Dopen2(file_id, datasetPath, H5P_DEFAULT);
+    hid_t datasetAccessProperty = createExtendableDatasetAccessProperties();
+    hid_t dataset = H5Dopen2(file_id, datasetPath, datasetAccessProperty);
+    H5Pclose(datasetAccessProperty);
     if (dataset < 0)
         throw HDF5Exception("Unable to open dataset %s", datasetPath);
 
@@ -299,14 +524,17 @@ void hdf5Extend2ndDimensionAndWriteToInt2DArray(hid_t file_id,
 
     hsize_t currentDimensions[2];
     H5Sget_simple_extent_dims(filespace, currentDimensions, nullptr);
-    RELEASE_ASSERT(buffer.size() == currentDimensions[0], "");
+    RELEASE_ASSERT(currentDimensions[0] > 0
+                   && buffer.size() % currentDimensions[0] == 0, "");
+    hsize_t numColumns = buffer.size() / currentDimensions[0];
 
-    hsize_t newDimensions[2] = {currentDimensions[0], currentDimensions[1] + 1};
+    hsize_t newDimensions[2] = {currentDimensions[0],
+                                currentDimensions[1] + numColumns};
     herr_t status = H5Dset_extent(dataset, newDimensions);
 
     filespace = H5Dget_space(dataset);
     hsize_t offset[2] = {0, currentDimensions[1]};
-    hsize_t slabsize[2] = {currentDimensions[0], 1};
+    hsize_t slabsize[2] = {currentDimensions[0], numColumns};
 
     status = H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, nullptr,
                                  slabsize, nullptr);
@@ -329,7 +557,7 @@ void hdf5CreateExtendableInt2DArray(hid_t file_id,
                                     const char *datasetPath,
                                     hsize_t stride)
 {
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
 
     int rank = 2;
     hsize_t initialDimensions[2] = {stride, 0};
@@ -339,14 +567,14 @@ void hdf5CreateExtendableInt2DArray(hid_t file_id,
             H5Screate_simple(rank, initialDimensions, maximumDimensions);
 
     // need chunking for extendable dataset
-    hsize_t chunkDimensions[2] = {stride, 1};
-    hid_t datasetCreationProperty = H5Pcreate(H5P_DATASET_CREATE);
-    H5Pset_chunk(datasetCreationProperty, rank, chunkDimensions);
+    hid_t datasetCreationProperty = createExtendableDatasetCreationProperties(
+                rank, initialDimensions, sizeof(int));
 
     assert(H5Tget_size(H5T_NATIVE_INT) == sizeof(int));
     hid_t dataset =
             H5Dcreate2(file_id, datasetPath, H5T_NATIVE_INT, dataspace,
                        H5P_DEFAULT, datasetCreationProperty, H5P_DEFAULT);
+    H5Pclose(datasetCreationProperty);
 
     if(dataset < 0)
         throw HDF5Exception("hdf5CreateExtendableInt2DArray");
@@ -365,19 +593,19 @@ void hdf5CreateExtendableDouble3DArray(hid_t file_id,
     hsize_t initialDimensions[3] = {stride1, stride2, 0};
     hsize_t maximumDimensions[3] = {stride1, stride2, H5S_UNLIMITED};
 
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
 
     hid_t dataspace =
             H5Screate_simple(rank, initialDimensions, maximumDimensions);
 
     // need chunking for extendable dataset
-    hsize_t chunkDimensions[3] = {stride1, stride2, 1};
-    hid_t datasetCreationProperty = H5Pcreate(H5P_DATASET_CREATE);
-    H5Pset_chunk(datasetCreationProperty, rank, chunkDimensions);
+    hid_t datasetCreationProperty = createExtendableDatasetCreationProperties(
+                rank, initialDimensions, sizeof(double));
 
     hid_t dataset =
             H5Dcreate2(file_id, datasetPath, H5T_NATIVE_DOUBLE, dataspace,
                        H5P_DEFAULT, datasetCreationProperty, H5P_DEFAULT);
+    H5Pclose(datasetCreationProperty);
 
     if(dataset < 0)
         throw HDF5Exception("hdf5CreateExtendableDouble3DArray");
@@ -396,7 +624,7 @@ int hdf5Read2DDoubleHyperslab(hid_t file_id,
 {
     RELEASE_ASSERT(buffer.size() == size0 * size1, "");
 
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
 
     hid_t dataset = H5Dopen2(file_id, path, H5P_DEFAULT);
     hid_t dataspace = H5Dget_space(dataset);
@@ -433,7 +661,7 @@ std::vector<int> hdf5Read1DIntegerHyperslab(H5::H5File const& file,
                                             hsize_t count,
                                             hsize_t offset)
 {
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file.getId()));
 
     H5::DataSet dataset = file.openDataSet(path);
     H5::DataSpace filespace = dataset.getSpace();
@@ -462,7 +690,7 @@ std::vector<int> hdf5Read2DIntegerHyperslab(const H5::H5File &file,
                                             hsize_t offset0,
                                             hsize_t offset1)
 {
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file.getId()));
 
     H5::DataSet dataset = file.openDataSet(path);
     H5::DataSpace filespace = dataset.getSpace();
@@ -506,7 +734,7 @@ int hdf5Read3DDoubleHyperslab(hid_t file_id,
                               hsize_t offset2,
                               double *buffer)
 {
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
 
     const int rank = 3;
     hid_t dataset = H5Dopen2(file_id, path, H5P_DEFAULT);
@@ -557,7 +785,7 @@ bool hdf5AttributeExists(hid_t fileId,
                          const char *datasetPath,
                          const char *attributeName)
 {
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(fileId));
 
     int exists = false;
 
@@ -579,7 +807,7 @@ void hdf5WriteStringAttribute(hid_t fileId,
                               const char *attributeName,
                               const char *attributeValue)
 {
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(fileId));
 
     int ret = H5LTset_attribute_string(fileId, datasetPath, attributeName,
                                        attributeValue);
@@ -630,7 +858,7 @@ void hdf5GetDatasetDimensions(hid_t file_id,
 {
     assert(file_id >= 0);
 
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
     H5_SAVE_ERROR_HANDLER;
 
     auto file = H5::H5File(file_id);
@@ -686,7 +914,7 @@ bool hdf5DatasetExists(hid_t file_id, const std::string &datasetName)
 
 void closeHDF5File(hid_t file_id)
 {
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
     if(file_id < 1)
         throw HDF5Exception("closeHDF5File: Invalid file handle given.");
 
@@ -711,15 +939,17 @@ void hdf5CreateExtendableString1DArray(hid_t file_id, const char *datasetPath)
     hsize_t initialDimensions[1] = {0};
     hsize_t maximumDimensions[1] = {H5S_UNLIMITED};
 
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
 
     H5::DataSpace dataspace(rank, initialDimensions, maximumDimensions);
     H5::H5File file (file_id);
 
     // need chunking for extendable dataset
-    hsize_t chunkDimensions[1] = {1};
-    H5::DSetCreatPropList datasetCreationProperty;
-    datasetCreationProperty.setChunk(rank, chunkDimensions);
+    hid_t datasetCreationPropertyId = createExtendableDatasetCreationProperties(
+                rank, initialDimensions, sizeof(hvl_t));
+    // copies the property list
+    H5::DSetCreatPropList datasetCreationProperty(datasetCreationPropertyId);
+    H5Pclose(datasetCreationPropertyId);
 
     H5::StrType strType(0, H5T_VARIABLE);
     RELEASE_ASSERT(H5T_STRING == H5Tget_class(strType.getId())
@@ -732,7 +962,15 @@ void hdf5CreateExtendableString1DArray(hid_t file_id, const char *datasetPath)
 void hdf5ExtendAndWriteToString1DArray(hid_t file_id, const char *datasetPath,
                                        const std::string &buffer)
 {
-    std::lock_guard<mutexHdfType> lock(mutexHdf);
+    hdf5ExtendAndWriteToString1DArray(file_id, datasetPath,
+                                      std::vector<std::string> {buffer});
+}
+
+void hdf5ExtendAndWriteToString1DArray(
+        hid_t file_id, const char *datasetPath,
+        const std::vector<std::string> &buffer)
+{
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
 
     H5::H5File file (file_id);
     auto dataset = file.openDataSet(datasetPath);
@@ -745,18 +983,21 @@ void hdf5ExtendAndWriteToString1DArray(hid_t file_id, const char *datasetPath,
 
     hsize_t currentDimensions[1];
     filespace.getSimpleExtentDims(currentDimensions);
-    hsize_t newDimensions[1] = {currentDimensions[0] + 1};
+    hsize_t newDimensions[1] = {currentDimensions[0] + buffer.size()};
     dataset.extend(newDimensions);
 
     filespace = dataset.getSpace();
     hsize_t offset[1] = {currentDimensions[0]};
-    hsize_t slabsize[1] = {1};
+    hsize_t slabsize[1] = {buffer.size()};
     filespace.selectHyperslab(H5S_SELECT_SET, slabsize, offset);
 
     H5::StrType strType(0, H5T_VARIABLE);
     H5::DataSpace memspace(rank, slabsize);
 
-    dataset.write(buffer, strType, memspace, filespace);
+    std::vector<const char *> strings(buffer.size());
+    std::transform(buffer.begin(), buffer.end(), strings.begin(),
+                   [](std::string const& str) { return str.c_str(); });
+    dataset.write(strings.data(), strType, memspace, filespace);
 }
 
 void hdf5CreateOrExtendAndWriteToString1DArray(hid_t file_id,
@@ -764,6 +1005,8 @@ void hdf5CreateOrExtendAndWriteToString1DArray(hid_t file_id,
                                                const char *datasetName,
                                                const std::string &buffer)
 {
+    std::lock_guard<mutexHdfType> lock(getFileMutex(file_id));
+
     hdf5EnsureGroupExists(file_id, parentPath);
 
     std::string fullDatasetPath = std::string(parentPath) + "/" + datasetName;
@@ -829,7 +1072,7 @@ bool hdf5DatasetExists(const H5::H5File &file, const std::string &datasetName)
 std::vector<std::string> hdf5Read1dStringDataset(
         H5::H5File const& file, const std::string &datasetPath)
 {
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
     auto dataset = file.openDataSet(datasetPath);
     auto filespace = dataset.getSpace();
 
@@ -858,7 +1101,7 @@ void hdf5Write1dStringDataset(
         const H5::H5File &file, const std::string &parentPath,
         const std::string &datasetPath, std::vector<std::string> const& buffer)
 {
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
 
     const int dims = 1;
     hsize_t dims0 = buffer.size();
@@ -280,8 +280,10 @@ bool launchedWithMpi()
 void initMpiIfNeeded(int *argc, char ***argv)
 {
 #ifdef PARPE_ENABLE_MPI
-    if(parpe::launchedWithMpi())
-        MPI_Init(argc, argv);
+    if(parpe::launchedWithMpi()) {
+        int threadSupport = MPI_THREAD_SINGLE;
+        MPI_Init_thread(argc, argv, MPI_THREAD_MULTIPLE, &threadSupport);
+    }
 #endif
 }
 
@@ -0,0 +1,80 @@
+#include <parpecommon/threadPool.h>
+
+#include <parpecommon/misc.h>
+
+namespace parpe {
+
+ThreadPool::ThreadPool(int numThreads)
+{
+    RELEASE_ASSERT(numThreads > 0, "Thread pool requires at least one thread.");
+    threads.reserve(numThreads);
+    for(int i = 0; i < numThreads; ++i)
+        threads.emplace_back(&ThreadPool::run, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        allDone.wait(lock, [this]{ return numPending == 0; });
+        stopping = true;
+    }
+    taskQueued.notify_all();
+    for(auto &thread: threads)
+        thread.join();
+}
+
+void ThreadPool::post(Task task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+        ++numPending;
+    }
+    taskQueued.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    allDone.wait(lock, [this]{ return numPending == 0; });
+    if(exception) {
+        auto e = exception;
+        exception = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+int ThreadPool::size() const
+{
+    return static_cast<int>(threads.size());
+}
+
+void ThreadPool::run(int threadIdx)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        taskQueued.wait(lock, [this]{ return stopping || !tasks.empty(); });
+        if(tasks.empty())
+            return; // stopping
+
+        auto task = std::move(tasks.front());
+        tasks.pop_front();
+        lock.unlock();
+
+        try {
+            task(threadIdx);
+        } catch (...) {
+            lock.lock();
+            if(!exception)
+                exception = std::current_exception();
+            lock.unlock();
+        }
+
+        lock.lock();
+        if(--numPending == 0)
+            allDone.notify_all();
+    }
+}
+
+} // namespace parpe
@@ -0,0 +1,82 @@
+#include <parpecommon/treeReduction.h>
+
+#include <parpecommon/misc.h>
+
+namespace parpe {
+
+TreeReduction::TreeReduction(int numTerms, int termSize)
+    : numTerms(numTerms)
+{
+    RELEASE_ASSERT(numTerms >= 0 && termSize >= 0, "");
+    if(numTerms == 0) {
+        result.assign(termSize, 0.0);
+        complete = true;
+    }
+}
+
+void TreeReduction::add(int termIdx, std::vector<double> term)
+{
+    RELEASE_ASSERT(termIdx >= 0 && termIdx < numTerms,
+                   "Term index out of range.");
+    int level = 0;
+    int nodeIdx = termIdx;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while(numNodes(level) > 1) {
+        int siblingIdx = nodeIdx ^ 1;
+        if(siblingIdx < numNodes(level)) {
+            auto sibling = pending.find({level, siblingIdx});
+            if(sibling == pending.end()) {
+                // wait for sibling
+                pending[{level, nodeIdx}] = std::move(term);
+                return;
+            }
+
+            auto siblingTerm = std::move(sibling->second);
+            pending.erase(sibling);
+            lock.unlock();
+
+            RELEASE_ASSERT(siblingTerm.size() == term.size(),
+                           "Terms differ in size.");
+            // element-wise addition is commutative, the tree fixes the order
+            for(std::size_t i = 0; i < term.size(); ++i)
+                term[i] += siblingTerm[i];
+
+            lock.lock();
+        }
+        // else: no sibling, pass on unchanged
+
+        ++level;
+        nodeIdx /= 2;
+    }
+
+    result = std::move(term);
+    complete = true;
+}
+
+bool TreeReduction::isComplete() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return complete;
+}
+
+const std::vector<double> &TreeReduction::getResult() const
+{
+    RELEASE_ASSERT(isComplete(), "Not all terms have been added.");
+    return result;
+}
+
+int TreeReduction::getNumPartialSums() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return static_cast<int>(pending.size());
+}
+
+int TreeReduction::numNodes(int level) const
+{
+    // ceil(numTerms / 2^level)
+    return static_cast<int>(
+                (static_cast<long>(numTerms) + (1L << level) - 1) >> level);
+}
+
+} // namespace parpe
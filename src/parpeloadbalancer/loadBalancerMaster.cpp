@@ -1,11 +1,105 @@
 #include <parpeloadbalancer/loadBalancerMaster.h>
+#include <parpeloadbalancer/loadBalancerWorker.h>
+
+#include <algorithm>
+#include <iterator>
+
+namespace parpe {
+
+JobQueue::JobQueue(int maxTimesSkipped)
+    : maxTimesSkipped(maxTimesSkipped)
+{
+}
+
+void JobQueue::push(JobData *job)
+{
+    clientQueues[job->clientId].jobs.push_back(job);
+    ++numJobs;
+}
+
+JobData *JobQueue::pop()
+{
+    if (clientQueues.empty())
+        return nullptr;
+
+    // next client after the last served one with the highest priority,
+    // unless some client has been passed over too often
+    auto selected = clientQueues.end();
+    bool selectedStarving = false;
+    auto next = clientQueues.upper_bound(lastClientId);
+    for (std::size_t i = 0; i < clientQueues.size(); ++i, ++next) {
+        if (next == clientQueues.end())
+            next = clientQueues.begin();
+        bool starving = next->second.timesSkipped >= maxTimesSkipped;
+        if (selected == clientQueues.end()
+                || (starving && !selectedStarving)
+                || (starving == selectedStarving
+                    && next->second.jobs.front()->priority
+                    > selected->second.jobs.front()->priority)) {
+            selected = next;
+            selectedStarving = starving;
+        }
+    }
+
+    auto job = selected->second.jobs.front();
+    for (auto &clientQueue: clientQueues) {
+        if (clientQueue.second.jobs.front()->priority < job->priority)
+            ++clientQueue.second.timesSkipped;
+    }
+
+    selected->second.jobs.pop_front();
+    selected->second.timesSkipped = 0;
+    lastClientId = selected->first;
+    if (selected->second.jobs.empty())
+        clientQueues.erase(selected);
+    --numJobs;
+
+    return job;
+}
+
+int JobQueue::removeIf(
+        std::function<bool(JobData const *)> const& predicate)
+{
+    int numRemoved = 0;
+    for (auto it = clientQueues.begin(); it != clientQueues.end();) {
+        auto &jobs = it->second.jobs;
+        auto newEnd = std::remove_if(jobs.begin(), jobs.end(), predicate);
+        numRemoved += std::distance(newEnd, jobs.end());
+        jobs.erase(newEnd, jobs.end());
+        if (jobs.empty())
+            it = clientQueues.erase(it);
+        else
+            ++it;
+    }
+    numJobs -= numRemoved;
+
+    return numRemoved;
+}
+
+bool JobQueue::empty() const
+{
+    return numJobs == 0;
+}
+
+std::size_t JobQueue::size() const
+{
+    return numJobs;
+}
+
+} // namespace parpe
 
 #ifdef PARPE_ENABLE_MPI
 
 #include <cassert>
+#include <algorithm>
+#include <cerrno>
 #include <climits>
+#include <cstdlib>
+#include <ctime>
 #include <sched.h>
+#include <string>
 
+#include <parpecommon/logging.h>
 #include <parpecommon/misc.h>
 #include <parpecommon/parpeException.h>
 
@@ -13,6 +107,9 @@
 
 namespace parpe {
 
+constexpr long LoadBalancerMaster::minPollIntervalNs;
+constexpr long LoadBalancerMaster::maxPollIntervalNs;
+
 void LoadBalancerMaster::run() {
     if (isRunning_)
         return;
@@ -27,10 +124,37 @@ void LoadBalancerMaster::run() {
            "Need multiple MPI processes!"); // crashes otherwise
 
     numWorkers = mpiCommSize - 1;
-    sentJobsData.resize(numWorkers, nullptr);
-    workerIsBusy.resize(numWorkers, false);
+
+    if(getMpiActive()) {
+        MPI_Comm_rank(mpiComm, &ownRank);
+
+        // blocking in MPI while queueJob may send wake-up messages from other
+        // threads
+        int threadSupport = MPI_THREAD_SINGLE;
+        MPI_Query_thread(&threadSupport);
+        mpiThreadMultiple = threadSupport == MPI_THREAD_MULTIPLE;
+        blockOnReplies = mpiThreadMultiple;
+        if(!mpiThreadMultiple)
+            logmessage(LOGLVL_DEBUG, "MPI_THREAD_MULTIPLE is not supported, "
+                                     "load balancer will poll for replies.");
+    }
+
+    if(auto env = std::getenv("PARPE_LOAD_BALANCER_POLL")) {
+        if(env[0] == '1')
+            blockOnReplies = false;
+    }
+
+    if(auto env = std::getenv("PARPE_JOBS_PER_WORKER")) {
+        jobsPerWorker = std::stoi(env);
+        RELEASE_ASSERT(jobsPerWorker > 0,
+                       "PARPE_JOBS_PER_WORKER must be positive.");
+    }
+
+    numJobsOnWorker.resize(numWorkers, 0);
+    workerSharedDataIds.resize(numWorkers);
+    sentJobsData.resize(numWorkers * jobsPerWorker, nullptr);
     // have to initialize before can wait!
-    sendRequests.resize(numWorkers, MPI_REQUEST_NULL);
+    sendRequests.resize(numWorkers * jobsPerWorker, MPI_REQUEST_NULL);
 
     // Create semaphore to limit queue length
 #ifdef SEM_VALUE_MAX
@@ -66,7 +190,19 @@ void *LoadBalancerMaster::threadEntryPoint(void *vpLoadBalancerMaster) {
     return nullptr;
 }
 
+/**
+ * @brief Cancellation point for the dispatcher thread, which otherwise runs
+ * with cancellation disabled. Cancelling inside MPI calls, which may contain
+ * cancellation points, could leave MPI in an inconsistent state.
+ */
+static void testCancel() {
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, nullptr);
+    pthread_testcancel();
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
+}
+
 void LoadBalancerMaster::loadBalancerThreadRun() {
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
 
     // dispatch queued work packages
     while (true) {
@@ -76,13 +212,122 @@ void LoadBalancerMaster::loadBalancerThreadRun() {
         while((freeWorkerIndex = getNextFreeWorkerIndex()) >= 0
               && sendQueuedJob(freeWorkerIndex)) {}
 
-        // check if any job finished
-        handleFinishedJobs();
-
         freeEmptiedSendBuffers();
+
+        // sleep until a reply arrives or a job is queued
+        waitForEvent(freeWorkerIndex != NO_FREE_WORKER);
     };
 }
 
+void LoadBalancerMaster::waitForEvent(bool haveFreeWorker) {
+    if(numJobsInFlight == 0) {
+        // nothing to receive, only new jobs can wake us up
+        waitForQueuedJob(-1);
+        return;
+    }
+
+    if(!blockOnReplies) {
+        pollForEvent(haveFreeWorker);
+        return;
+    }
+
+    if(haveFreeWorker) {
+        // new jobs can be sent right away, so let queueJob wake us up
+        pthread_mutex_lock(&mutexQueue);
+        bool haveJob = !queue.empty();
+        dispatcherWaitingForJob = !haveJob;
+        pthread_mutex_unlock(&mutexQueue);
+        if(haveJob)
+            return;
+    }
+
+    // not cancellable, terminate() sends a wake-up message
+    MPI_Status status;
+    MPI_Message message = MPI_MESSAGE_NULL;
+    MPI_Mprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, mpiComm, &message, &status);
+
+    pthread_mutex_lock(&mutexQueue);
+    dispatcherWaitingForJob = false;
+    pthread_mutex_unlock(&mutexQueue);
+
+    // the matched message has to be received in any case
+    handleMessage(&message, &status);
+    testCancel();
+
+    // handle any other replies that arrived meanwhile
+    handleFinishedJobs();
+}
+
+void LoadBalancerMaster::pollForEvent(bool haveFreeWorker) {
+    long pollIntervalNs = minPollIntervalNs;
+    while(true) {
+        if(handleFinishedJobs() > 0)
+            return;
+
+        if(haveFreeWorker) {
+            // a new job can be sent right away
+            if(waitForQueuedJob(pollIntervalNs))
+                return;
+        } else {
+            // new jobs would have to wait for a reply anyways
+            timespec sleepTime {0, pollIntervalNs};
+            nanosleep(&sleepTime, nullptr);
+        }
+
+        pollIntervalNs = std::min(2 * pollIntervalNs, maxPollIntervalNs);
+    }
+}
+
+void LoadBalancerMaster::wakeDispatcher(bool force) {
+    if(!blockOnReplies || wakeupPending
+            || !(force || dispatcherWaitingForJob))
+        return;
+
+    wakeupPending = true;
+    // zero-byte messages are sent eagerly, don't need to keep the request
+    MPI_Request request = MPI_REQUEST_NULL;
+    MPI_Isend(MPI_BOTTOM, 0, MPI_BYTE, ownRank, MPI_TAG_WAKEUP, mpiComm,
+              &request);
+    MPI_Request_free(&request);
+}
+
+static void unlockMutex(void *mutex) {
+    pthread_mutex_unlock(static_cast<pthread_mutex_t *>(mutex));
+}
+
+bool LoadBalancerMaster::waitForQueuedJob(long timeoutNs) {
+    timespec deadline {};
+    if(timeoutNs >= 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += timeoutNs;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+    }
+
+    bool haveJob = false;
+
+    pthread_mutex_lock(&mutexQueue);
+    // pthread_cond_*wait are cancellation points and reacquire the mutex
+    // before the thread is cancelled
+    pthread_cleanup_push(unlockMutex, &mutexQueue);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, nullptr);
+
+    while(queue.empty()) {
+        if(timeoutNs < 0) {
+            pthread_cond_wait(&condQueue, &mutexQueue);
+        } else if(pthread_cond_timedwait(&condQueue, &mutexQueue, &deadline)
+                  == ETIMEDOUT) {
+            break;
+        }
+    }
+    haveJob = !queue.empty();
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
+    pthread_cleanup_pop(1);
+
+    return haveJob;
+}
+
 void LoadBalancerMaster::freeEmptiedSendBuffers() {
     // free any emptied send buffers
     while (true) {
@@ -101,56 +346,86 @@ void LoadBalancerMaster::freeEmptiedSendBuffers() {
             break;
         }
     }
+
+    for(auto it = sharedDataSends.begin(); it != sharedDataSends.end(); ) {
+        int sent = 0;
+        MPI_Test(&it->first, &sent, MPI_STATUS_IGNORE);
+        if(sent)
+            it = sharedDataSends.erase(it);
+        else
+            ++it;
+    }
 }
 
 int LoadBalancerMaster::handleFinishedJobs() {
-    int finishedWorkerIdx = NO_FREE_WORKER;
+    int numHandled = 0;
 
     // handle all finished jobs, if any
     while (true) {
         // add cancellation point to avoid invalid reads in
         // loadBalancer.recvRequests
-        pthread_testcancel();
+        testCancel();
 
         // check for waiting incoming message
         MPI_Status status;
+        MPI_Message message = MPI_MESSAGE_NULL;
         int messageWaiting = 0;
-        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, mpiComm,
-                   &messageWaiting, &status);
+        MPI_Improbe(MPI_ANY_SOURCE, MPI_ANY_TAG, mpiComm,
+                    &messageWaiting, &message, &status);
 
         if (messageWaiting) {
             // some job is finished, process that
-            finishedWorkerIdx = handleReply(&status);
-
-            // directly send new work if available
-            if(sendQueuedJob(finishedWorkerIdx))
-                finishedWorkerIdx = NO_FREE_WORKER; // not free anymore
+            if(handleMessage(&message, &status))
+                ++numHandled;
         } else {
             // there was nothing to be finished
             break;
         }
     }
-    return finishedWorkerIdx;
+    return numHandled;
+}
+
+bool LoadBalancerMaster::handleMessage(MPI_Message *mpiMessage,
+                                       MPI_Status *mpiStatus) {
+    if(mpiStatus->MPI_TAG == MPI_TAG_WAKEUP
+            && mpiStatus->MPI_SOURCE == ownRank) {
+        MPI_Mrecv(MPI_BOTTOM, 0, MPI_BYTE, mpiMessage, MPI_STATUS_IGNORE);
+        pthread_mutex_lock(&mutexQueue);
+        wakeupPending = false;
+        pthread_mutex_unlock(&mutexQueue);
+        return false;
+    }
+
+    int finishedWorkerIdx = handleReply(mpiMessage, mpiStatus);
+
+    // directly send new work if available
+    sendQueuedJob(finishedWorkerIdx);
+
+    return true;
 }
 
 int LoadBalancerMaster::getNextFreeWorkerIndex() {
-    for (unsigned int i = 0; i < workerIsBusy.size(); ++i) {
-        if (!workerIsBusy[i])
-            return i;
+    // prefer the least loaded worker, so that all workers are kept busy before
+    // any worker's prefetch queue is filled up
+    int freeWorkerIdx = NO_FREE_WORKER;
+    int minJobs = jobsPerWorker;
+    for (int i = 0; i < numWorkers; ++i) {
+        if (numJobsOnWorker[i] < minJobs) {
+            minJobs = numJobsOnWorker[i];
+            freeWorkerIdx = i;
+            if(minJobs == 0)
+                break;
+        }
     }
 
-    return NO_FREE_WORKER;
+    return freeWorkerIdx;
 }
 
 JobData *LoadBalancerMaster::getNextJob() {
 
     pthread_mutex_lock(&mutexQueue);
 
-    JobData *nextJob = nullptr;
-    if (!queue.empty()) {
-        nextJob = queue.front();
-        queue.pop();
-    }
+    JobData *nextJob = queue.pop();
 
     pthread_mutex_unlock(&mutexQueue);
 
@@ -161,7 +436,17 @@ void LoadBalancerMaster::sendToWorker(int workerIdx, JobData *data) {
     assert(workerIdx >= 0);
     assert(workerIdx < numWorkers);
 
-    workerIsBusy[workerIdx] = true;
+    if(data->sharedData)
+        sendSharedDataToWorker(workerIdx, data);
+
+    // find unused slot of this worker
+    int slot = workerIdx * jobsPerWorker;
+    while(sentJobsData[slot])
+        ++slot;
+    assert(slot < (workerIdx + 1) * jobsPerWorker);
+
+    ++numJobsOnWorker[workerIdx];
+    ++numJobsInFlight;
 
     int tag = data->jobId;
     int workerRank = workerIdx + 1;
@@ -172,11 +457,48 @@ void LoadBalancerMaster::sendToWorker(int workerIdx, JobData *data) {
 
     MPI_Isend(data->sendBuffer.data(), data->sendBuffer.size(), mpiJobDataType,
               workerRank, tag,
-              mpiComm, &sendRequests[workerIdx]);
+              mpiComm, &sendRequests[slot]);
+
+    // only visible to cancelQueuedJobs after sending, so that a cancel
+    // message can't overtake the job
+    pthread_mutex_lock(&mutexQueue);
+    sentJobsData[slot] = data;
+    pthread_mutex_unlock(&mutexQueue);
 
     sem_post(&semQueue);
 }
 
+void LoadBalancerMaster::sendSharedDataToWorker(int workerIdx,
+                                                JobData const *data)
+{
+    assert(data->sharedDataId >= 0);
+
+    // Mirror the worker's cache: mark as most recently used, send if missing
+    auto &cachedIds = workerSharedDataIds[workerIdx];
+    auto cached = std::find(cachedIds.begin(), cachedIds.end(),
+                            data->sharedDataId);
+    if(cached != cachedIds.end()) {
+        cachedIds.erase(cached);
+        cachedIds.push_front(data->sharedDataId);
+        return;
+    }
+
+    cachedIds.push_front(data->sharedDataId);
+    if(static_cast<int>(cachedIds.size()) > NUM_SHARED_DATA_CACHED)
+        cachedIds.pop_back();
+
+#ifdef MASTER_QUEUE_H_SHOW_COMMUNICATION
+    printf("\x1b[31mSending shared data %d to rank %d (%luB).\x1b[0m\n",
+           data->sharedDataId, workerIdx + 1, data->sharedData->size());
+#endif
+
+    sharedDataSends.emplace_back(MPI_REQUEST_NULL, data->sharedData);
+    auto &sharedDataSend = sharedDataSends.back();
+    MPI_Isend(sharedDataSend.second->data(), sharedDataSend.second->size(),
+              mpiJobDataType, workerIdx + 1, MPI_TAG_SHARED_DATA, mpiComm,
+              &sharedDataSend.first);
+}
+
 void LoadBalancerMaster::queueJob(JobData *data) {
     RELEASE_ASSERT(isRunning_, "Can't queue job while not running.");
 
@@ -184,12 +506,16 @@ void LoadBalancerMaster::queueJob(JobData *data) {
 
     pthread_mutex_lock(&mutexQueue);
 
-    if (lastJobId == INT_MAX) // Unlikely, but prevent overflow
-        lastJobId = 0;
+    // Unlikely, but prevent overflow. Don't use tags reserved for control
+    // messages.
+    if (lastJobId == INT_MAX || lastJobId < MPI_TAG_MAX_CONTROL)
+        lastJobId = MPI_TAG_MAX_CONTROL;
 
     data->jobId = ++lastJobId;
 
     queue.push(data);
+    pthread_cond_signal(&condQueue);
+    wakeDispatcher(false);
 
 #ifdef MASTER_QUEUE_H_SHOW_COMMUNICATION
     int size = sizeof(*data) + data->sendBuffer.size() + data->recvBuffer.size();
@@ -199,6 +525,42 @@ void LoadBalancerMaster::queueJob(JobData *data) {
     pthread_mutex_unlock(&mutexQueue);
 }
 
+int LoadBalancerMaster::cancelQueuedJobs(
+        std::function<bool(JobData const *)> const& predicate) {
+    pthread_mutex_lock(&mutexQueue);
+
+    int numCancelled = queue.removeIf(predicate);
+    // release queue slots as done in sendToWorker
+    for (int i = 0; i < numCancelled; ++i)
+        sem_post(&semQueue);
+
+    // IDs of the selected jobs which have been sent, per worker
+    std::vector<std::vector<int>> sentJobIds;
+    if(mpiThreadMultiple) {
+        sentJobIds.resize(numWorkers);
+        for(int slot = 0; slot < static_cast<int>(sentJobsData.size());
+            ++slot) {
+            if(sentJobsData[slot] && predicate(sentJobsData[slot]))
+                sentJobIds[slot / jobsPerWorker].push_back(
+                            sentJobsData[slot]->jobId);
+        }
+    }
+
+    pthread_mutex_unlock(&mutexQueue);
+
+    // Workers skip these jobs if they haven't started them yet. Otherwise, or
+    // if the job has been finished in the meantime, the message is ignored.
+    for(int workerIdx = 0; workerIdx < static_cast<int>(sentJobIds.size());
+        ++workerIdx) {
+        auto const& jobIds = sentJobIds[workerIdx];
+        if(!jobIds.empty())
+            MPI_Send(jobIds.data(), jobIds.size(), MPI_INT, workerIdx + 1,
+                     MPI_TAG_CANCEL, mpiComm);
+    }
+
+    return numCancelled;
+}
+
 void LoadBalancerMaster::terminate() {
     // avoid double termination
     pthread_mutex_lock(&mutexQueue);
@@ -207,21 +569,59 @@ void LoadBalancerMaster::terminate() {
         return;
     }
     isRunning_ = false;
+    pthread_cancel(queueThread);
+    // the dispatcher might be blocked in MPI
+    wakeDispatcher(true);
     pthread_mutex_unlock(&mutexQueue);
 
-    pthread_cancel(queueThread);
     // wait until canceled
     pthread_join(queueThread, nullptr);
 
+    // discard a wake-up message that was not received anymore
+    if(wakeupPending) {
+        MPI_Message message = MPI_MESSAGE_NULL;
+        MPI_Mprobe(ownRank, MPI_TAG_WAKEUP, mpiComm, &message,
+                   MPI_STATUS_IGNORE);
+        MPI_Mrecv(MPI_BOTTOM, 0, MPI_BYTE, &message, MPI_STATUS_IGNORE);
+        wakeupPending = false;
+    }
+
+    // Workers keep receiving until they get the termination signal, so
+    // pending sends will complete. Afterwards, clients may destroy their
+    // jobs, even if no reply has been received.
+    for(auto &sendRequest: sendRequests)
+        if(sendRequest != MPI_REQUEST_NULL)
+            MPI_Wait(&sendRequest, MPI_STATUS_IGNORE);
+    for(auto &sharedDataSend: sharedDataSends)
+        MPI_Wait(&sharedDataSend.first, MPI_STATUS_IGNORE);
+    sharedDataSends.clear();
+
     pthread_mutex_destroy(&mutexQueue);
+    pthread_cond_destroy(&condQueue);
     sem_destroy(&semQueue);
 }
 
-int LoadBalancerMaster::handleReply(MPI_Status *mpiStatus) {
+int LoadBalancerMaster::handleReply(MPI_Message *mpiMessage,
+                                    MPI_Status *mpiStatus) {
 
     int workerIdx = mpiStatus->MPI_SOURCE - 1;
-    JobData *data = sentJobsData[workerIdx];
-    sentJobsData[workerIdx] = nullptr;
+
+    // match reply to job by tag
+    int slot = workerIdx * jobsPerWorker;
+    int const slotEnd = slot + jobsPerWorker;
+    while(slot < slotEnd
+          && !(sentJobsData[slot]
+               && sentJobsData[slot]->jobId == mpiStatus->MPI_TAG))
+        ++slot;
+    RELEASE_ASSERT(slot < slotEnd, "Received reply for unknown job.");
+
+    JobData *data = sentJobsData[slot];
+    pthread_mutex_lock(&mutexQueue);
+    sentJobsData[slot] = nullptr;
+    pthread_mutex_unlock(&mutexQueue);
+    // The job has been received by the worker, so this completes immediately,
+    // but the slot must not be reused with a pending request
+    MPI_Wait(&sendRequests[slot], MPI_STATUS_IGNORE);
 
     // allocate memory for result
     int lenRecvBuffer = 0;
@@ -234,11 +634,11 @@ int LoadBalancerMaster::handleReply(MPI_Status *mpiStatus) {
 #endif
 
     // receive
-    MPI_Recv(data->recvBuffer.data(), data->recvBuffer.size(), mpiJobDataType,
-             mpiStatus->MPI_SOURCE, mpiStatus->MPI_TAG, mpiComm,
-             MPI_STATUS_IGNORE);
+    MPI_Mrecv(data->recvBuffer.data(), data->recvBuffer.size(), mpiJobDataType,
+              mpiMessage, MPI_STATUS_IGNORE);
 
-    workerIsBusy[workerIdx] = false;
+    --numJobsOnWorker[workerIdx];
+    --numJobsInFlight;
 
 #ifdef MASTER_QUEUE_H_SHOW_COMMUNICATION
     printf("\x1b[32mReceived result for job %d from %d\x1b[0m\n",
@@ -269,7 +669,6 @@ bool LoadBalancerMaster::sendQueuedJob(int freeWorkerIndex)
 
     if (currentQueueElement) {
         sendToWorker(freeWorkerIndex, currentQueueElement);
-        sentJobsData[freeWorkerIndex] = currentQueueElement;
         return true;
     }
     return false;
@@ -283,7 +682,8 @@ void LoadBalancerMaster::sendTerminationSignalToAllWorkers() {
 
     for (int i = 1; i < commSize; ++i) {
         reqs[i - 1] = MPI_REQUEST_NULL;
-        MPI_Isend(MPI_BOTTOM, 0, MPI_INT, i, 0, mpiComm, &reqs[i - 1]);
+        MPI_Isend(MPI_BOTTOM, 0, MPI_INT, i, MPI_TAG_EXIT_SIGNAL, mpiComm,
+                  &reqs[i - 1]);
     }
     MPI_Waitall(commSize - 1, reqs, MPI_STATUS_IGNORE);
 }
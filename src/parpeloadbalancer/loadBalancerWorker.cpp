@@ -2,12 +2,15 @@
 
 #ifdef PARPE_ENABLE_MPI
 
+#include <algorithm>
 #include <alloca.h>
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
 #include <mpi.h>
 
+#include <parpecommon/misc.h>
+
 #define QUEUE_WORKER_H_VERBOSE 0
 #define LOADBALANCERWORKER_REPORT_WAITING_TIME 1
 
@@ -17,61 +20,158 @@
 
 namespace parpe {
 
-void LoadBalancerWorker::run(messageHandlerFunc const& messageHandler) {
+void LoadBalancerWorker::run(messageHandlerFunc const& messageHandler,
+                             sharedDataHandlerFunc const& sharedDataHandler) {
     bool terminate = false;
 
-    while (!terminate) {
-        terminate = waitForAndHandleJobs(messageHandler);
+    while (!terminate || !receiveQueue.empty()) {
+        // The termination signal is sent after the results of all jobs have
+        // been received, so there is no need to check for further jobs
+        // afterwards
+        if(!terminate)
+            terminate = receiveJobs(receiveQueue.empty());
+
+        if(!receiveQueue.empty())
+            handleNextJob(messageHandler, sharedDataHandler);
+
+        freeSentReplies(false);
     }
+
+    freeSentReplies(true);
 }
 
-bool LoadBalancerWorker::waitForAndHandleJobs(const messageHandlerFunc& messageHandler) {
+bool LoadBalancerWorker::receiveJobs(bool block) {
     int rank, err;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    while(true) {
+        MPI_Status mpiStatus;
+
+        if(block) {
 #ifdef LOADBALANCERWORKER_REPORT_WAITING_TIME
-    double startTime = MPI_Wtime();
+            double startTime = MPI_Wtime();
 #endif
 
 #if QUEUE_WORKER_H_VERBOSE >= 3
-    printf("[%d] Waiting for work.\n", rank);
+            printf("[%d] Waiting for work.\n", rank);
 #endif
+            // wait for receiving a single job and check for size
+            MPI_Probe(0, MPI_ANY_TAG, MPI_COMM_WORLD, &mpiStatus);
 
-    // wait for receiving a single job and check for size
-    MPI_Status mpiStatus;
-    MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &mpiStatus);
-    int msgSize;
-    MPI_Get_count(&mpiStatus, MPI_BYTE, &msgSize);
-    std::vector<char> buffer(static_cast<unsigned int>(msgSize));
-
-    // receive message
-    int source = 0;
-    err = MPI_Recv(buffer.data(), msgSize, MPI_BYTE, source, MPI_ANY_TAG,
-                   MPI_COMM_WORLD, &mpiStatus);
+#ifdef LOADBALANCERWORKER_REPORT_WAITING_TIME
+            double endTime = MPI_Wtime();
+            double waitedSeconds = (endTime - startTime);
+            logmessage(LOGLVL_DEBUG, "Message received after waiting %fs.", rank, waitedSeconds);
+#endif
+            // only block for the first message
+            block = false;
+        } else {
+            // A message that arrived during the last job may not be matched
+            // by the first MPI_Iprobe, which only makes progress then (e.g.
+            // Open MPI). Check twice, so cancelled jobs are not started.
+            int messageWaiting = 0;
+            for(int i = 0; i < 2 && !messageWaiting; ++i)
+                MPI_Iprobe(0, MPI_ANY_TAG, MPI_COMM_WORLD, &messageWaiting,
+                           &mpiStatus);
+            if(!messageWaiting)
+                return false;
+        }
+
+        int msgSize;
+        MPI_Get_count(&mpiStatus, MPI_BYTE, &msgSize);
+        std::vector<char> buffer(static_cast<unsigned int>(msgSize));
+
+        // receive message
+        err = MPI_Recv(buffer.data(), msgSize, MPI_BYTE, mpiStatus.MPI_SOURCE,
+                       mpiStatus.MPI_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
 
 #if QUEUE_WORKER_H_VERBOSE >= 3
-    printf("W%d: Received job %d\n", rank, mpiStatus.MPI_TAG);
+        printf("W%d: Received job %d\n", rank, mpiStatus.MPI_TAG);
 #endif
-    if (err != MPI_SUCCESS)
-        abort();
+        if (err != MPI_SUCCESS)
+            abort();
 
-    if (mpiStatus.MPI_TAG == MPI_TAG_EXIT_SIGNAL) {
-        return true;
+        if (mpiStatus.MPI_TAG == MPI_TAG_EXIT_SIGNAL) {
+            return true;
+        }
+
+        if (mpiStatus.MPI_TAG == MPI_TAG_CANCEL) {
+            cancelJobs(buffer);
+            continue;
+        }
+
+        receiveQueue.push_back({mpiStatus.MPI_TAG, std::move(buffer)});
     }
+}
 
-#ifdef LOADBALANCERWORKER_REPORT_WAITING_TIME
-    double endTime = MPI_Wtime();
-    double waitedSeconds = (endTime - startTime);
-    logmessage(LOGLVL_DEBUG, "Message received after waiting %fs.", rank, waitedSeconds);
-#endif
+void LoadBalancerWorker::handleNextJob(
+        const messageHandlerFunc &messageHandler,
+        const sharedDataHandlerFunc &sharedDataHandler)
+{
+    ReceivedJob job = std::move(receiveQueue.front());
+    receiveQueue.pop_front();
+
+    if(job.jobId == MPI_TAG_SHARED_DATA) {
+        // no reply
+        RELEASE_ASSERT(sharedDataHandler,
+                       "Received shared data, but no handler was provided.");
+        sharedDataHandler(job.buffer);
+        return;
+    }
 
-    messageHandler(buffer, mpiStatus.MPI_TAG);
+    messageHandler(job.buffer, job.jobId);
 
 #if QUEUE_WORKER_H_VERBOSE >= 2
-    printf("[%d] Job done, sending results, %dB.\n", rank, msgSize);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    printf("[%d] Job done, sending results, %luB.\n", rank, job.buffer.size());
 #endif
-    MPI_Send(buffer.data(), buffer.size(), MPI_BYTE, 0, mpiStatus.MPI_TAG, MPI_COMM_WORLD);
+    sendReply(job.jobId, std::move(job.buffer));
+}
 
-    return false;
+void LoadBalancerWorker::cancelJobs(const std::vector<char> &buffer)
+{
+    auto jobIds = reinterpret_cast<int const*>(buffer.data());
+    int numJobIds = buffer.size() / sizeof(int);
+
+    for(int i = 0; i < numJobIds; ++i) {
+        auto job = std::find_if(receiveQueue.begin(), receiveQueue.end(),
+                                [&](ReceivedJob const& job) {
+            return job.jobId == jobIds[i];
+        });
+        // already processed otherwise
+        if(job == receiveQueue.end())
+            continue;
+
+        receiveQueue.erase(job);
+        sendReply(jobIds[i], std::vector<char>());
+    }
+}
+
+void LoadBalancerWorker::sendReply(int jobId, std::vector<char> buffer)
+{
+    pendingReplies.push_back({MPI_REQUEST_NULL, std::move(buffer)});
+    auto &reply = pendingReplies.back();
+    MPI_Isend(reply.buffer.data(), reply.buffer.size(), MPI_BYTE, 0,
+              jobId, MPI_COMM_WORLD, &reply.request);
+}
+
+void LoadBalancerWorker::freeSentReplies(bool wait)
+{
+    for(auto it = pendingReplies.begin(); it != pendingReplies.end(); ) {
+        int sent = 0;
+        if(wait) {
+            MPI_Wait(&it->request, MPI_STATUS_IGNORE);
+            sent = 1;
+        } else {
+            MPI_Test(&it->request, &sent, MPI_STATUS_IGNORE);
+        }
+
+        if(sent)
+            it = pendingReplies.erase(it);
+        else
+            ++it;
+    }
 }
 
 } // namespace parpe
@@ -1,11 +1,12 @@
 #include <parpeoptimization/multiStartOptimization.h>
 #include <parpecommon/logging.h>
 #include <parpecommon/parpeException.h>
+#include <parpecommon/threadPool.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
-#include <pthread.h>
-#include <unistd.h>
 #include <cassert>
 
 namespace parpe {
@@ -21,7 +22,7 @@ MultiStartOptimization::MultiStartOptimization(
       runParallel(runParallel),
       first_start_idx(first_start_idx)
 {
-
+    setMaxParallelStarts(problem.getMaxParallelStarts());
 }
 
 void MultiStartOptimization::run() {
@@ -33,97 +34,48 @@ void MultiStartOptimization::run() {
 
 void MultiStartOptimization::runMultiThreaded()
 {
+    int numThreads = std::max(1, std::min(numberOfStarts, maxParallelStarts));
     logmessage(LOGLVL_DEBUG,
-               "Starting runParallelMultiStartOptimization with %d starts",
-               numberOfStarts);
-
-    std::vector<pthread_t> localOptimizationThreads(numberOfStarts);
-
-    std::vector<OptimizationProblem *> localProblems =
-            createLocalOptimizationProblems();
-
-    if(localProblems.size() != static_cast<std::vector<OptimizationProblem *>::size_type>(numberOfStarts)) {
-        throw ParPEException("Number of problems does not match number of specific starts.");
-    }
+               "Starting runParallelMultiStartOptimization with %d starts, "
+               "%d in parallel", numberOfStarts, numThreads);
 
-    pthread_attr_t threadAttr;
-    pthread_attr_init(&threadAttr);
-    pthread_attr_setdetachstate(&threadAttr, PTHREAD_CREATE_JOINABLE);
+    // start indices for retries after the regular ones
+    std::atomic<int> nextRetryStartIdx(first_start_idx + numberOfStarts);
 
-    int lastStartIdx = -1;
-    // launch threads for required number of starts
+    ThreadPool pool(numThreads);
     for (int ms = 0; ms < numberOfStarts; ++ms) {
-        ++lastStartIdx;
-
-        logmessage(LOGLVL_DEBUG,
-                   "Spawning thread for local optimization #%d (%d)",
-                   lastStartIdx, ms);
-
-        pthread_create(&localOptimizationThreads.at(ms), &threadAttr,
-                       getLocalOptimumThreadWrapper, static_cast<void *>(localProblems[ms]));
-    }
-
-    int numCompleted = 0;
-
-    while (numCompleted < numberOfStarts) {
-        for (int ms = 0; ms < numberOfStarts; ++ms) {
-            // problem still running?
-            if (!localProblems[ms])
-                continue;
-
-            int *threadStatus = nullptr;
-#ifndef __APPLE__
-            // TODO(#84) pthread_tryjoin_np is not available on macOS. can replace easily by pthread_join, but this would only allow restarting failed threads rather late, so we disable the retry option for now.
-            int joinStatus = pthread_tryjoin_np(localOptimizationThreads[ms],
-                                                reinterpret_cast<void **>(&threadStatus));
-#else
-            int joinStatus = pthread_join(localOptimizationThreads[ms],
-                                                reinterpret_cast<void **>(&threadStatus));
-#endif
-            if (joinStatus == 0) { // joined successful
-                delete localProblems[ms];
-                localProblems[ms] = nullptr;
-
-                if (*threadStatus == 0 || !restartOnFailure) {
-                    if (*threadStatus == 0) {
-                        logmessage(LOGLVL_DEBUG,
-                                   "Thread ms #%d finished successfully", ms);
-                    } else {
-                        logmessage(LOGLVL_DEBUG, "Thread ms #%d finished "
-                                                 "unsuccessfully. Not trying "
-                                                 "new starting point.",
-                                   ms);
-                    }
-                    ++numCompleted;
+        pool.post([this, ms, &nextRetryStartIdx](int /*threadIdx*/) {
+            int startIdx = first_start_idx + ms;
+            while (true) {
+                logmessage(LOGLVL_DEBUG,
+                           "Starting local optimization #%d (%d)",
+                           startIdx, ms);
+                if (runLocalOptimization(startIdx) == 0) {
+                    logmessage(LOGLVL_DEBUG,
+                               "Thread ms #%d finished successfully", ms);
+                    return;
                 }
-#ifndef __APPLE__
-                else {
-                    logmessage(LOGLVL_WARNING, "Thread ms #%d finished "
-                                               "unsuccessfully... trying new "
-                                               "starting point",
-                               ms);
-                    ++lastStartIdx;
-
-                    localProblems[ms] = msProblem.getLocalProblem(lastStartIdx).release();
-                    logmessage(
-                                LOGLVL_DEBUG,
-                                "Spawning thread for local optimization #%d (%d)",
-                                lastStartIdx, ms);
-                    pthread_create(&localOptimizationThreads[ms], &threadAttr,
-                                   getLocalOptimumThreadWrapper,
-                                   static_cast<void *>(localProblems[ms]));
+
+                if (!restartOnFailure) {
+                    logmessage(LOGLVL_DEBUG, "Thread ms #%d finished "
+                                             "unsuccessfully. Not trying "
+                                             "new starting point.", ms);
+                    return;
                 }
-#endif
-                delete threadStatus;
-            }
-        }
 
-        sleep(1); // TODO: replace by condition via ThreadWrapper
+                startIdx = nextRetryStartIdx++;
+                logmessage(LOGLVL_WARNING, "Thread ms #%d finished "
+                                           "unsuccessfully... trying new "
+                                           "starting point #%d",
+                           ms, startIdx);
+            }
+        });
     }
 
-    logmessage(LOGLVL_DEBUG, "runParallelMultiStartOptimization finished");
+    // blocks until all starts (including retries) have completed
+    pool.wait();
 
-    pthread_attr_destroy(&threadAttr);
+    logmessage(LOGLVL_DEBUG, "runParallelMultiStartOptimization finished");
 }
 
 void MultiStartOptimization::runSingleThreaded()
@@ -142,8 +94,7 @@ void MultiStartOptimization::runSingleThreaded()
         if(ms == numberOfStarts)
             break;
 
-        auto problem = msProblem.getLocalProblem(first_start_idx + ms);
-        auto result = getLocalOptimum(problem.get());
+        auto result = runLocalOptimization(first_start_idx + ms);
         if(result) {
             logmessage(LOGLVL_DEBUG,
                        "Start #%d finished successfully", ms);
@@ -163,15 +114,19 @@ void MultiStartOptimization::setRunParallel(bool runParallel)
     this->runParallel = runParallel;
 }
 
-std::vector<OptimizationProblem *>
-MultiStartOptimization::createLocalOptimizationProblems() {
-    std::vector<OptimizationProblem *> localProblems(numberOfStarts);
-
-    for (int ms = 0; ms < numberOfStarts; ++ms) {
-        localProblems[ms] = msProblem.getLocalProblem(first_start_idx + ms).release();
-    }
+void MultiStartOptimization::setMaxParallelStarts(int maxParallelStarts)
+{
+    // no limit: run all starts at once, as without thread pool
+    if (maxParallelStarts <= 0)
+        maxParallelStarts = numberOfStarts;
+    this->maxParallelStarts = std::max(1, maxParallelStarts);
+}
 
-    return localProblems;
+int MultiStartOptimization::runLocalOptimization(int startIdx)
+{
+    // only create while running to keep memory bounded
+    auto problem = msProblem.getLocalProblem(startIdx);
+    return getLocalOptimum(problem.get());
 }
 
 } // namespace parpe
@@ -96,7 +96,7 @@ std::unique_ptr<OptimizationOptions> OptimizationOptions::fromHDF5(
 
     const char *hdf5path = path.c_str();
 
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(fileId);
 
     if (hdf5AttributeExists(fileId, hdf5path, "optimizer")) {
         int buffer;
@@ -123,6 +123,11 @@ std::unique_ptr<OptimizationOptions> OptimizationOptions::fromHDF5(
                               &o->multistartsInParallel);
     }
 
+    if (hdf5AttributeExists(fileId, hdf5path, "maxParallelStarts")) {
+        H5LTget_attribute_int(fileId, hdf5path, "maxParallelStarts",
+                              &o->maxParallelStarts);
+    }
+
     if (hdf5AttributeExists(fileId, hdf5path, "maxIter")) {
         // this value is overwritten by any optimizer-specific configuration
         H5LTget_attribute_int(fileId, hdf5path, "maxIter", &o->maxOptimizerIterations);
@@ -176,7 +181,7 @@ std::vector<double> OptimizationOptions::getStartingPoint(hid_t fileId,
 
     const char *path = "/optimizationOptions/randomStarts";
 
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(fileId);
     H5_SAVE_ERROR_HANDLER;
 
     hid_t dataset;
@@ -222,6 +227,7 @@ std::string OptimizationOptions::toString() {
     s += "maxIter: " + patch::to_string(maxOptimizerIterations) + "\n";
     s += "printToStdout: " + patch::to_string(printToStdout) + "\n";
     s += "numStarts: " + patch::to_string(numStarts) + "\n";
+    s += "maxParallelStarts: " + patch::to_string(maxParallelStarts) + "\n";
     s += "\n";
 
     for_each<std::string&>(
@@ -11,6 +11,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <cassert>
 #include <numeric>
@@ -167,6 +168,107 @@ void OptimizationProblem::fillInitialParameters(gsl::span<double> buffer) const
                                             buffer);
 }
 
+FunctionEvaluationCache::FunctionEvaluationCache(int capacity)
+    : capacity(capacity)
+{
+}
+
+const FunctionEvaluationCache::Entry *FunctionEvaluationCache::find(
+        gsl::span<const double> parameters, bool needGradient)
+{
+    auto hash = hashParameters(parameters);
+
+    auto entry = findIn(gradientEntries, parameters, hash);
+    if(!entry && !needGradient)
+        entry = findIn(valueEntries, parameters, hash);
+
+    if(entry)
+        ++numHits;
+    else
+        ++numMisses;
+
+    return entry;
+}
+
+void FunctionEvaluationCache::insert(Entry entry)
+{
+    if(capacity <= 0)
+        return;
+
+    entry.hash = hashParameters(entry.parameters);
+    bool withGradient = !entry.gradient.empty();
+
+    if(withGradient) {
+        // superseded by the new entry
+        valueEntries.remove_if([&entry](Entry const& e) {
+            return e.hash == entry.hash && e.parameters == entry.parameters;
+        });
+    }
+
+    auto &entries = withGradient ? gradientEntries : valueEntries;
+    entries.push_front(std::move(entry));
+    if(entries.size() > static_cast<std::size_t>(capacity))
+        entries.pop_back();
+}
+
+void FunctionEvaluationCache::clear()
+{
+    valueEntries.clear();
+    gradientEntries.clear();
+}
+
+int FunctionEvaluationCache::getCapacity() const
+{
+    return capacity;
+}
+
+void FunctionEvaluationCache::setCapacity(int capacity)
+{
+    this->capacity = capacity;
+    for(auto entries: {&valueEntries, &gradientEntries}) {
+        if(entries->size() > static_cast<std::size_t>(std::max(capacity, 0)))
+            entries->resize(std::max(capacity, 0));
+    }
+}
+
+int FunctionEvaluationCache::getNumHits() const
+{
+    return numHits;
+}
+
+int FunctionEvaluationCache::getNumMisses() const
+{
+    return numMisses;
+}
+
+std::size_t FunctionEvaluationCache::hashParameters(
+        gsl::span<const double> parameters)
+{
+    // boost::hash_combine
+    std::size_t seed = parameters.size();
+    std::hash<double> hasher;
+    for(auto const p: parameters)
+        seed ^= hasher(p) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    return seed;
+}
+
+const FunctionEvaluationCache::Entry *FunctionEvaluationCache::findIn(
+        std::list<Entry> &entries, gsl::span<const double> parameters,
+        std::size_t hash)
+{
+    for(auto it = entries.begin(); it != entries.end(); ++it) {
+        if(it->hash == hash
+                && std::equal(parameters.begin(), parameters.end(),
+                              it->parameters.begin(), it->parameters.end())) {
+            // mark as most recently used
+            entries.splice(entries.begin(), entries, it);
+            return &entries.front();
+        }
+    }
+    return nullptr;
+}
+
+
 OptimizationReporter::OptimizationReporter(GradientFunction *gradFun,
                                            std::unique_ptr<Logger> logger) :
         OptimizationReporter(gradFun, nullptr, std::move(logger)) {
@@ -179,6 +281,12 @@ OptimizationReporter::OptimizationReporter(GradientFunction *gradFun,
         resultWriter(std::move(rw)), logger(std::move(logger)) {
     setGradientFunction(gradFun);
     defaultLoggerPrefix = this->logger->getPrefix();
+
+    int cacheSize = 5;
+    if(auto env = std::getenv("PARPE_EVALUATION_CACHE_SIZE")) {
+        cacheSize = std::stoi(env);
+    }
+    setEvaluationCacheSize(cacheSize);
 }
 
 FunctionEvaluationStatus OptimizationReporter::evaluate(gsl::span<const double> parameters,
@@ -193,34 +301,36 @@ FunctionEvaluationStatus OptimizationReporter::evaluate(gsl::span<const double>
     if (beforeCostFunctionCall(parameters) != 0)
         return functionEvaluationFailure;
 
-    if (gradient.data()) {
-        if (!haveCachedGradient
-                || !std::equal(parameters.begin(), parameters.end(),
-                               cachedParameters.begin())) {
-            // Have to compute anew
-            cachedStatus = gradFun->evaluate(
-                        parameters, cachedCost, cachedGradient,
-                        logger ? logger : this->logger.get(), &functionCpuSec);
-            haveCachedCost = true;
-            haveCachedGradient = true;
-        }
+    bool needGradient = gradient.data() != nullptr;
+    if (auto cached = evaluationCache.find(parameters, needGradient)) {
         // recycle old result
-        std::copy(cachedGradient.begin(), cachedGradient.end(), gradient.begin());
-        fval = cachedCost;
+        cachedCost = cached->fval;
+        cachedStatus = cached->status;
+        if (needGradient)
+            cachedGradient = cached->gradient;
     } else {
-        if (!haveCachedCost
-                || !std::equal(parameters.begin(), parameters.end(),
-                               cachedParameters.begin())) {
-            // Have to compute anew
-            cachedStatus = gradFun->evaluate(
-                        parameters, cachedCost, gsl::span<double>(),
-                        logger ? logger : this->logger.get(), &functionCpuSec);
-            haveCachedCost = true;
-            haveCachedGradient = false;
-        }
-        fval = cachedCost;
+        // Have to compute anew
+        FunctionEvaluationCache::Entry entry;
+        entry.parameters.assign(parameters.begin(), parameters.end());
+        if (needGradient)
+            entry.gradient.resize(numParameters_);
+        entry.status = gradFun->evaluate(
+                    parameters, entry.fval,
+                    needGradient ? gsl::span<double>(entry.gradient)
+                                 : gsl::span<double>(),
+                    logger ? logger : this->logger.get(), &functionCpuSec);
+
+        cachedCost = entry.fval;
+        cachedStatus = entry.status;
+        if (needGradient)
+            cachedGradient = entry.gradient;
+        evaluationCache.insert(std::move(entry));
     }
 
+    if (needGradient)
+        std::copy(cachedGradient.begin(), cachedGradient.end(), gradient.begin());
+    fval = cachedCost;
+
     // update cached parameters
     cachedParameters.resize(numParameters_);
     std::copy(parameters.begin(), parameters.end(), cachedParameters.begin());
@@ -338,10 +448,14 @@ void OptimizationReporter::finished(double optimalCost,
                                         "time: wall: %f cpu: %f.", exitStatus,
                            cachedCost, timeElapsed, cpuTimeTotalSec);
 
-    if (resultWriter)
+    if (resultWriter) {
+        resultWriter->saveEvaluationCacheStatistics(
+                    evaluationCache.getNumHits(),
+                    evaluationCache.getNumMisses());
         resultWriter->saveOptimizerResults(cachedCost, cachedParameters,
                                            timeElapsed, cpuTimeTotalSec,
                                            exitStatus);
+    }
 }
 
 double OptimizationReporter::getFinalCost() const {
@@ -356,6 +470,18 @@ void OptimizationReporter::setGradientFunction(GradientFunction *gradFun) const
     this->gradFun = gradFun;
     numParameters_ = gradFun->numParameters();
     cachedGradient.resize(numParameters_);
+    // results are specific to the function
+    evaluationCache.clear();
+}
+
+void OptimizationReporter::setEvaluationCacheSize(int numEntries) const
+{
+    evaluationCache.setCapacity(numEntries);
+}
+
+const FunctionEvaluationCache &OptimizationReporter::getEvaluationCache() const
+{
+    return evaluationCache;
 }
 
 void OptimizationProblemImpl::fillParametersMin(gsl::span<double> buffer) const {
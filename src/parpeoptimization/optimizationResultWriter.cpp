@@ -6,6 +6,7 @@
 #include <parpecommon/logging.h>
 
 #include <cmath>
+#include <cstdlib>
 #include <sstream>
 #include <iostream>
 
@@ -13,13 +14,28 @@
 
 namespace parpe {
 
+namespace {
+
+std::shared_ptr<AsyncHdf5Writer> createAsyncWriter(H5::H5File const& file) {
+    double flushInterval = 1.0;
+    if(auto env = std::getenv("PARPE_RESULT_WRITER_FLUSH_INTERVAL")) {
+        flushInterval = std::stod(env);
+    }
+    if(flushInterval <= 0.0)
+        return nullptr;
+    return std::make_shared<AsyncHdf5Writer>(file, flushInterval);
+}
+
+} // anonymous namespace
+
 OptimizationResultWriter::OptimizationResultWriter(const H5::H5File& file,
                                                    std::string rootPath) :
     rootPath(std::move(rootPath)) {
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
     this->file = file;
 
     hdf5EnsureGroupExists(file, this->rootPath);
+    asyncWriter = createAsyncWriter(file);
 }
 
 OptimizationResultWriter::OptimizationResultWriter(const std::string &filename,
@@ -31,12 +47,13 @@ OptimizationResultWriter::OptimizationResultWriter(const std::string &filename,
     file = hdf5CreateFile(filename.c_str(), overwrite);
 
     hdf5EnsureGroupExists(file, this->rootPath);
+    asyncWriter = createAsyncWriter(file);
 }
 
 OptimizationResultWriter::OptimizationResultWriter(
         const OptimizationResultWriter &other)
-    : rootPath(other.rootPath) {
-    auto lock = hdf5MutexGetLock();
+    : rootPath(other.rootPath), asyncWriter(other.asyncWriter) {
+    auto lock = hdf5MutexGetLock(other.file.getId());
     file = other.file;
     hdf5EnsureGroupExists(file, rootPath);
 }
@@ -62,22 +79,21 @@ void OptimizationResultWriter::logObjectiveFunctionEvaluation(
 {
 
     std::string pathStr = getIterationPath(numIterations);
-    const char *fullGroupPath = pathStr.c_str();
 
-    hdf5CreateOrExtendAndWriteToDouble2DArray(
-                file.getId(), fullGroupPath, "costFunCost",
+    appendToDouble2DArray(
+                pathStr, "costFunCost",
                 gsl::make_span<const double>(&objectiveFunctionValue, 1));
 
     if (logGradientEachFunctionEvaluation) {
         if (!objectiveFunctionGradient.empty()) {
-            hdf5CreateOrExtendAndWriteToDouble2DArray(
-                        file.getId(), fullGroupPath, "costFunGradient",
+            appendToDouble2DArray(
+                        pathStr, "costFunGradient",
                         objectiveFunctionGradient);
         } else if (!parameters.empty()) {
             double dummyGradient[parameters.size()];
             std::fill_n(dummyGradient, parameters.size(), NAN);
-            hdf5CreateOrExtendAndWriteToDouble2DArray(
-                        file.getId(), fullGroupPath, "costFunGradient",
+            appendToDouble2DArray(
+                        pathStr, "costFunGradient",
                         gsl::make_span<const double>(dummyGradient,
                                                      parameters.size()));
         }
@@ -85,19 +101,18 @@ void OptimizationResultWriter::logObjectiveFunctionEvaluation(
 
     if (logParametersEachFunctionEvaluation)
         if (!parameters.empty())
-            hdf5CreateOrExtendAndWriteToDouble2DArray(
-                        file.getId(), fullGroupPath, "costFunParameters",
-                        parameters);
+            appendToDouble2DArray(pathStr, "costFunParameters", parameters);
 
-    hdf5CreateOrExtendAndWriteToDouble2DArray(
-                file.getId(), fullGroupPath, "costFunWallTimeInSec",
+    appendToDouble2DArray(
+                pathStr, "costFunWallTimeInSec",
                 gsl::make_span<const double>(&timeElapsedInSeconds, 1));
 
-    hdf5CreateOrExtendAndWriteToInt2DArray(
-                file.getId(), fullGroupPath, "costFunCallIndex",
+    appendToInt2DArray(
+                pathStr, "costFunCallIndex",
                 gsl::make_span<const int>(&numFunctionCalls, 1));
 
-    flushResultWriter();
+    if(!asyncWriter)
+        flushResultWriter();
 }
 
 void OptimizationResultWriter::logOptimizerIteration(
@@ -109,44 +124,38 @@ void OptimizationResultWriter::logOptimizerIteration(
         double cpuSeconds)
 {
     std::string const& pathStr = getRootPath();
-    const char *fullGroupPath = pathStr.c_str();
 
-    hdf5CreateOrExtendAndWriteToDouble2DArray(
-                file.getId(), fullGroupPath, "iterCostFunCost",
+    appendToDouble2DArray(
+                pathStr, "iterCostFunCost",
                 gsl::make_span<const double>(&objectiveFunctionValue, 1));
 
     if (logGradientEachIteration) {
         if (!gradient.empty()) {
-            hdf5CreateOrExtendAndWriteToDouble2DArray(
-                        file.getId(), fullGroupPath, "iterCostFunGradient",
-                        gradient);
+            appendToDouble2DArray(pathStr, "iterCostFunGradient", gradient);
         } else if (!parameters.empty()) {
             std::vector<double> nanGradient(parameters.size(), NAN);
-            hdf5CreateOrExtendAndWriteToDouble2DArray(
-                        file.getId(), fullGroupPath, "iterCostFunGradient",
-                        nanGradient);
+            appendToDouble2DArray(pathStr, "iterCostFunGradient", nanGradient);
         }
     }
 
     if (!parameters.empty()) {
-        hdf5CreateOrExtendAndWriteToDouble2DArray(
-                    file.getId(), fullGroupPath, "iterCostFunParameters",
-                    parameters);
+        appendToDouble2DArray(pathStr, "iterCostFunParameters", parameters);
     }
 
-    hdf5CreateOrExtendAndWriteToDouble2DArray(
-                file.getId(), fullGroupPath, "iterCostFunWallSec",
+    appendToDouble2DArray(
+                pathStr, "iterCostFunWallSec",
                 gsl::make_span<const double>(&wallSeconds, 1));
 
-    hdf5CreateOrExtendAndWriteToDouble2DArray(
-                file.getId(), fullGroupPath, "iterCostFunCpuSec",
+    appendToDouble2DArray(
+                pathStr, "iterCostFunCpuSec",
                 gsl::make_span(&cpuSeconds, 1));
 
-    hdf5CreateOrExtendAndWriteToInt2DArray(
-                file.getId(), fullGroupPath, "iterIndex",
+    appendToInt2DArray(
+                pathStr, "iterIndex",
                 gsl::make_span<const int>(&numIterations, 1));
 
-    flushResultWriter();
+    if(!asyncWriter)
+        flushResultWriter();
 }
 
 
@@ -166,21 +175,61 @@ void OptimizationResultWriter::starting(
         gsl::span<double const> initialParameters) {
     if (!initialParameters.empty()) {
         std::string const& pathStr = getRootPath();
-        const char *fullGroupPath = pathStr.c_str();
 
-        hdf5CreateOrExtendAndWriteToDouble2DArray(
-                    file.getId(), fullGroupPath, "initialParameters",
-                    initialParameters);
-        flushResultWriter();
+        appendToDouble2DArray(pathStr, "initialParameters", initialParameters);
+        if(!asyncWriter)
+            flushResultWriter();
     }
 }
 
 void OptimizationResultWriter::flushResultWriter() const {
-    auto lock = hdf5MutexGetLock();
+    if(asyncWriter)
+        asyncWriter->flush();
+
+    auto lock = hdf5MutexGetLock(file.getId());
 
     file.flush(H5F_SCOPE_LOCAL);
 }
 
+void OptimizationResultWriter::appendToDouble2DArray(
+        std::string const& parentPath, const char *datasetName,
+        gsl::span<const double> buffer) {
+    if(asyncWriter)
+        asyncWriter->appendToDouble2DArray(parentPath, datasetName, buffer);
+    else
+        hdf5CreateOrExtendAndWriteToDouble2DArray(
+                    file.getId(), parentPath.c_str(), datasetName, buffer);
+}
+
+void OptimizationResultWriter::appendToInt2DArray(
+        std::string const& parentPath, const char *datasetName,
+        gsl::span<const int> buffer) {
+    if(asyncWriter)
+        asyncWriter->appendToInt2DArray(parentPath, datasetName, buffer);
+    else
+        hdf5CreateOrExtendAndWriteToInt2DArray(
+                    file.getId(), parentPath.c_str(), datasetName, buffer);
+}
+
+void OptimizationResultWriter::saveEvaluationCacheStatistics(
+        int numHits, int numMisses) const {
+
+    std::string const& optimPath = getRootPath();
+    hdf5EnsureGroupExists(file, optimPath);
+
+    hsize_t dimensions[1] = { 1 };
+
+    auto lock = hdf5MutexGetLock(file.getId());
+
+    std::string fullGroupPath = (optimPath + "/evaluationCacheHits");
+    H5LTmake_dataset(file.getId(), fullGroupPath.c_str(), 1, dimensions,
+                     H5T_NATIVE_INT, &numHits);
+
+    fullGroupPath = (optimPath + "/evaluationCacheMisses");
+    H5LTmake_dataset(file.getId(), fullGroupPath.c_str(), 1, dimensions,
+                     H5T_NATIVE_INT, &numMisses);
+}
+
 void OptimizationResultWriter::saveOptimizerResults(
         double finalNegLogLikelihood,
         gsl::span<const double> optimalParameters,
@@ -194,7 +243,7 @@ void OptimizationResultWriter::saveOptimizerResults(
     std::string fullGroupPath;
     hsize_t dimensions[1] = { 1 };
 
-    auto lock = hdf5MutexGetLock();
+    auto lock = hdf5MutexGetLock(file.getId());
 
     fullGroupPath = (optimPath + "/finalCost");
     H5LTmake_dataset(file.getId(), fullGroupPath.c_str(), 1, dimensions,
@@ -219,6 +268,8 @@ void OptimizationResultWriter::saveOptimizerResults(
                          H5T_NATIVE_DOUBLE, optimalParameters.data());
     }
 
+    // the asynchronous writer needs the HDF5 mutex, see flushResultWriter
+    lock.unlock();
     flushResultWriter();
 }
 
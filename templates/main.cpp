@@ -31,6 +31,10 @@ public:
         // setup data and problem
         dataProvider = std::make_unique<parpe::MultiConditionDataProviderHDF5>(
                     getModel(), inFileArgument);
+#ifdef PARPE_ENABLE_MPI
+        // collective, all processes construct the data provider
+        dataProvider->shareInputDataOnNodeIfRequested(MPI_COMM_WORLD);
+#endif
 
         // read options from file
         auto optimizationOptions = parpe::OptimizationOptions::fromHDF5(dataProvider->getHdf5FileId());
@@ -56,6 +56,10 @@ int main(int argc, char **argv) {
         //    remove(resultFileName.c_str());
 
         parpe::MultiConditionDataProviderHDF5 dp(getModel(), dataFileName.c_str(), dataFilePath + "/inputData");
+#ifdef PARPE_ENABLE_MPI
+        dp.shareInputDataOnNodeIfRequested(MPI_COMM_WORLD);
+#endif
+
         status = parpe::runSimulator(dp, simulationMode,
                                      dataFileName, dataFilePath,
                                      dataFileName, dataFilePath,
@@ -85,6 +89,9 @@ int main(int argc, char **argv) {
         }
 
         parpe::MultiConditionDataProviderHDF5 dp(getModel(), conditionFileName.c_str(), conditionFilePath);
+#ifdef PARPE_ENABLE_MPI
+        dp.shareInputDataOnNodeIfRequested(MPI_COMM_WORLD);
+#endif
 
         status = parpe::runSimulator(dp, simulationMode,
                                      conditionFileName, conditionFilePath,
@@ -0,0 +1,133 @@
+/**
+ * @file amiciBenchmark.cpp
+ *
+ * Microbenchmarks for the evaluation of AMICI-based objective functions:
+ * - result package serialization on the worker plus reading llh and
+ *   gradient on the master, flat wire format vs. boost archive
+ * - negative log-likelihood for hierarchical optimization, reference
+ *   implementation vs. precomputed kernel, for a large synthetic dataset
+ *
+ * Usage: benchmark_amici [numRepetitions]
+ */
+
+#include <parpeamici/simulationWireFormat.h>
+#include <parpeamici/hierarchicalOptimization.h>
+#include <parpecommon/misc.h>
+
+#include <amici/serialization.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <numeric>
+
+namespace {
+
+using ResultMap = std::map<int,
+    parpe::AmiciSimulationRunner::AmiciResultPackageSimple>;
+
+ResultMap createResults(int numConditions, int numParameters,
+                        int numOutputs, int numStates) {
+    ResultMap results;
+    for(int i = 0; i < numConditions; ++i) {
+        auto &result = results[3 * i + 1];
+        result.llh = -i - 0.5;
+        result.simulationTimeSeconds = 0.1 * i;
+        result.status = i % 2;
+        result.gradient.resize(numParameters);
+        std::iota(result.gradient.begin(), result.gradient.end(), i);
+        result.modelOutput.resize(numOutputs);
+        std::iota(result.modelOutput.begin(), result.modelOutput.end(), -i);
+        result.modelStates.resize(numStates, i);
+        if(i == 0)
+            result.modelOutputSensitivities.resize(numOutputs, 0.5);
+    }
+    return results;
+}
+
+void benchmarkResultPackages(int numRepetitions) {
+    auto results = createResults(8, 1000, 500, 100);
+
+    double sumBoost = 0.0;
+    parpe::WallTimer timer;
+    for(int rep = 0; rep < numRepetitions; ++rep) {
+        auto buffer = amici::serializeToStdVec(results);
+        auto received = amici::deserializeFromChar<ResultMap>(
+                    buffer.data(), buffer.size());
+        for(auto const& result: received)
+            sumBoost += result.second.llh + result.second.gradient[0];
+    }
+    double timeBoost = timer.getTotal();
+
+    double sumFlat = 0.0;
+    timer.reset();
+    for(int rep = 0; rep < numRepetitions; ++rep) {
+        auto buffer = parpe::serializeResultPackages(results);
+        parpe::ResultPackagesView received(buffer);
+        for(int i = 0; i < received.size(); ++i)
+            sumFlat += received.llh(i) + received.gradient(i)[0];
+    }
+    double timeFlat = timer.getTotal();
+
+    std::printf("Result packages (%dx): boost %.3fs, flat %.3fs%s\n",
+                numRepetitions, timeBoost, timeFlat,
+                sumBoost == sumFlat ? "" : " (MISMATCH)");
+}
+
+void benchmarkNegLogLikelihood(int numRepetitions) {
+    constexpr int numConditions = 1000;
+    constexpr int numValuesPerCondition = 50 * 20; // nt x ny
+
+    std::vector<std::vector<double>> measurements(numConditions);
+    std::vector<std::vector<double>> sigmas(numConditions);
+    std::vector<std::vector<double>> outputs(numConditions);
+    for(int conditionIdx = 0; conditionIdx < numConditions; ++conditionIdx) {
+        for(int i = 0; i < numValuesPerCondition; ++i) {
+            int j = conditionIdx * numValuesPerCondition + i;
+            measurements[conditionIdx].push_back(
+                        j % 7 == 0 ? NAN : std::sin(j));
+            sigmas[conditionIdx].push_back(0.5 + (j % 3));
+            outputs[conditionIdx].push_back(std::cos(j));
+        }
+    }
+    auto measurementMatrices =
+            std::make_shared<parpe::ConditionMatrices const>(measurements);
+    parpe::ConditionMatrices sigmaMatrices(sigmas);
+    parpe::ConditionMatrices outputMatrices(outputs);
+
+    double sumReference = 0.0;
+    parpe::WallTimer timer;
+    for(int rep = 0; rep < numRepetitions; ++rep)
+        sumReference += parpe::computeNegLogLikelihood(
+                    *measurementMatrices, outputMatrices, sigmaMatrices);
+    double timeReference = timer.getTotal();
+
+    timer.reset();
+    parpe::NegLogLikelihoodKernel kernel(measurementMatrices, sigmaMatrices);
+    double timeSetup = timer.getTotal();
+
+    double sumKernel = 0.0;
+    timer.reset();
+    for(int rep = 0; rep < numRepetitions; ++rep)
+        sumKernel += kernel.evaluate(outputMatrices);
+    double timeKernel = timer.getTotal();
+
+    std::printf("Negative log-likelihood (%dx %d values): reference %.3fs, "
+                "kernel %.3fs (setup %.3fs)%s\n",
+                numRepetitions, numConditions * numValuesPerCondition,
+                timeReference, timeKernel, timeSetup,
+                std::fabs(sumReference - sumKernel)
+                <= 1e-9 * std::fabs(sumReference) ? "" : " (MISMATCH)");
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    int numRepetitions = argc > 1 ? std::atoi(argv[1]) : 200;
+
+    benchmarkResultPackages(numRepetitions);
+    benchmarkNegLogLikelihood(numRepetitions);
+
+    return EXIT_SUCCESS;
+}
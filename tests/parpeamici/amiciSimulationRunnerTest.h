@@ -2,6 +2,7 @@
 
 #include <parpeamici/amiciSimulationRunner.h>
 #include <parpecommon/misc.h>
+#include <parpecommon/parpeException.h>
 
 #include "../parpecommon/testingMisc.h"
 
@@ -25,3 +26,86 @@ TEST(simulationWorkerAmici, testSerializeResultPackageMessage) {
 
     EXPECT_EQ(resultsAct, results);
 }
+
+TEST(simulationWorkerAmici, testCreateWorkPackagesWithoutHistory) {
+    std::vector<int> conditions {0, 1, 2, 3, 4};
+    auto packages = parpe::AmiciSimulationRunner::createWorkPackages(
+                conditions, 2, amici::SensitivityOrder::none, nullptr);
+
+    std::vector<std::vector<int>> expected {{0, 1}, {2, 3}, {4}};
+    EXPECT_EQ(expected, packages);
+}
+
+TEST(simulationWorkerAmici, testCreateWorkPackagesLongestFirst) {
+    parpe::SimulationRuntimeHistory history;
+    history.record(0, amici::SensitivityOrder::first, 1.0);
+    history.record(1, amici::SensitivityOrder::first, 10.0);
+    history.record(2, amici::SensitivityOrder::first, 2.0);
+    history.record(3, amici::SensitivityOrder::first, 3.0);
+    // no history for condition 4: expected to take the average, i.e. 4.0
+
+    std::vector<int> conditions {0, 1, 2, 3, 4};
+
+    // one simulation per package: sorted by expected time
+    auto packages = parpe::AmiciSimulationRunner::createWorkPackages(
+                conditions, 1, amici::SensitivityOrder::first, &history);
+    std::vector<std::vector<int>> expected {{1}, {4}, {3}, {2}, {0}};
+    EXPECT_EQ(expected, packages);
+
+    // balanced packages
+    packages = parpe::AmiciSimulationRunner::createWorkPackages(
+                conditions, 3, amici::SensitivityOrder::first, &history);
+    expected = {{1, 0}, {4, 3, 2}};
+    EXPECT_EQ(expected, packages);
+
+    // history is kept per sensitivity order
+    packages = parpe::AmiciSimulationRunner::createWorkPackages(
+                conditions, 3, amici::SensitivityOrder::none, &history);
+    expected = {{0, 1, 2}, {3, 4}};
+    EXPECT_EQ(expected, packages);
+}
+
+TEST(simulationWorkerAmici, testParameterEpochCache) {
+    parpe::AmiciSimulationRunner::AmiciParameterEpoch epoch;
+    epoch.id = 3;
+    epoch.optimizationParameters = {1.0, 2.0, 3.0};
+
+    parpe::ParameterEpochCache cache;
+    cache.handleSharedData(amici::serializeToStdVec(epoch));
+
+    parpe::AmiciSimulationRunner::AmiciWorkPackageSimple work;
+    work.parameterEpoch = 3;
+    work.conditionIndices = {4, 5};
+    auto buffer = amici::serializeToStdVec(work);
+    work = amici::deserializeFromChar<
+            parpe::AmiciSimulationRunner::AmiciWorkPackageSimple>(
+                buffer.data(), buffer.size());
+    EXPECT_TRUE(work.optimizationParameters.empty());
+
+    cache.resolve(work);
+    EXPECT_EQ(epoch.optimizationParameters, work.optimizationParameters);
+
+    work.parameterEpoch = 4;
+    EXPECT_THROW(cache.resolve(work), parpe::ParPEException);
+
+    // interleaved epochs: the least recently used one is evicted
+    for(int id = 4; id < 3 + parpe::NUM_SHARED_DATA_CACHED; ++id) {
+        epoch.id = id;
+        epoch.optimizationParameters = {static_cast<double>(id)};
+        cache.handleSharedData(amici::serializeToStdVec(epoch));
+    }
+    work.parameterEpoch = 3;
+    cache.resolve(work);
+    EXPECT_EQ(std::vector<double>({1.0, 2.0, 3.0}),
+              work.optimizationParameters);
+
+    epoch.id = 3 + parpe::NUM_SHARED_DATA_CACHED;
+    cache.handleSharedData(amici::serializeToStdVec(epoch));
+    work.parameterEpoch = 3;
+    EXPECT_NO_THROW(cache.resolve(work));
+    work.parameterEpoch = 4;
+    EXPECT_THROW(cache.resolve(work), parpe::ParPEException);
+    work.parameterEpoch = 5;
+    cache.resolve(work);
+    EXPECT_EQ(std::vector<double>({5.0}), work.optimizationParameters);
+}
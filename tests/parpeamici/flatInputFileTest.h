@@ -0,0 +1,298 @@
+#include <gtest/gtest.h>
+
+#include "../parpecommon/testingMisc.h"
+
+#include <parpeamici/flatInputFile.h>
+#include <parpecommon/parpeException.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+namespace {
+
+/** Writes a FlatInputFile as parpe.hdf5_pe_input.write_flat_input_file */
+class FlatInputFileWriter {
+  public:
+    template<typename T>
+    void addSection(std::vector<T> const& values) {
+        auto const* bytes = reinterpret_cast<char const*>(values.data());
+        sections.emplace_back(bytes, bytes + values.size() * sizeof(T));
+        counts.push_back(values.size());
+    }
+
+    void write(std::string const& fileName,
+               parpe::FlatInputFile::Header header) const {
+        std::memcpy(header.magic, parpe::FlatInputFile::magic,
+                    sizeof(header.magic));
+        header.version = parpe::FlatInputFile::version;
+        header.numSections = sections.size();
+
+        std::vector<parpe::FlatInputFile::SectionEntry> table;
+        auto offset = align(sizeof(header)
+                            + sections.size() * sizeof(table[0]));
+        for(std::size_t i = 0; i < sections.size(); ++i) {
+            table.push_back({offset, counts[i]});
+            offset = align(offset + sections[i].size());
+        }
+
+        std::ofstream out(fileName, std::ios::binary);
+        out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+        out.write(reinterpret_cast<char const*>(table.data()),
+                  table.size() * sizeof(table[0]));
+        for(std::size_t i = 0; i < sections.size(); ++i) {
+            std::string padding(table[i].offset - out.tellp(), '\0');
+            out.write(padding.data(), padding.size());
+            out.write(sections[i].data(), sections[i].size());
+        }
+    }
+
+  private:
+    static std::uint64_t align(std::uint64_t offset) {
+        return (offset + 7) / 8 * 8;
+    }
+
+    std::vector<std::vector<char>> sections;
+    std::vector<std::uint64_t> counts;
+};
+
+/** Two simulations, three conditions, one fixed parameter, two model
+ * parameters, three optimization parameters */
+FlatInputFileWriter getTestFileWriter(
+        std::vector<std::uint64_t> const& timepointOffsets = {0, 2, 3},
+        std::vector<std::int32_t> const& simulationConditions
+        = {-1, 0, 0, 1, 2, 1},
+        std::vector<double> const& fixedParameters = {1.0, 2.0, 3.0}) {
+    FlatInputFileWriter writer;
+    writer.addSection(simulationConditions);
+    writer.addSection(fixedParameters);
+    writer.addSection(timepointOffsets);
+    writer.addSection(std::vector<double> {0.0, 1.0, 5.0});
+    writer.addSection(std::vector<std::uint64_t> {0, 2, 3});
+    writer.addSection(std::vector<double> {0.1, 0.2, 0.3});
+    writer.addSection(std::vector<double> {1.0, 1.0, 2.0});
+    writer.addSection(std::vector<std::int32_t> {0, 1, 2, -1});
+    writer.addSection(std::vector<std::int32_t> {0, 2, 2, 0});
+    writer.addSection(std::vector<double> {});
+    writer.addSection(std::vector<std::int32_t> {0, 2, 1});
+    return writer;
+}
+
+parpe::FlatInputFile::Header getTestFileHeader() {
+    parpe::FlatInputFile::Header header {};
+    header.numSimulationConditions = 2;
+    header.numConditions = 3;
+    header.numFixedParameters = 1;
+    header.numModelParameters = 2;
+    header.numOptimizationParameters = 3;
+    return header;
+}
+
+} // anonymous namespace
+
+
+TEST(flatInputFile, readsSections) {
+    char tmpName[TMP_MAX];
+    if(!std::tmpnam(tmpName))
+        std::abort();
+    getTestFileWriter().write(tmpName, getTestFileHeader());
+
+    {
+        parpe::FlatInputFile input(tmpName);
+        EXPECT_EQ(2, input.getNumSimulationConditions());
+        EXPECT_EQ(3, input.getNumConditions());
+        EXPECT_EQ(1, input.getNumFixedParameters());
+        EXPECT_EQ(2, input.getNumModelParameters());
+        EXPECT_EQ(3, input.getNumOptimizationParameters());
+
+        auto conditions = input.getSimulationConditions();
+        EXPECT_EQ((std::vector<std::int32_t> {-1, 0, 0, 1, 2, 1}),
+                  std::vector<std::int32_t>(conditions.begin(),
+                                            conditions.end()));
+        auto timepoints = input.getTimepoints();
+        EXPECT_EQ((std::vector<double> {0.0, 1.0, 5.0}),
+                  std::vector<double>(timepoints.begin(), timepoints.end()));
+        auto offsets = input.getTimepointOffsets();
+        EXPECT_EQ(3U, offsets.size());
+        EXPECT_EQ(2U, offsets[1]);
+        EXPECT_EQ(2.0, input.getSigmas()[2]);
+        EXPECT_EQ(-1, input.getParameterMapping()[3]);
+        EXPECT_EQ(2, input.getParameterScaleSimulation()[1]);
+        EXPECT_TRUE(input.getParameterOverrides().empty());
+        EXPECT_EQ(1, input.getParameterScaleOptimization()[2]);
+    }
+
+    std::remove(tmpName);
+}
+
+TEST(flatInputFile, writesImage) {
+    std::vector<std::int32_t> conditions {-1, 0, 0, 1, 2, 1};
+    std::vector<double> fixedParameters {1.0, 2.0, 3.0};
+    std::vector<std::uint64_t> offsets {0, 2, 3};
+    std::vector<double> timepoints {0.0, 1.0, 5.0};
+    std::vector<double> sigmas {1.0, 1.0, 2.0};
+    std::vector<std::int32_t> mapping {0, 1, 2, -1};
+    std::vector<std::int32_t> scaleOpt {0, 2, 1};
+
+    parpe::FlatInputWriter writer(getTestFileHeader());
+    writer.setSection(parpe::FlatInputFile::simulationConditions,
+                      gsl::make_span(conditions));
+    writer.setSection(parpe::FlatInputFile::fixedParameters,
+                      gsl::make_span(fixedParameters));
+    writer.setSection(parpe::FlatInputFile::timepointOffsets,
+                      gsl::make_span(offsets));
+    writer.setSection(parpe::FlatInputFile::timepoints,
+                      gsl::make_span(timepoints));
+    writer.setSection(parpe::FlatInputFile::measurementOffsets,
+                      gsl::make_span(offsets));
+    writer.setSection(parpe::FlatInputFile::measurements,
+                      gsl::make_span(timepoints));
+    writer.setSection(parpe::FlatInputFile::sigmas, gsl::make_span(sigmas));
+    writer.setSection(parpe::FlatInputFile::parameterMapping,
+                      gsl::make_span(mapping));
+    writer.setSection(parpe::FlatInputFile::parameterScaleSimulation,
+                      gsl::make_span(mapping));
+    writer.setSection(parpe::FlatInputFile::parameterScaleOptimization,
+                      gsl::make_span(scaleOpt));
+    EXPECT_THROW(writer.setSection(parpe::FlatInputFile::sigmas,
+                                   gsl::make_span(mapping)),
+                 parpe::ParPEException);
+
+    std::vector<std::uint64_t> buffer(writer.size() / sizeof(std::uint64_t));
+    ASSERT_EQ(buffer.size() * sizeof(std::uint64_t), writer.size());
+    writer.write(buffer.data());
+
+    parpe::FlatInputFile input(buffer.data(), writer.size());
+    EXPECT_EQ(2, input.getNumSimulationConditions());
+    EXPECT_EQ(3, input.getNumOptimizationParameters());
+    EXPECT_EQ(5.0, input.getMeasurements()[2]);
+    EXPECT_EQ(-1, input.getParameterMapping()[3]);
+    EXPECT_TRUE(input.getParameterOverrides().empty());
+    EXPECT_EQ(2, input.getParameterScaleOptimization()[1]);
+
+    // truncated
+    EXPECT_THROW(parpe::FlatInputFile(buffer.data(), writer.size() - 8),
+                 parpe::ParPEException);
+}
+
+TEST(flatInputFile, rejectsInvalidFiles) {
+    char tmpName[TMP_MAX];
+    if(!std::tmpnam(tmpName))
+        std::abort();
+
+    EXPECT_THROW(parpe::FlatInputFile input(tmpName), parpe::ParPEException);
+
+    // dimensions don't match sections
+    auto header = getTestFileHeader();
+    header.numModelParameters = 3;
+    getTestFileWriter().write(tmpName, header);
+    EXPECT_THROW(parpe::FlatInputFile input(tmpName), parpe::ParPEException);
+
+    // offsets out of range
+    getTestFileWriter({0, 2, 4}).write(tmpName, getTestFileHeader());
+    EXPECT_THROW(parpe::FlatInputFile input(tmpName), parpe::ParPEException);
+
+    // condition indices out of range, with and without fixed parameters
+    getTestFileWriter({0, 2, 3}, {-2, 0, 0, 1, 2, 1})
+            .write(tmpName, getTestFileHeader());
+    EXPECT_THROW(parpe::FlatInputFile input(tmpName), parpe::ParPEException);
+
+    header = getTestFileHeader();
+    header.numConditions = 2;
+    getTestFileWriter({0, 2, 3}, {-1, 0, 0, 1, 2, 1}, {1.0, 2.0})
+            .write(tmpName, header);
+    EXPECT_THROW(parpe::FlatInputFile input(tmpName), parpe::ParPEException);
+
+    header.numFixedParameters = 0;
+    getTestFileWriter({0, 2, 3}, {-1, 0, 0, 1, -2, 1}, {})
+            .write(tmpName, header);
+    EXPECT_THROW(parpe::FlatInputFile input(tmpName), parpe::ParPEException);
+
+    header.numConditions = 3;
+    getTestFileWriter({0, 2, 3}, {-1, 0, 0, 1, 2, 1}, {})
+            .write(tmpName, header);
+    EXPECT_NO_THROW(parpe::FlatInputFile input(tmpName));
+
+    // not a flat input file
+    std::ofstream(tmpName) << std::string(512, 'x');
+    EXPECT_THROW(parpe::FlatInputFile input(tmpName), parpe::ParPEException);
+
+    std::remove(tmpName);
+}
+
+namespace {
+
+/**
+ * @brief Create a flat input file with parpe.hdf5_pe_input using
+ * flatInputFileTest.py.
+ * @return false if the Python environment is not available
+ */
+bool writeFlatInputFileWithPython(std::string const& flatFileName, int nk) {
+    struct stat buffer;
+    if(stat(PARPE_TEST_PYTHON, &buffer) != 0)
+        return false;
+
+    parpe::TemporaryFile hdf5File;
+    auto command = std::string("PYTHONPATH=" PARPE_PYTHON_SOURCE_DIR " ")
+            + PARPE_TEST_PYTHON + " " FLAT_INPUT_FILE_TEST_SCRIPT " "
+            + hdf5File.getName() + " " + flatFileName + " "
+            + std::to_string(nk);
+    auto status = std::system(command.c_str());
+    if(WIFEXITED(status) && WEXITSTATUS(status) == 77)
+        return false;
+    EXPECT_EQ(0, status) << command;
+    return status == 0;
+}
+
+} // anonymous namespace
+
+TEST(flatInputFile, readsPythonOutput) {
+    for(int nk: {1, 0}) {
+        parpe::TemporaryFile flatFile;
+        if(!writeFlatInputFileWithPython(flatFile.getName(), nk)) {
+            if(HasFailure())
+                return;
+            GTEST_SKIP() << "Python environment unavailable";
+        }
+
+        parpe::FlatInputFile input(flatFile.getName());
+        EXPECT_EQ(2, input.getNumSimulationConditions());
+        EXPECT_EQ(3, input.getNumConditions());
+        EXPECT_EQ(nk, input.getNumFixedParameters());
+        EXPECT_EQ(2, input.getNumModelParameters());
+        EXPECT_EQ(3, input.getNumOptimizationParameters());
+
+        auto conditions = input.getSimulationConditions();
+        EXPECT_EQ((std::vector<std::int32_t> {-1, 0, 0, 1, 2, 1}),
+                  std::vector<std::int32_t>(conditions.begin(),
+                                            conditions.end()));
+        auto fixedParameters = input.getFixedParameters();
+        EXPECT_EQ(nk ? (std::vector<double> {1.0, 2.0, 3.0})
+                     : std::vector<double>(),
+                  std::vector<double>(fixedParameters.begin(),
+                                      fixedParameters.end()));
+        auto timepoints = input.getTimepoints();
+        EXPECT_EQ((std::vector<double> {0.0, 1.0, 5.0}),
+                  std::vector<double>(timepoints.begin(), timepoints.end()));
+        auto measurementOffsets = input.getMeasurementOffsets();
+        EXPECT_EQ((std::vector<std::uint64_t> {0, 2, 3}),
+                  std::vector<std::uint64_t>(measurementOffsets.begin(),
+                                             measurementOffsets.end()));
+        EXPECT_EQ(0.3, input.getMeasurements()[2]);
+        EXPECT_EQ(2.0, input.getSigmas()[2]);
+        // transposed from num_model_parameters x num_simulations
+        auto mapping = input.getParameterMapping();
+        EXPECT_EQ((std::vector<std::int32_t> {0, 1, 2, -1}),
+                  std::vector<std::int32_t>(mapping.begin(), mapping.end()));
+        EXPECT_EQ(2, input.getParameterScaleSimulation()[1]);
+        EXPECT_TRUE(input.getParameterOverrides().empty());
+        EXPECT_EQ(1, input.getParameterScaleOptimization()[2]);
+    }
+}
@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+"""Write a minimal parPE HDF5 input file and convert it with
+parpe.hdf5_pe_input.write_flat_input_file (see flatInputFileTest.h).
+
+Exits with 77 if the required packages are not available."""
+
+import sys
+
+try:
+    import h5py
+    import numpy as np
+    from parpe.hdf5 import write_string_array
+    from parpe.hdf5_pe_input import write_flat_input_file
+except ImportError as e:
+    print(f"Skipping: {e}")
+    sys.exit(77)
+
+
+def write_test_input(f: h5py.File, nk: int) -> None:
+    """Two simulations, three conditions, nk fixed parameters, two model
+    parameters, three optimization parameters"""
+    write_string_array(f, 'model/parameterIds', ['p0', 'p1'])
+    write_string_array(f, 'model/fixedParameterIds',
+                       [f'k{i}' for i in range(nk)])
+    write_string_array(f, 'parameters/parameterNames', ['a', 'b', 'c'])
+
+    f.create_dataset('fixedParameters/simulationConditions',
+                     data=np.array([[-1, 0, 0], [1, 2, 1]], dtype='<i4'))
+    if nk:
+        # nk x num_conditions
+        f.create_dataset('fixedParameters/k',
+                         data=np.array([[1.0, 2.0, 3.0]]))
+
+    f.create_dataset('measurements/t/0', data=[0.0, 1.0])
+    f.create_dataset('measurements/y/0', data=[[0.1], [0.2]])
+    f.create_dataset('measurements/ysigma/0', data=[[1.0], [1.0]])
+    f.create_dataset('measurements/t/1', data=[5.0])
+    f.create_dataset('measurements/y/1', data=[[0.3]])
+    f.create_dataset('measurements/ysigma/1', data=[[2.0]])
+
+    # num_model_parameters x num_simulations
+    f.create_dataset('parameters/optimizationSimulationMapping',
+                     data=np.array([[0, 2], [1, -1]], dtype='<i4'))
+    # num_simulations x num_model_parameters
+    f.create_dataset('parameters/pscaleSimulation',
+                     data=np.array([[0, 2], [2, 0]], dtype='<i4'))
+    f.create_dataset('parameters/pscaleOptimization',
+                     data=np.array([0, 2, 1], dtype='<i4'))
+
+
+def main():
+    if len(sys.argv) != 4:
+        print(f"USAGE: {sys.argv[0]} HDF5_FILE FLAT_FILE NUM_FIXED_PARAMETERS")
+        sys.exit(1)
+
+    hdf5_file_name, flat_file_name, nk = sys.argv[1:]
+    with h5py.File(hdf5_file_name, 'w') as f:
+        write_test_input(f, int(nk))
+    write_flat_input_file(hdf5_file_name, flat_file_name)
+
+
+if __name__ == '__main__':
+    main()
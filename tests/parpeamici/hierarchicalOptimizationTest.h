@@ -441,6 +441,79 @@ TEST_F(hierarchicalOptimization, testScaling) {
                                                  amici::ParameterScaling::ln));
 }
 
+TEST_F(hierarchicalOptimization, analyticalParametersMatchReference) {
+    // single-pass wrapper kernels vs. per-parameter reference implementation
+    auto makeProvider = [](int optimizationParameterIdx,
+            std::map<int, std::vector<int>> const& conditionObservables) {
+        auto provider =
+                std::make_unique<parpe::AnalyticalParameterProviderDefault>();
+        provider->optimizationParameterIndices = {optimizationParameterIdx};
+        provider->mapping.push_back(conditionObservables);
+        provider->conditionsForParameter.emplace_back();
+        for(auto const& kvp: conditionObservables)
+            provider->conditionsForParameter[0].push_back(kvp.first);
+        return provider;
+    };
+    auto scalingProvider = makeProvider(1, {{1, {0}}, {2, {0, 2}}});
+    auto offsetProvider = makeProvider(2, {{0, {1}}, {3, {1, 2}}});
+    auto sigmaProvider = makeProvider(3, {{0, {0, 1, 2}}, {1, {1}}});
+    auto scalingProviderNonOwning = scalingProvider.get();
+    auto offsetProviderNonOwning = offsetProvider.get();
+    auto sigmaProviderNonOwning = sigmaProvider.get();
+
+    auto fun = std::make_unique<AmiciSummedGradientFunctionMock>();
+    ON_CALL(*fun, numParameters()).WillByDefault(Return(numParameters_));
+    ON_CALL(*fun, getParameterScaling(_))
+            .WillByDefault(Return(amici::ParameterScaling::none));
+    ON_CALL(*fun, getAllMeasurements()).WillByDefault(Return(measurements));
+    ON_CALL(*fun, getAllSigmas()).WillByDefault(Return(sigmas));
+
+    parpe::HierarchicalOptimizationWrapper wrapper(
+                std::move(fun), std::move(scalingProvider),
+                std::move(offsetProvider), std::move(sigmaProvider),
+                numConditions, numObservables, parpe::ErrorModel::normal);
+
+    auto expectedOutputs = modelOutput;
+    for(int conditionIdx = 0; conditionIdx < numConditions; ++conditionIdx)
+        for(int i = 0; (unsigned) i < expectedOutputs[conditionIdx].size(); ++i)
+            expectedOutputs[conditionIdx][i] = 0.5 + 0.1 * i - 0.2 * conditionIdx;
+    parpe::ConditionMatrices outputs(expectedOutputs);
+
+    auto scalings = wrapper.computeAnalyticalScalings(measurements, outputs);
+    ASSERT_EQ(1U, scalings.size());
+    EXPECT_NEAR(parpe::computeAnalyticalScalings(
+                    0, expectedOutputs, measurements,
+                    *scalingProviderNonOwning, numObservables),
+                scalings[0], 1e-12);
+
+    auto offsets = wrapper.computeAnalyticalOffsets(measurements, outputs);
+    ASSERT_EQ(1U, offsets.size());
+    EXPECT_NEAR(parpe::computeAnalyticalOffsets(
+                    0, expectedOutputs, measurements,
+                    *offsetProviderNonOwning, numObservables),
+                offsets[0], 1e-12);
+
+    wrapper.applyOptimalScalings(scalings, outputs);
+    wrapper.applyOptimalOffsets(offsets, outputs);
+    parpe::applyOptimalScaling(0, scalings[0], expectedOutputs,
+                               *scalingProviderNonOwning, numObservables);
+    parpe::applyOptimalOffset(0, offsets[0], expectedOutputs,
+                              *offsetProviderNonOwning, numObservables);
+    for(int conditionIdx = 0; conditionIdx < numConditions; ++conditionIdx)
+        EXPECT_EQ(expectedOutputs[conditionIdx],
+                  std::vector<double>(outputs[conditionIdx].begin(),
+                                      outputs[conditionIdx].end()));
+
+    auto analyticalSigmas = wrapper.computeAnalyticalSigmas(measurements,
+                                                            outputs);
+    ASSERT_EQ(1U, analyticalSigmas.size());
+    EXPECT_NEAR(parpe::computeAnalyticalSigmas(
+                    0, expectedOutputs, measurements,
+                    *sigmaProviderNonOwning, numObservables),
+                analyticalSigmas[0], 1e-12);
+}
+
+
 TEST(hierarchicalOptimization1, spliceParameters) {
     const std::vector<double>
             fullParametersExp {0.0, 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0};
@@ -531,6 +604,11 @@ TEST_F(hierarchicalOptimization, testWrappedFunIsCalledWithGradient) {
     EXPECT_CALL(*scalingProvider, getOptimizationParameterIndices());
     EXPECT_CALL(*offsetProvider, getOptimizationParameterIndices());
     EXPECT_CALL(*sigmaProvider, getOptimizationParameterIndices());
+    // data is not read before the first evaluation
+    EXPECT_CALL(*fun, getAllMeasurements()).Times(0);
+    EXPECT_CALL(*fun, getAllSigmas()).Times(0);
+    EXPECT_CALL(*scalingProvider, getConditionsForParameter(0)).Times(0);
+    EXPECT_CALL(*scalingProvider, getObservablesForParameter(0, 0)).Times(0);
 
     parpe::HierarchicalOptimizationWrapper hierarchicalWrapper(
                 std::move(fun), std::move(scalingProvider),
@@ -553,8 +631,11 @@ TEST_F(hierarchicalOptimization, testWrappedFunIsCalledWithGradient) {
     // ensure fun::evaluate is called with gradient
     EXPECT_CALL(*funNonOwning, numParameters());
     EXPECT_CALL(*funNonOwning, getModelOutputs(_, _, _, _));
-    EXPECT_CALL(*scalingProviderNonOwning, getConditionsForParameter(0)).Times(2);
-    EXPECT_CALL(*scalingProviderNonOwning, getObservablesForParameter(0, 0)).Times(2);
+    // parameter-output mapping is compiled once
+    EXPECT_CALL(*funNonOwning, getAllMeasurements());
+    EXPECT_CALL(*funNonOwning, getAllSigmas());
+    EXPECT_CALL(*scalingProviderNonOwning, getConditionsForParameter(0));
+    EXPECT_CALL(*scalingProviderNonOwning, getObservablesForParameter(0, 0));
     EXPECT_CALL(*funNonOwning, evaluate(_, _, _, Ne(gsl::span<double>()), _, _));
 
     double fval;
@@ -566,14 +647,38 @@ TEST_F(hierarchicalOptimization, testWrappedFunIsCalledWithGradient) {
     // test fun::evaluate is not called if no gradient (only get outputs)
     EXPECT_CALL(*funNonOwning, numParameters());
     EXPECT_CALL(*funNonOwning, getModelOutputs(_, _, _, _));
+    EXPECT_CALL(*funNonOwning, getAllMeasurements()).Times(0);
     EXPECT_CALL(*scalingProviderNonOwning, getConditionsForParameter(0))
-            .Times(2);
+            .Times(0);
     EXPECT_CALL(*scalingProviderNonOwning, getObservablesForParameter(0, 0))
-            .Times(2);
+            .Times(0);
 
     hierarchicalWrapper.evaluate(parameters, fval, gsl::span<double>(), nullptr, nullptr);
 }
 
+TEST(hierarchicalOptimization1, dataCacheCreatesOnce) {
+    parpe::HierarchicalOptimizationDataCache cache;
+    int numCalls = 0;
+
+    EXPECT_THROW(cache.get([&numCalls]()
+                 -> parpe::HierarchicalOptimizationDataCache::DataPtr {
+        ++numCalls;
+        throw parpe::ParPEException("read failed");
+    }), parpe::ParPEException);
+
+    auto create = [&numCalls]() {
+        ++numCalls;
+        return std::make_shared<parpe::HierarchicalOptimizationData const>();
+    };
+    auto first = cache.get(create);
+    auto second = cache.get(create);
+
+    // retried after the failure, then shared
+    EXPECT_EQ(2, numCalls);
+    EXPECT_NE(nullptr, first);
+    EXPECT_EQ(first, second);
+}
+
 TEST(hierarchicalOptimization1, likelihoodOfMatchingData) {
     const std::vector<double> data {1.0, 2.0, 3.0};
     const std::vector<double> sigmas {1.0, 1.0, 1.0};
@@ -586,6 +691,166 @@ TEST(hierarchicalOptimization1, likelihoodOfMatchingData) {
     EXPECT_EQ(expected, actual);
 }
 
+TEST_F(hierarchicalOptimization, negLogLikelihoodKernel) {
+    auto outputs = modelOutput;
+    outputs[1][2] = 3.0;
+    auto knownSigmas = sigmas;
+    knownSigmas[2][0] = 0.5;
+
+    auto sharedMeasurements =
+            std::make_shared<parpe::ConditionMatrices const>(measurements);
+    parpe::NegLogLikelihoodKernel kernel(sharedMeasurements, knownSigmas);
+    auto expected = parpe::computeNegLogLikelihood(measurements, outputs,
+                                                   knownSigmas);
+    EXPECT_NEAR(expected, kernel.evaluate(outputs), 1e-12);
+    EXPECT_NEAR(expected, kernel.evaluate(outputs, knownSigmas), 1e-12);
+
+    // sigmas to be provided on evaluation
+    knownSigmas[2][0] = NAN;
+    parpe::NegLogLikelihoodKernel kernelUnknownSigmas(sharedMeasurements,
+                                                      knownSigmas);
+    EXPECT_TRUE(std::isnan(kernelUnknownSigmas.evaluate(outputs)));
+    knownSigmas[2][0] = 0.5;
+    EXPECT_NEAR(expected, kernelUnknownSigmas.evaluate(outputs, knownSigmas),
+                1e-12);
+
+    outputs[3][4] = NAN;
+    EXPECT_TRUE(std::isnan(kernel.evaluate(outputs)));
+}
+
+TEST(hierarchicalOptimization1, weightedMedian) {
+    EXPECT_EQ(2.0, parpe::weightedMedian({3.0, 1.0, 2.0}, {1.0, 1.0, 1.0}));
+    // even: any value in between is optimal, use midpoint
+    EXPECT_EQ(1.5, parpe::weightedMedian({2.0, 1.0}, {1.0, 1.0}));
+    EXPECT_EQ(3.0, parpe::weightedMedian({1.0, 2.0, 3.0}, {1.0, 1.0, 3.0}));
+    // zero weights are ignored
+    EXPECT_EQ(1.0, parpe::weightedMedian({1.0, 2.0, 3.0}, {1.0, 0.0, 0.0}));
+    EXPECT_TRUE(std::isnan(parpe::weightedMedian({}, {})));
+}
+
+TEST(hierarchicalOptimization1, laplaceAnalyticalParameters) {
+    // one condition, one observable, one outlier
+    const std::vector<std::vector<double>> measurements {
+        {2.0, 4.0, 6.0, 8.0, 100.0}};
+    const std::vector<std::vector<double>> sigmas {
+        {NAN, NAN, NAN, NAN, NAN}};
+    const std::vector<std::vector<double>> modelOutput {
+        {1.0, 2.0, 3.0, 4.0, 5.0}};
+
+    auto makeProvider = [](int optimizationParameterIdx) {
+        auto provider =
+                std::make_unique<parpe::AnalyticalParameterProviderDefault>();
+        provider->optimizationParameterIndices = {optimizationParameterIdx};
+        provider->mapping.push_back({{0, {0}}});
+        provider->conditionsForParameter.push_back({0});
+        return provider;
+    };
+
+    auto fun = std::make_unique<AmiciSummedGradientFunctionMock>();
+    ON_CALL(*fun, numParameters()).WillByDefault(Return(4));
+    ON_CALL(*fun, getParameterScaling(_))
+            .WillByDefault(Return(amici::ParameterScaling::none));
+    ON_CALL(*fun, getAllMeasurements()).WillByDefault(Return(measurements));
+    ON_CALL(*fun, getAllSigmas()).WillByDefault(Return(sigmas));
+
+    parpe::HierarchicalOptimizationWrapper wrapper(
+                std::move(fun), makeProvider(0), makeProvider(1),
+                makeProvider(2), 1, 1, parpe::ErrorModel::laplace);
+
+    parpe::ConditionMatrices outputs(modelOutput);
+    auto const& mes = wrapper.getMeasurements();
+
+    // weighted median of m / y, unaffected by the outlier
+    auto scalings = wrapper.computeAnalyticalScalings(mes, outputs);
+    ASSERT_EQ(1U, scalings.size());
+    EXPECT_EQ(2.0, scalings[0]);
+    wrapper.applyOptimalScalings(scalings, outputs);
+
+    // median of residuals
+    auto offsets = wrapper.computeAnalyticalOffsets(mes, outputs);
+    ASSERT_EQ(1U, offsets.size());
+    EXPECT_EQ(0.0, offsets[0]);
+    wrapper.applyOptimalOffsets(offsets, outputs);
+
+    // mean absolute residual
+    auto analyticalSigmas = wrapper.computeAnalyticalSigmas(mes, outputs);
+    ASSERT_EQ(1U, analyticalSigmas.size());
+    EXPECT_DOUBLE_EQ(18.0, analyticalSigmas[0]);
+
+    auto fullSigmas = wrapper.getSigmas();
+    wrapper.fillInAnalyticalSigmas(fullSigmas, analyticalSigmas);
+    parpe::NegLogLikelihoodKernel kernel(
+                std::make_shared<parpe::ConditionMatrices const>(mes),
+                fullSigmas, parpe::ErrorModel::laplace);
+    EXPECT_NEAR(5.0 * std::log(36.0) + 90.0 / 18.0,
+                kernel.evaluate(outputs), 1e-12);
+    EXPECT_NEAR(kernel.evaluate(outputs), kernel.evaluate(outputs, fullSigmas),
+                1e-12);
+}
+
+TEST(hierarchicalOptimization1, conditionMatrices) {
+    const std::vector<std::vector<double>> matrices {{1.0, 2.0}, {}, {3.0}};
+    parpe::ConditionMatrices flat(matrices);
+
+    ASSERT_EQ(3U, flat.size());
+    EXPECT_EQ(3U, flat.getValues().size());
+    for(int i = 0; i < 3; ++i)
+        EXPECT_EQ(matrices[i],
+                  std::vector<double>(flat[i].begin(), flat[i].end()));
+
+    flat[2][0] = 4.0;
+    EXPECT_EQ(4.0, flat.getValues()[2]);
+}
+
+TEST(hierarchicalOptimization1, negLogLikelihoodGradientFromSensitivities) {
+    // linear model y(p) = y0 + S p with 2 timepoints, 2 observables,
+    // 2 parameters, scaled outputs s * y + b
+    constexpr int numObservables = 2;
+    const std::vector<double> y0 {1.0, 2.0, 3.0, 4.0};
+    // nt x np x ny
+    const std::vector<double> sy {0.1, 0.2,  0.3, -0.4,
+                                  -0.5, 0.6,  0.7, 0.8};
+    const std::vector<double> scalings {2.0, 1.0, 2.0, 1.0};
+    const std::vector<double> offset {0.0, 0.5, 0.0, 0.5};
+    const std::vector<double> measurements {2.5, NAN, 5.0, 4.0};
+    const std::vector<double> sigmas {1.0, 2.0, 0.5, 1.5};
+    const std::vector<double> p {0.3, -0.2};
+
+    auto outputs = [&](std::vector<double> const& p) {
+        std::vector<double> y(y0.size());
+        for(int t = 0; t < 2; ++t) {
+            for(int j = 0; j < numObservables; ++j) {
+                int i = j + t * numObservables;
+                y[i] = y0[i];
+                for(int k = 0; k < 2; ++k)
+                    y[i] += sy[(t * 2 + k) * numObservables + j] * p[k];
+                y[i] = scalings[i] * y[i] + offset[i];
+            }
+        }
+        return y;
+    };
+
+    auto actual = parpe::computeNegLogLikelihoodGradient(
+                measurements, outputs(p), sigmas, scalings, sy,
+                numObservables);
+    ASSERT_EQ(2U, actual.size());
+
+    // compare to finite differences
+    constexpr double eps = 1e-6;
+    for(int k = 0; k < 2; ++k) {
+        auto pPlus = p;
+        auto pMinus = p;
+        pPlus[k] += eps;
+        pMinus[k] -= eps;
+        auto expected = (parpe::computeNegLogLikelihood(
+                             measurements, outputs(pPlus), sigmas)
+                         - parpe::computeNegLogLikelihood(
+                             measurements, outputs(pMinus), sigmas))
+                / (2 * eps);
+        EXPECT_NEAR(expected, actual[k], 1e-6);
+    }
+}
+
 
 TEST_F(hierarchicalOptimization, problemWrapper) {
     //std::unique_ptr<parpe::OptimizationProblem> problem(new parpe::QuadraticTestProblem());
@@ -2,7 +2,10 @@
 #include "multiConditionDataProviderTest.h"
 #include "multiConditionProblemTest.h"
 #include "simulationResultWriterTest.h"
+#include "simulationLogWriterTest.h"
+#include "flatInputFileTest.h"
 #include "hierarchicalOptimizationTest.h"
+#include "simulationWireFormatTest.h"
 
 #include <gtest/gtest.h>
 
@@ -3,3 +3,76 @@
 #include "../parpecommon/testingMisc.h"
 
 #include <gtest/gtest.h>
+
+#include <parpeamici/amiciMisc.h>
+#include <parpecommon/parpeException.h>
+
+#include <cmath>
+
+
+TEST(parameterMappingPlan, matchesElementwiseMapping) {
+    using amici::ParameterScaling;
+    // all combinations of scales, one unmapped parameter, and two simulation
+    // parameters mapped to the same optimization parameter
+    std::vector<ParameterScaling> scaleOpt {
+        ParameterScaling::none, ParameterScaling::ln, ParameterScaling::log10};
+    std::vector<int> mapping {0, 1, 2, 0, 1, 2, 0, 1, 2, -1, 2};
+    std::vector<ParameterScaling> scaleSim {
+        ParameterScaling::none, ParameterScaling::none, ParameterScaling::none,
+        ParameterScaling::ln, ParameterScaling::ln, ParameterScaling::ln,
+        ParameterScaling::log10, ParameterScaling::log10,
+        ParameterScaling::log10, ParameterScaling::none,
+        ParameterScaling::log10};
+    std::vector<double> overrides(mapping.size(), 0.0);
+    overrides[9] = 5.0;
+    std::vector<double> optimizationParameters {2.0, 0.3, -0.7};
+
+    parpe::ParameterMappingPlan plan(mapping, scaleSim, scaleOpt, overrides);
+    EXPECT_EQ(mapping, plan.getMapping());
+    EXPECT_EQ(scaleSim, plan.getParameterScaleSim());
+
+    std::vector<double> simulationParameters(mapping.size());
+    plan.setSimulationParameters(optimizationParameters, simulationParameters);
+
+    std::vector<double> simulationGradient(mapping.size());
+    std::vector<double> expectedGradient(scaleOpt.size(), 0.0);
+    for(int i = 0; i < static_cast<int>(mapping.size()); ++i) {
+        simulationGradient[i] = 0.1 * (i + 1);
+        if(mapping[i] < 0) {
+            EXPECT_EQ(overrides[i], simulationParameters[i]);
+            continue;
+        }
+        auto expected = parpe::getScaledParameter(
+                    parpe::getUnscaledParameter(
+                        optimizationParameters[mapping[i]],
+                        scaleOpt[mapping[i]]), scaleSim[i]);
+        EXPECT_NEAR(expected, simulationParameters[i], 1e-12);
+
+        expectedGradient[mapping[i]] += -2.0 * parpe::applyChainRule(
+                    simulationGradient[i], simulationParameters[i],
+                    scaleSim[i], scaleOpt[mapping[i]]);
+    }
+
+    std::vector<double> gradient(scaleOpt.size(), 0.0);
+    plan.addGradient(simulationGradient, gradient, simulationParameters, -2.0);
+    for(int i = 0; i < static_cast<int>(gradient.size()); ++i)
+        EXPECT_NEAR(expectedGradient[i], gradient[i], 1e-12);
+}
+
+TEST(parameterMappingPlan, unmappedWithoutOverrides) {
+    using amici::ParameterScaling;
+    std::vector<ParameterScaling> scaleOpt {ParameterScaling::none};
+    std::vector<int> mapping {-1, 0};
+    std::vector<ParameterScaling> scaleSim(2, ParameterScaling::none);
+
+    EXPECT_THROW(parpe::ParameterMappingPlan(mapping, scaleSim, scaleOpt, {}),
+                 parpe::ParPEException);
+
+    // no overrides needed if all parameters are mapped
+    mapping[0] = 0;
+    parpe::ParameterMappingPlan plan(mapping, scaleSim, scaleOpt, {});
+    std::vector<double> simulationParameters(2);
+    plan.setSimulationParameters(std::vector<double> {3.0},
+                                 simulationParameters);
+    EXPECT_EQ((std::vector<double> {3.0, 3.0}), simulationParameters);
+}
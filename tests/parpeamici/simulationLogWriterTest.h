@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+
+#include <parpeamici/simulationLogWriter.h>
+#include <parpecommon/hdf5Misc.h>
+
+#include "../parpecommon/testingMisc.h"
+
+#include <amici/hdf5.h>
+
+#include <cmath>
+#include <vector>
+
+
+TEST(simulationLogWriter, writesBufferedRecords) {
+    parpe::TemporaryFile tmpFile;
+    H5::H5File file(tmpFile.getName(), H5F_ACC_TRUNC);
+
+    constexpr int numRecords = 5;
+    {
+        // smaller than numRecords to exercise the full buffer
+        parpe::SimulationLogWriter log(file, 2, 10.0);
+        for(int i = 0; i < numRecords; ++i) {
+            parpe::SimulationLogRecord record;
+            record.path = "/sim";
+            record.parameters = {1.0 * i, 2.0 * i};
+            record.llh = -1.0 * i;
+            // no gradient for odd records
+            if(i % 2 == 0)
+                record.gradient = {0.5 * i, 0.25 * i};
+            record.jobId = i;
+            record.label = "c" + std::to_string(i);
+            log.log(record);
+        }
+        log.flush();
+        EXPECT_EQ(numRecords, log.getNumRecordsWritten());
+    }
+
+    hsize_t m, n;
+    auto llh = amici::hdf5::getDoubleDataset2D(
+                file, "/sim/simulationLogLikelihood", m, n);
+    EXPECT_EQ(1U, m);
+    EXPECT_EQ(static_cast<hsize_t>(numRecords), n);
+    EXPECT_EQ(-3.0, llh[3]);
+
+    // (numParameters x numRecords)
+    auto parameters = amici::hdf5::getDoubleDataset2D(
+                file, "/sim/simulationParameters", m, n);
+    EXPECT_EQ(2U, m);
+    EXPECT_EQ(static_cast<hsize_t>(numRecords), n);
+    EXPECT_EQ(4.0, parameters[numRecords + 2]);
+
+    auto gradient = amici::hdf5::getDoubleDataset2D(
+                file, "/sim/simulationLogLikelihoodGradient", m, n);
+    EXPECT_EQ(1.0, gradient[2]);
+    EXPECT_TRUE(std::isnan(gradient[1]));
+
+    auto labels = parpe::hdf5Read1dStringDataset(file, "/sim/simulationLabel");
+    EXPECT_EQ((std::vector<std::string> {"c0", "c1", "c2", "c3", "c4"}),
+              labels);
+}
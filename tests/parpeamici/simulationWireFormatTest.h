@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+
+#include <parpeamici/simulationWireFormat.h>
+#include <parpecommon/parpeException.h>
+
+#include <numeric>
+
+namespace {
+
+using ResultMap = std::map<int,
+    parpe::AmiciSimulationRunner::AmiciResultPackageSimple>;
+
+ResultMap createResults(int numConditions, int numParameters,
+                        int numOutputs, int numStates) {
+    ResultMap results;
+    for(int i = 0; i < numConditions; ++i) {
+        auto &result = results[3 * i + 1];
+        result.llh = -i - 0.5;
+        result.simulationTimeSeconds = 0.1 * i;
+        result.status = i % 2;
+        result.gradient.resize(numParameters);
+        std::iota(result.gradient.begin(), result.gradient.end(), i);
+        result.modelOutput.resize(numOutputs);
+        std::iota(result.modelOutput.begin(), result.modelOutput.end(), -i);
+        result.modelStates.resize(numStates, i);
+        if(i == 0)
+            result.modelOutputSensitivities.resize(numOutputs, 0.5);
+    }
+    return results;
+}
+
+} // namespace
+
+TEST(simulationWireFormat, workPackageRoundTrip) {
+    parpe::AmiciSimulationRunner::AmiciWorkPackageSimple work;
+    work.optimizationParameters = {1.0, 2.0, 3.0};
+    work.sensitivityOrder = amici::SensitivityOrder::first;
+    work.conditionIndices = {7, 2, 9};
+    work.logPrefix = "o0i1";
+    work.parameterEpoch = 5;
+    work.sendOutputSensitivities = true;
+
+    auto buffer = parpe::serializeWorkPackage(work);
+    auto actual = parpe::deserializeWorkPackage(buffer);
+
+    EXPECT_EQ(work.optimizationParameters, actual.optimizationParameters);
+    EXPECT_EQ(work.sensitivityOrder, actual.sensitivityOrder);
+    EXPECT_EQ(work.conditionIndices, actual.conditionIndices);
+    EXPECT_EQ(work.logPrefix, actual.logPrefix);
+    EXPECT_EQ(work.parameterEpoch, actual.parameterEpoch);
+    EXPECT_TRUE(actual.sendOutputSensitivities);
+
+    buffer.pop_back();
+    EXPECT_THROW(parpe::deserializeWorkPackage(buffer), parpe::ParPEException);
+}
+
+TEST(simulationWireFormat, resultPackagesRoundTrip) {
+    auto results = createResults(3, 4, 5, 0);
+
+    auto buffer = parpe::serializeResultPackages(results);
+    parpe::ResultPackagesView view(buffer);
+
+    ASSERT_EQ(3, view.size());
+    EXPECT_EQ(1, view.conditionIndex(0));
+    EXPECT_EQ(results[1].gradient,
+              std::vector<double>(view.gradient(0).begin(),
+                                  view.gradient(0).end()));
+    EXPECT_TRUE(view.modelStates(2).empty());
+    EXPECT_EQ(5U, view.modelOutputSensitivities(0).size());
+    EXPECT_TRUE(view.modelOutputSensitivities(1).empty());
+    EXPECT_EQ(results, view.toMap());
+
+    // version mismatch
+    buffer[4] = 99;
+    EXPECT_THROW(parpe::ResultPackagesView view2(buffer),
+                 parpe::ParPEException);
+}
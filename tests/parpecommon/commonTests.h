@@ -319,3 +319,107 @@ TEST(costFunction, linearModel3) {
     lm.evaluate(parameters, features, outputsAct, gradAct);
     EXPECT_TRUE(gradExp == gradAct);
 }
+
+#include <parpecommon/threadPool.h>
+
+#include <atomic>
+#include <numeric>
+
+TEST(threadPool, runsAllTasksWithThreadIndex) {
+    parpe::ThreadPool pool(3);
+    EXPECT_EQ(3, pool.size());
+
+    std::vector<int> perThreadCount(pool.size(), 0);
+    std::atomic<int> numInvalidIdx {0};
+    for(int i = 0; i < 100; ++i) {
+        pool.post([&](int threadIdx) {
+            if(threadIdx < 0 || threadIdx >= 3)
+                ++numInvalidIdx;
+            else
+                ++perThreadCount[threadIdx];
+        });
+    }
+    pool.wait();
+
+    EXPECT_EQ(0, numInvalidIdx);
+    EXPECT_EQ(100, std::accumulate(perThreadCount.begin(),
+                                   perThreadCount.end(), 0));
+}
+
+TEST(threadPool, rethrowsTaskException) {
+    parpe::ThreadPool pool(2);
+    pool.post([](int) { throw parpe::ParPEException("failed"); });
+    EXPECT_THROW(pool.wait(), parpe::ParPEException);
+    // exception is reported once
+    pool.wait();
+}
+
+#include <parpecommon/treeReduction.h>
+
+#include <algorithm>
+
+TEST(treeReduction, resultIndependentOfOrder) {
+    // terms with very different magnitudes, so that the sum depends on
+    // the order of summation
+    constexpr int numTerms = 37;
+    std::vector<std::vector<double>> terms(numTerms);
+    for(int i = 0; i < numTerms; ++i)
+        terms[i] = {std::pow(10.0, (i * 7) % 17 - 8) * (i % 3 - 1.1), 1.0 * i};
+
+    std::vector<int> order(numTerms);
+    std::iota(order.begin(), order.end(), 0);
+
+    parpe::TreeReduction reference(numTerms, 2);
+    for(auto i: order)
+        reference.add(i, terms[i]);
+    ASSERT_TRUE(reference.isComplete());
+    EXPECT_NEAR(numTerms * (numTerms - 1) / 2.0,
+                reference.getResult()[1], 1e-12);
+
+    std::reverse(order.begin(), order.end());
+    for(int permutation = 0; permutation < 10; ++permutation) {
+        std::next_permutation(order.begin(), order.end());
+        std::rotate(order.begin(), order.begin() + 5 * permutation % numTerms,
+                    order.end());
+
+        parpe::TreeReduction reduction(numTerms, 2);
+        for(auto i: order) {
+            EXPECT_FALSE(reduction.isComplete());
+            reduction.add(i, terms[i]);
+        }
+        ASSERT_TRUE(reduction.isComplete());
+        // bitwise identical
+        EXPECT_EQ(reference.getResult(), reduction.getResult());
+    }
+}
+
+TEST(treeReduction, memoryLogarithmicInOrder) {
+    constexpr int numTerms = 37;
+    // ceil(log2(37)) + 1
+    constexpr int maxPartialSums = 7;
+
+    parpe::TreeReduction reduction(numTerms, 1);
+    for(int i = 0; i < numTerms; ++i) {
+        reduction.add(i, {1.0});
+        EXPECT_LE(reduction.getNumPartialSums(), maxPartialSums);
+    }
+    ASSERT_TRUE(reduction.isComplete());
+    EXPECT_EQ(0, reduction.getNumPartialSums());
+    EXPECT_EQ(std::vector<double> {numTerms}, reduction.getResult());
+
+    // terms without sibling are kept until the gap is filled
+    parpe::TreeReduction interleaved(numTerms, 1);
+    for(int i = 1; i < numTerms; i += 2)
+        interleaved.add(i, {1.0});
+    EXPECT_EQ(numTerms / 2, interleaved.getNumPartialSums());
+    for(int i = 0; i < numTerms; i += 2)
+        interleaved.add(i, {1.0});
+    ASSERT_TRUE(interleaved.isComplete());
+    EXPECT_EQ(0, interleaved.getNumPartialSums());
+}
+
+TEST(treeReduction, empty) {
+    parpe::TreeReduction reduction(0, 3);
+    ASSERT_TRUE(reduction.isComplete());
+    EXPECT_EQ(std::vector<double>(3, 0.0), reduction.getResult());
+}
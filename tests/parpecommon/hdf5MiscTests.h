@@ -1,10 +1,13 @@
 #include <gtest/gtest.h>
 
 #include <parpecommon/hdf5Misc.h>
+#include <parpecommon/asyncHdf5Writer.h>
 
 #include "testingMisc.h"
 
+#include <chrono>
 #include <cstdio>
+#include <future>
 #include <H5Cpp.h>
 
 class hdf5Misc : public ::testing::Test {
@@ -47,6 +50,43 @@ TEST_F(hdf5Misc, testMutexGetLock) {
 }
 
 
+TEST_F(hdf5Misc, testPerFileMutex) {
+    char otherFileName[TMP_MAX];
+    auto otherFileId = parpe::hdf5CreateFile(std::tmpnam(otherFileName), false);
+    // second handle to the first file
+    auto sameFileId = H5Fopen(tempFileName, H5F_ACC_RDONLY, H5P_DEFAULT);
+
+    auto lockFromOtherThread = [](hid_t id) {
+        return std::async(std::launch::async, [id] {
+            auto lock = parpe::hdf5MutexGetLock(id);
+            parpe::hdf5GroupExists(id, "/");
+        });
+    };
+
+    {
+        auto lock = parpe::hdf5MutexGetLock(fileId);
+
+        auto other = lockFromOtherThread(otherFileId);
+        auto same = lockFromOtherThread(sameFileId);
+
+        // writing to a different file only blocks without per-file locking
+        EXPECT_EQ(parpe::hdf5HasPerFileLocking(),
+                  other.wait_for(std::chrono::seconds(5))
+                  == std::future_status::ready);
+        EXPECT_EQ(std::future_status::timeout,
+                  same.wait_for(std::chrono::milliseconds(100)));
+
+        lock.unlock();
+        other.get();
+        same.get();
+    }
+
+    H5Fclose(sameFileId);
+    H5Fclose(otherFileId);
+    std::remove(otherFileName);
+}
+
+
 TEST_F(hdf5Misc, testErrorStackWalker) {
     H5_SAVE_ERROR_HANDLER;
 
@@ -148,6 +188,116 @@ TEST_F(hdf5Misc, testDatasetDimensions) {
     EXPECT_EQ(0, d3);
 }
 
+TEST_F(hdf5Misc, testAsyncWriter) {
+    H5::H5File file(fileId);
+    {
+        // long interval, so rows are only written on flush / destruction
+        parpe::AsyncHdf5Writer writer(file, 100.0);
+        for(int i = 0; i < 3; ++i) {
+            double row[2] = {1.0 * i, 10.0 * i};
+            writer.appendToDouble2DArray("/grp", "doubles", row);
+            writer.appendToInt2DArray("/grp", "ints",
+                                      gsl::make_span(&i, 1));
+        }
+        writer.flush();
+        EXPECT_TRUE(parpe::hdf5DatasetExists(fileId, "/grp/doubles"));
+
+        int last = 3;
+        writer.appendToInt2DArray("/grp", "ints", gsl::make_span(&last, 1));
+    }
+
+    // datasets are (stride x numRows)
+    std::vector<double> doubles(6);
+    parpe::hdf5Read2DDoubleHyperslab(fileId, "/grp/doubles", 2, 3, 0, 0,
+                                     doubles);
+    EXPECT_EQ((std::vector<double> {0.0, 1.0, 2.0, 0.0, 10.0, 20.0}),
+              doubles);
+
+    auto ints = parpe::hdf5Read2DIntegerHyperslab(file, "/grp/ints",
+                                                  1, 4, 0, 0);
+    EXPECT_EQ((std::vector<int> {0, 1, 2, 3}), ints);
+}
+
+TEST_F(hdf5Misc, testAsyncWriterFlushWhileLocked) {
+    H5::H5File file(fileId);
+    parpe::AsyncHdf5Writer writer(file, 100.0);
+
+    EXPECT_FALSE(parpe::hdf5MutexIsLockedByThisThread(fileId));
+    auto lock = parpe::hdf5MutexGetLock(fileId);
+    EXPECT_TRUE(parpe::hdf5MutexIsLockedByThisThread(fileId));
+    EXPECT_FALSE(std::async(std::launch::async, [this] {
+        return parpe::hdf5MutexIsLockedByThisThread(fileId);
+    }).get());
+
+    // would deadlock otherwise
+    EXPECT_DEATH(writer.flush(), "");
+
+    lock.unlock();
+    EXPECT_FALSE(parpe::hdf5MutexIsLockedByThisThread(fileId));
+    writer.flush();
+}
+
+TEST(hdf5MiscChunks, defaultChunkDimensions) {
+    parpe::Hdf5ExtendableDatasetOptions options;
+    hsize_t rows, columns;
+
+    // scalar traces: many entries per chunk
+    parpe::hdf5GetChunkDimensions(options, 1, sizeof(double), rows, columns);
+    EXPECT_EQ(1U, rows);
+    EXPECT_EQ(1024U, columns);
+
+    // gradients for 10k parameters: full column, few entries per chunk
+    parpe::hdf5GetChunkDimensions(options, 10000, sizeof(double),
+                                  rows, columns);
+    EXPECT_EQ(10000U, rows);
+    EXPECT_EQ(3U, columns);
+
+    // huge stride: split along rows
+    parpe::hdf5GetChunkDimensions(options, 1000000, sizeof(double),
+                                  rows, columns);
+    EXPECT_EQ(32768U, rows);
+    EXPECT_EQ(1U, columns);
+
+    options.chunkRows = 100;
+    options.chunkColumns = 7;
+    parpe::hdf5GetChunkDimensions(options, 10, sizeof(double), rows, columns);
+    EXPECT_EQ(10U, rows);
+    EXPECT_EQ(7U, columns);
+}
+
+TEST_F(hdf5Misc, testExtendableDatasetOptions) {
+    auto oldOptions = parpe::hdf5GetExtendableDatasetOptions();
+
+    parpe::Hdf5ExtendableDatasetOptions options;
+    options.chunkColumns = 16;
+    options.compressionLevel = 4;
+    options.chunkCacheSize = 1024 * 1024;
+    parpe::hdf5SetExtendableDatasetOptions(options);
+
+    std::vector<double> row(5, 1.0);
+    parpe::hdf5CreateOrExtendAndWriteToDouble2DArray(fileId, "/", "ds", row);
+    parpe::hdf5CreateOrExtendAndWriteToDouble2DArray(fileId, "/", "ds", row);
+    parpe::hdf5SetExtendableDatasetOptions(oldOptions);
+
+    hid_t dataset = H5Dopen2(fileId, "/ds", H5P_DEFAULT);
+    hid_t plist = H5Dget_create_plist(dataset);
+    hsize_t chunkDimensions[2];
+    EXPECT_EQ(2, H5Pget_chunk(plist, 2, chunkDimensions));
+    EXPECT_EQ(5U, chunkDimensions[0]);
+    EXPECT_EQ(16U, chunkDimensions[1]);
+    if(H5Zfilter_avail(H5Z_FILTER_DEFLATE)) {
+        // shuffle + deflate
+        EXPECT_EQ(2, H5Pget_nfilters(plist));
+    }
+    H5Pclose(plist);
+    H5Dclose(dataset);
+
+    int d1 = 0, d2 = 0;
+    parpe::hdf5GetDatasetDimensions(fileId, "/ds", 2, &d1, &d2);
+    EXPECT_EQ(5, d1);
+    EXPECT_EQ(2, d2);
+}
+
 // TODO:
 // hdf5CreateExtendableDouble2DArray
 // hdf5CreateOrExtendAndWriteToDouble2DArray
@@ -0,0 +1,139 @@
+/**
+ * @file hdf5WriterBenchmark.cpp
+ *
+ * Appends optimizer traces (cost, gradient, parameters, timing per
+ * iteration, as written by OptimizationResultWriter) to extendable datasets
+ * with different Hdf5ExtendableDatasetOptions and reports write time and
+ * file size. Rows are either written one at a time, or batched by
+ * AsyncHdf5Writer.
+ *
+ * Usage: benchmark_hdf5_writer [numParameters [numIterations [numStarts]]]
+ */
+
+#include <parpecommon/asyncHdf5Writer.h>
+#include <parpecommon/hdf5Misc.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+namespace {
+
+struct Configuration {
+    std::string label;
+    parpe::Hdf5ExtendableDatasetOptions options;
+};
+
+double runBenchmark(std::string const& fileName, int numParameters,
+                    int numIterations, int numStarts, bool async) {
+    auto fileId = parpe::hdf5CreateFile(fileName.c_str(), true);
+    // takes its own reference
+    H5::H5File file(fileId);
+    H5Fclose(fileId);
+    std::unique_ptr<parpe::AsyncHdf5Writer> writer;
+    if (async)
+        writer = std::make_unique<parpe::AsyncHdf5Writer>(file, 1.0);
+
+    auto appendDouble = [&](std::string const& path, const char *name,
+                            gsl::span<const double> row) {
+        if (writer)
+            writer->appendToDouble2DArray(path, name, row);
+        else
+            parpe::hdf5CreateOrExtendAndWriteToDouble2DArray(
+                        file.getId(), path.c_str(), name, row);
+    };
+
+    std::mt19937 rng(0);
+    std::normal_distribution<double> distribution;
+    std::vector<double> parameters(numParameters);
+    std::vector<double> gradient(numParameters);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int iteration = 0; iteration < numIterations; ++iteration) {
+        for (int multiStart = 0; multiStart < numStarts; ++multiStart) {
+            // parameters change slowly between iterations
+            for (auto &p : parameters)
+                p += 0.01 * distribution(rng);
+            for (auto &g : gradient)
+                g = distribution(rng);
+            double cost = distribution(rng);
+            double wallTime = 1.0;
+
+            auto path = "/multistarts/" + std::to_string(multiStart);
+            appendDouble(path, "iterCostFunCost",
+                         gsl::make_span<const double>(&cost, 1));
+            appendDouble(path, "iterCostFunGradient", gradient);
+            appendDouble(path, "iterCostFunParameters", parameters);
+            appendDouble(path, "iterCostFunWallSec",
+                         gsl::make_span<const double>(&wallTime, 1));
+            if (writer)
+                writer->appendToInt2DArray(
+                            path, "iterIndex",
+                            gsl::make_span<const int>(&iteration, 1));
+            else
+                parpe::hdf5CreateOrExtendAndWriteToInt2DArray(
+                            file.getId(), path.c_str(), "iterIndex",
+                            gsl::make_span<const int>(&iteration, 1));
+        }
+    }
+    if (writer)
+        writer->flush();
+    file.flush(H5F_SCOPE_LOCAL);
+
+    auto end = std::chrono::steady_clock::now();
+    writer.reset();
+    file.close();
+
+    return std::chrono::duration<double>(end - start).count();
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    int numParameters = argc > 1 ? std::atoi(argv[1]) : 10000;
+    int numIterations = argc > 2 ? std::atoi(argv[2]) : 200;
+    int numStarts = argc > 3 ? std::atoi(argv[3]) : 4;
+
+    parpe::initHDF5Mutex();
+
+    std::vector<Configuration> configurations(4);
+    configurations[0].label = "legacy (1 column per chunk)";
+    configurations[0].options.chunkColumns = 1;
+    configurations[0].options.chunkRows = numParameters;
+    configurations[1].label = "default";
+    configurations[2].label = "default, deflate 4";
+    configurations[2].options.compressionLevel = 4;
+    configurations[3].label = "default, 16 MiB chunk cache";
+    configurations[3].options.chunkCacheSize = 16 * 1024 * 1024;
+
+    std::printf("%d parameters, %d iterations, %d starts\n",
+                numParameters, numIterations, numStarts);
+    std::printf("%-30s %-8s %12s %12s\n", "configuration", "mode",
+                "time [s]", "size [MiB]");
+
+    std::string fileName = "benchmark_hdf5_writer.h5";
+    for (auto const& configuration : configurations) {
+        parpe::hdf5SetExtendableDatasetOptions(configuration.options);
+        for (bool async : {false, true}) {
+            double seconds = runBenchmark(fileName, numParameters,
+                                          numIterations, numStarts, async);
+
+            struct stat fileStatus {};
+            stat(fileName.c_str(), &fileStatus);
+            std::printf("%-30s %-8s %12.3f %12.2f\n",
+                        configuration.label.c_str(),
+                        async ? "batched" : "per row",
+                        seconds, fileStatus.st_size / 1024.0 / 1024.0);
+        }
+    }
+    std::remove(fileName.c_str());
+
+    return EXIT_SUCCESS;
+}
@@ -11,6 +11,7 @@
 #include <cassert>
 #include <algorithm>
 #include <random>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -113,6 +114,24 @@ std::string captureStreamToString(const std::function<void()>& f,
                      std::istreambuf_iterator<char>());
 }
 
+TemporaryFile::TemporaryFile() {
+    char const* tmpDir = std::getenv("TMPDIR");
+    std::string pattern = std::string(tmpDir ? tmpDir : "/tmp")
+            + "/parpeXXXXXX";
+    std::vector<char> buffer(pattern.begin(), pattern.end());
+    buffer.push_back('\0');
+
+    int fd = mkstemp(buffer.data());
+    if(fd < 0)
+        std::abort();
+    close(fd);
+    name = buffer.data();
+}
+
+TemporaryFile::~TemporaryFile() {
+    std::remove(name.c_str());
+}
+
 double getLogLikelihoodOffset(int n) {
     const double pi = atan(1) * 4.0;
     return - n * 0.5 * log(2.0 * pi);
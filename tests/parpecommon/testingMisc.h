@@ -26,6 +26,25 @@ std::string captureStreamToString(const std::function<void()>& f, std::ostream &
 
 std::string captureStreamToString(const std::function<void()>& f, std::FILE* captureStream = stdout, int captureStreamFd = STDOUT_FILENO);
 
+/**
+ * @brief A uniquely named, initially empty file which is deleted on
+ * destruction
+ */
+class TemporaryFile {
+  public:
+    TemporaryFile();
+
+    TemporaryFile(TemporaryFile const&) = delete;
+    TemporaryFile& operator=(TemporaryFile const&) = delete;
+
+    ~TemporaryFile();
+
+    std::string const& getName() const { return name; }
+
+  private:
+    std::string name;
+};
+
 } // namespace parpe
 
 #endif
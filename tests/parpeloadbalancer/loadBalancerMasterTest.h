@@ -6,7 +6,10 @@
 
 #include <mpi.h>
 
+#include <atomic>
 #include <cstdio>
+#include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 
 #define QUEUE_MASTER_TEST
@@ -22,15 +25,25 @@ int MPI_Comm_size(MPI_Comm comm, int *size) {
     return MPI_SUCCESS;
 }
 
+/** Set once the dispatcher thread is blocked in MPI_Testany, i.e. it won't
+ * try to send any jobs */
+static std::atomic<bool> dispatcherBlocked {false};
+
+// The dispatcher thread is only cancellable at explicit points, since MPI
+// calls must not be cancelled. The mocks below never return, so they have to
+// allow cancellation themselves.
 int MPI_Testany(int count, MPI_Request array_of_requests[], int *index,
                 int *flag, MPI_Status *status) {
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, nullptr);
+    dispatcherBlocked = true;
     sleep(1000); // do nothing and wait to be killed
 
     return 0;
 }
 
-int MPI_Iprobe(int source, int tag, MPI_Comm comm, int *flag,
-               MPI_Status *status) {
+int MPI_Improbe(int source, int tag, MPI_Comm comm, int *flag,
+                MPI_Message *message, MPI_Status *status) {
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, nullptr);
     sleep(1000);
     return 0;
 }
@@ -43,8 +56,9 @@ public:
                                         MPI_Request array_of_requests[],
                                         int *index,
                                         int *flag, MPI_Status *status));
-    MOCK_CONST_METHOD5(MPI_Iprobe, int(int source, int tag, MPI_Comm comm,
-                                       int *flag, MPI_Status *status));
+    MOCK_CONST_METHOD6(MPI_Improbe, int(int source, int tag, MPI_Comm comm,
+                                        int *flag, MPI_Message *message,
+                                        MPI_Status *status));
 
     MockMPI() {
         _MPI_Comm_size = [this](MPI_Comm comm, int *size){ return MPI_Comm_size(comm, size); };
@@ -73,8 +87,12 @@ TEST_F(queuemaster, test_queueinit) {
 
 TEST_F(queuemaster, test_queue) {
     EXPECT_CALL(mockMpi, MPI_Comm_size(_, _)).Times(1);
+    dispatcherBlocked = false;
     parpe::LoadBalancerMaster lbm;
     lbm.run();
+    // MPI is not initialized, so jobs must not be sent
+    while(!dispatcherBlocked)
+        sched_yield();
 
     EXPECT_EQ(lbm.getNumQueuedJobs(), 0);
 
@@ -89,6 +107,87 @@ TEST_F(queuemaster, test_queue) {
     lbm.terminate();
 }
 
+TEST(jobQueue, roundRobinAcrossClients) {
+    parpe::JobQueue queue;
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(nullptr, queue.pop());
+
+    // client 0 queues many jobs at once, client 1 afterwards
+    std::vector<parpe::JobData> jobs(6);
+    for(int i = 0; i < 6; ++i) {
+        jobs[i].clientId = i < 4 ? 0 : 1;
+        jobs[i].jobId = i;
+        queue.push(&jobs[i]);
+    }
+    EXPECT_EQ(6U, queue.size());
+
+    std::vector<int> order;
+    while(auto job = queue.pop())
+        order.push_back(job->jobId);
+    EXPECT_EQ((std::vector<int> {0, 4, 1, 5, 2, 3}), order);
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(jobQueue, priority) {
+    parpe::JobQueue queue;
+
+    std::vector<parpe::JobData> jobs(4);
+    for(int i = 0; i < 4; ++i) {
+        jobs[i].clientId = i % 2;
+        jobs[i].jobId = i;
+        // client 1 is preferred
+        jobs[i].priority = i % 2 ? -1.0 : -2.0;
+        queue.push(&jobs[i]);
+    }
+
+    std::vector<int> order;
+    while(auto job = queue.pop())
+        order.push_back(job->jobId);
+    EXPECT_EQ((std::vector<int> {1, 3, 0, 2}), order);
+}
+
+TEST(jobQueue, priorityAging) {
+    parpe::JobQueue queue(2);
+
+    // client 0 has low priority, client 1 high priority
+    std::vector<parpe::JobData> jobs(8);
+    for(int i = 0; i < 8; ++i) {
+        jobs[i].clientId = i < 2 ? 0 : 1;
+        jobs[i].jobId = i;
+        jobs[i].priority = i < 2 ? -2.0 : -1.0;
+        queue.push(&jobs[i]);
+    }
+
+    // client 0 is served after being passed over twice
+    std::vector<int> order;
+    while(auto job = queue.pop())
+        order.push_back(job->jobId);
+    EXPECT_EQ((std::vector<int> {2, 3, 0, 4, 5, 1, 6, 7}), order);
+}
+
+TEST(jobQueue, removeIf) {
+    parpe::JobQueue queue;
+
+    std::vector<parpe::JobData> jobs(5);
+    for(int i = 0; i < 5; ++i) {
+        jobs[i].clientId = i % 2;
+        jobs[i].jobId = i;
+        queue.push(&jobs[i]);
+    }
+
+    // removes all jobs of client 1
+    EXPECT_EQ(2, queue.removeIf([](parpe::JobData const* job) {
+        return job->jobId % 2 == 1;
+    }));
+    EXPECT_EQ(3U, queue.size());
+
+    std::vector<int> order;
+    while(auto job = queue.pop())
+        order.push_back(job->jobId);
+    EXPECT_EQ((std::vector<int> {0, 2, 4}), order);
+    EXPECT_TRUE(queue.empty());
+}
+
 TEST_F(queuemaster, test_terminateMasterQueue_noInit) {
     // terminate uninitialized masterQueue should not fail
     parpe::LoadBalancerMaster lbm;
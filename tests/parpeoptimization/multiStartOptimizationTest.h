@@ -6,6 +6,15 @@
 #include "quadraticTestProblem.h"
 #include "../parpecommon/testingMisc.h"
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <thread>
+#include <vector>
+
 #ifdef PARPE_ENABLE_IPOPT
 #include <parpeoptimization/localOptimizationIpopt.h>
 
@@ -27,5 +36,118 @@ TEST(multiStartOptimization, testMultiStartOptimization) {
     optimizer.runSingleThreaded();
 }
 
-// TODO: test retry on error
 #endif
+
+/**
+ * @brief MultiStartOptimization which records the started local optimizations
+ * instead of running them
+ */
+class CountingMultiStartOptimization : public parpe::MultiStartOptimization {
+  public:
+    using parpe::MultiStartOptimization::MultiStartOptimization;
+
+    /** Start indices to fail */
+    std::set<int> failingStarts;
+
+    /** Start indices in the order they were run */
+    std::vector<int> startedIndices;
+
+    /** Maximum number of concurrently running starts */
+    int peakRunning = 0;
+
+    /** If > 0, each start waits (up to 10s) until this many starts are
+     * running concurrently */
+    int rendezvous = 0;
+
+  protected:
+    int runLocalOptimization(int startIdx) override {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            startedIndices.push_back(startIdx);
+            peakRunning = std::max(peakRunning, ++running);
+            allRunning.notify_all();
+            if(rendezvous > 0)
+                allRunning.wait_for(lock, std::chrono::seconds(10), [this]() {
+                    return peakRunning >= rendezvous;
+                });
+        }
+
+        // give other starts a chance to overlap
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        std::lock_guard<std::mutex> lock(mutex);
+        --running;
+        return failingStarts.count(startIdx) ? 1 : 0;
+    }
+
+  private:
+    std::mutex mutex;
+    std::condition_variable allRunning;
+    int running = 0;
+};
+
+TEST(multiStartOptimization, boundedParallelStarts) {
+    int numStarts = 10;
+
+    parpe::QuadraticOptimizationMultiStartProblem ms(numStarts, true);
+    CountingMultiStartOptimization optimizer(ms, true, 5);
+    // fewer threads than starts
+    optimizer.setMaxParallelStarts(3);
+
+    optimizer.runMultiThreaded();
+
+    EXPECT_LE(optimizer.peakRunning, 3);
+    std::sort(optimizer.startedIndices.begin(),
+              optimizer.startedIndices.end());
+    std::vector<int> expected(numStarts);
+    std::iota(expected.begin(), expected.end(), 5);
+    EXPECT_EQ(expected, optimizer.startedIndices);
+}
+
+TEST(multiStartOptimization, unboundedParallelStarts) {
+    int numStarts = 4;
+
+    parpe::QuadraticOptimizationMultiStartProblem ms(numStarts, true);
+    CountingMultiStartOptimization optimizer(ms);
+    // default: all starts at once
+    EXPECT_EQ(0, ms.getMaxParallelStarts());
+    optimizer.rendezvous = numStarts;
+
+    optimizer.runMultiThreaded();
+
+    EXPECT_EQ(numStarts, optimizer.peakRunning);
+    EXPECT_EQ(numStarts, static_cast<int>(optimizer.startedIndices.size()));
+}
+
+TEST(multiStartOptimization, retryOnFailure) {
+    int numStarts = 4;
+    int firstStartIdx = 10;
+
+    parpe::QuadraticOptimizationMultiStartProblem ms(numStarts, true);
+    CountingMultiStartOptimization optimizer(ms, true, firstStartIdx);
+    optimizer.setMaxParallelStarts(2);
+    // start 12 fails, and so does its first retry
+    optimizer.failingStarts = {12, 14};
+
+    optimizer.runMultiThreaded();
+
+    // retries get fresh indices after the regular ones
+    std::sort(optimizer.startedIndices.begin(),
+              optimizer.startedIndices.end());
+    EXPECT_EQ((std::vector<int> {10, 11, 12, 13, 14, 15}),
+              optimizer.startedIndices);
+}
+
+TEST(multiStartOptimization, noRetryWithoutRestartOnFailure) {
+    int numStarts = 4;
+
+    parpe::QuadraticOptimizationMultiStartProblem ms(numStarts, false);
+    CountingMultiStartOptimization optimizer(ms);
+    optimizer.failingStarts = {1};
+
+    optimizer.runMultiThreaded();
+
+    std::sort(optimizer.startedIndices.begin(),
+              optimizer.startedIndices.end());
+    EXPECT_EQ((std::vector<int> {0, 1, 2, 3}), optimizer.startedIndices);
+}
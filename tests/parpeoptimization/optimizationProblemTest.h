@@ -108,6 +108,81 @@ TEST(optimizationProblem, quadraticTestFunction) {
 
 
 
+TEST(optimizationProblem, functionEvaluationCache) {
+    parpe::FunctionEvaluationCache cache(2);
+    std::vector<double> p1 {1.0}, p2 {2.0}, p3 {3.0};
+
+    auto makeEntry = [](std::vector<double> const& parameters,
+            bool withGradient) {
+        parpe::FunctionEvaluationCache::Entry entry;
+        entry.parameters = parameters;
+        entry.fval = parameters[0] * 10.0;
+        if(withGradient)
+            entry.gradient = {parameters[0]};
+        return entry;
+    };
+
+    EXPECT_EQ(nullptr, cache.find(p1, false));
+    cache.insert(makeEntry(p1, false));
+    ASSERT_NE(nullptr, cache.find(p1, false));
+    EXPECT_EQ(10.0, cache.find(p1, false)->fval);
+    // value only is not sufficient
+    EXPECT_EQ(nullptr, cache.find(p1, true));
+
+    cache.insert(makeEntry(p2, true));
+    // gradient entries also serve value-only requests
+    ASSERT_NE(nullptr, cache.find(p2, false));
+    EXPECT_EQ(std::vector<double>{2.0}, cache.find(p2, true)->gradient);
+
+    // value-only entries do not evict gradient entries
+    cache.insert(makeEntry(p3, false));
+    cache.insert(makeEntry(p1, false));
+    EXPECT_NE(nullptr, cache.find(p2, true));
+
+    // least recently used is evicted
+    cache.find(p3, false);
+    cache.insert(makeEntry(p2, false));
+    EXPECT_EQ(nullptr, cache.find(p1, false));
+    EXPECT_NE(nullptr, cache.find(p3, false));
+
+    EXPECT_EQ(7, cache.getNumHits());
+    EXPECT_EQ(3, cache.getNumMisses());
+
+    cache.setCapacity(0);
+    EXPECT_EQ(nullptr, cache.find(p3, false));
+    cache.insert(makeEntry(p3, false));
+    EXPECT_EQ(nullptr, cache.find(p3, false));
+}
+
+
+TEST(optimizationProblem, reporterUsesEvaluationCache) {
+    parpe::QuadraticGradientFunctionMock fun;
+    EXPECT_CALL(fun, numParameters()).Times(testing::AnyNumber());
+    parpe::OptimizationReporter reporter(&fun,
+                                         std::make_unique<parpe::Logger>());
+    reporter.setEvaluationCacheSize(3);
+
+    double p1 = 1.0, p2 = 2.0;
+    double fval = NAN, gradient = NAN;
+    auto gradientSpan = gsl::span<double>(&gradient, 1);
+
+    // f(p1), f(p2), f'(p1) are evaluated, the rest is from the cache
+    EXPECT_CALL(fun, evaluate_impl(_, _, _, _, _)).Times(3);
+    reporter.evaluate(gsl::make_span(&p1, 1), fval, gsl::span<double>());
+    reporter.evaluate(gsl::make_span(&p2, 1), fval, gsl::span<double>());
+    reporter.evaluate(gsl::make_span(&p1, 1), fval, gsl::span<double>());
+    reporter.evaluate(gsl::make_span(&p1, 1), fval, gradientSpan);
+    reporter.evaluate(gsl::make_span(&p2, 1), fval, gsl::span<double>());
+    EXPECT_EQ(51.0, fval);
+    reporter.evaluate(gsl::make_span(&p1, 1), fval, gradientSpan);
+    EXPECT_EQ(46.0, fval);
+    EXPECT_EQ(4.0, gradient);
+
+    EXPECT_EQ(3, reporter.getEvaluationCache().getNumHits());
+    EXPECT_EQ(3, reporter.getEvaluationCache().getNumMisses());
+}
+
+
 TEST(optimizationProblem, gradientChecker) {
     parpe::QuadraticTestProblem problem {};
     constexpr int numParameterIndices {1};
@@ -29,7 +29,12 @@ TEST(optimizationResultWriter, testResultWriter) {
 
     w.saveOptimizerResults(1.0, gsl::span<double>(), 12.0, 17.0, 0);
 
-    // TODO: check output
+    // buffered rows are written by saveOptimizerResults
+    int numRows = 0, dummy = 0;
+    parpe::hdf5GetDatasetDimensions(file.getId(), "/bla2/iterCostFunCost", 2,
+                                    &dummy, &numRows);
+    EXPECT_EQ(2, numRows);
+    EXPECT_TRUE(parpe::hdf5DatasetExists(file, "/bla2/finalCost"));
 
     EXPECT_FALSE(remove(tmpFilename));
 }